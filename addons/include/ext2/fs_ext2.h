@@ -132,5 +132,21 @@ int fs_ext2_unmount(const char *mp);
 */
 int fs_ext2_sync(const char *mp);
 
+/** \brief  Periodically sync all ext2 filesystems in the background.
+
+    This function starts (or stops) a thread that syncs every filesystem that
+    is mounted read-write, as fs_ext2_sync() would, once every given number of
+    milliseconds. This puts an upper bound on how long modified data can sit in
+    the caches before it makes it to the block device, without having to call
+    fs_ext2_sync() by hand. When blocks are written back, any runs of adjacent
+    dirty blocks are written to the device together.
+
+    \param  ms          How often to sync, in milliseconds. 0 stops syncing.
+    \retval 0           On success.
+    \retval -1          On error (errno will be set to EINVAL if fs_ext2 is
+                        not initialized or ms is negative).
+*/
+int fs_ext2_flush_interval(int ms);
+
 __END_DECLS
 #endif /* !__EXT2_FS_EXT2_H */
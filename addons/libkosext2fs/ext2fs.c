@@ -21,70 +21,129 @@
 
 static int initted = 0;
 
-/* This is basically the same as bgrad_cache from fs_iso9660 */
-static void make_mru(ext2_fs_t *fs, ext2_cache_t **cache, int block) {
-    int i;
-    ext2_cache_t *tmp;
+static inline struct ext2_cache_hash *cache_bucket(ext2_fs_t *fs,
+                                                   uint32_t bl) {
+    return &fs->bhash[(bl * 2654435761U) >> 16 & fs->bhash_mask];
+}
+
+static ext2_cache_t *cache_find(ext2_fs_t *fs, uint32_t bl) {
+    ext2_cache_t *c;
 
-    /* Don't try it with the end block */
-    if(block < 0 || block >= fs->cache_size - 1)
-        return;
+    LIST_FOREACH(c, cache_bucket(fs, bl), hash) {
+        if(c->block == bl)
+            return c;
+    }
 
-    /* Make a copy and scoot everything down */
-    tmp = cache[block];
+    return NULL;
+}
+
+static inline void make_mru(ext2_fs_t *fs, ext2_cache_t *c) {
+    TAILQ_REMOVE(&fs->blru, c, lru);
+    TAILQ_INSERT_TAIL(&fs->blru, c, lru);
+}
 
-    for(i = block; i < fs->cache_size - 1; ++i) {
-        cache[i] = cache[i + 1];
+static int block_write_multi(ext2_fs_t *fs, uint32_t block_num, uint32_t count,
+                             const uint8_t *blk) {
+    int fs_per_block = fs->sb.s_log_block_size - fs->dev->l_block_size + 10;
+
+    if(fs_per_block < 0)
+        return -EINVAL;
+
+    if(fs->sb.s_blocks_count < block_num + count)
+        return -EINVAL;
+
+    if(fs->dev->write_blocks(fs->dev, block_num << fs_per_block,
+                             count << fs_per_block, blk))
+        return -EIO;
+
+    return 0;
+}
+
+/* Write back the dirty block c, along with any dirty blocks right around it in
+   the cache, in one write to the block device. */
+static int cache_wb_run(ext2_fs_t *fs, ext2_cache_t *c) {
+    ext2_cache_t *run[EXT2_CACHE_WB_MAX], *tmp;
+    uint32_t first = c->block;
+    int cnt, i, err;
+
+    /* Find the start of the run, making sure c stays in it. */
+    while(first > 0 && c->block - first < EXT2_CACHE_WB_MAX - 1) {
+        tmp = cache_find(fs, first - 1);
+
+        if(!tmp || !(tmp->flags & EXT2_CACHE_FLAG_DIRTY))
+            break;
+
+        --first;
     }
 
-    cache[fs->cache_size - 1] = tmp;
+    for(cnt = 0; cnt < EXT2_CACHE_WB_MAX; ++cnt) {
+        tmp = cache_find(fs, first + cnt);
+
+        if(!tmp || !(tmp->flags & EXT2_CACHE_FLAG_DIRTY))
+            break;
+
+        run[cnt] = tmp;
+    }
+
+    if(cnt == 1) {
+        err = ext2_block_write_nc(fs, c->block, c->data);
+    }
+    else {
+        for(i = 0; i < cnt; ++i)
+            memcpy(fs->wb_buf + i * fs->block_size, run[i]->data,
+                   fs->block_size);
+
+        err = block_write_multi(fs, first, cnt, fs->wb_buf);
+    }
+
+    if(err)
+        return err;
+
+    for(i = 0; i < cnt; ++i)
+        run[i]->flags &= ~EXT2_CACHE_FLAG_DIRTY;
+
+    return 0;
 }
 
 /* XXXX: This needs locking! */
 uint8_t *ext2_block_read(ext2_fs_t *fs, uint32_t bl, int *err) {
-    int i;
-    uint8_t *rv;
-    ext2_cache_t **cache = fs->bcache;
-
-    /* Look through the cache from the most recently used to the least recently
-       used entry. */
-    for(i = fs->cache_size - 1; i >= 0; --i) {
-        if(cache[i]->block == bl && cache[i]->flags) {
-            rv = cache[i]->data;
-            make_mru(fs, cache, i);
-            goto out;
-        }
+    ext2_cache_t *c;
+
+    /* See if we've already got it. */
+    if((c = cache_find(fs, bl))) {
+        make_mru(fs, c);
+        return c->data;
     }
 
-    /* If we didn't get anything, did we end up with an invalid entry or do we
-       need to boot someone out? */
-    if(i < 0) {
-        i = 0;
+    /* If not, boot out the least recently used entry. Make sure that if the
+       block is dirty, we write it back out. */
+    c = TAILQ_FIRST(&fs->blru);
 
-        /* Make sure that if the block is dirty, we write it back out. */
-        if(cache[0]->flags & EXT2_CACHE_FLAG_DIRTY) {
-            if(ext2_block_write_nc(fs, cache[0]->block, cache[0]->data)) {
-                /* XXXX: Uh oh... */
-                *err = EIO;
-                return NULL;
-            }
+    if(c->flags & EXT2_CACHE_FLAG_DIRTY) {
+        if(cache_wb_run(fs, c)) {
+            /* XXXX: Uh oh... */
+            *err = EIO;
+            return NULL;
         }
     }
 
+    if(c->flags & EXT2_CACHE_FLAG_VALID) {
+        LIST_REMOVE(c, hash);
+        c->flags = 0;
+    }
+
     /* Try to read the block in question. */
-    if(ext2_block_read_nc(fs, bl, cache[i]->data)) {
+    if(ext2_block_read_nc(fs, bl, c->data)) {
         *err = EIO;
-        cache[i]->flags = 0;            /* Mark it as invalid... */
         return NULL;
     }
 
-    cache[i]->block = bl;
-    cache[i]->flags = EXT2_CACHE_FLAG_VALID;
-    rv = cache[i]->data;
-    make_mru(fs, cache, i);
+    c->block = bl;
+    c->flags = EXT2_CACHE_FLAG_VALID;
+    LIST_INSERT_HEAD(cache_bucket(fs, bl), c, hash);
+    make_mru(fs, c);
 
-out:
-    return rv;
+    return c->data;
 }
 
 int ext2_block_read_nc(ext2_fs_t *fs, uint32_t block_num, uint8_t *rv) {
@@ -105,6 +164,72 @@ int ext2_block_read_nc(ext2_fs_t *fs, uint32_t block_num, uint8_t *rv) {
     return 0;
 }
 
+int ext2_block_read_multi_nc(ext2_fs_t *fs, uint32_t block_num,
+                             uint32_t count, uint8_t *rv) {
+    int fs_per_block = fs->sb.s_log_block_size - fs->dev->l_block_size + 10;
+    ext2_cache_t *c;
+    uint32_t i;
+
+    if(fs_per_block < 0)
+        return -EINVAL;
+
+    if(fs->sb.s_blocks_count < block_num + count || block_num + count < count)
+        return -EINVAL;
+
+    if(fs->dev->read_blocks(fs->dev, block_num << fs_per_block,
+                            count << fs_per_block, rv))
+        return -EIO;
+
+    /* The cache might have newer versions of some of these blocks. */
+    for(i = 0; i < count; ++i) {
+        c = cache_find(fs, block_num + i);
+
+        if(c && (c->flags & EXT2_CACHE_FLAG_DIRTY))
+            memcpy(rv + i * fs->block_size, c->data, fs->block_size);
+    }
+
+    return 0;
+}
+
+int ext2_block_prefetch(ext2_fs_t *fs, uint32_t block_num, uint32_t count) {
+    ext2_cache_t *c;
+    uint32_t i;
+    int err;
+
+    if(count > fs->ra_max)
+        count = fs->ra_max;
+
+    /* Don't bother if the first block is already here. This is most likely
+       the case when we've already read ahead over these blocks. */
+    if(!count || cache_find(fs, block_num))
+        return 0;
+
+    if((err = ext2_block_read_multi_nc(fs, block_num, count, fs->ra_buf)))
+        return err;
+
+    for(i = 0; i < count; ++i) {
+        if(cache_find(fs, block_num + i))
+            continue;
+
+        /* Grab the least recently used entry, like ext2_block_read does. */
+        c = TAILQ_FIRST(&fs->blru);
+
+        if((c->flags & EXT2_CACHE_FLAG_DIRTY) && (err = cache_wb_run(fs, c)))
+            return err;
+
+        if(c->flags & EXT2_CACHE_FLAG_VALID)
+            LIST_REMOVE(c, hash);
+
+        memcpy(c->data, fs->ra_buf + i * fs->block_size, fs->block_size);
+        c->block = block_num + i;
+        c->flags = EXT2_CACHE_FLAG_VALID;
+        LIST_INSERT_HEAD(cache_bucket(fs, c->block), c, hash);
+        make_mru(fs, c);
+    }
+
+    return 0;
+}
+
 int ext2_block_write_nc(ext2_fs_t *fs, uint32_t block_num, const uint8_t *blk) {
     int fs_per_block = fs->sb.s_log_block_size - fs->dev->l_block_size + 10;
 
@@ -124,39 +249,33 @@ int ext2_block_write_nc(ext2_fs_t *fs, uint32_t block_num, const uint8_t *blk) {
 }
 
 int ext2_block_mark_dirty(ext2_fs_t *fs, uint32_t block_num) {
-    int i;
-    ext2_cache_t **cache = fs->bcache;
-
-    /* Look through the cache from the most recently used to the least recently
-       used entry. */
-    for(i = fs->cache_size - 1; i >= 0; --i) {
-        if(cache[i]->block == block_num && cache[i]->flags) {
-            cache[i]->flags |= EXT2_CACHE_FLAG_DIRTY;
-            make_mru(fs, cache, i);
-            return 0;
-        }
-    }
+    ext2_cache_t *c;
+
+    if(!(c = cache_find(fs, block_num)))
+        return -EINVAL;
 
-    return -EINVAL;
+    c->flags |= EXT2_CACHE_FLAG_DIRTY;
+    make_mru(fs, c);
+    return 0;
 }
 
 int ext2_block_cache_wb(ext2_fs_t *fs) {
     int i, err;
-    ext2_cache_t **cache = fs->bcache;
+    ext2_cache_t *c;
 
     /* Don't even bother if we're mounted read-only. */
     if(!(fs->mnt_flags & EXT2FS_MNT_FLAG_RW))
         return 0;
 
-    for(i = fs->cache_size - 1; i >= 0; --i) {
-        if(cache[i]->flags & EXT2_CACHE_FLAG_DIRTY) {
-            if((err = ext2_block_write_nc(fs, cache[i]->block, cache[i]->data)))
-                return err;
+    for(i = 0; i < fs->cache_size; ++i) {
+        c = &fs->bcache[i];
 
-            cache[i]->flags &= ~EXT2_CACHE_FLAG_DIRTY;
+        if(c->flags & EXT2_CACHE_FLAG_DIRTY) {
+            if((err = cache_wb_run(fs, c)))
+                return err;
         }
     }
-    
+
     return 0;
 }
 
@@ -260,6 +379,10 @@ uint32_t ext2_log_block_size(const ext2_fs_t *fs) {
     return fs->sb.s_log_block_size + 10;
 }
 
+uint32_t ext2_readahead_blocks(const ext2_fs_t *fs) {
+    return fs->ra_max;
+}
+
 int ext2_init(void) {
     ext2_inode_init();
     initted = 1;
@@ -273,7 +396,7 @@ ext2_fs_t *ext2_fs_init(kos_blockdev_t *bd, uint32_t flags) {
 
 ext2_fs_t *ext2_fs_init_ex(kos_blockdev_t *bd, uint32_t flags, int cache_sz) {
     ext2_fs_t *rv;
-    uint32_t bc;
+    uint32_t bc, hash_sz;
     int j;
     int block_size;
 
@@ -409,46 +532,54 @@ ext2_fs_t *ext2_fs_init_ex(kos_blockdev_t *bd, uint32_t flags, int cache_sz) {
 #endif /* EXT2FS_DEBUG */
 
     /* Make space for the block cache. */
-    if(!(rv->bcache = (ext2_cache_t **)malloc(sizeof(ext2_cache_t *) *
-                                              cache_sz))) {
+    if(cache_sz < 1)
+        cache_sz = 1;
+
+    for(hash_sz = 1; hash_sz < (uint32_t)cache_sz; hash_sz <<= 1) ;
+
+    rv->ra_max = cache_sz / 4;
+
+    if(rv->ra_max > EXT2_READAHEAD_BLOCKS)
+        rv->ra_max = EXT2_READAHEAD_BLOCKS;
+    else if(!rv->ra_max)
+        rv->ra_max = 1;
+
+    rv->bcache = (ext2_cache_t *)malloc(sizeof(ext2_cache_t) * cache_sz);
+    rv->bcache_data = (uint8_t *)malloc(block_size * cache_sz);
+    rv->bhash = (struct ext2_cache_hash *)malloc(sizeof(struct ext2_cache_hash)
+                                                 * hash_sz);
+    rv->wb_buf = (uint8_t *)malloc(block_size * EXT2_CACHE_WB_MAX);
+    rv->ra_buf = (uint8_t *)malloc(block_size * rv->ra_max);
+
+    if(!rv->bcache || !rv->bcache_data || !rv->bhash || !rv->wb_buf ||
+       !rv->ra_buf) {
+        free(rv->ra_buf);
+        free(rv->wb_buf);
+        free(rv->bhash);
+        free(rv->bcache_data);
+        free(rv->bcache);
         free(rv->bg);
         free(rv);
         bd->shutdown(bd);
         return NULL;
     }
 
-    for(j = 0; j < cache_sz; ++j) {
-        if(!(rv->bcache[j] = (ext2_cache_t *)malloc(sizeof(ext2_cache_t))))
-            goto out_cache;
-    }
+    TAILQ_INIT(&rv->blru);
 
-    for(j = 0; j < cache_sz; ++j) {
-        if(!(rv->bcache[j]->data = (uint8_t *)malloc(block_size)))
-            goto out_bcache;
+    for(j = 0; j < (int)hash_sz; ++j)
+        LIST_INIT(&rv->bhash[j]);
 
-        rv->bcache[j]->flags = 0;
+    for(j = 0; j < cache_sz; ++j) {
+        rv->bcache[j].data = rv->bcache_data + j * block_size;
+        rv->bcache[j].flags = 0;
+        rv->bcache[j].block = 0;
+        TAILQ_INSERT_TAIL(&rv->blru, &rv->bcache[j], lru);
     }
 
     rv->cache_size = cache_sz;
+    rv->bhash_mask = hash_sz - 1;
 
     return rv;
-
-out_bcache:
-    for(; j >= 0; --j) {
-        free(rv->bcache[j]->data);
-    }
-
-    j = cache_sz - 1;
-out_cache:
-    for(; j >= 0; --j) {
-        free(rv->bcache[j]);
-    }
-
-    free(rv->bcache);
-    free(rv->bg);
-    free(rv);
-    bd->shutdown(bd);
-    return NULL;
 }
 
 int ext2_fs_sync(ext2_fs_t *fs) {
@@ -499,16 +630,13 @@ int ext2_fs_sync(ext2_fs_t *fs) {
 }
 
 void ext2_fs_shutdown(ext2_fs_t *fs) {
-    int i;
-
     /* Sync the filesystem back to the block device, if needed. */
     ext2_fs_sync(fs);
 
-    for(i = 0; i < fs->cache_size; ++i) {
-        free(fs->bcache[i]->data);
-        free(fs->bcache[i]);
-    }
-
+    free(fs->ra_buf);
+    free(fs->wb_buf);
+    free(fs->bhash);
+    free(fs->bcache_data);
     free(fs->bcache);
     fs->dev->shutdown(fs->dev);
     free(fs->bg);
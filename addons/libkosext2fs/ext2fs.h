@@ -50,6 +50,14 @@ __BEGIN_DECLS
 */
 #define EXT2_CACHE_BLOCKS       32
 
+/* Maximum number of blocks to read ahead into the block cache when a file is
+   being read sequentially in small pieces. The read-ahead window starts out
+   small and doubles with each sequential read, up to this many blocks. Reads
+   of whole blocks that are stored contiguously on the device skip the cache
+   entirely, so this only matters for small reads. It's cut down to a quarter
+   of the block cache on filesystems mounted with a smaller cache. */
+#define EXT2_READAHEAD_BLOCKS   16
+
 /* End tunable filesystem parameters. */
 
 /* Convenience stuff, for in case you want to use this outside of KOS. */
@@ -71,6 +79,10 @@ typedef struct kos_blockdev {
 #define SYMLOOP_MAX 16
 #endif
 
+#ifndef PATH_MAX
+#define PATH_MAX 4096
+#endif
+
 #endif /* EXT2_NOT_IN_KOS */
 
 /* Opaque ext2 filesystem type */
@@ -87,6 +99,11 @@ typedef struct ext2fs_struct ext2_fs_t;
 uint32_t ext2_block_size(const ext2_fs_t *fs);
 uint32_t ext2_log_block_size(const ext2_fs_t *fs);
 
+/* The most blocks ext2_block_prefetch() will read at once on this filesystem.
+   This is EXT2_READAHEAD_BLOCKS, or a quarter of the block cache if that's
+   smaller. */
+uint32_t ext2_readahead_blocks(const ext2_fs_t *fs);
+
 /* Initialize low-level structures (like the global inode cache). If you don't
    call this before calling ext2_fs_init(), it will be called for you before
    mounting the first filesystem. */
@@ -100,6 +117,17 @@ void ext2_fs_shutdown(ext2_fs_t *fs);
 int ext2_block_read_nc(ext2_fs_t *fs, uint32_t block_num, uint8_t *rv);
 uint8_t *ext2_block_read(ext2_fs_t *fs, uint32_t block_num, int *err);
 
+/* Read a run of contiguous blocks straight from the block device into the
+   given buffer, without going through the cache (other than to pick up any
+   blocks in the cache that haven't been written back yet). */
+int ext2_block_read_multi_nc(ext2_fs_t *fs, uint32_t block_num,
+                             uint32_t count, uint8_t *rv);
+
+/* Read a run of contiguous blocks into the cache, in one read from the block
+   device, if they aren't already there. At most ext2_readahead_blocks(fs)
+   blocks are read. */
+int ext2_block_prefetch(ext2_fs_t *fs, uint32_t block_num, uint32_t count);
+
 int ext2_block_write_nc(ext2_fs_t *fs, uint32_t block_num, const uint8_t *blk);
 
 int ext2_block_mark_dirty(ext2_fs_t *fs, uint32_t block_num);
@@ -16,15 +16,26 @@
 #ifndef __EXT2_EXT2INTERNAL_H
 #define __EXT2_EXT2INTERNAL_H
 
+#include <sys/queue.h>
+
 #define EXT2_CACHE_FLAG_VALID   1
 #define EXT2_CACHE_FLAG_DIRTY   2
 
+/* Maximum number of contiguous dirty blocks written back in one go. */
+#define EXT2_CACHE_WB_MAX       16
+
 typedef struct ext2_cache {
     uint32_t flags;
     uint32_t block;
     uint8_t *data;
+
+    LIST_ENTRY(ext2_cache) hash;
+    TAILQ_ENTRY(ext2_cache) lru;
 } ext2_cache_t;
 
+LIST_HEAD(ext2_cache_hash, ext2_cache);
+TAILQ_HEAD(ext2_cache_lru, ext2_cache);
+
 struct ext2fs_struct {
     kos_blockdev_t *dev;
     ext2_superblock_t sb;
@@ -33,8 +44,23 @@ struct ext2fs_struct {
     uint32_t bg_count;
     ext2_bg_desc_t *bg;
 
-    ext2_cache_t **bcache;
+    /* Block cache. Valid entries are in the hash table, and all entries are
+       on the LRU list, least recently used first. */
+    ext2_cache_t *bcache;
+    uint8_t *bcache_data;
     int cache_size;
+    struct ext2_cache_hash *bhash;
+    uint32_t bhash_mask;
+    struct ext2_cache_lru blru;
+
+    /* Buffer used to write back runs of contiguous dirty blocks. */
+    uint8_t *wb_buf;
+
+    /* Buffer used to read ahead into the cache, and how many blocks it holds.
+       That's kept to a quarter of the cache, so that reading ahead doesn't
+       push out the blocks it just read in. */
+    uint8_t *ra_buf;
+    uint32_t ra_max;
 
     uint32_t flags;
     uint32_t mnt_flags;
@@ -14,7 +14,9 @@
 #include <sys/queue.h>
 
 #include <kos/fs.h>
+#include <kos/sem.h>
 #include <kos/mutex.h>
+#include <kos/thread.h>
 #include <kos/dbglog.h>
 
 #include <ext2/fs_ext2.h>
@@ -45,6 +47,11 @@ LIST_HEAD(ext2_list, fs_ext2_fs);
 static struct ext2_list ext2_fses;
 static mutex_t ext2_mutex;
 
+/* Background flusher state. */
+static kthread_t *flush_thd = NULL;
+static semaphore_t flush_sem;
+static volatile int flush_ms = 0;
+
 static struct {
     uint32_t inode_num;
     int mode;
@@ -52,6 +59,12 @@ static struct {
     dirent_t dent;
     ext2_inode_t *inode;
     fs_ext2_fs_t *fs;
+
+    /* Read-ahead state: where the last read left off, how many blocks to read
+       ahead and the block that we've read ahead up to. */
+    uint64_t ra_pos;
+    uint32_t ra_win;
+    uint32_t ra_end;
 } fh[MAX_EXT2_FILES];
 
 static int create_empty_file(fs_ext2_fs_t *fs, const char *fn,
@@ -220,6 +233,9 @@ created:
     fh[fd].mode = mode;
     fh[fd].ptr = 0;
     fh[fd].fs = mnt;
+    fh[fd].ra_pos = 0;
+    fh[fd].ra_win = 0;
+    fh[fd].ra_end = 0;
 
     mutex_unlock(&ext2_mutex);
 
@@ -241,15 +257,53 @@ static int fs_ext2_close(void *h) {
     return 0;
 }
 
+/* Read blocks ahead of the current position of a file that is being read
+   sequentially into the block cache, so that small reads don't each have to
+   wait on the device. */
+static void fs_ext2_readahead(ext2_fs_t *fs, file_t fd, uint64_t sz) {
+    uint32_t lbs = ext2_log_block_size(fs);
+    uint32_t blk, end, last, pbn, n;
+
+    if(!fh[fd].ra_win || !sz)
+        return;
+
+    blk = fh[fd].ptr >> lbs;
+    last = (sz - 1) >> lbs;
+    end = blk + fh[fd].ra_win;
+
+    if(end > last + 1)
+        end = last + 1;
+
+    /* Only go to the device when we're halfway through what we've already
+       read ahead. */
+    if(fh[fd].ra_end > blk + fh[fd].ra_win / 2)
+        return;
+
+    if(blk < fh[fd].ra_end)
+        blk = fh[fd].ra_end;
+
+    while(blk < end) {
+        if(ext2_inode_map_blocks(fs, fh[fd].inode, blk, end - blk, &pbn, &n))
+            return;
+
+        if(pbn && ext2_block_prefetch(fs, pbn, n))
+            return;
+
+        blk += n;
+    }
+
+    fh[fd].ra_end = end;
+}
+
 static ssize_t fs_ext2_read(void *h, void *buf, size_t cnt) {
     file_t fd = ((file_t)h) - 1;
     ext2_fs_t *fs;
-    uint32_t bs, lbs, bo;
+    uint32_t bs, lbs, bo, pbn, n;
     uint8_t *block;
     uint8_t *bbuf = (uint8_t *)buf;
     ssize_t rv;
     uint64_t sz;
-    int mode;
+    int mode, err;
 
     mutex_lock(&ext2_mutex);
 
@@ -286,6 +340,19 @@ static ssize_t fs_ext2_read(void *h, void *buf, size_t cnt) {
     rv = (ssize_t)cnt;
     bo = fh[fd].ptr & ((1 << lbs) - 1);
 
+    /* Keep track of whether this read picks up where the last one left off,
+       opening up the read-ahead window if so. */
+    if(fh[fd].ptr == fh[fd].ra_pos && fh[fd].ptr) {
+        fh[fd].ra_win = fh[fd].ra_win ? fh[fd].ra_win << 1 : 2;
+
+        if(fh[fd].ra_win > ext2_readahead_blocks(fs))
+            fh[fd].ra_win = ext2_readahead_blocks(fs);
+    }
+    else {
+        fh[fd].ra_win = 0;
+        fh[fd].ra_end = 0;
+    }
+
     /* Handle the first block specially if we are offset within it. */
     if(bo) {
         if(!(block = ext2_inode_read_block(fs, fh[fd].inode, fh[fd].ptr >> lbs,
@@ -307,27 +374,60 @@ static ssize_t fs_ext2_read(void *h, void *buf, size_t cnt) {
         }
     }
 
-    /* While we still have more to read, do it. */
-    while(cnt) {
-        if(!(block = ext2_inode_read_block(fs, fh[fd].inode, fh[fd].ptr >> lbs,
-                                           NULL, &errno))) {
+    /* Read as many whole blocks as we can. Figure out where they are in runs
+       of blocks that are next to each other on the device, and read each of
+       those runs straight into the buffer in one go. */
+    while(cnt >= bs) {
+        if((err = ext2_inode_map_blocks(fs, fh[fd].inode, fh[fd].ptr >> lbs,
+                                        cnt >> lbs, &pbn, &n))) {
             mutex_unlock(&ext2_mutex);
+            errno = -err;
             return -1;
         }
 
-        if(cnt > bs) {
+        if(!pbn) {
+            /* Hole in the file */
+            memset(bbuf, 0, n << lbs);
+        }
+        else if(n == 1) {
+            /* A lone block might as well come from the cache. */
+            if(!(block = ext2_block_read(fs, pbn, &errno))) {
+                mutex_unlock(&ext2_mutex);
+                return -1;
+            }
+
             memcpy(bbuf, block, bs);
-            fh[fd].ptr += bs;
-            cnt -= bs;
-            bbuf += bs;
         }
-        else {
-            memcpy(bbuf, block, cnt);
-            fh[fd].ptr += cnt;
-            cnt = 0;
+        else if((err = ext2_block_read_multi_nc(fs, pbn, n, bbuf))) {
+            mutex_unlock(&ext2_mutex);
+            errno = -err;
+            return -1;
         }
+
+        fh[fd].ptr += n << lbs;
+        cnt -= n << lbs;
+        bbuf += n << lbs;
     }
 
+    /* Handle whatever is left of the last block. */
+    if(cnt) {
+        if(!(block = ext2_inode_read_block(fs, fh[fd].inode, fh[fd].ptr >> lbs,
+                                           NULL, &errno))) {
+            mutex_unlock(&ext2_mutex);
+            return -1;
+        }
+
+        memcpy(bbuf, block, cnt);
+        fh[fd].ptr += cnt;
+    }
+
+    /* Big reads go straight to the device, so there's no point in reading
+       ahead into the cache for them. */
+    fh[fd].ra_pos = fh[fd].ptr;
+
+    if((size_t)rv < (fh[fd].ra_win << lbs))
+        fs_ext2_readahead(fs, fd, sz);
+
     /* We're done, clean up and return. */
     mutex_unlock(&ext2_mutex);
     return rv;
@@ -2037,6 +2137,61 @@ int fs_ext2_sync(const char *mp) {
     return rv;
 }
 
+static void *flush_thd_func(void *param) {
+    fs_ext2_fs_t *i;
+
+    (void)param;
+
+    for(;;) {
+        /* We get signalled when it's time to quit. Otherwise, we just time out
+           after the flush interval. */
+        if(!sem_wait_timed(&flush_sem, flush_ms) || !flush_ms)
+            break;
+
+        mutex_lock(&ext2_mutex);
+
+        LIST_FOREACH(i, &ext2_fses, entry) {
+            if(i->mount_flags & FS_EXT2_MOUNT_READWRITE)
+                ext2_fs_sync(i->fs);
+        }
+
+        mutex_unlock(&ext2_mutex);
+    }
+
+    return NULL;
+}
+
+int fs_ext2_flush_interval(int ms) {
+    if(!initted || ms < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    /* Stop the old thread first, if there is one. */
+    if(flush_thd) {
+        flush_ms = 0;
+        sem_signal(&flush_sem);
+        thd_join(flush_thd, NULL);
+        flush_thd = NULL;
+        sem_destroy(&flush_sem);
+    }
+
+    if(!ms)
+        return 0;
+
+    flush_ms = ms;
+    sem_init(&flush_sem, 0);
+
+    if(!(flush_thd = thd_create(0, &flush_thd_func, NULL))) {
+        flush_ms = 0;
+        sem_destroy(&flush_sem);
+        return -1;
+    }
+
+    thd_set_label(flush_thd, "fs_ext2 flusher");
+    return 0;
+}
+
 int fs_ext2_init(void) {
     if(initted)
         return 0;
@@ -2056,6 +2211,8 @@ int fs_ext2_shutdown(void) {
     if(!initted)
         return 0;
 
+    fs_ext2_flush_interval(0);
+
     /* Clean up the mounted filesystems */
     i = LIST_FIRST(&ext2_fses);
     while(i) {
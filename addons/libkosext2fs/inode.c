@@ -1369,3 +1369,97 @@ uint8_t *ext2_inode_read_block(ext2_fs_t *fs, const ext2_inode_t *inode,
         return NULL;
     }
 }
+
+/* Find the entry in an inode's block map for the given logical block. This
+   returns the array of block pointers that the entry is in, with *idx set to
+   the entry's index in the array and *left set to the number of entries in
+   the array from there to the end. Holes in the map (where an indirect block
+   doesn't exist) come back as a single zero entry. */
+static const uint32_t *inode_map_entry(ext2_fs_t *fs, const ext2_inode_t *inode,
+                                       uint32_t block_num, uint32_t *idx,
+                                       uint32_t *left, int *err) {
+    static const uint32_t hole = 0;
+    uint32_t blks_per_ind = fs->block_size >> 2, ibn, span;
+    const uint32_t *iblock;
+    int levels;
+
+    /* Direct blocks are right in the inode. */
+    if(block_num < 12) {
+        *idx = block_num;
+        *left = 12 - block_num;
+        return inode->i_block;
+    }
+
+    /* Figure out how many levels of indirection we're dealing with. */
+    block_num -= 12;
+
+    if(block_num < blks_per_ind) {
+        levels = 1;
+        ibn = inode->i_block[12];
+    }
+    else if((block_num -= blks_per_ind) < blks_per_ind * blks_per_ind) {
+        levels = 2;
+        ibn = inode->i_block[13];
+    }
+    else {
+        block_num -= blks_per_ind * blks_per_ind;
+        levels = 3;
+        ibn = inode->i_block[14];
+    }
+
+    /* Walk down the levels of indirect blocks. */
+    for(;;) {
+        if(!ibn) {
+            *idx = 0;
+            *left = 1;
+            return &hole;
+        }
+
+        if(!(iblock = (const uint32_t *)ext2_block_read(fs, ibn, err)))
+            return NULL;
+
+        if(--levels == 0)
+            break;
+
+        /* Each entry at this level covers this many blocks. */
+        span = levels == 2 ? blks_per_ind * blks_per_ind : blks_per_ind;
+        ibn = iblock[block_num / span];
+        block_num %= span;
+    }
+
+    *idx = block_num;
+    *left = blks_per_ind - block_num;
+    return iblock;
+}
+
+int ext2_inode_map_blocks(ext2_fs_t *fs, const ext2_inode_t *inode,
+                          uint32_t block_num, uint32_t count,
+                          uint32_t *r_block, uint32_t *r_count) {
+    const uint32_t *map;
+    uint32_t idx, left, first, n;
+    int err;
+
+    if(!(map = inode_map_entry(fs, inode, block_num, &idx, &left, &err)))
+        return -err;
+
+    first = map[idx];
+
+    for(n = 1; n < count; ++n) {
+        /* Move on to the next entry, which may be in another indirect
+           block. */
+        if(--left) {
+            ++idx;
+        }
+        else if(!(map = inode_map_entry(fs, inode, block_num + n, &idx, &left,
+                                        &err))) {
+            return -err;
+        }
+
+        if(first ? map[idx] != first + n : map[idx] != 0)
+            break;
+    }
+
+    *r_block = first;
+    *r_count = n;
+    return 0;
+}
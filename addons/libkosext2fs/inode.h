@@ -158,6 +158,15 @@ uint8_t *ext2_inode_read_block(ext2_fs_t *fs, const ext2_inode_t *inode,
                                uint32_t block_num, uint32_t *r_block,
                                int *err);
 
+/* Map a run of logical blocks of an inode to physical blocks. This finds the
+   physical block that block_num is stored in and how many of the (up to count)
+   blocks after it are stored right after it on the device. If the inode has a
+   hole at block_num, *r_block is set to 0 and *r_count to the length of the
+   hole. Returns 0 on success or a negative error code. */
+int ext2_inode_map_blocks(ext2_fs_t *fs, const ext2_inode_t *inode,
+                          uint32_t block_num, uint32_t count,
+                          uint32_t *r_block, uint32_t *r_count);
+
 /* In symlink.c */
 int ext2_resolve_symlink(ext2_fs_t *fs, ext2_inode_t *inode, char *rv,
                          size_t *rv_len);
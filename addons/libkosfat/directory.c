@@ -310,7 +310,7 @@ static int fat_search_long(fat_fs_t *fs, const char *fn, uint32_t cluster,
             if(!memcmp(longname_buf, longname_buf2, fnlen * sizeof(uint16_t))) {
                 /* The next entry should be the dentry we want (that is to say,
                    the short name entry for this long name). */
-                if(i < max) {
+                if(i + 1 < max) {
                     if(cluster != cluster2) {
                         if(!(cl = fat_cluster_read(fs, cluster, &err))) {
                             dbglog(DBG_ERROR, "Error reading directory at "
@@ -380,8 +380,16 @@ static int fat_search_long(fat_fs_t *fs, const char *fn, uint32_t cluster,
             else {
                 skip = 1;
 
-                if(cluster2 != cluster)
-                    break;
+                /* If the long name crossed into the next cluster, then pick
+                   up from where it ended in that cluster. */
+                if(cluster2 != cluster) {
+                    if(!(cl = fat_cluster_read(fs, cluster, &err))) {
+                        dbglog(DBG_ERROR, "Error reading directory at "
+                               "cluster %" PRIu32 ": %s\n", cluster,
+                               strerror(err));
+                        return -EIO;
+                    }
+                }
             }
         }
 
@@ -400,6 +408,8 @@ static int fat_search_long(fat_fs_t *fs, const char *fn, uint32_t cluster,
             if(max2 <= 0)
                 done = 1;
         }
+
+        i = 0;
     }
 
     return -ENOENT;
@@ -484,6 +494,226 @@ static int is_component_short(const char *fn) {
     return 1;
 }
 
+/* Directory entry cache. This remembers the results of searching directories
+   for path components, keyed by the cluster of the directory and the name (with
+   ASCII case folded, just like the searches themselves). */
+static uint32_t dcache_hash(uint32_t parent, const char *fn, size_t len) {
+    uint32_t h = 2166136261U ^ parent;
+    size_t i;
+
+    for(i = 0; i < len; ++i) {
+        h ^= (uint8_t)tolower((int)(uint8_t)fn[i]);
+        h *= 16777619U;
+    }
+
+    return h;
+}
+
+static int dcache_name_eq(const fat_dcache_ent_t *ent, const char *fn,
+                          size_t len) {
+    size_t i;
+
+    if(ent->len != len)
+        return 0;
+
+    for(i = 0; i < len; ++i) {
+        if(ent->name[i] != tolower((int)(uint8_t)fn[i]))
+            return 0;
+    }
+
+    return 1;
+}
+
+static fat_dcache_ent_t *dcache_find(fat_fs_t *fs, uint32_t parent,
+                                     const char *fn, size_t len) {
+    fat_dcache_ent_t *ent;
+    uint32_t h = dcache_hash(parent, fn, len) & fs->dhash_mask;
+
+    LIST_FOREACH(ent, &fs->dhash[h], hash) {
+        if(ent->parent == parent && dcache_name_eq(ent, fn, len)) {
+            /* Move it to the most recently used end of the list. */
+            TAILQ_REMOVE(&fs->dlru, ent, lru);
+            TAILQ_INSERT_TAIL(&fs->dlru, ent, lru);
+            return ent;
+        }
+    }
+
+    return NULL;
+}
+
+static void dcache_drop(fat_fs_t *fs, fat_dcache_ent_t *ent) {
+    LIST_REMOVE(ent, hash);
+    ent->flags = 0;
+
+    /* Put it up front so that it gets reused first. */
+    TAILQ_REMOVE(&fs->dlru, ent, lru);
+    TAILQ_INSERT_HEAD(&fs->dlru, ent, lru);
+}
+
+static void dcache_insert(fat_fs_t *fs, uint32_t parent, const char *fn,
+                          size_t len, uint32_t flags, uint32_t cl,
+                          uint32_t off, uint32_t lcl, uint32_t loff) {
+    fat_dcache_ent_t *ent;
+    size_t i;
+
+    /* Boot out the least recently used entry. */
+    ent = TAILQ_FIRST(&fs->dlru);
+
+    if(ent->flags & FAT_DCACHE_FLAG_VALID)
+        LIST_REMOVE(ent, hash);
+
+    ent->flags = FAT_DCACHE_FLAG_VALID | flags;
+    ent->parent = parent;
+    ent->cl = cl;
+    ent->off = off;
+    ent->lcl = lcl;
+    ent->loff = loff;
+    ent->len = (uint8_t)len;
+
+    for(i = 0; i < len; ++i)
+        ent->name[i] = tolower((int)(uint8_t)fn[i]);
+
+    LIST_INSERT_HEAD(&fs->dhash[dcache_hash(parent, fn, len) & fs->dhash_mask],
+                     ent, hash);
+    TAILQ_REMOVE(&fs->dlru, ent, lru);
+    TAILQ_INSERT_TAIL(&fs->dlru, ent, lru);
+}
+
+/* Something is being added to the directory at parent. Any negative entries
+   for it might not be true anymore (and this can't just look at the name being
+   added, because of the short name that goes along with a long name). The new
+   entry's cluster might also have belonged to a directory that has since been
+   deleted, so throw out anything cached for that too. */
+static void dcache_added(fat_fs_t *fs, uint32_t parent, uint32_t cluster) {
+    int i;
+    fat_dcache_ent_t *ent;
+
+    for(i = 0; i < fs->dcache_size; ++i) {
+        ent = &fs->dcache[i];
+
+        if(!(ent->flags & FAT_DCACHE_FLAG_VALID))
+            continue;
+
+        if((ent->parent == parent && (ent->flags & FAT_DCACHE_FLAG_NEG)) ||
+           ent->parent == cluster)
+            dcache_drop(fs, ent);
+    }
+}
+
+/* The directory entry at cl/off is being erased. */
+static void dcache_erased(fat_fs_t *fs, uint32_t cl, uint32_t off) {
+    int i;
+    fat_dcache_ent_t *ent;
+
+    for(i = 0; i < fs->dcache_size; ++i) {
+        ent = &fs->dcache[i];
+
+        if((ent->flags & FAT_DCACHE_FLAG_VALID) &&
+           !(ent->flags & FAT_DCACHE_FLAG_NEG) && ent->cl == cl &&
+           ent->off == off)
+            dcache_drop(fs, ent);
+    }
+}
+
+int fat_dcache_init(fat_fs_t *fs, int entries) {
+    int i;
+    uint32_t buckets = 1;
+
+    fs->dcache = NULL;
+    fs->dcache_size = 0;
+
+    if(entries <= 0)
+        return 0;
+
+    while(buckets < (uint32_t)entries)
+        buckets <<= 1;
+
+    if(!(fs->dcache = (fat_dcache_ent_t *)malloc(sizeof(fat_dcache_ent_t) *
+                                                 entries)))
+        return -ENOMEM;
+
+    if(!(fs->dhash = (struct fat_dcache_hash *)
+         malloc(sizeof(struct fat_dcache_hash) * buckets))) {
+        free(fs->dcache);
+        fs->dcache = NULL;
+        return -ENOMEM;
+    }
+
+    for(i = 0; i < (int)buckets; ++i)
+        LIST_INIT(&fs->dhash[i]);
+
+    TAILQ_INIT(&fs->dlru);
+
+    for(i = 0; i < entries; ++i) {
+        fs->dcache[i].flags = 0;
+        TAILQ_INSERT_TAIL(&fs->dlru, &fs->dcache[i], lru);
+    }
+
+    fs->dcache_size = entries;
+    fs->dhash_mask = buckets - 1;
+    return 0;
+}
+
+void fat_dcache_shutdown(fat_fs_t *fs) {
+    if(!fs->dcache)
+        return;
+
+    free(fs->dhash);
+    free(fs->dcache);
+    fs->dcache = NULL;
+    fs->dcache_size = 0;
+}
+
+/* Search the directory at cluster for the given path component, checking the
+   directory entry cache first. */
+static int fat_search(fat_fs_t *fs, const char *fn, uint32_t cluster,
+                      fat_dentry_t *rv, uint32_t *rcl, uint32_t *roff,
+                      uint32_t *rlcl, uint32_t *rloff) {
+    size_t len = strlen(fn);
+    fat_dcache_ent_t *ent;
+    char comp[11];
+    int err, cache = fs->dcache && len <= FAT_DCACHE_NAME_MAX;
+
+    if(cache && (ent = dcache_find(fs, cluster, fn, len))) {
+        if(ent->flags & FAT_DCACHE_FLAG_NEG)
+            return -ENOENT;
+
+        /* Read the entry itself back in, since its contents (the size, for
+           instance) may have changed since it was cached. */
+        if(!fat_get_dentry(fs, ent->cl, ent->off, rv) &&
+           rv->name[0] != FAT_ENTRY_EOD && rv->name[0] != FAT_ENTRY_FREE) {
+            *rcl = ent->cl;
+            *roff = ent->off;
+            *rlcl = ent->lcl;
+            *rloff = ent->loff;
+            return 0;
+        }
+
+        /* That shouldn't happen, but if it does, just do the search. */
+        dcache_drop(fs, ent);
+    }
+
+    if(is_component_short(fn)) {
+        normalize_shortname(fn, comp);
+        err = fat_search_dir(fs, comp, cluster, rv, rcl, roff);
+        *rlcl = 0;
+        *rloff = 0;
+    }
+    else {
+        err = fat_search_long(fs, fn, cluster, rv, rcl, roff, rlcl, rloff);
+    }
+
+    if(cache) {
+        if(!err)
+            dcache_insert(fs, cluster, fn, len, 0, *rcl, *roff, *rlcl, *rloff);
+        else if(err == -ENOENT)
+            dcache_insert(fs, cluster, fn, len, FAT_DCACHE_FLAG_NEG, 0, 0, 0,
+                          0);
+    }
+
+    return err;
+}
+
 static int fat_find_child2(fat_fs_t *fs, const char fn[11],
                            fat_dentry_t *parent) {
     uint32_t cl;
@@ -497,31 +727,16 @@ static int fat_find_child2(fat_fs_t *fs, const char fn[11],
 int fat_find_child(fat_fs_t *fs, const char *fn, fat_dentry_t *parent,
                    fat_dentry_t *rv, uint32_t *rcl, uint32_t *roff,
                    uint32_t *rlcl, uint32_t *rloff) {
-    char *fnc = strdup(fn), comp[11];
     uint32_t cl;
-    int err;
 
     cl = parent->cluster_low | (parent->cluster_high << 16);
-
-    if(is_component_short(fnc)) {
-        normalize_shortname(fnc, comp);
-
-        err = fat_search_dir(fs, comp, cl, rv, rcl, roff);
-        *rlcl = 0;
-        *rloff = 0;
-    }
-    else {
-        err = fat_search_long(fs, fnc, cl, rv, rcl, roff, rlcl, rloff);
-    }
-
-    free(fnc);
-    return err;
+    return fat_search(fs, fn, cl, rv, rcl, roff, rlcl, rloff);
 }
 
 int fat_find_dentry(fat_fs_t *fs, const char *fn, fat_dentry_t *rv,
                     uint32_t *rcl, uint32_t *roff, uint32_t *rlcl,
                     uint32_t *rloff) {
-    char *fnc = strdup(fn), comp[11], *tmp, *tok;
+    char *fnc = strdup(fn), *tmp, *tok;
     int err = -ENOENT;
     fat_dentry_t cur;
     uint32_t cl, off, lcl = 0, loff = 0;
@@ -561,17 +776,8 @@ int fat_find_dentry(fat_fs_t *fs, const char *fn, fat_dentry_t *rv,
             fs->sb.fat_size));
     }
 
-    if(is_component_short(tok)) {
-        normalize_shortname(tok, comp);
-
-        if((err = fat_search_dir(fs, comp, cl, &cur, &cl, &off)) < 0)
-            goto out;
-    }
-    else {
-        if((err = fat_search_long(fs, tok, cl, &cur, &cl, &off, &lcl,
-                                  &loff)) < 0)
-            goto out;
-    }
+    if((err = fat_search(fs, tok, cl, &cur, &cl, &off, &lcl, &loff)) < 0)
+        goto out;
 
     tok = strtok_r(NULL, "/", &tmp);
 
@@ -584,19 +790,9 @@ int fat_find_dentry(fat_fs_t *fs, const char *fn, fat_dentry_t *rv,
 
         cl = cur.cluster_low | (cur.cluster_high << 16);
 
-        if(is_component_short(tok)) {
-            normalize_shortname(tok, comp);
-            lcl = loff = 0;
-
-            if((err = fat_search_dir(fs, comp, cl, &cur, &cl, &off)) < 0) {
-                goto out;
-            }
-        }
-        else {
-            if((err = fat_search_long(fs, tok, cl, &cur, &cl, &off, &lcl,
-                                      &loff)) < 0)
-                goto out;
-        }
+        if((err = fat_search(fs, tok, cl, &cur, &cl, &off, &lcl,
+                             &loff)) < 0)
+            goto out;
 
         tok = strtok_r(NULL, "/", &tmp);
     }
@@ -626,6 +822,9 @@ int fat_erase_dentry(fat_fs_t *fs, uint32_t cl, uint32_t off, uint32_t lcl,
     uint32_t max, max2, i;
     int done = 0, err;
 
+    if(fs->dcache)
+        dcache_erased(fs, cl, off);
+
     /* Read the cluster/block where the short name lives. */
     if(!(buf = fat_cluster_read(fs, cl, &err))) {
         dbglog(DBG_ERROR, "Error reading directory entry at cluster %" PRIu32
@@ -894,6 +1093,8 @@ static int fat_get_free_dentry(fat_fs_t *fs, uint32_t cluster, uint32_t *rcl,
                         soff = i << 5;
                     }
 
+                    /* The new cluster goes after this one. */
+                    old = cluster;
                     goto alloc_another;
                 }
             }
@@ -1287,6 +1488,9 @@ int fat_add_dentry(fat_fs_t *fs, const char *fn, fat_dentry_t *parent,
 
     cl = parent->cluster_low | (parent->cluster_high << 16);
 
+    if(fs->dcache)
+        dcache_added(fs, cl, cluster);
+
     if(is_component_short(fn)) {
         normalize_shortname(fn, comp);
 
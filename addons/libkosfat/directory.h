@@ -77,6 +77,9 @@ int fat_update_dentry(fat_fs_t *fs, fat_dentry_t *ent, uint32_t cluster,
                       uint32_t off);
 void fat_update_mtime(fat_dentry_t *ent);
 
+int fat_dcache_init(fat_fs_t *fs, int entries);
+void fat_dcache_shutdown(fat_fs_t *fs);
+
 #ifdef FAT_DEBUG
 void fat_dentry_print(const fat_dentry_t *ent);
 #endif
@@ -35,7 +35,8 @@ static void make_mru(fat_fs_t *fs, fat_cache_t **cache, int block) {
 
 
 static int fat_fatblock_read_nc(fat_fs_t *fs, uint32_t bn, uint8_t *rv) {
-    if(fs->sb.fat_size <= bn)
+    if(bn < fs->sb.reserved_sectors ||
+       bn >= fs->sb.reserved_sectors + fs->sb.fat_size)
         return -EINVAL;
 
     if(fs->dev->read_blocks(fs->dev, bn, 1, rv))
@@ -46,7 +47,8 @@ static int fat_fatblock_read_nc(fat_fs_t *fs, uint32_t bn, uint8_t *rv) {
 
 static int fat_fatblock_write_nc(fat_fs_t *fs, uint32_t bn,
                                  const uint8_t *blk) {
-    if(fs->sb.fat_size <= bn)
+    if(bn < fs->sb.reserved_sectors ||
+       bn >= fs->sb.reserved_sectors + fs->sb.fat_size)
         return -EINVAL;
 
     if(fs->dev->write_blocks(fs->dev, bn, 1, blk))
@@ -213,8 +215,102 @@ uint32_t fat_read_fat(fat_fs_t *fs, uint32_t cl, int *err) {
     return val;
 }
 
+static void fat_bitmap_set(fat_fs_t *fs, uint32_t cl, int used) {
+    if(cl >= fs->sb.num_clusters + 2)
+        return;
+
+    if(used)
+        fs->fbitmap[cl >> 5] |= 1U << (cl & 31);
+    else
+        fs->fbitmap[cl >> 5] &= ~(1U << (cl & 31));
+}
+
+/* Build the free-cluster bitmap by reading through the whole FAT. This also
+   gives us an exact count of the free clusters, which is more than can be said
+   for the FSinfo sector (when there even is one). */
+static int fat_bitmap_init(fat_fs_t *fs) {
+    uint32_t last = fs->sb.num_clusters + 2, words = (last + 31) >> 5;
+    uint32_t *bm, cl, val, off, sn, nfree = 0;
+    const uint8_t *blk = NULL;
+    int err, shift = (fs->sb.fs_type == FAT_FS_FAT32) ? 2 : 1;
+
+    if(!(bm = (uint32_t *)malloc(words * sizeof(uint32_t)))) {
+        fs->flags |= FAT_FS_FLAG_NO_BITMAP;
+        return -ENOMEM;
+    }
+
+    /* Clusters 0 and 1 don't exist, and neither does anything past the end of
+       the filesystem, so mark all of those as being in use. */
+    memset(bm, 0, words * sizeof(uint32_t));
+    bm[0] = 3;
+
+    for(cl = last; cl < (words << 5); ++cl)
+        bm[cl >> 5] |= 1U << (cl & 31);
+
+    for(cl = 2; cl < last; ++cl) {
+        if(fs->sb.fs_type == FAT_FS_FAT12) {
+            /* FAT12 is small enough that there's no point in being clever. */
+            if((val = fat_read_fat(fs, cl, &err)) == FAT_INVALID_CLUSTER)
+                goto out_err;
+        }
+        else {
+            /* Read each FAT block once and pull all the entries out of it. */
+            off = cl << shift;
+
+            if(!blk || !(off & (fs->sb.bytes_per_sector - 1))) {
+                sn = fs->sb.reserved_sectors + (off / fs->sb.bytes_per_sector);
+
+                if(!(blk = fat_read_fatblock(fs, sn, &err)))
+                    goto out_err;
+            }
+
+            off &= fs->sb.bytes_per_sector - 1;
+            val = blk[off] | (blk[off + 1] << 8);
+
+            if(shift == 2)
+                val |= (blk[off + 2] << 16) | ((blk[off + 3] & 0x0F) << 24);
+        }
+
+        if(val != FAT_FREE_CLUSTER)
+            bm[cl >> 5] |= 1U << (cl & 31);
+        else
+            ++nfree;
+    }
+
+    fs->fbitmap = bm;
+    fs->fbitmap_words = words;
+    fs->sb.free_clusters = nfree;
+    return 0;
+
+out_err:
+    free(bm);
+    return -err;
+}
+
+/* Find the first free cluster at or after start, wrapping around to the
+   beginning of the filesystem if need be. */
+static uint32_t fat_bitmap_find(fat_fs_t *fs, uint32_t start) {
+    uint32_t w = start >> 5, word, i;
+
+    /* Ignore anything before the starting point in the first word. We'll come
+       back around to it at the end if we have to. */
+    word = fs->fbitmap[w] | ((1U << (start & 31)) - 1);
+
+    for(i = 0; i <= fs->fbitmap_words; ++i) {
+        if(word != 0xFFFFFFFF)
+            return (w << 5) + __builtin_ctz(~word);
+
+        if(++w == fs->fbitmap_words)
+            w = 0;
+
+        word = fs->fbitmap[w];
+    }
+
+    return FAT_INVALID_CLUSTER;
+}
+
 int fat_write_fat(fat_fs_t *fs, uint32_t cl, uint32_t val) {
-    uint32_t sn, off;
+    uint32_t sn, off, n = cl;
     uint8_t *blk, *blk2;
     int err;
 
@@ -232,7 +328,7 @@ int fat_write_fat(fat_fs_t *fs, uint32_t cl, uint32_t val) {
             /* Read the FAT block. */
             blk = fat_read_fatblock(fs, sn, &err);
             if(!blk)
-                return err;
+                return -err;
 
             blk[off] = (uint8_t)val;
             blk[off + 1] = (uint8_t)(val >> 8);
@@ -253,7 +349,7 @@ int fat_write_fat(fat_fs_t *fs, uint32_t cl, uint32_t val) {
             /* Read the FAT block. */
             blk = fat_read_fatblock(fs, sn, &err);
             if(!blk)
-                return err;
+                return -err;
 
             blk[off] = (uint8_t)val;
             blk[off + 1] = (uint8_t)(val >> 8);
@@ -270,7 +366,7 @@ int fat_write_fat(fat_fs_t *fs, uint32_t cl, uint32_t val) {
             /* Read the FAT block. */
             blk = fat_read_fatblock(fs, sn, &err);
             if(!blk)
-                return err;
+                return -err;
 
             /* See if we have the very special case of the entry spanning two
                blocks... This is why we can't have nice things... */
@@ -278,7 +374,7 @@ int fat_write_fat(fat_fs_t *fs, uint32_t cl, uint32_t val) {
                 blk2 = fat_read_fatblock(fs, sn + 1, &err);
 
                 if(!blk2)
-                    return err;
+                    return -err;
 
                 /* The bright side here is that we at least know that the
                    cluster number is odd... */
@@ -308,6 +404,10 @@ int fat_write_fat(fat_fs_t *fs, uint32_t cl, uint32_t val) {
             break;
     }
 
+    /* Keep the free-cluster bitmap in sync, if we've built it yet. */
+    if(fs->fbitmap)
+        fat_bitmap_set(fs, n, val != FAT_FREE_CLUSTER);
+
     return 0;
 }
 
@@ -326,11 +426,13 @@ int fat_is_eof(fat_fs_t *fs, uint32_t cl) {
     return -1;
 }
 
-uint32_t fat_allocate_cluster(fat_fs_t *fs, int *err) {
+/* Search the FAT itself for a free cluster. This is only used if there wasn't
+   enough memory for the free-cluster bitmap. */
+static uint32_t fat_scan_cluster(fat_fs_t *fs, int *err) {
     uint32_t sn, off, val;
     uint8_t *blk;
     uint32_t cl, i, cps, last;
-    int tries = 1;
+    int tries = 1, rv;
 
     /* Don't let us write to the FAT if we're on a read-only FS. */
     if(!(fs->mnt_flags & FAT_MNT_FLAG_RW)) {
@@ -457,10 +559,13 @@ retry_fat16:
                 ++i) {
                 if(!(cl = fat_read_fat(fs, i, err))) {
                     /* Allocate it by adding in an end of chain marker. */
-                    if((*err = fat_write_fat(fs, i, 0x0FFF)) < 0)
+                    if((rv = fat_write_fat(fs, i, 0x0FFF)) < 0) {
+                        *err = -rv;
                         return FAT_INVALID_CLUSTER;
+                    }
 
                     fs->sb.last_alloc_cluster = i;
+                    return i;
                 }
                 else if(cl == FAT_INVALID_CLUSTER) {
                     return cl;
@@ -470,10 +575,13 @@ retry_fat16:
             for(i = 2; i < fs->sb.last_alloc_cluster + 1; ++i) {
                 if(!(cl = fat_read_fat(fs, i, err))) {
                     /* Allocate it by adding in an end of chain marker. */
-                    if((*err = fat_write_fat(fs, i, 0x0FFF)) < 0)
+                    if((rv = fat_write_fat(fs, i, 0x0FFF)) < 0) {
+                        *err = -rv;
                         return FAT_INVALID_CLUSTER;
+                    }
 
                     fs->sb.last_alloc_cluster = i;
+                    return i;
                 }
                 else if(cl == FAT_INVALID_CLUSTER) {
                     return cl;
@@ -492,6 +600,55 @@ retry_fat16:
     return val;
 }
 
+uint32_t fat_allocate_cluster_near(fat_fs_t *fs, uint32_t hint, int *err) {
+    uint32_t cl;
+    int rv;
+
+    /* Don't let us write to the FAT if we're on a read-only FS. */
+    if(!(fs->mnt_flags & FAT_MNT_FLAG_RW)) {
+        *err = EROFS;
+        return FAT_INVALID_CLUSTER;
+    }
+
+    /* Build the free-cluster bitmap if this is the first allocation. If we
+       can't spare the memory for it, fall back to searching the FAT. */
+    if(!fs->fbitmap) {
+        if(fs->flags & FAT_FS_FLAG_NO_BITMAP)
+            return fat_scan_cluster(fs, err);
+
+        if((rv = fat_bitmap_init(fs)) == -ENOMEM) {
+            return fat_scan_cluster(fs, err);
+        }
+        else if(rv < 0) {
+            *err = -rv;
+            return FAT_INVALID_CLUSTER;
+        }
+    }
+
+    if(hint < 2 || hint >= fs->sb.num_clusters + 2)
+        hint = 2;
+
+    if((cl = fat_bitmap_find(fs, hint)) == FAT_INVALID_CLUSTER) {
+        *err = ENOSPC;
+        return FAT_INVALID_CLUSTER;
+    }
+
+    /* Put an end of chain marker in to allocate it. This also marks it as used
+       in the bitmap. */
+    if((rv = fat_write_fat(fs, cl, 0x0FFFFFFF)) < 0) {
+        *err = -rv;
+        return FAT_INVALID_CLUSTER;
+    }
+
+    fs->sb.last_alloc_cluster = cl;
+    --fs->sb.free_clusters;
+    return cl;
+}
+
+uint32_t fat_allocate_cluster(fat_fs_t *fs, int *err) {
+    return fat_allocate_cluster_near(fs, fs->sb.last_alloc_cluster + 1, err);
+}
+
 /* This function could be made better/more optimized... However, it takes the
    simplest/most clear approach to this for now. */
 int fat_erase_chain(fat_fs_t *fs, uint32_t cluster) {
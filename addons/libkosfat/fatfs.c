@@ -14,6 +14,7 @@
 #include "fatfs.h"
 #include "bpb.h"
 #include "fatinternal.h"
+#include "directory.h"
 
 /* This is basically the same as bgrad_cache from fs_iso9660 */
 static void make_mru(fat_fs_t *fs, fat_cache_t **cache, int block) {
@@ -277,6 +278,10 @@ fat_fs_t *fat_fs_init_ex(kos_blockdev_t *bd, uint32_t flags, int cache_sz,
     }
 
     rv->dev = bd;
+    rv->flags = 0;
+    rv->fbitmap = NULL;
+    rv->fbitmap_words = 0;
+    rv->dcache = NULL;
     rv->mnt_flags = flags & FAT_MNT_VALID_FLAGS_MASK;
 
     if(rv->mnt_flags != flags) {
@@ -345,6 +350,13 @@ fat_fs_t *fat_fs_init_ex(kos_blockdev_t *bd, uint32_t flags, int cache_sz,
     }
 
     rv->fcache_size = fcache_sz;
+
+    /* The directory entry cache is just nice to have, so don't fail the mount
+       if there's not enough memory for it. */
+    if(fat_dcache_init(rv, FAT_DCACHE_ENTRIES))
+        dbglog(DBG_WARNING, "fat_fs_init: not enough memory for the "
+               "directory entry cache\n");
+
     return rv;
 
 out_fcache2:
@@ -431,6 +443,8 @@ void fat_fs_shutdown(fat_fs_t *fs) {
         free(fs->fcache[i]);
     }
 
+    free(fs->fbitmap);
+    fat_dcache_shutdown(fs);
     fs->dev->shutdown(fs->dev);
     free(fs);
 }
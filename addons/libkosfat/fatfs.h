@@ -48,6 +48,15 @@ __BEGIN_DECLS
 */
 #define FAT_FCACHE_BLOCKS       8
 
+/* Size of the directory entry cache, in entries. Each time a path is looked
+   up, the result of searching each directory along the way is remembered
+   here (including lookups that didn't find anything), so that opening or
+   stat()ing things in big directories doesn't require reading through the
+   whole directory every time. Each entry takes a bit over 100 bytes. Setting
+   this to 0 disables the cache entirely.
+*/
+#define FAT_DCACHE_ENTRIES      64
+
 /* End tunable filesystem parameters. */
 
 /* Convenience stuff, for in case you want to use this outside of KOS. */
@@ -121,6 +130,7 @@ uint32_t fat_read_fat(fat_fs_t *fs, uint32_t cl, int *err);
 int fat_write_fat(fat_fs_t *fs, uint32_t cl, uint32_t val);
 int fat_is_eof(fat_fs_t *fs, uint32_t cl);
 uint32_t fat_allocate_cluster(fat_fs_t *fs, int *err);
+uint32_t fat_allocate_cluster_near(fat_fs_t *fs, uint32_t hint, int *err);
 int fat_erase_chain(fat_fs_t *fs, uint32_t cluster);
 
 __END_DECLS
@@ -9,6 +9,7 @@
 
 #include <stddef.h>
 #include <stdint.h>
+#include <sys/queue.h>
 
 #include "bpb.h"
 
@@ -21,6 +22,32 @@ typedef struct fat_cache {
     uint8_t *data;
 } fat_cache_t;
 
+/* Longest name (in bytes) that will be kept in the directory entry cache.
+   Lookups of anything longer just go straight to the directory. */
+#define FAT_DCACHE_NAME_MAX     63
+
+#define FAT_DCACHE_FLAG_VALID   1
+#define FAT_DCACHE_FLAG_NEG     2
+
+/* A cached path component lookup. The key is the (first) cluster of the
+   directory that was searched and the name that was looked up, and the value
+   is where the entry was found, or nothing at all for a negative entry (a
+   lookup that didn't find anything). */
+typedef struct fat_dcache_ent {
+    uint32_t flags;
+    uint32_t parent;
+    uint32_t cl, off;
+    uint32_t lcl, loff;
+    uint8_t len;
+    char name[FAT_DCACHE_NAME_MAX + 1];
+
+    LIST_ENTRY(fat_dcache_ent) hash;
+    TAILQ_ENTRY(fat_dcache_ent) lru;
+} fat_dcache_ent_t;
+
+LIST_HEAD(fat_dcache_hash, fat_dcache_ent);
+TAILQ_HEAD(fat_dcache_lru, fat_dcache_ent);
+
 struct fatfs_struct {
     kos_blockdev_t *dev;
     fat_superblock_t sb;
@@ -31,6 +58,19 @@ struct fatfs_struct {
     fat_cache_t **fcache;
     int fcache_size;
 
+    /* Free-cluster bitmap, one bit per cluster (set if the cluster is in use).
+       This gets built from the FAT the first time a cluster is allocated. */
+    uint32_t *fbitmap;
+    uint32_t fbitmap_words;
+
+    /* Directory entry cache. Valid entries are in the hash table, and all
+       entries are on the LRU list, least recently used first. */
+    fat_dcache_ent_t *dcache;
+    int dcache_size;
+    struct fat_dcache_hash *dhash;
+    uint32_t dhash_mask;
+    struct fat_dcache_lru dlru;
+
     uint32_t flags;
     uint32_t mnt_flags;
 };
@@ -38,6 +78,10 @@ struct fatfs_struct {
 /* The BPB/FSinfo blocks need to be written back to the block device... */
 #define FAT_FS_FLAG_SB_DIRTY   1
 
+/* There wasn't enough memory for the free-cluster bitmap, so don't bother
+   trying to build it again. */
+#define FAT_FS_FLAG_NO_BITMAP  2
+
 #ifdef FAT_NOT_IN_KOS
 #include <stdio.h>
 #define DBG_DEBUG 0
@@ -35,6 +35,14 @@ char *strdup(const char *);
 
 #define MAX_FAT_FILES 16
 
+/* A run of contiguous clusters in a file's cluster chain, starting at the
+   given cluster order (the index of the cluster within the file). */
+typedef struct fat_run {
+    uint32_t order;
+    uint32_t cluster;
+    uint32_t len;
+} fat_run_t;
+
 typedef struct fs_fat_fs {
     LIST_ENTRY(fs_fat_fs) entry;
 
@@ -60,6 +68,14 @@ static struct {
     uint32_t ptr;
     dirent_t dent;
     fs_fat_fs_t *fs;
+
+    /* Cache of the part of the cluster chain that we've walked so far, as a
+       list of runs sorted by order. This covers cluster orders 0 through
+       run_end - 1, so that seeking within it doesn't have to touch the FAT. */
+    fat_run_t *runs;
+    uint32_t run_cnt;
+    uint32_t run_max;
+    uint32_t run_end;
 } fh[MAX_FAT_FILES];
 
 static uint16_t longname_buf[256];
@@ -137,15 +153,107 @@ static int fat_create_entry(fat_fs_t *fs, const char *fn, uint8_t attr,
     return 0;
 }
 
+static void chain_reset(int fd) {
+    free(fh[fd].runs);
+    fh[fd].runs = NULL;
+    fh[fd].run_cnt = fh[fd].run_max = fh[fd].run_end = 0;
+}
+
+/* Add the next cluster of the chain to the cache. This only ever extends the
+   end of the cached part of the chain. If we run out of memory, the cache just
+   stops growing and the FAT gets read for anything past the end of it. */
+static void chain_add(int fd, uint32_t order, uint32_t cl) {
+    fat_run_t *run, *tmp;
+    uint32_t max;
+
+    if(order != fh[fd].run_end || cl < 2)
+        return;
+
+    if(fh[fd].run_cnt) {
+        run = &fh[fd].runs[fh[fd].run_cnt - 1];
+
+        if(run->cluster + run->len == cl) {
+            ++run->len;
+            ++fh[fd].run_end;
+            return;
+        }
+    }
+
+    if(fh[fd].run_cnt == fh[fd].run_max) {
+        max = fh[fd].run_max ? fh[fd].run_max << 1 : 8;
+
+        if(!(tmp = (fat_run_t *)realloc(fh[fd].runs, max * sizeof(fat_run_t))))
+            return;
+
+        fh[fd].runs = tmp;
+        fh[fd].run_max = max;
+    }
+
+    run = &fh[fd].runs[fh[fd].run_cnt++];
+    run->order = order;
+    run->cluster = cl;
+    run->len = 1;
+    ++fh[fd].run_end;
+}
+
+/* Look up a cluster by its order in the file. The order must be less than
+   run_end. */
+static uint32_t chain_lookup(int fd, uint32_t order) {
+    uint32_t lo = 0, hi = fh[fd].run_cnt - 1, mid;
+
+    while(lo < hi) {
+        mid = (lo + hi + 1) >> 1;
+
+        if(fh[fd].runs[mid].order <= order)
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+
+    return fh[fd].runs[lo].cluster + (order - fh[fd].runs[lo].order);
+}
+
+/* Figure out the cluster after the one the file handle is currently on. */
+static uint32_t next_cluster(fat_fs_t *fs, int fd, int *err) {
+    uint32_t order = fh[fd].cluster_order + 1, cl;
+
+    if(order < fh[fd].run_end)
+        return chain_lookup(fd, order);
+
+    cl = fat_read_fat(fs, fh[fd].cluster, err);
+
+    if(cl != FAT_INVALID_CLUSTER && !fat_is_eof(fs, cl))
+        chain_add(fd, order, cl);
+
+    return cl;
+}
+
 static int advance_cluster(fat_fs_t *fs, int fd, uint32_t order, int write) {
     uint32_t clo, cl, cl2;
     int err;
 
+    /* If we've already walked that far, then we can just look it up. */
+    if(order < fh[fd].run_end) {
+        fh[fd].cluster = chain_lookup(fd, order);
+        fh[fd].cluster_order = order;
+        fh[fd].mode &= ~0x80000000;
+        return 0;
+    }
+
     cl = fh[fd].cluster;
     clo = fh[fd].cluster_order;
 
-    /* Are we moving forward or backward? */
-    if(clo > order) {
+    /* Otherwise, start from the furthest point we know about (which is also
+       where we want to be if the last read left us sitting at the end of the
+       chain). */
+    if(fh[fd].run_end && (clo > order || clo < fh[fd].run_end - 1 ||
+                          fat_is_eof(fs, cl))) {
+        clo = fh[fd].run_end - 1;
+        cl = chain_lookup(fd, clo);
+        fh[fd].cluster = cl;
+        fh[fd].cluster_order = clo;
+    }
+    else if(clo > order) {
         /* If moving backward, we have to start from the beginning of the file
            and advance forward. */
         clo = 0;
@@ -173,8 +281,9 @@ static int advance_cluster(fat_fs_t *fs, int fd, uint32_t order, int write) {
                 return -EDOM;
             }
             else {
-                /* Allocate a new cluster */
-                cl2 = fat_allocate_cluster(fs, &err);
+                /* Allocate a new cluster, right after the current one if we
+                   can, to keep the file contiguous. */
+                cl2 = fat_allocate_cluster_near(fs, cl + 1, &err);
 
                 if(cl2 == FAT_INVALID_CLUSTER) {
                     return -err;
@@ -195,7 +304,7 @@ static int advance_cluster(fat_fs_t *fs, int fd, uint32_t order, int write) {
         }
 
         cl = cl2;
-        ++clo;
+        chain_add(fd, ++clo, cl);
     }
 
     fh[fd].cluster = cl;
@@ -205,7 +314,7 @@ static int advance_cluster(fat_fs_t *fs, int fd, uint32_t order, int write) {
 }
 
 static void *fs_fat_open(vfs_handler_t *vfs, const char *fn, int mode) {
-    file_t fd;
+    file_t fd, i;
     fs_fat_fs_t *mnt = (fs_fat_fs_t *)vfs->privdata;
     int rv;
     uint32_t cl, cl2;
@@ -318,6 +427,20 @@ static void *fs_fat_open(vfs_handler_t *vfs, const char *fn, int mode) {
                 mutex_unlock(&fat_mutex);
                 return NULL;
             }
+
+            /* Any other handles open on the file now have a stale chain, so
+               send them back to the start of it. */
+            for(i = 0; i < MAX_FAT_FILES; ++i) {
+                if(fh[i].opened && fh[i].fs == mnt &&
+                   fh[i].dentry_cluster == fh[fd].dentry_cluster &&
+                   fh[i].dentry_offset == fh[fd].dentry_offset) {
+                    chain_reset(i);
+                    chain_add(i, 0, cl);
+                    fh[i].cluster = cl;
+                    fh[i].cluster_order = 0;
+                    fh[i].mode |= 0x80000000;
+                }
+            }
         }
 
         /* Set the size to 0. */
@@ -342,6 +465,8 @@ created:
         (fh[fd].dentry.cluster_high << 16);
     fh[fd].cluster_order = 0;
     fh[fd].opened = 1;
+    chain_reset(fd);
+    chain_add(fd, 0, fh[fd].cluster);
 
     mutex_unlock(&fat_mutex);
     return (void *)(fd + 1);
@@ -357,6 +482,7 @@ static int fs_fat_close(void *h) {
         fh[fd].opened = 0;
         fh[fd].dentry_offset = fh[fd].dentry_cluster = 0;
         fh[fd].dentry_lcl = fh[fd].dentry_loff = 0;
+        chain_reset(fd);
     }
     else {
         rv = -1;
@@ -447,7 +573,7 @@ static ssize_t fs_fat_read(void *h, void *buf, size_t cnt) {
             fh[fd].ptr += bs - bo;
             cnt -= bs - bo;
             bbuf += bs - bo;
-            cl = fat_read_fat(fs, fh[fd].cluster, &errno);
+            cl = next_cluster(fs, fd, &errno);
 
             if(cl == FAT_INVALID_CLUSTER) {
                 mutex_unlock(&fat_mutex);
@@ -468,7 +594,7 @@ static ssize_t fs_fat_read(void *h, void *buf, size_t cnt) {
 
             /* Did we hit the end of the cluster? */
             if(cnt + bo == bs) {
-                cl = fat_read_fat(fs, fh[fd].cluster, &errno);
+                cl = next_cluster(fs, fd, &errno);
 
                 if(cl == FAT_INVALID_CLUSTER) {
                     mutex_unlock(&fat_mutex);
@@ -496,7 +622,7 @@ static ssize_t fs_fat_read(void *h, void *buf, size_t cnt) {
             fh[fd].ptr += bs;
             cnt -= bs;
             bbuf += bs;
-            cl = fat_read_fat(fs, fh[fd].cluster, &errno);
+            cl = next_cluster(fs, fd, &errno);
 
             if(cl == FAT_INVALID_CLUSTER) {
                 mutex_unlock(&fat_mutex);
@@ -517,7 +643,7 @@ static ssize_t fs_fat_read(void *h, void *buf, size_t cnt) {
 
             /* Did we hit the end of the cluster? */
             if(cnt == bs) {
-                cl = fat_read_fat(fs, fh[fd].cluster, &errno);
+                cl = next_cluster(fs, fd, &errno);
 
                 if(cl == FAT_INVALID_CLUSTER) {
                     mutex_unlock(&fat_mutex);
@@ -1477,6 +1603,7 @@ int fs_fat_init(void) {
 
 int fs_fat_shutdown(void) {
     fs_fat_fs_t *i, *next;
+    int j;
 
     if(!initted)
         return 0;
@@ -1495,6 +1622,9 @@ int fs_fat_shutdown(void) {
         i = next;
     }
 
+    for(j = 0; j < MAX_FAT_FILES; ++j)
+        chain_reset(j);
+
     mutex_destroy(&fat_mutex);
     initted = 0;
 
@@ -0,0 +1,164 @@
+/* KallistiOS ##version##
+
+   genwait_stress.c
+   Copyright (C) 2026 The KOS Team and contributors
+
+*/
+
+/* This program parks a large number of threads in timed waits, each on its own
+   semaphore with its own timeout, and keeps them cycling through waits that
+   either time out or get signaled. While that's going on, it measures how long
+   interrupts stay disabled while one of the waiters is woken up (which has to
+   pull it back out of the timeout queue), and how late a timed wait of its own
+   comes back (which takes in the timer interrupt's trip through the timeout
+   queue). With the timeout queue being a heap, neither should get much worse
+   as the number of waiters goes up. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <kos/thread.h>
+#include <kos/sem.h>
+
+#include <arch/arch.h>
+#include <arch/irq.h>
+#include <arch/timer.h>
+#include <dc/maple.h>
+#include <dc/maple/controller.h>
+
+#define MAX_WAITERS 1000
+#define ROUNDS      5000
+#define STACK_SIZE  4096
+
+static semaphore_t sems[MAX_WAITERS];
+static volatile int stop;
+static volatile int failed;
+static volatile uint32 signaled, timeouts;
+
+/* A simple LCG, so that each thread can have its own sequence of timeouts. */
+static uint32 next_rand(uint32 *state) {
+    *state = *state * 1103515245 + 12345;
+    return *state >> 16;
+}
+
+static void *waiter(void *param) {
+    int idx = (int)param;
+    uint32 state = idx + 1;
+
+    while(!stop) {
+        if(!sem_wait_timed(&sems[idx], 1 + next_rand(&state) % 50)) {
+            ++signaled;
+        }
+        else if(errno == ETIMEDOUT) {
+            ++timeouts;
+        }
+        else {
+            fprintf(stderr, "Waiter %d: sem_wait_timed failed: %s\n", idx,
+                    strerror(errno));
+            failed = 1;
+            break;
+        }
+    }
+
+    return NULL;
+}
+
+static int run_round(int count) {
+    kthread_attr_t attr = { 0, STACK_SIZE, NULL, 0, NULL };
+    static kthread_t *thds[MAX_WAITERS];
+    semaphore_t probe;
+    uint64 t, irq_off, irq_off_max = 0, irq_off_total = 0;
+    uint64 late, late_max = 0;
+    uint32 state = 12345;
+    int i, old, rv = 0;
+
+    stop = 0;
+    signaled = timeouts = 0;
+    sem_init(&probe, 0);
+
+    for(i = 0; i < count; ++i) {
+        sem_init(&sems[i], 0);
+
+        if(!(thds[i] = thd_create_ex(&attr, &waiter, (void *)i))) {
+            fprintf(stderr, "Failed to spawn waiter %d: %s\n", i,
+                    strerror(errno));
+            count = i;
+            rv = -1;
+            goto out;
+        }
+    }
+
+    /* Let everyone get into their first wait. */
+    thd_sleep(100);
+
+    for(i = 0; i < ROUNDS && !failed; ++i) {
+        /* Wake someone up, with interrupts disabled around the whole thing so
+           that nothing else gets counted. */
+        old = irq_disable();
+        t = timer_ns_gettime64();
+        sem_signal(&sems[next_rand(&state) % count]);
+        irq_off = timer_ns_gettime64() - t;
+        irq_restore(old);
+
+        irq_off_total += irq_off;
+
+        if(irq_off > irq_off_max)
+            irq_off_max = irq_off;
+
+        /* Every so often, see how late a short timed wait of our own is. */
+        if(!(i & 15)) {
+            t = timer_us_gettime64();
+            sem_wait_timed(&probe, 2);
+            late = timer_us_gettime64() - t;
+            late = late > 2000 ? late - 2000 : 0;
+
+            if(late > late_max)
+                late_max = late;
+        }
+        else {
+            thd_pass();
+        }
+    }
+
+    printf("%4d waiters: wake IRQ-off avg %5lu ns, max %6lu ns; "
+           "timed wait late by up to %4lu us (%lu timeouts)\n", count,
+           (uint32)(irq_off_total / ROUNDS), (uint32)irq_off_max,
+           (uint32)late_max, (uint32)timeouts);
+
+out:
+    stop = 1;
+
+    for(i = 0; i < count; ++i)
+        sem_signal(&sems[i]);
+
+    for(i = 0; i < count; ++i) {
+        thd_join(thds[i], NULL);
+        sem_destroy(&sems[i]);
+    }
+
+    sem_destroy(&probe);
+
+    return failed ? -1 : rv;
+}
+
+KOS_INIT_FLAGS(INIT_DEFAULT);
+
+int main(int argc, char *argv[]) {
+    int count;
+
+    cont_btn_callback(0, CONT_START | CONT_A | CONT_B | CONT_X | CONT_Y,
+                      (cont_btn_callback_t)arch_exit);
+
+    printf("KallistiOS genwait timeout queue stress test\n");
+
+    for(count = 10; count <= MAX_WAITERS; count *= 10) {
+        if(run_round(count) < 0) {
+            fprintf(stderr, "***** GENWAIT_STRESS FAILED *****\n");
+            return EXIT_FAILURE;
+        }
+    }
+
+    printf("***** GENWAIT_STRESS DONE *****\n");
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,189 @@
+/* KallistiOS ##version##
+
+   prio_inherit.c
+   Copyright (C) 2026 The KOS Team and contributors
+
+*/
+
+/* This program sets up a classic priority inversion and checks that priority
+   inheritance gets rid of it. A low priority thread takes a lock and starts
+   doing some work with it. A high priority thread then tries to take the same
+   lock and has to wait, while a medium priority thread hogs the CPU. Without
+   priority inheritance, the low priority thread can't finish its work (and
+   release the lock) until the medium priority thread is done, so the high
+   priority thread ends up waiting for the medium priority one. With priority
+   inheritance, the low priority thread gets boosted and the high priority
+   thread only has to wait for the critical section itself.
+
+   This is done once for a mutex and once for the write side of a reader/writer
+   semaphore, each time both without and with priority inheritance. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <kos/thread.h>
+#include <kos/mutex.h>
+#include <kos/rwsem.h>
+#include <kos/sem.h>
+
+#include <arch/arch.h>
+#include <arch/timer.h>
+#include <dc/maple.h>
+#include <dc/maple/controller.h>
+
+#define UNUSED __attribute__((unused))
+
+#define PRIO_HIGH   5
+#define PRIO_MED    12
+#define PRIO_LOW    15
+
+/* How long each of the threads keeps the CPU busy for, in milliseconds. */
+#define LOW_WORK    50
+#define MED_WORK    500
+
+static mutex_t mtx;
+static rw_semaphore_t rws;
+static int use_rwsem;
+static semaphore_t held;
+static uint32 loops_per_ms;
+static uint64 high_wait;
+
+/* Burn some CPU time. This is based on a loop count rather than the clock, so
+   that time spent preempted doesn't count towards the work. */
+static void busy_work(int ms) {
+    volatile uint32 i;
+    uint32 cnt = loops_per_ms * ms;
+
+    for(i = 0; i < cnt; ++i)
+        ;
+}
+
+static void calibrate(void) {
+    uint64 start, end;
+
+    loops_per_ms = 1000;
+    start = timer_us_gettime64();
+    busy_work(100);
+    end = timer_us_gettime64();
+
+    loops_per_ms = (uint32)(100000ULL * 1000 / (end - start));
+}
+
+static void lock(void) {
+    if(use_rwsem)
+        rwsem_write_lock(&rws);
+    else
+        mutex_lock(&mtx);
+}
+
+static void unlock(void) {
+    if(use_rwsem)
+        rwsem_write_unlock(&rws);
+    else
+        mutex_unlock(&mtx);
+}
+
+static void *low_thd(void *param UNUSED) {
+    lock();
+    sem_signal(&held);
+    busy_work(LOW_WORK);
+    unlock();
+
+    return NULL;
+}
+
+static void *med_thd(void *param UNUSED) {
+    busy_work(MED_WORK);
+    return NULL;
+}
+
+static void *high_thd(void *param UNUSED) {
+    uint64 start = timer_us_gettime64();
+
+    lock();
+    high_wait = timer_us_gettime64() - start;
+    unlock();
+
+    return NULL;
+}
+
+static kthread_t *spawn(void *(*routine)(void *), prio_t prio,
+                        const char *label) {
+    kthread_attr_t attr = { 0, 0, NULL, prio, label };
+    return thd_create_ex(&attr, routine, NULL);
+}
+
+static uint64 run_round(int protocol) {
+    kthread_t *low, *med, *high;
+
+    mutex_init(&mtx, MUTEX_TYPE_NORMAL);
+    mutex_set_protocol(&mtx, protocol, 0);
+    rwsem_init(&rws);
+    rwsem_set_protocol(&rws, protocol, 0);
+    sem_init(&held, 0);
+
+    /* Let the low priority thread grab the lock first. */
+    low = spawn(&low_thd, PRIO_LOW, "low");
+    sem_wait(&held);
+
+    /* Then start the other two. Both of them outrank us, so the high priority
+       one blocks on the lock and the medium one starts hogging the CPU as soon
+       as we block in the join. */
+    high = spawn(&high_thd, PRIO_HIGH, "high");
+    med = spawn(&med_thd, PRIO_MED, "med");
+
+    thd_join(high, NULL);
+    thd_join(med, NULL);
+    thd_join(low, NULL);
+
+    sem_destroy(&held);
+    rwsem_destroy(&rws);
+    mutex_destroy(&mtx);
+
+    return high_wait;
+}
+
+static int run_test(const char *name) {
+    uint64 off, on;
+
+    off = run_round(THD_PI_NONE);
+    on = run_round(THD_PI_INHERIT);
+
+    printf("%s: high priority wait %lu ms without inheritance, %lu ms with\n",
+           name, (uint32)(off / 1000), (uint32)(on / 1000));
+
+    /* With inheritance, the wait should be about as long as the low priority
+       thread's critical section. Leave a good amount of slack. */
+    if(on > LOW_WORK * 2 * 1000) {
+        fprintf(stderr, "%s: wait not bounded with priority inheritance\n",
+                name);
+        return -1;
+    }
+
+    return 0;
+}
+
+KOS_INIT_FLAGS(INIT_DEFAULT);
+
+int main(int argc, char *argv[]) {
+    int rv = 0;
+
+    cont_btn_callback(0, CONT_START | CONT_A | CONT_B | CONT_X | CONT_Y,
+                      (cont_btn_callback_t)arch_exit);
+
+    printf("KallistiOS priority inheritance test\n");
+    calibrate();
+
+    use_rwsem = 0;
+    rv |= run_test("mutex_t");
+
+    use_rwsem = 1;
+    rv |= run_test("rw_semaphore_t");
+
+    if(rv) {
+        fprintf(stderr, "***** PRIO_INHERIT FAILED *****\n");
+        return EXIT_FAILURE;
+    }
+
+    printf("***** PRIO_INHERIT DONE *****\n");
+    return EXIT_SUCCESS;
+}
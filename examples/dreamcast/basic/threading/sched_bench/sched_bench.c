@@ -0,0 +1,168 @@
+/* KallistiOS ##version##
+
+   sched_bench.c
+   Copyright (C) 2026 The KOS Team and contributors
+
+*/
+
+/* This program measures how long the scheduler takes to hand the CPU from one
+   thread to another as the number of threads sitting in the run queue grows.
+   Two high priority threads ping-pong a pair of semaphores back and forth,
+   while a configurable number of lower priority threads stay runnable in the
+   background. With the per-priority run queue, the numbers printed for each
+   round should stay more or less flat no matter how many background threads
+   there are. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <kos/thread.h>
+#include <kos/sem.h>
+
+#include <arch/arch.h>
+#include <arch/timer.h>
+#include <dc/maple.h>
+#include <dc/maple/controller.h>
+
+#define UNUSED __attribute__((unused))
+#define ITERATIONS  10000
+#define MAX_BG_THDS 256
+
+static semaphore_t ping, pong;
+static volatile int stop;
+static volatile uint64 signal_time;
+static uint64 wake_total, wake_max;
+
+static void *bg_thd(void *param UNUSED) {
+    while(!stop)
+        thd_pass();
+
+    return NULL;
+}
+
+static void *pinger(void *param UNUSED) {
+    int i;
+
+    for(i = 0; i < ITERATIONS; ++i) {
+        signal_time = timer_us_gettime64();
+        sem_signal(&ping);
+        sem_wait(&pong);
+    }
+
+    return NULL;
+}
+
+static void *ponger(void *param UNUSED) {
+    int i;
+    uint64 lat;
+
+    for(i = 0; i < ITERATIONS; ++i) {
+        sem_wait(&ping);
+
+        /* The pinger never got started. */
+        if(stop)
+            break;
+
+        lat = timer_us_gettime64() - signal_time;
+        wake_total += lat;
+
+        if(lat > wake_max)
+            wake_max = lat;
+
+        sem_signal(&pong);
+    }
+
+    return NULL;
+}
+
+static int run_round(int bg_count) {
+    kthread_attr_t attr = { 0, 0, NULL, 5, NULL };
+    kthread_t *bg[MAX_BG_THDS], *a = NULL, *b = NULL;
+    uint64 start, end;
+    int i, rv = 0;
+
+    stop = 0;
+    wake_total = wake_max = 0;
+    sem_init(&ping, 0);
+    sem_init(&pong, 0);
+
+    /* The background threads sit at a lower priority than the ping-pong pair,
+       so they stay on the run queue for the whole round. */
+    for(i = 0; i < bg_count; ++i) {
+        if(!(bg[i] = thd_create(0, &bg_thd, NULL))) {
+            fprintf(stderr, "Failed to spawn background thread %d: %s\n", i,
+                    strerror(errno));
+            bg_count = i;
+            rv = -1;
+            goto out;
+        }
+
+        thd_set_prio(bg[i], 20);
+    }
+
+    start = timer_us_gettime64();
+    attr.label = "ponger";
+
+    if(!(b = thd_create_ex(&attr, &ponger, NULL))) {
+        fprintf(stderr, "Failed to spawn ponger: %s\n", strerror(errno));
+        rv = -1;
+        goto out;
+    }
+
+    attr.label = "pinger";
+
+    if(!(a = thd_create_ex(&attr, &pinger, NULL))) {
+        fprintf(stderr, "Failed to spawn pinger: %s\n", strerror(errno));
+        rv = -1;
+        goto out;
+    }
+
+    thd_join(a, NULL);
+    thd_join(b, NULL);
+    end = timer_us_gettime64();
+
+    printf("%4d background threads: %5lu ns/switch, wake avg %3lu us, "
+           "max %4lu us\n", bg_count,
+           (uint32)((end - start) * 1000 / (ITERATIONS * 2)),
+           (uint32)(wake_total / ITERATIONS), (uint32)wake_max);
+
+out:
+    stop = 1;
+
+    /* If the ponger is still around, it's waiting for a ping that's never
+       going to come. */
+    if(b && !a) {
+        sem_signal(&ping);
+        thd_join(b, NULL);
+    }
+
+    for(i = 0; i < bg_count; ++i)
+        thd_join(bg[i], NULL);
+
+    sem_destroy(&ping);
+    sem_destroy(&pong);
+
+    return rv;
+}
+
+KOS_INIT_FLAGS(INIT_DEFAULT);
+
+int main(int argc, char *argv[]) {
+    int count;
+
+    cont_btn_callback(0, CONT_START | CONT_A | CONT_B | CONT_X | CONT_Y,
+                      (cont_btn_callback_t)arch_exit);
+
+    printf("KallistiOS scheduler benchmark\n");
+
+    for(count = 0; count <= MAX_BG_THDS; count = count ? count * 2 : 1) {
+        if(run_round(count) < 0) {
+            fprintf(stderr, "***** SCHED_BENCH FAILED *****\n");
+            return EXIT_FAILURE;
+        }
+    }
+
+    printf("***** SCHED_BENCH DONE *****\n");
+    return EXIT_SUCCESS;
+}
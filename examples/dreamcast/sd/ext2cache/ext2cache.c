@@ -0,0 +1,267 @@
+/* KallistiOS ##version##
+
+   ext2cache.c
+   Copyright (C) 2026 The KOS Team and contributors
+
+   This example benchmarks the block cache in libkosext2fs. It mounts an ext2
+   filesystem with a few different cache sizes and, for each one, times cache
+   hits, cache misses and (if the filesystem is writable) how many device
+   writes it takes to write back a bunch of dirty blocks.
+
+   On the Dreamcast, this uses the first partition of the SD card, which is
+   mounted read-only unless you add -DENABLE_WRITE to the KOS_CFLAGS. Nothing
+   on the card is actually changed either way, since the blocks that are marked
+   dirty are written back with the same data they were read with.
+
+   This can also be built to run on a PC with Makefile.nonkos, in which case it
+   takes the filename of an ext2 image on the command line. For instance:
+       dd if=/dev/zero of=test.img bs=1M count=64
+       mke2fs test.img
+       ./ext2cache.kos test.img
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <sys/time.h>
+
+#ifdef _arch_dreamcast
+#include <kos/blockdev.h>
+#include <dc/sd.h>
+#else
+#include <unistd.h>
+#endif
+
+#include "ext2fs.h"
+
+/* Add -DENABLE_WRITE to the KOS_CFLAGS in the Makefile to test write-back on
+   the SD card. This is always done on the PC. */
+#if defined(ENABLE_WRITE) || !defined(_arch_dreamcast)
+#define MNT_MODE EXT2FS_MNT_FLAG_RW
+#else
+#define MNT_MODE EXT2FS_MNT_FLAG_RO
+#endif
+
+#define HIT_ROUNDS  200000
+
+static int (*real_write)(kos_blockdev_t *d, uint32_t block, size_t count,
+                         const void *buf);
+static uint32_t write_calls, write_blocks;
+
+/* Count the writes that make it to the device. */
+static int count_write(kos_blockdev_t *d, uint32_t block, size_t count,
+                       const void *buf) {
+    ++write_calls;
+    write_blocks += count;
+    return real_write(d, block, count, buf);
+}
+
+static uint64_t now_us(void) {
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+static uint32_t rand_state = 1;
+
+static uint32_t next_rand(void) {
+    rand_state = rand_state * 1103515245 + 12345;
+    return rand_state >> 8;
+}
+
+static int run_round(kos_blockdev_t *dev, int cache_sz) {
+    ext2_fs_t *fs;
+    uint32_t fs_blocks, first, i;
+    uint64_t start, hit_time, miss_time;
+    int err;
+
+    if(!(fs = ext2_fs_init_ex(dev, MNT_MODE, cache_sz))) {
+        fprintf(stderr, "Could not mount the filesystem\n");
+        return -1;
+    }
+
+    fs_blocks = (uint32_t)(((uint64_t)dev->count_blocks(dev) <<
+                            dev->l_block_size) / ext2_block_size(fs));
+
+    if(fs_blocks < (uint32_t)cache_sz * 5) {
+        fprintf(stderr, "Filesystem too small for a cache of %d blocks\n",
+                cache_sz);
+        ext2_fs_shutdown(fs);
+        return -1;
+    }
+
+    /* Stay away from the superblock and block group descriptors. */
+    first = fs_blocks / 2 - cache_sz * 2;
+
+    /* Hits: bounce around a working set half the size of the cache. */
+    for(i = 0; i < (uint32_t)cache_sz / 2; ++i) {
+        if(!ext2_block_read(fs, first + i, &err))
+            goto io_error;
+    }
+
+    start = now_us();
+
+    for(i = 0; i < HIT_ROUNDS; ++i) {
+        if(!ext2_block_read(fs, first + next_rand() % (cache_sz / 2), &err))
+            goto io_error;
+    }
+
+    hit_time = now_us() - start;
+
+    /* Misses: stream through four times the size of the cache. */
+    start = now_us();
+
+    for(i = 0; i < (uint32_t)cache_sz * 4; ++i) {
+        if(!ext2_block_read(fs, first + i, &err))
+            goto io_error;
+    }
+
+    miss_time = now_us() - start;
+
+    printf("%5d blocks: hit %4" PRIu32 " ns, miss %6" PRIu32 " ns", cache_sz,
+           (uint32_t)(hit_time * 1000 / HIT_ROUNDS),
+           (uint32_t)(miss_time * 1000 / (cache_sz * 4)));
+
+    /* Write-back: dirty the whole cache and sync it. The blocks are all
+       adjacent, so they should go out in big runs. */
+    if(MNT_MODE == EXT2FS_MNT_FLAG_RW) {
+        for(i = 0; i < (uint32_t)cache_sz; ++i) {
+            if(!ext2_block_read(fs, first + i, &err))
+                goto io_error;
+
+            ext2_block_mark_dirty(fs, first + i);
+        }
+
+        write_calls = write_blocks = 0;
+        start = now_us();
+
+        if(ext2_block_cache_wb(fs))
+            goto io_error;
+
+        printf(", write-back %" PRIu32 " blocks in %" PRIu32 " writes (%"
+               PRIu32 " us)", write_blocks >> (ext2_log_block_size(fs) -
+                                               dev->l_block_size),
+               write_calls, (uint32_t)(now_us() - start));
+    }
+
+    printf("\n");
+    ext2_fs_shutdown(fs);
+    return 0;
+
+io_error:
+    fprintf(stderr, "\nI/O error during the benchmark\n");
+    ext2_fs_shutdown(fs);
+    return -1;
+}
+
+/* For testing outside of KOS... */
+#ifndef _arch_dreamcast
+static int blockdev_dummy(kos_blockdev_t *d) {
+    (void)d;
+    return 0;
+}
+
+static int blockdev_read(kos_blockdev_t *d, uint32_t block, size_t count,
+                         void *buf) {
+    FILE *fp = (FILE *)d->dev_data;
+    ssize_t rv;
+
+    rv = pread(fileno(fp), buf, count << d->l_block_size,
+               (off_t)block << d->l_block_size);
+    return (rv > 0) ? 0 : -1;
+}
+
+static int blockdev_write(kos_blockdev_t *d, uint32_t block, size_t count,
+                          const void *buf) {
+    FILE *fp = (FILE *)d->dev_data;
+    ssize_t rv;
+
+    rv = pwrite(fileno(fp), buf, count << d->l_block_size,
+                (off_t)block << d->l_block_size);
+    return (rv > 0) ? 0 : -1;
+}
+
+static uint32_t blockdev_count(kos_blockdev_t *d) {
+    FILE *fp = (FILE *)d->dev_data;
+    off_t len;
+
+    fseeko(fp, 0, SEEK_END);
+    len = ftello(fp);
+    fseeko(fp, 0, SEEK_SET);
+
+    return (uint32_t)(len >> d->l_block_size);
+}
+
+/* The shutdown function doesn't close the file, since the filesystem gets
+   mounted and unmounted a few times. */
+static kos_blockdev_t the_bd = {
+    NULL,
+    9,
+
+    &blockdev_dummy,
+    &blockdev_dummy,
+
+    &blockdev_read,
+    &blockdev_write,
+    &blockdev_count
+};
+#endif
+
+int main(int argc, char *argv[]) {
+    static const int sizes[] = { 32, 128, 512, 2048 };
+    kos_blockdev_t dev;
+    unsigned int i;
+    int rv = 0;
+
+#ifdef _arch_dreamcast
+    uint8_t partition_type;
+
+    (void)argc;
+    (void)argv;
+
+    if(sd_init()) {
+        fprintf(stderr, "Could not initialize the SD card.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if(sd_blockdev_for_partition(0, &dev, &partition_type)) {
+        fprintf(stderr, "Could not find the first partition on the SD "
+                "card!\n");
+        sd_shutdown();
+        exit(EXIT_FAILURE);
+    }
+#else
+    FILE *fp;
+
+    if(argc != 2) {
+        fprintf(stderr, "Usage: %s image\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    if(!(fp = fopen(argv[1], "r+b"))) {
+        perror(argv[1]);
+        exit(EXIT_FAILURE);
+    }
+
+    the_bd.dev_data = fp;
+    dev = the_bd;
+#endif
+
+    real_write = dev.write_blocks;
+    dev.write_blocks = &count_write;
+
+    printf("libkosext2fs block cache benchmark\n");
+
+    for(i = 0; i < sizeof(sizes) / sizeof(sizes[0]) && !rv; ++i)
+        rv = run_round(&dev, sizes[i]);
+
+#ifdef _arch_dreamcast
+    sd_shutdown();
+#else
+    fclose(fp);
+#endif
+
+    return rv ? EXIT_FAILURE : EXIT_SUCCESS;
+}
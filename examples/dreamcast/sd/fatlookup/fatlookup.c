@@ -0,0 +1,303 @@
+/* KallistiOS ##version##
+
+   fatlookup.c
+   Copyright (C) 2026 The KOS Team and contributors
+
+   This example benchmarks path lookups in libkosfat, with a few different
+   sizes of the directory entry cache (including with it turned off). It looks
+   up files in a directory with a lot of long-named files in it, timing lookups
+   of files that exist (over a small working set, so they can all stay in the
+   cache) and of files that don't.
+
+   The files are created in the root directory of the filesystem if they aren't
+   there already. Since that requires writing to the filesystem, on the
+   Dreamcast (where this uses the first partition of the SD card) you have to
+   add -DENABLE_WRITE to the KOS_CFLAGS the first time it is run. Each file is
+   empty, so they don't take up any space other than the directory entries.
+
+   This can also be built to run on a PC with Makefile.nonkos, in which case it
+   takes the filename of a FAT image on the command line. For instance:
+       mkfs.vfat -F 32 -C test.img 65536
+       ./fatlookup.kos test.img
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <sys/time.h>
+
+#ifdef _arch_dreamcast
+#include <kos/blockdev.h>
+#include <dc/sd.h>
+#else
+#include <unistd.h>
+#endif
+
+#include "fatfs.h"
+#include "directory.h"
+
+/* Add -DENABLE_WRITE to the KOS_CFLAGS in the Makefile to create the files on
+   the SD card. This is always done on the PC. */
+#if defined(ENABLE_WRITE) || !defined(_arch_dreamcast)
+#define MNT_MODE FAT_MNT_FLAG_RW
+#else
+#define MNT_MODE FAT_MNT_FLAG_RO
+#endif
+
+#define NUM_FILES       1000
+#define WORKING_SET     32
+#define HIT_ROUNDS      2000
+#define MISS_ROUNDS     200
+
+static uint64_t now_us(void) {
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+static uint32_t rand_state = 1;
+
+static uint32_t next_rand(void) {
+    rand_state = rand_state * 1103515245 + 12345;
+    return rand_state >> 8;
+}
+
+/* The names all start differently, so that coming up with their short names
+   doesn't take forever. */
+static void file_name(char *buf, int i, int path) {
+    sprintf(buf, "%s%04d Save Data.dat", path ? "/" : "", i);
+}
+
+static int lookup(fat_fs_t *fs, const char *fn) {
+    fat_dentry_t ent;
+    uint32_t cl, off, lcl, loff;
+
+    return fat_find_dentry(fs, fn, &ent, &cl, &off, &lcl, &loff);
+}
+
+static int make_files(fat_fs_t *fs) {
+    fat_dentry_t root;
+    uint32_t cl, off, lcl, loff;
+    char fn[32];
+    int i, err, made = 0;
+
+    if((err = fat_find_dentry(fs, "/", &root, &cl, &off, &lcl, &loff)) < 0)
+        return err;
+
+    for(i = 0; i < NUM_FILES; ++i) {
+        file_name(fn, i, 1);
+
+        if(!lookup(fs, fn))
+            continue;
+
+        if(MNT_MODE != FAT_MNT_FLAG_RW) {
+            fprintf(stderr, "The test files don't exist. Build with "
+                    "-DENABLE_WRITE to create them.\n");
+            return -1;
+        }
+
+        file_name(fn, i, 0);
+
+        if((err = fat_add_dentry(fs, fn, &root, FAT_ATTR_ARCHIVE, 0, &cl,
+                                 &off, &lcl, &loff)) < 0)
+            return err;
+
+        ++made;
+    }
+
+    if(made) {
+        printf("Created %d files\n", made);
+        fat_fs_sync(fs);
+    }
+
+    return 0;
+}
+
+static int run_round(fat_fs_t *fs, int dcache_sz) {
+    char fn[32];
+    uint64_t start, hit_time, miss_time;
+    int i;
+
+    /* Start over with an empty cache of the requested size. */
+    fat_dcache_shutdown(fs);
+
+    if(fat_dcache_init(fs, dcache_sz)) {
+        fprintf(stderr, "Could not allocate the directory entry cache\n");
+        return -1;
+    }
+
+    /* Look everything in the working sets up once first, so the cache (if
+       there is one) is warmed up. */
+    for(i = 0; i < WORKING_SET; ++i) {
+        file_name(fn, NUM_FILES - 1 - i, 1);
+        lookup(fs, fn);
+        file_name(fn, NUM_FILES + i, 1);
+        lookup(fs, fn);
+    }
+
+    /* Hits: bounce around a working set at the end of the directory. */
+    start = now_us();
+
+    for(i = 0; i < HIT_ROUNDS; ++i) {
+        file_name(fn, NUM_FILES - 1 - next_rand() % WORKING_SET, 1);
+
+        if(lookup(fs, fn)) {
+            fprintf(stderr, "Lookup of %s failed\n", fn);
+            return -1;
+        }
+    }
+
+    hit_time = now_us() - start;
+
+    /* Misses: look for things that aren't there, again and again. */
+    start = now_us();
+
+    for(i = 0; i < MISS_ROUNDS; ++i) {
+        file_name(fn, NUM_FILES + next_rand() % WORKING_SET, 1);
+
+        if(!lookup(fs, fn)) {
+            fprintf(stderr, "Lookup of %s succeeded\n", fn);
+            return -1;
+        }
+    }
+
+    miss_time = now_us() - start;
+
+    printf("%5d entries: existing %7" PRIu32 " ns, missing %7" PRIu32 " ns\n",
+           dcache_sz, (uint32_t)(hit_time * 1000 / HIT_ROUNDS),
+           (uint32_t)(miss_time * 1000 / MISS_ROUNDS));
+
+    return 0;
+}
+
+/* For testing outside of KOS... */
+#ifndef _arch_dreamcast
+static int blockdev_dummy(kos_blockdev_t *d) {
+    (void)d;
+    return 0;
+}
+
+static int blockdev_shutdown(kos_blockdev_t *d) {
+    FILE *fp = (FILE *)d->dev_data;
+
+    fclose(fp);
+    return 0;
+}
+
+static int blockdev_read(kos_blockdev_t *d, uint64_t block, size_t count,
+                         void *buf) {
+    FILE *fp = (FILE *)d->dev_data;
+    ssize_t rv;
+
+    rv = pread(fileno(fp), buf, count << d->l_block_size,
+               (off_t)block << d->l_block_size);
+    return (rv > 0) ? 0 : -1;
+}
+
+static int blockdev_write(kos_blockdev_t *d, uint64_t block, size_t count,
+                          const void *buf) {
+    FILE *fp = (FILE *)d->dev_data;
+    ssize_t rv;
+
+    rv = pwrite(fileno(fp), buf, count << d->l_block_size,
+                (off_t)block << d->l_block_size);
+    return (rv > 0) ? 0 : -1;
+}
+
+static uint32_t blockdev_count(kos_blockdev_t *d) {
+    FILE *fp = (FILE *)d->dev_data;
+    off_t len;
+
+    fseeko(fp, 0, SEEK_END);
+    len = ftello(fp);
+    fseeko(fp, 0, SEEK_SET);
+
+    return (uint32_t)(len >> d->l_block_size);
+}
+
+static kos_blockdev_t the_bd = {
+    NULL,
+    9,
+
+    &blockdev_dummy,
+    &blockdev_shutdown,
+
+    &blockdev_read,
+    &blockdev_write,
+    &blockdev_count
+};
+#endif
+
+int main(int argc, char *argv[]) {
+    static const int sizes[] = { 0, 16, 64, 256 };
+    kos_blockdev_t *dev;
+    fat_fs_t *fs;
+    unsigned int i;
+    int rv;
+
+#ifdef _arch_dreamcast
+    static kos_blockdev_t sd_dev;
+    uint8_t partition_type;
+
+    (void)argc;
+    (void)argv;
+
+    if(sd_init()) {
+        fprintf(stderr, "Could not initialize the SD card.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if(sd_blockdev_for_partition(0, &sd_dev, &partition_type)) {
+        fprintf(stderr, "Could not find the first partition on the SD "
+                "card!\n");
+        sd_shutdown();
+        exit(EXIT_FAILURE);
+    }
+
+    dev = &sd_dev;
+#else
+    FILE *fp;
+
+    if(argc != 2) {
+        fprintf(stderr, "Usage: %s image\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    if(!(fp = fopen(argv[1], "r+b"))) {
+        perror(argv[1]);
+        exit(EXIT_FAILURE);
+    }
+
+    the_bd.dev_data = fp;
+    dev = &the_bd;
+#endif
+
+    printf("libkosfat path lookup benchmark\n");
+
+    if(!(fs = fat_fs_init(dev, MNT_MODE))) {
+        fprintf(stderr, "Could not mount the filesystem\n");
+        rv = -1;
+        goto out;
+    }
+
+    if((rv = make_files(fs)) < 0) {
+        if(rv != -1)
+            fprintf(stderr, "Could not create the test files: %s\n",
+                    strerror(-rv));
+    }
+    else {
+        for(i = 0; i < sizeof(sizes) / sizeof(sizes[0]) && !rv; ++i)
+            rv = run_round(fs, sizes[i]);
+    }
+
+    fat_fs_shutdown(fs);
+
+out:
+#ifdef _arch_dreamcast
+    sd_shutdown();
+#endif
+
+    return rv ? EXIT_FAILURE : EXIT_SUCCESS;
+}
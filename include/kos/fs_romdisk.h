@@ -47,6 +47,14 @@ int fs_romdisk_shutdown(void);
     This function will mount a ROMFS image that has been loaded into memory to
     the specified mountpoint.
 
+    To make opening files fast, a hash index of every file and directory in the
+    image is used for path lookups. If the image was made with genromfs -I, the
+    index stored in the image is used as is. Otherwise, it is built here, which
+    takes one pass over the directory tree and a little bit of memory. If that
+    memory can't be allocated, lookups just scan each directory instead. The
+    stored index file can't be opened, and doesn't show up in directory
+    listings.
+
     \param  mountpoint      The directory to mount this romdisk on
     \param  img             The ROMFS image
     \param  own_buffer      If 0, you are still responsible for img, and must
@@ -352,6 +352,27 @@ typedef struct fs_socket_proto {
                             currently true in the socket. 0 if none are true.
     */
     short (*poll)(net_socket_t *s, short events);
+
+    /** \brief  Receive a batch of messages on a socket created with the
+                protocol.
+
+        This function should implement the ::recvmmsg() function for the
+        protocol. It is optional: if it is NULL, ::recvmmsg() will be built on
+        top of the recvfrom function instead. This is meant for protocols that
+        can do better than that, for instance by only locking the socket once
+        for the whole batch.
+
+        \param  s           The socket to receive data on
+        \param  msgvec      The messages to fill in
+        \param  vlen        The number of elements in msgvec
+        \param  flags       Flags to the function
+        \param  timeout     Maximum time to wait for the first message (NULL
+                            to wait indefinitely)
+        \retval -1          On error (set errno appropriately)
+        \retval n           The number of messages received
+    */
+    int (*recvmmsg)(net_socket_t *s, struct mmsghdr *msgvec, unsigned int vlen,
+                    int flags, struct timespec *timeout);
 } fs_socket_proto_t;
 
 /** \brief  Initializer for the entry field in the fs_socket_proto_t struct. */
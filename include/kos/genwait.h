@@ -43,10 +43,39 @@ __BEGIN_DECLS
     \retval -1              On error or being woken by timeout
 
     \par    Error Conditions:
-    \em     EAGAIN - on timeout
+    \em     EAGAIN - on timeout \n
+    \em     ENOMEM - no room on the timeout queue (room for each thread is set
+                     aside when it is created, so this should only happen if
+                     genwait_init() couldn't allocate the queue)
 */
 int genwait_wait(void * obj, const char * mesg, int timeout, void (*callback)(void *));
 
+/** \brief  Sleep on an object, with a timeout in microseconds.
+
+    This function works exactly like genwait_wait(), except that the timeout is
+    specified in microseconds rather than milliseconds.
+
+    \param  obj             The object to sleep on
+    \param  mesg            A message to show in the status
+    \param  timeout         If not woken before this many microseconds have
+                            passed, wake up anyway (0 for no timeout)
+    \param  callback        If non-NULL, call this function with obj as its
+                            argument if the wait times out (but before the
+                            calling thread has been woken back up)
+    \retval 0               On successfully being woken up (not by timeout)
+    \retval -1              On error or being woken by timeout
+
+    \par    Error Conditions:
+    \em     EAGAIN - on timeout \n
+    \em     ENOMEM - no room on the timeout queue (room for each thread is set
+                     aside when it is created, so this should only happen if
+                     genwait_init() couldn't allocate the queue)
+
+    \sa genwait_wait
+*/
+int genwait_wait_us(void *obj, const char *mesg, uint64 timeout,
+                    void (*callback)(void *));
+
 /* Wake up N threads waiting on the given object. If cnt is <=0, then we
    wake all threads. Returns the number of threads actually woken. */
 /** \brief  Wake up a number of threads sleeping on an object.
@@ -129,7 +158,7 @@ int genwait_wake_thd(void *obj, kthread_t *thd, int err);
     There should be no reason you need to call this function, it is called
     internally by the scheduler for you.
 
-    \param  now             The current system time, in milliseconds since boot
+    \param  now             The current system time, in microseconds since boot
 */
 void genwait_check_timeouts(uint64 now);
 
@@ -139,7 +168,7 @@ void genwait_check_timeouts(uint64 now);
     function is for the internal use of the scheduler, and should not be called
     from user code.
 
-    \return                 The next timeout time in milliseconds since boot, or
+    \return                 The next timeout time in microseconds since boot, or
                             0 if there are no pending genwait_wait() calls
 */
 uint64 genwait_next_timeout(void);
@@ -150,6 +179,11 @@ int genwait_init(void);
 
 /* Shut down the genwait system */
 void genwait_shutdown(void);
+
+/* Make sure there's room on the timeout queue for the given number of threads.
+   This is called whenever a thread is created, so that genwait_wait() never
+   has to allocate anything. */
+int genwait_reserve(size_t count);
 /** \endcond */
 
 
@@ -81,6 +81,7 @@ extern void * __kos_romdisk;
 #define INIT_NET            0x0004  /**< \brief Enable built-in networking */
 #define INIT_MALLOCSTATS    0x0008  /**< \brief Enable malloc statistics */
 #define INIT_QUIET          0x0010  /**< \brief Disable dbgio */
+#define INIT_THD_TICKLESS   0x0020  /**< \brief Skip timer ticks when idle */
 /** @} */
 
 __END_DECLS
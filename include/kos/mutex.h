@@ -44,6 +44,13 @@
     There is a fourth type of mutex defined (MUTEX_TYPE_DEFAULT), which maps to
     the MUTEX_TYPE_NORMAL type. This is simply for alignment with POSIX.
 
+    Any type of mutex can also be set up to use priority inheritance
+    (or a priority ceiling) with mutex_set_protocol(). With priority
+    inheritance, a thread holding the mutex runs at the priority of the most
+    important thread waiting for it until it unlocks the mutex, so that a high
+    priority thread can't be held up indefinitely by medium priority threads
+    starving a low priority lock holder.
+
     \author Lawrence Sebald
     \see    kos/sem.h
 */
@@ -69,6 +76,7 @@ typedef struct kos_mutex {
     int dynamic;
     kthread_t *holder;
     int count;
+    kthread_pi_t pi;
 } mutex_t;
 
 /** \defgroup mutex_types               Mutex types
@@ -127,6 +135,33 @@ mutex_t *mutex_create(void) __depr("Use mutex_init or an initializer.");
 */
 int mutex_init(mutex_t *m, int mtype);
 
+/** \brief  Set the priority protocol of a mutex.
+
+    This function sets up a mutex to use priority inheritance or a priority
+    ceiling. With THD_PI_INHERIT, the thread holding the mutex has its priority
+    raised to that of the highest priority thread waiting for the mutex. With
+    THD_PI_CEILING, the thread holding the mutex always runs at (at least) the
+    ceiling priority. Either way, the thread goes back to its own priority once
+    it unlocks the mutex, and the mutex is handed over directly to the highest
+    priority waiter.
+
+    This should be called right after the mutex is initialized, before any
+    thread tries to lock it.
+
+    \param  m               The mutex to set up
+    \param  protocol        The protocol to use (see \ref thd_pi_protocols)
+    \param  ceiling         The priority ceiling, for THD_PI_CEILING
+
+    \retval 0               On success
+    \retval -1              On error, errno will be set as appropriate
+
+    \par    Error Conditions:
+    \em     EINVAL - the mutex has not been initialized properly \n
+    \em     EINVAL - an invalid protocol or ceiling was specified \n
+    \em     EBUSY - the mutex is currently locked
+*/
+int mutex_set_protocol(mutex_t *m, int protocol, prio_t ceiling);
+
 /** \brief  Destroy a mutex.
 
     This function destroys a mutex, releasing any memory that may have been
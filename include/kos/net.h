@@ -27,10 +27,33 @@ __BEGIN_DECLS
 
 #include <arch/types.h>
 #include <sys/queue.h>
+#include <sys/uio.h>
 #include <netinet/in.h>
 
 /* All functions in this header return < 0 on failure, and 0 on success. */
 
+/** \brief  Most pieces that one packet can be given to a driver in. */
+#define NETIF_TX_MAX_IOV    4
+
+/** \brief Structure describing one packet to be transmitted.
+
+    Packets are handed to drivers as a list of pieces, generally the headers
+    followed by the data, so that the network stack never has to copy them all
+    into one place. The driver puts them together as it copies the packet out
+    to the hardware.
+
+    \headerfile kos/net.h
+*/
+typedef struct netif_txpkt {
+    /** \brief  The pieces of the packet, in order */
+    const struct iovec  *iov;
+
+    /** \brief  Number of pieces (no more than NETIF_TX_MAX_IOV) */
+    int                 iovcnt;
+
+    /** \brief  Total length of the packet, in bytes */
+    int                 len;
+} netif_txpkt_t;
 
 
 /** \brief Structure describing one usable network device.
@@ -171,6 +194,30 @@ typedef struct knetif {
         \param  count       The number of addresses in list.
     */
     int (*if_set_mc)(struct knetif *self, const uint8 *list, int count);
+
+    /** \brief  Queue a batch of packets for transmission.
+
+        This is optional, and is only worth having if the driver can do
+        something with a whole batch that it couldn't with one packet at a
+        time (or can put the pieces of a packet together more cheaply than
+        the stack can). If it is NULL, each packet is put together and sent
+        with if_tx() instead. The packets only have to stay around until this
+        returns. Use net_tx_batch() rather than calling this directly.
+
+        \param  self        The network device in question.
+        \param  pkts        The packets to transmit.
+        \param  count       The number of packets.
+        \param  blocking    1 if we should block if needed, 0 otherwise.
+        \return             The number of packets queued (which may be less
+                            than count if not blocking), or NETIF_TX_ERROR or
+                            NETIF_TX_AGAIN if none could be.
+    */
+    int (*if_tx_batch)(struct knetif *self, const netif_txpkt_t *pkts,
+                       int count, int blocking);
+
+    /** \brief  The packet buffer currently being processed by
+                net_input_pbuf() (for internal use only). */
+    struct net_pbuf     *rx_pbuf;
 } netif_t;
 
 /** \defgroup net_flags Flags for netif_t
@@ -268,8 +315,9 @@ int net_arp_insert(netif_t *nif, const uint8 mac[6], const uint8 ip[4],
 /** \brief  Look up an entry from the ARP cache.
 
     If no entry is found, then an ARP query will be sent and an error will be
-    returned. If you specify a packet with the call, it will be sent when the
-    reply comes in.
+    returned. If you specify a packet with the call, it will be queued up and
+    sent when the reply comes in. A few packets can be queued up for each
+    address, after which the oldest ones are dropped.
 
     \param  nif             The network device in use.
     \param  ip_in           The IP address to lookup.
@@ -279,8 +327,10 @@ int net_arp_insert(netif_t *nif, const uint8 mac[6], const uint8 ip[4],
     \param  data            Packet data to go with the header.
     \param  data_size       The size of data.
     \retval 0               On success.
-    \retval -1              A query is outstanding for that address.
-    \retval -2              Address not found, query generated.
+    \retval -1              A query is outstanding for that address, and the
+                            packet (if any) could not be queued.
+    \retval -2              Address not found, query generated or packet
+                            queued.
     \retval -3              Error allocating memory.
 */
 int net_arp_lookup(netif_t *nif, const uint8 ip_in[4], uint8 mac_out[6],
@@ -347,6 +397,156 @@ int net_input(netif_t *device, const uint8 *data, int len);
 */
 net_input_func net_input_set_target(net_input_func t);
 
+/** \brief  Submit a received packet that is in a packet buffer.
+
+    This works like net_input(), except that the packet is in a buffer from the
+    packet buffer pool. Protocols that queue up the data that they receive (like
+    UDP) can take the buffer over with net_pbuf_claim() instead of copying the
+    data out of it. Whatever happens, the buffer belongs to the network stack
+    after this is called, so the driver should not touch it again.
+
+    \param  device          The network device submitting packets.
+    \param  pb              The packet buffer (data and len must be set).
+    \return                 0 on success, <0 on failure.
+*/
+int net_input_pbuf(netif_t *device, struct net_pbuf *pb);
+
+/***** net_output.c *******************************************************/
+
+/** \brief  Transmit a batch of packets on a network device.
+
+    This hands the packets to the driver's if_tx_batch() function if it has
+    one. Otherwise, each packet is put together in one buffer (unless it is
+    already in one piece) and sent with if_tx(). Either way, if_tx_commit() is
+    called afterwards.
+
+    \param  nif             The network device to send on.
+    \param  pkts            The packets to send.
+    \param  count           The number of packets.
+    \param  blocking        NETIF_BLOCK if it is ok to block, NETIF_NOBLOCK
+                            otherwise.
+    \return                 The number of packets sent (which may be less
+                            than count if not blocking), or NETIF_TX_ERROR or
+                            NETIF_TX_AGAIN if none were.
+*/
+int net_tx_batch(netif_t *nif, const netif_txpkt_t *pkts, int count,
+                 int blocking);
+
+/***** net_pbuf.c *********************************************************/
+
+/** \brief  Size of the data area of each packet buffer, in bytes.
+
+    This is big enough for a full-sized Ethernet frame, with some slack so that
+    DMA transfers can be rounded out to 32 bytes.
+*/
+#define NET_PBUF_SIZE       1600
+
+/** \brief  Number of packet buffers in the pool.
+
+    The whole pool is allocated when the network is brought up, and is never
+    given back. Each buffer takes 1664 bytes (NET_PBUF_SIZE, plus the fields in
+    front of it, rounded out to 32 bytes), so the pool costs a fixed 104KiB
+    (about 106KB) of RAM.
+*/
+#define NET_PBUF_COUNT      64
+
+/** \brief  Packet buffer.
+
+    Packet buffers are preallocated, fixed-size buffers for received packets.
+    They are handed out by net_pbuf_alloc() and can be allocated and freed in
+    interrupts. A network driver can receive a frame straight into one and pass
+    it up with net_input_pbuf(), after which the stack can keep it queued up
+    (for instance, on a socket) until the data has been read, without copying
+    the frame or going to the heap. Buffers handed out by net_pbuf_claim() may
+    come from the heap instead, but they are freed the same way.
+
+    \headerfile kos/net.h
+*/
+typedef struct net_pbuf {
+    /** \brief  Queue handle, for use by whoever owns the buffer. */
+    TAILQ_ENTRY(net_pbuf)   pb_queue;
+
+    /** \brief  Start of the data in the buffer. */
+    uint8                   *data;
+
+    /** \brief  Length of the data in the buffer. */
+    size_t                  len;
+
+    /** \brief  Scratch space, for use by whoever owns the buffer. */
+    uint32                  priv[8];
+
+    /** \brief  The buffer itself. */
+    uint8                   buf[NET_PBUF_SIZE] __attribute__((aligned(32)));
+} net_pbuf_t;
+
+/** \brief  Queue of packet buffers. */
+TAILQ_HEAD(net_pbuf_queue, net_pbuf);
+
+/* \cond */
+int net_pbuf_init(void);
+/* \endcond */
+
+/** \brief  Grab a buffer from the packet buffer pool.
+
+    This function is safe to call in an interrupt.
+
+    \return                 A buffer (with data pointing at the start of the
+                            buffer and len set to 0), or NULL if the pool is
+                            empty.
+*/
+net_pbuf_t *net_pbuf_alloc(void);
+
+/** \brief  Return a buffer to the packet buffer pool.
+
+    This function is safe to call in an interrupt, as long as the buffer came
+    from net_pbuf_alloc() (one from net_pbuf_claim() might have to go back to
+    the heap).
+
+    \param  pb              The buffer to free (may be NULL).
+*/
+void net_pbuf_free(net_pbuf_t *pb);
+
+/** \brief  Take over the buffer that some received data is in.
+
+    This is meant to be called by protocols from their input functions, to get
+    a packet buffer holding a piece of the packet being processed that they can
+    keep around. If the data is in the buffer that was passed to
+    net_input_pbuf(), that buffer is handed over as is (with data and len
+    adjusted to cover the given range). Otherwise, a new buffer is allocated and
+    the data is copied into it. If the data is bigger than NET_PBUF_SIZE (as
+    with a datagram that was put back together from fragments), or the pool is
+    empty, that buffer comes from the heap instead.
+
+    \param  nif             The network device the packet came in on.
+    \param  data            The data to keep.
+    \param  len             The length of the data.
+    \return                 A buffer holding the data, or NULL if there's no
+                            memory left for one (or the heap can't be used
+                            from the interrupt this was called in).
+*/
+net_pbuf_t *net_pbuf_claim(netif_t *nif, const uint8 *data, size_t len);
+
+/** \brief  Copy some received data into a buffer from the heap.
+
+    This is like net_pbuf_claim(), but never takes a buffer from the pool, for
+    protocols that have already got as many of those as they should be holding.
+
+    \param  data            The data to keep.
+    \param  len             The length of the data.
+    \return                 A buffer holding the data, or NULL if there's no
+                            memory left for one (or the heap can't be used
+                            from the interrupt this was called in).
+*/
+net_pbuf_t *net_pbuf_copy(const uint8 *data, size_t len);
+
+/** \brief  Is a buffer one from the pool?
+
+    \param  pb              The buffer to check.
+    \return                 Nonzero if the buffer is from the pool, 0 if it
+                            came from the heap.
+*/
+int net_pbuf_pooled(const net_pbuf_t *pb);
+
 /***** net_icmp.c *********************************************************/
 
 /** \brief  ICMPv4 echo reply callback type.
@@ -563,6 +763,63 @@ typedef struct net_ipv6_stats {
 */
 net_ipv6_stats_t net_ipv6_get_stats(void);
 
+/***** net_frag.c *********************************************************/
+
+/** \brief  Fragment reassembly statistics structure.
+
+    This structure holds some statistics about the reassembly of fragmented
+    IPv4 and IPv6 datagrams, and can be retrieved with the appropriate
+    function.
+
+    \headerfile kos/net.h
+*/
+typedef struct net_frag_stats {
+    uint32  frags_recv;             /**< \brief Fragments received */
+    uint32  frags_dropped;          /**< \brief Fragments thrown away */
+    uint32  dgrams_ok;              /**< \brief Datagrams put back together */
+    uint32  dgrams_timeout;         /**< \brief Datagrams that timed out */
+    uint32  dgrams_evicted;         /**< \brief Datagrams dropped for memory */
+    uint32  dgrams_bad;             /**< \brief Datagrams with bad fragments */
+    uint32  dgrams_pending;         /**< \brief Datagrams being reassembled */
+    uint32  mem_used;               /**< \brief Bytes held by fragments */
+    uint32  mem_peak;               /**< \brief Most bytes ever held */
+} net_frag_stats_t;
+
+/** \brief  Retrieve statistics from fragment reassembly.
+    \return                 The fragment reassembly stats structure.
+*/
+net_frag_stats_t net_frag_get_stats(void);
+
+/***** net_neigh.c ********************************************************/
+
+/** \brief  Neighbor table statistics structure.
+
+    This structure holds some statistics about the neighbor table, which holds
+    the link-layer addresses found with ARP and NDP. It can be retrieved with
+    the appropriate function.
+
+    \headerfile kos/net.h
+*/
+typedef struct net_neigh_stats {
+    uint32  entries;                /**< \brief Entries in the table */
+    uint32  lookups;                /**< \brief Lookups done */
+    uint32  misses;                 /**< \brief Lookups that found nothing */
+    uint32  queries;                /**< \brief ARP/NDP queries sent */
+    uint32  resolved;               /**< \brief Addresses that were found */
+    uint32  unresolved;             /**< \brief Addresses that were given up on */
+    uint32  expired;                /**< \brief Entries that timed out */
+    uint32  table_full;             /**< \brief Entries not made (table full) */
+    uint32  pkt_pending;            /**< \brief Packets waiting on an address */
+    uint32  pkt_queued;             /**< \brief Packets queued up to wait */
+    uint32  pkt_sent;               /**< \brief Queued packets sent */
+    uint32  pkt_dropped;            /**< \brief Packets dropped while waiting */
+} net_neigh_stats_t;
+
+/** \brief  Retrieve statistics from the neighbor table.
+    \return                 The neighbor table stats structure.
+*/
+net_neigh_stats_t net_neigh_get_stats(void);
+
 /***** net_ndp.c **********************************************************/
 
 /** \brief  Init NDP.
@@ -574,7 +831,8 @@ int net_ndp_init(void);
 void net_ndp_shutdown(void);
 
 /** \brief  Garbage collect timed out NDP entries.
-    This will be called periodically as NDP queries come in.
+    Entries are aged automatically by the network thread, so there's usually
+    no need to call this.
 */
 void net_ndp_gc(void);
 
@@ -591,8 +849,8 @@ int net_ndp_insert(netif_t *nif, const uint8 mac[6], const struct in6_addr *ip,
 /** \brief  Look up an entry from the NDP cache.
 
     If no entry is found, then an NDP query will be sent and an error will be
-    returned. If you specify a packet with the call, it will be sent when the
-    reply comes in.
+    returned. If you specify a packet with the call, it will be queued up and
+    sent when the reply comes in.
 
     \param  net             The network device to use.
     \param  ip              The IPv6 address to query.
@@ -622,6 +880,8 @@ typedef struct net_udp_stats {
     uint32  pkt_recv_bad_size;      /**< \brief Packets of a bad size */
     uint32  pkt_recv_bad_chksum;    /**< \brief Packets with a bad checksum */
     uint32  pkt_recv_no_sock;       /**< \brief Packets with to a closed port */
+    uint32  pkt_recv_no_buf;        /**< \brief Packets dropped for lack of
+                                                 buffer space */
 } net_udp_stats_t;
 
 /** \brief  Retrieve statistics from the UDP layer.
@@ -671,8 +931,6 @@ uint32 net_crc32be(const uint8 *data, int size);
                             previous calculation) or some initial seed value
                             (typically 0xFFFF or 0x0000).
     \return                 The calculated CRC16-CCITT.
-    \note                   Based on code found online at
-                            http://www.ccsinfo.com/forum/viewtopic.php?t=24977
 */
 uint16 net_crc16ccitt(const uint8 *data, int size, uint16 start);
 
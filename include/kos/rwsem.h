@@ -51,6 +51,9 @@ typedef struct rw_semaphore {
 
     /** \brief  Space for one reader who's trying to upgrade to a writer. */
     kthread_t *reader_waiting;
+
+    /** \brief  Priority inheritance state for the write lock. */
+    kthread_pi_t pi;
 } rw_semaphore_t;
 
 /** \brief  Initializer for a transient reader/writer semaphore */
@@ -80,6 +83,30 @@ rw_semaphore_t *rwsem_create(void) __depr("Use rwsem_init or RWSEM_INITIALIZER."
 */
 int rwsem_init(rw_semaphore_t *s);
 
+/** \brief  Set the priority protocol of a reader/writer semaphore.
+
+    This function sets up the write side of a reader/writer semaphore to use
+    priority inheritance or a priority ceiling. While a writer holds the lock,
+    it is boosted to the priority of the highest priority writer waiting for it
+    (with THD_PI_INHERIT) or to the ceiling (with THD_PI_CEILING), and goes back
+    to its own priority once it unlocks. Readers are not tracked, so they are
+    never boosted.
+
+    This should be called right after the semaphore is initialized, before any
+    thread tries to lock it.
+
+    \param  s       The r/w semaphore to set up.
+    \param  protocol The protocol to use (see \ref thd_pi_protocols).
+    \param  ceiling The priority ceiling, for THD_PI_CEILING.
+    \retval 0       On success.
+    \retval -1      On error, errno will be set as appropriate.
+
+    \par    Error Conditions:
+    \em     EINVAL - an invalid protocol or ceiling was specified \n
+    \em     EBUSY - the semaphore is currently locked
+*/
+int rwsem_set_protocol(rw_semaphore_t *s, int protocol, prio_t ceiling);
+
 /** \brief  Destroy a reader/writer semaphore.
 
     This function cleans up a reader/writer semaphore. It is an error to attempt
@@ -0,0 +1,149 @@
+/* KallistiOS ##version##
+
+   include/kos/sched_trace.h
+   Copyright (C) 2026 The KOS Team and contributors
+
+*/
+
+/** \file    kos/sched_trace.h
+    \brief   Scheduler event tracing.
+    \ingroup threads
+
+    This file contains an optional trace facility for the scheduler and the
+    genwait system. When tracing is started, a fixed-size ring buffer is
+    allocated and every context switch, genwait sleep, wakeup and timeout is
+    recorded into it as a small binary record. Once the ring fills up, the
+    oldest records are overwritten. The ring can then be dumped as text with
+    any printf-like function (such as dbgio_printf) or saved raw to a file for
+    offline analysis.
+
+    Events are recorded from inside the scheduler with interrupts disabled, so
+    recording never takes any locks. When tracing is stopped, the only cost is
+    a single flag check at each trace point.
+
+    \author The KOS Team and contributors
+
+    \see    kos/thread.h
+*/
+
+#ifndef __KOS_SCHED_TRACE_H
+#define __KOS_SCHED_TRACE_H
+
+#include <sys/cdefs.h>
+__BEGIN_DECLS
+
+#include <stdint.h>
+#include <kos/thread.h>
+
+/** \defgroup sched_trace_types     Scheduler trace event types
+    \ingroup  threads
+
+    These are the values that can appear in the type field of a
+    sched_trace_evt_t.
+
+    @{
+*/
+#define SCHED_TRACE_SWITCH_PREEMPT  1   /**< \brief Preempted (arg: next tid) */
+#define SCHED_TRACE_SWITCH_YIELD    2   /**< \brief Yielded (arg: next tid) */
+#define SCHED_TRACE_WAIT            3   /**< \brief Genwait sleep (arg: obj) */
+#define SCHED_TRACE_WAKE            4   /**< \brief Genwait wakeup (arg: obj) */
+#define SCHED_TRACE_TIMEOUT         5   /**< \brief Genwait timeout (arg: obj) */
+#define SCHED_TRACE_CREATE          6   /**< \brief Thread created */
+#define SCHED_TRACE_EXIT            7   /**< \brief Thread exited */
+/** @} */
+
+/** \brief   A single scheduler trace record.
+    \ingroup threads
+
+    This is the binary format of each event in the trace ring, and the format
+    that sched_trace_save() writes out to a file (in the native byte order).
+
+    \headerfile kos/sched_trace.h
+*/
+typedef struct sched_trace_evt {
+    uint32_t time;      /**< \brief Low 32 bits of the time, in microseconds */
+    uint16_t type;      /**< \brief Event type (see \ref sched_trace_types) */
+    uint16_t prio;      /**< \brief Priority of the thread */
+    tid_t    tid;       /**< \brief Thread the event applies to */
+    uint32_t arg;       /**< \brief Event-specific argument */
+} sched_trace_evt_t;
+
+/** \cond */
+extern int __sched_trace_on;
+void __sched_trace_record(int type, kthread_t *thd, uint32_t arg);
+/** \endcond */
+
+/** \brief   Record a scheduler trace event.
+    \ingroup threads
+
+    This is used internally by the scheduler. It must be called with
+    interrupts disabled.
+
+    \param  type            The type of event.
+    \param  thd             The thread that the event applies to.
+    \param  arg             The event-specific argument.
+*/
+static inline void sched_trace(int type, kthread_t *thd, uint32_t arg) {
+    if(__sched_trace_on)
+        __sched_trace_record(type, thd, arg);
+}
+
+/** \brief   Start recording scheduler events.
+    \ingroup threads
+
+    This function allocates a ring buffer for the given number of events and
+    starts recording into it. If tracing is already running, the old ring is
+    thrown away.
+
+    \param  count           The number of events to keep. This is rounded up
+                            to a power of two.
+
+    \retval 0               On success.
+    \retval -1              If the ring couldn't be allocated.
+*/
+int sched_trace_start(size_t count);
+
+/** \brief   Stop recording scheduler events.
+    \ingroup threads
+
+    This function stops recording, but keeps the ring around so that it can
+    still be dumped or saved. The ring is freed by the next call to
+    sched_trace_start() or by sched_trace_free().
+*/
+void sched_trace_stop(void);
+
+/** \brief   Free the scheduler trace ring.
+    \ingroup threads
+
+    This function stops tracing (if it is running) and frees the ring.
+*/
+void sched_trace_free(void);
+
+/** \brief   Print out the recorded scheduler events.
+    \ingroup threads
+
+    This function prints out all events in the ring, oldest first, using the
+    given print function.
+
+    \param  pf              The printf-like function to print with.
+
+    \retval 0               On success.
+    \retval -1              If there is no trace ring.
+*/
+int sched_trace_dump(int (*pf)(const char *fmt, ...));
+
+/** \brief   Save the recorded scheduler events to a file.
+    \ingroup threads
+
+    This function writes all events in the ring, oldest first, to the given
+    file as an array of sched_trace_evt_t.
+
+    \param  fn              The file to write to.
+
+    \return                 The number of events written, or -1 on error.
+*/
+int sched_trace_save(const char *fn);
+
+__END_DECLS
+
+#endif  /* __KOS_SCHED_TRACE_H */
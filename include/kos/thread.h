@@ -101,9 +101,12 @@ __BEGIN_DECLS
 /* Pre-define list/queue types */
 struct kthread;
 
+struct kthread_pi;
+
 /* \cond */
 TAILQ_HEAD(ktqueue, kthread);
 LIST_HEAD(ktlist, kthread);
+LIST_HEAD(kthread_pi_list, kthread_pi);
 /* \endcond */
 
 /** \brief   Control Block Header
@@ -118,6 +121,80 @@ typedef struct tcbhead {
     uintptr_t pointer_guard; /**< \brief Pointer guard (unused) */
 } tcbhead_t;
 
+/** \brief   Per-thread scheduling statistics.
+    \ingroup threads
+
+    These counters are kept up to date by the scheduler for every thread. All
+    times are in microseconds.
+
+    \headerfile kos/thread.h
+*/
+typedef struct kthread_stats {
+    /** \brief  Total time spent running (not counting the current slice). */
+    uint64_t run_time;
+
+    /** \brief  When the thread was last switched in. */
+    uint64_t last_start;
+
+    /** \brief  When the thread last went to sleep on a genwait object. */
+    uint64_t wait_start;
+
+    /** \brief  Longest time from a genwait sleep until running again. */
+    uint64_t max_wait;
+
+    /** \brief  Number of times the thread has been switched in. */
+    uint32_t switches;
+
+    /** \brief  Number of times the thread blocked or yielded. */
+    uint32_t voluntary;
+
+    /** \brief  Number of times the thread was preempted. */
+    uint32_t preempted;
+} kthread_stats_t;
+
+/** \defgroup thd_pi_protocols    Lock priority protocols
+    \ingroup  threads
+
+    These are the values that can be used for the protocol of a lock that
+    supports priority inheritance (such as a mutex_t or a rw_semaphore_t).
+
+    @{
+*/
+#define THD_PI_NONE         0   /**< \brief No priority boosting (default) */
+#define THD_PI_INHERIT      1   /**< \brief Holder inherits waiters' priority */
+#define THD_PI_CEILING      2   /**< \brief Holder runs at the lock's ceiling */
+/** @} */
+
+/** \brief   Priority inheritance state of a lock.
+    \ingroup threads
+
+    This structure is embedded in each lock that supports priority inheritance
+    or priority ceilings. It keeps track of the thread that owns the lock and
+    the threads that are blocked waiting for it, so that the owner can be run at
+    the priority of the most important waiter until it releases the lock.
+
+    All members of this structure should be considered to be private. It is
+    only ever touched by the scheduler with interrupts disabled.
+
+    \headerfile kos/thread.h
+*/
+typedef struct kthread_pi {
+    /** \brief  List handle for the owner's list of held locks. */
+    LIST_ENTRY(kthread_pi) held;
+
+    /** \brief  Threads blocked waiting for the lock. */
+    struct ktlist waiters;
+
+    /** \brief  The thread that owns the lock, if any. */
+    struct kthread *owner;
+
+    /** \brief  Protocol in use (see \ref thd_pi_protocols). */
+    int protocol;
+
+    /** \brief  Priority ceiling, for THD_PI_CEILING. */
+    prio_t ceiling;
+} kthread_pi_t;
+
 /** \brief   Structure describing one running thread.
     \ingroup threads
 
@@ -131,16 +208,28 @@ typedef struct kthread {
     /** \brief  Thread list handle. Not a function. */
     LIST_ENTRY(kthread) t_list;
 
+    /** \brief  Thread ID hash handle. Not a function either. */
+    LIST_ENTRY(kthread) t_hash;
+
+    /** \brief  Thread pointer hash handle. Still not a function. */
+    LIST_ENTRY(kthread) t_phash;
+
     /** \brief  Run/Wait queue handle. Once again, not a function. */
     TAILQ_ENTRY(kthread) thdq;
 
-    /** \brief  Timer queue handle (if applicable). Also not a function. */
-    TAILQ_ENTRY(kthread) timerq;
+    /** \brief  Timer queue heap index (if applicable). */
+    int timer_idx;
+
+    /** \brief  Order the thread went onto the timer queue in (to break ties
+                between equal timeouts). */
+    uint32 timer_seq;
 
     /** \brief  Kernel thread id. */
     tid_t tid;
 
-    /** \brief  Static priority: 0..PRIO_MAX (higher means lower priority). */
+    /** \brief  Effective priority: 0..PRIO_MAX (higher means lower priority).
+        This is the same as base_prio unless the thread has been boosted by a
+        lock it holds. */
     prio_t prio;
 
     /** \brief  Thread flags.
@@ -170,8 +259,8 @@ typedef struct kthread {
 
     /** \brief  Next scheduled time.
         This value is used for sleep and timed block operations. This value is
-        in milliseconds since the start of timer_ms_gettime(). This should be
-        enough for something like 2 million years of wait time. ;) */
+        in microseconds since the start of timer_us_gettime64(). This should be
+        enough for something like 500 thousand years of wait time. ;) */
     uint64_t wait_timeout;
 
     /** \brief  Thread label.
@@ -197,9 +286,16 @@ typedef struct kthread {
     /** \brief  Our reent struct for newlib. */
     struct _reent thd_reent;
 
-    /** \brief  OS-level thread-local storage.
+    /** \brief  OS-level thread-local storage, for the first keys.
         \see    kos/tls.h   */
-    struct kthread_tls_kv_list tls_list;
+    void *tls_slots[KTHREAD_TLS_SLOTS];
+
+    /** \brief  OS-level thread-local storage overflow table.
+        \see    kos/tls.h   */
+    void **tls_ext;
+
+    /** \brief  Number of entries in the overflow table. */
+    int tls_ext_size;
 
     /** \brief Compiler-level thread-local storage. */
     tcbhead_t* tcbhead;
@@ -207,6 +303,22 @@ typedef struct kthread {
     /** \brief  Return value of the thread function.
         This is only used in joinable threads.  */
     void *rv;
+
+    /** \brief  Scheduling statistics.
+        \see    thd_pslist_stats */
+    kthread_stats_t stats;
+
+    /** \brief  Priority set by the user, before any boosting. */
+    prio_t base_prio;
+
+    /** \brief  Priority inheritance locks held by this thread. */
+    struct kthread_pi_list pi_held;
+
+    /** \brief  Priority inheritance lock this thread is blocked on. */
+    kthread_pi_t *pi_wait;
+
+    /** \brief  List handle for the waiters of pi_wait. */
+    LIST_ENTRY(kthread) pi_wlist;
 } kthread_t;
 
 /** \defgroup thd_flags             Thread flag values
@@ -445,7 +557,8 @@ void thd_exit(void *rv) __noreturn;
     comments in kernel/thread/thread.c for more info, especially if you need to
     guarantee low latencies. This function just updates irq_srt_addr and
     thd_current. Set 'now' to non-zero if you want to use a particular system
-    time for checking timeouts.
+    time (in microseconds, as returned by timer_us_gettime64()) for checking
+    timeouts.
 
     \param  front_of_line   Set to 0, unless you have a good reason not to.
     \param  now             Set to 0, unless you have a good reason not to.
@@ -485,13 +598,42 @@ void thd_pass(void);
 */
 void thd_sleep(int ms);
 
+/** \brief   Sleep for a given number of microseconds.
+    \ingroup threads
+
+    This function works just like thd_sleep(), but with microsecond resolution.
+    The primary timer is programmed for the exact wakeup time, so short sleeps
+    don't have to wait for the next timeslice tick.
+
+    \param  us              The number of microseconds to sleep.
+
+    \sa thd_sleep
+*/
+void thd_sleep_us(uint64_t us);
+
+/** \brief   Enable or disable tickless idle mode.
+    \ingroup threads
+
+    Normally the scheduler's timer fires HZ times per second, even when there
+    is nothing to do. In tickless mode, the periodic tick is skipped while the
+    idle thread is the only runnable thread, and the timer is only programmed
+    for the next timed wakeup. This can also be enabled at startup with the
+    INIT_THD_TICKLESS init flag.
+
+    \param  enable          Non-zero to enable tickless idle, 0 to disable.
+
+    \return                 The previous setting.
+*/
+int thd_set_tickless(int enable);
+
 /** \brief       Set a thread's priority value.
     \ingroup     threads
     \relatesalso kthread_t
 
     This function is used to change the priority value of a thread. If the
     thread is scheduled already, it will be rescheduled with the new priority
-    value.
+    value. If the thread currently holds any priority inheritance locks, it
+    will keep running at the boosted priority until it releases them.
 
     \param  thd             The thread to change the priority of.
     \param  prio            The priority value to assign to the thread.
@@ -502,6 +644,64 @@ void thd_sleep(int ms);
 */
 int thd_set_prio(kthread_t *thd, prio_t prio);
 
+/** \brief   Mark a priority inheritance lock as owned by a thread.
+    \ingroup threads
+
+    This is used internally by the locking primitives, and must be called with
+    interrupts disabled. The owner is boosted to the lock's ceiling, if it has
+    one.
+
+    \param  pi              The lock's priority inheritance state.
+    \param  thd             The new owner of the lock.
+*/
+void thd_pi_acquire(kthread_pi_t *pi, kthread_t *thd);
+
+/** \brief   Mark a priority inheritance lock as no longer owned.
+    \ingroup threads
+
+    This is used internally by the locking primitives, and must be called with
+    interrupts disabled. Any boost that the owner got from this lock is undone.
+
+    \param  pi              The lock's priority inheritance state.
+*/
+void thd_pi_release(kthread_pi_t *pi);
+
+/** \brief   Record that a thread is about to block on a lock.
+    \ingroup threads
+
+    This is used internally by the locking primitives, and must be called with
+    interrupts disabled right before going to sleep on the lock. If the lock
+    uses THD_PI_INHERIT, its owner (and whoever that thread is blocked on, and
+    so on) is boosted to the priority of the blocking thread.
+
+    \param  pi              The lock's priority inheritance state.
+    \param  thd             The thread that is about to block.
+*/
+void thd_pi_block(kthread_pi_t *pi, kthread_t *thd);
+
+/** \brief   Record that a thread is no longer blocked on a lock.
+    \ingroup threads
+
+    This is used internally by the locking primitives, and must be called with
+    interrupts disabled. This undoes thd_pi_block(), whether the thread got the
+    lock or gave up waiting for it.
+
+    \param  thd             The thread that was blocked.
+*/
+void thd_pi_unblock(kthread_t *thd);
+
+/** \brief   Find the most important thread waiting on a lock.
+    \ingroup threads
+
+    This must be called with interrupts disabled.
+
+    \param  pi              The lock's priority inheritance state.
+
+    \return                 The highest priority waiter, or NULL if there are
+                            no waiters.
+*/
+kthread_t *thd_pi_best_waiter(kthread_pi_t *pi);
+
 /** \brief       Retrieve the current thread's kthread struct.
     \ingroup     threads
     \relatesalso kthread_t
@@ -699,6 +899,20 @@ int thd_pslist(int (*pf)(const char *fmt, ...));
 */
 int thd_pslist_queue(int (*pf)(const char *fmt, ...));
 
+/** \brief   Print scheduling statistics for all threads.
+    \ingroup threads
+
+    This function prints out the run time, context switch counts and longest
+    genwait latency of every thread using the given print function.
+
+    \param  pf              The printf-like function to print with.
+
+    \retval 0               On success.
+
+    \sa thd_pslist, kthread_stats_t
+*/
+int thd_pslist_stats(int (*pf)(const char *fmt, ...));
+
 /** \brief   Initialize the threading system.
     \ingroup threads
 
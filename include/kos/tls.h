@@ -26,32 +26,15 @@ __BEGIN_DECLS
 /** \brief  Thread-local storage key type. */
 typedef int kthread_key_t;
 
-/** \brief  Thread-local storage key-value pair.
+/** \brief  Number of TLS keys stored directly in each thread.
 
-    This is the structure that is actually used to store the specific value for
-    a thread for a single TLS key.
-
-    You will not end up using these directly at all in programs, as they are
-    only used internally.
+    The values for the first KTHREAD_TLS_SLOTS keys are kept in an array inside
+    each thread's kthread_t. Values for any keys past that go into a per-thread
+    overflow table that is grown as needed. Either way, looking up a value is
+    just an array access. Keys are reused once deleted, so most programs will
+    never need the overflow table at all.
 */
-typedef struct kthread_tls_kv {
-    /** \brief  List handle -- NOT a function. */
-    LIST_ENTRY(kthread_tls_kv) kv_list;
-
-    /** \brief  The key associated with this data. */
-    kthread_key_t key;
-
-    /** \brief  The value of the data. */
-    void *data;
-
-    /** \brief  Optional destructor for the value (set per key). */
-    void (*destructor)(void *);
-} kthread_tls_kv_t;
-
-/** \cond */
-/* TLS Key-Value pair list type. */
-LIST_HEAD(kthread_tls_kv_list, kthread_tls_kv);
-/** \endcond */
+#define KTHREAD_TLS_SLOTS   16
 
 /** \cond */
 /* Retrieve the next key value (i.e, what key the next kthread_key_create will
@@ -109,18 +92,34 @@ int kthread_setspecific(kthread_key_t key, const void *value);
     This function deletes a TLS key, removing all threads' values for the given
     key. This function <em>does not</em> cause any destructors to be called.
 
+    The key may be handed out again by a later call to kthread_key_create().
+
     \param  key     The key to delete.
-    \retval -1      On failure, and sets errno to one of the following: EINVAL
-                    if the key is invalid, EPERM if unsafe to call free.
+    \retval -1      On failure, and sets errno to EINVAL if the key is invalid
+                    or has already been deleted.
     \retval 0       On success.
 */
 int kthread_key_delete(kthread_key_t key);
 
 /** \cond */
-/* Delete the destructor for a given key. This function is for internal use
-   only! */
+struct kthread;
+
+/* Is the given key allocated (created and not yet deleted)? Internal use
+   only. */
+int kthread_key_valid(kthread_key_t key);
+
+/* Delete the destructor for a given key, and allow the key to be reused. This
+   function is for internal use only! */
 void kthread_key_delete_destructor(kthread_key_t key);
 
+/* Get a pointer to the storage for a key in the given thread, or NULL if the
+   thread has never had storage for that key. Internal use only. */
+void **kthread_tls_slot(struct kthread *thd, kthread_key_t key);
+
+/* Run the destructors for a thread that is going away, and free its overflow
+   table. Internal use only. */
+void kthread_tls_destroy(struct kthread *thd);
+
 /* Initialization and shutdown. Once again, internal use only. */
 int kthread_tls_init(void);
 void kthread_tls_shutdown(void);
@@ -0,0 +1,41 @@
+/* KallistiOS ##version##
+
+   netinet/tcp.h
+   Copyright (C) 2026 The KOS Team and contributors
+*/
+
+/** \file   netinet/tcp.h
+    \brief  Definitions for the Transmission Control Protocol.
+
+    This file contains the socket options that can be used with TCP sockets at
+    the IPPROTO_TCP level, as directed by the POSIX 2008 standard.
+
+    \author The KOS Team and contributors
+
+    \see    netinet/in.h
+*/
+
+#ifndef __NETINET_TCP_H
+#define __NETINET_TCP_H
+
+#include <sys/cdefs.h>
+
+__BEGIN_DECLS
+
+/** \defgroup tcp_opts                  TCP protocol level options
+
+    These are the various socket-level options that can be accessed with the
+    setsockopt() and getsockopt() functions for the IPPROTO_TCP level value.
+
+    \see                so_opts
+    \see                ipv4_opts
+    \see                ipv6_opts
+
+    @{
+*/
+#define TCP_NODELAY             28  /**< \brief Don't delay small sends (get/set) */
+/** @} */
+
+__END_DECLS
+
+#endif /* __NETINET_TCP_H */
@@ -0,0 +1,148 @@
+/* KallistiOS ##version##
+
+   sys/epoll.h
+   Copyright (C) 2026 The KOS Team and contributors
+*/
+
+/** \file   sys/epoll.h
+    \brief  Scalable I/O event notification.
+
+    This file contains an interface modeled after the epoll interface from
+    Linux. Unlike with poll(), the set of file descriptors to watch is
+    registered once with an epoll instance (itself a file descriptor), instead
+    of being passed in on every call. Whenever one of the registered files
+    becomes ready, it is put on the instance's ready list, so the cost of
+    waiting doesn't depend on how many files are being watched.
+
+    Both level-triggered (the default) and edge-triggered (EPOLLET) operation
+    are supported, as is one-shot operation (EPOLLONESHOT). As with poll(), the
+    only files that actually signal readiness are sockets and ptys. Files that
+    don't support polling are always reported as being ready for reading and
+    writing.
+
+    File descriptors should be removed from any epoll instances they are in
+    with EPOLL_CTL_DEL before they are closed.
+
+    \author The KOS Team and contributors
+
+    \see    poll.h
+*/
+
+#ifndef __SYS_EPOLL_H
+#define __SYS_EPOLL_H
+
+#include <sys/cdefs.h>
+#include <sys/types.h>
+#include <stdint.h>
+#include <poll.h>
+
+__BEGIN_DECLS
+
+/** \defgroup epoll_events              Events for epoll
+
+    These are the events that can be set in the events field of a
+    struct epoll_event. The basic events are the same as the ones used by
+    poll().
+
+    @{
+*/
+#define EPOLLIN         POLLIN      /**< \brief Data may be read */
+#define EPOLLRDNORM     POLLRDNORM  /**< \brief Normal data may be read */
+#define EPOLLRDBAND     POLLRDBAND  /**< \brief Priority data may be read */
+#define EPOLLPRI        POLLPRI     /**< \brief High-priority data may be read */
+#define EPOLLOUT        POLLOUT     /**< \brief Data may be written */
+#define EPOLLWRNORM     POLLWRNORM  /**< \brief Normal data may be written */
+#define EPOLLWRBAND     POLLWRBAND  /**< \brief Priority data may be written */
+#define EPOLLERR        POLLERR     /**< \brief Error has occurred */
+#define EPOLLHUP        POLLHUP     /**< \brief Peer disconnected */
+
+#define EPOLLONESHOT    (1U << 30)  /**< \brief Disable after one event */
+#define EPOLLET         (1U << 31)  /**< \brief Edge-triggered operation */
+/** @} */
+
+/** \defgroup epoll_ctl_ops             Operations for epoll_ctl()
+
+    @{
+*/
+#define EPOLL_CTL_ADD   1           /**< \brief Add a file descriptor */
+#define EPOLL_CTL_DEL   2           /**< \brief Remove a file descriptor */
+#define EPOLL_CTL_MOD   3           /**< \brief Change a file's events */
+/** @} */
+
+/** \brief  Flag for epoll_create1() to set close-on-exec (ignored). */
+#define EPOLL_CLOEXEC   0x01
+
+/** \brief  User data associated with a registered file descriptor. */
+typedef union epoll_data {
+    void *ptr;                  /**< \brief A pointer */
+    int fd;                     /**< \brief A file descriptor */
+    uint32_t u32;               /**< \brief A 32-bit integer */
+    uint64_t u64;               /**< \brief A 64-bit integer */
+} epoll_data_t;
+
+/** \brief  An event to watch for, or one that has happened.
+    \headerfile sys/epoll.h
+*/
+struct epoll_event {
+    uint32_t events;            /**< \brief Events (see \ref epoll_events) */
+    epoll_data_t data;          /**< \brief User data */
+};
+
+/** \brief  Create an epoll instance.
+
+    \param  size        A hint for how many files will be watched. This is
+                        ignored, but must be greater than zero.
+    \return             A file descriptor for the new instance, or -1 on error
+                        (sets errno as appropriate). Close it with close() when
+                        it is no longer needed.
+*/
+int epoll_create(int size);
+
+/** \brief  Create an epoll instance, with flags.
+
+    \param  flags       0 or EPOLL_CLOEXEC.
+    \return             A file descriptor for the new instance, or -1 on error
+                        (sets errno as appropriate).
+*/
+int epoll_create1(int flags);
+
+/** \brief  Add, change or remove a file descriptor in an epoll instance.
+
+    \param  epfd        The epoll instance.
+    \param  op          The operation (see \ref epoll_ctl_ops).
+    \param  fd          The file descriptor to operate on.
+    \param  event       The events to watch for and the user data to report
+                        with them (ignored for EPOLL_CTL_DEL). EPOLLERR and
+                        EPOLLHUP are always watched for.
+    \retval 0           On success.
+    \retval -1          On error (sets errno as appropriate).
+
+    \par    Error Conditions:
+    \em     EBADF - epfd or fd is not a valid file descriptor \n
+    \em     EINVAL - epfd is not an epoll instance, fd is epfd or op is invalid \n
+    \em     EEXIST - fd is already in the instance (EPOLL_CTL_ADD) \n
+    \em     ENOENT - fd is not in the instance (EPOLL_CTL_MOD/DEL) \n
+    \em     ENOMEM - out of memory
+*/
+int epoll_ctl(int epfd, int op, int fd, struct epoll_event *event);
+
+/** \brief  Wait for events on an epoll instance.
+
+    This function blocks until at least one of the file descriptors in the
+    instance is ready, or until the timeout expires.
+
+    \param  epfd        The epoll instance.
+    \param  events      Where to store the events that happened.
+    \param  maxevents   The number of elements in events.
+    \param  timeout     Maximum amount of time to block, in milliseconds. Pass
+                        0 to not block at all and -1 to block until an event
+                        occurs.
+    \return             The number of events stored, 0 on timeout, or -1 on
+                        error (sets errno as appropriate).
+*/
+int epoll_wait(int epfd, struct epoll_event *events, int maxevents,
+               int timeout);
+
+__END_DECLS
+
+#endif /* !__SYS_EPOLL_H */
@@ -156,8 +156,36 @@ struct sockaddr_storage {
 #define MSG_TRUNC       0x20    /**< \brief Normal data truncated (U) */
 #define MSG_WAITALL     0x40    /**< \brief Attempt to fill read buffer */
 #define MSG_DONTWAIT    0x80    /**< \brief Make this call non-blocking (non-standard) */
+#define MSG_WAITFORONE  0x100   /**< \brief Only block for the first message (recvmmsg only, non-standard) */
 /** @} */
 
+/** \brief  Message header structure.
+
+    This structure describes a message to be received, for use with recvmmsg().
+    Ancillary data is not supported, so msg_control is ignored and
+    msg_controllen is always set to 0.
+
+    \headerfile sys/socket.h
+*/
+struct msghdr {
+    void         *msg_name;         /**< \brief Address of the peer (may be NULL) */
+    socklen_t     msg_namelen;      /**< \brief Size of msg_name */
+    struct iovec *msg_iov;          /**< \brief Scatter array for the data */
+    int           msg_iovlen;       /**< \brief Elements in msg_iov */
+    void         *msg_control;      /**< \brief Ancillary data (unsupported) */
+    socklen_t     msg_controllen;   /**< \brief Ancillary data length */
+    int           msg_flags;        /**< \brief Flags on the received message */
+};
+
+/** \brief  Message header structure for batch operations (non-standard).
+
+    \headerfile sys/socket.h
+*/
+struct mmsghdr {
+    struct msghdr msg_hdr;          /**< \brief The message */
+    unsigned int  msg_len;          /**< \brief Bytes received */
+};
+
 /** \brief  Unspecified address family. */
 #define AF_UNSPEC   0
 
@@ -281,6 +309,37 @@ ssize_t recv(int socket, void *buffer, size_t length, int flags);
 ssize_t recvfrom(int socket, void *buffer, size_t length, int flags,
                  struct sockaddr *address, socklen_t *address_len);
 
+/* \cond */
+struct timespec;
+/* \endcond */
+
+/** \brief  Receive multiple messages on a socket (non-standard).
+
+    This function receives a batch of messages at once, which is cheaper than
+    calling recvfrom() for each one, since the socket only needs to be looked up
+    and locked once. For datagram sockets, each message is one datagram, and
+    MSG_TRUNC is set in its msg_flags if it didn't fit.
+
+    This blocks (unless the socket is non-blocking or MSG_DONTWAIT is set) until
+    at least one message is available, then returns as many as are already
+    queued up, without waiting for more. That is, it always acts as if
+    MSG_WAITFORONE was set.
+
+    \param  socket      The socket to receive on.
+    \param  msgvec      The messages to fill in.
+    \param  vlen        The number of elements in msgvec.
+    \param  flags       The type of message reception (MSG_DONTWAIT,
+                        MSG_WAITFORONE or MSG_PEEK).
+    \param  timeout     The longest time to block for the first message (NULL
+                        to block indefinitely). This is currently only supported
+                        for UDP sockets.
+    \return             On success, the number of messages received. On error
+                        (including when the timeout expires), -1, and sets errno
+                        as appropriate.
+*/
+int recvmmsg(int socket, struct mmsghdr *msgvec, unsigned int vlen, int flags,
+             struct timespec *timeout);
+
 /** \brief  Send a message on a connected socket.
 
     This function sends messages to the peer on a connected socket.
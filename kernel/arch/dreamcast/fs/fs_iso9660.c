@@ -32,6 +32,8 @@ ISO9660 systems, as these were used as references as well.
 #include <dc/cdrom.h>
 #include <dc/vblank.h>
 
+#include <arch/cache.h>
+
 #include <kos/thread.h>
 #include <kos/mutex.h>
 #include <kos/fs.h>
@@ -187,126 +189,210 @@ static uint32 iso_733(const uint8 *from) {
 
 
 /********************************************************************************/
-/* Low-level block cacheing routines. This implements a simple queue-based
-   LRU/MRU cacheing system. Whenever a block is requested, it will be placed
-   on the MRU end of the queue. As more blocks are loaded than can fit in
-   the cache, blocks are deleted from the LRU end. */
-
-/* Holds the data for one cache block, and a pointer to the next one.
-   As sectors are read from the disc, they are added to the front of
-   this cache. As the cache fills up, sectors are removed from the end
-   of it. */
-typedef struct {
-    uint32  sector;         /* CD sector */
+/* Low-level block cacheing routines. Each cache is a fixed set of blocks,
+   sized when the file system is initialized, that are kept on an LRU list and
+   hashed by sector number. Whenever a block is requested, it is looked up in
+   the hash and moved to the MRU end of the list. As more blocks are loaded
+   than can fit in the cache, blocks are recycled from the LRU end. The inode
+   and data caches are separate (with separate locks), so that directory
+   lookups stay hot even while file data is being streamed in. */
+
+/* Holds the data for one cache block. */
+typedef struct cache_block {
+    TAILQ_ENTRY(cache_block) lru;   /* LRU list handle */
+    LIST_ENTRY(cache_block) hash;   /* Hash chain handle */
+    uint32  sector;         /* CD sector, or -1 if unused */
     uint8   data[2048];     /* Sector data */
 } cache_block_t;
 
-/* List of cache blocks (ordered least recently used to most recently) */
+TAILQ_HEAD(cache_lru, cache_block);
+LIST_HEAD(cache_chain, cache_block);
+
+/* One block cache. */
+typedef struct {
+    struct cache_lru lru;       /* Blocks, least recently used first */
+    struct cache_chain *hash;   /* Hash chains, by sector number */
+    uint32  hash_mask;          /* Number of chains - 1 */
+    cache_block_t *blocks;      /* Storage for the blocks */
+    int     count;              /* Number of blocks */
+    mutex_t mutex;              /* Cache modification mutex */
+    uint32  hits, misses;       /* Statistics */
+} block_cache_t;
+
+/* Default number of blocks in each cache */
 #define NUM_CACHE_BLOCKS 16
-static cache_block_t *icache[NUM_CACHE_BLOCKS];     /* inode cache */
-static cache_block_t *dcache[NUM_CACHE_BLOCKS];     /* data cache */
 
-/* Cache modification mutex */
-static mutex_t cache_mutex;
+static block_cache_t icache;    /* inode cache */
+static block_cache_t dcache;    /* data cache */
 
-/* Clears all cache blocks */
-static void bclear_cache(cache_block_t **cache) {
-    int i;
+/* Read-ahead buffer for sequential reads. This holds a run of consecutive data
+   sectors that was read in with a single multi-sector DMA request. It is
+   shared between all open files, and protected by the data cache's mutex. */
+#define RA_MAX_SECTORS 16
+static uint8 *ra_buf;
+static uint32 ra_first = (uint32)-1;    /* First sector in the buffer */
+static uint32 ra_count;                 /* Number of valid sectors */
+static uint32 ra_hits, ra_fills;        /* Statistics */
+
+static int bread_sectors(void *buf, uint32 sector, int cnt);
+
+/* Set up a cache with the given number of blocks */
+static int bcache_init(block_cache_t *cache, int count) {
+    uint32 i, chains = 16;
+
+    while(chains < (uint32)count)
+        chains <<= 1;
+
+    cache->blocks = (cache_block_t *)malloc(count * sizeof(cache_block_t));
+    cache->hash = (struct cache_chain *)malloc(chains *
+                                               sizeof(struct cache_chain));
+
+    if(!cache->blocks || !cache->hash) {
+        free(cache->blocks);
+        free(cache->hash);
+        cache->blocks = NULL;
+        cache->hash = NULL;
+        return -1;
+    }
+
+    cache->count = count;
+    cache->hash_mask = chains - 1;
+    cache->hits = cache->misses = 0;
 
-    mutex_lock(&cache_mutex);
+    for(i = 0; i < chains; i++)
+        LIST_INIT(&cache->hash[i]);
 
-    for(i = 0; i < NUM_CACHE_BLOCKS; i++)
-        cache[i]->sector = (uint32)-1;
+    TAILQ_INIT(&cache->lru);
 
-    mutex_unlock(&cache_mutex);
+    for(i = 0; i < (uint32)count; i++) {
+        cache->blocks[i].sector = (uint32)-1;
+        TAILQ_INSERT_TAIL(&cache->lru, &cache->blocks[i], lru);
+    }
+
+    mutex_init(&cache->mutex, MUTEX_TYPE_NORMAL);
+    return 0;
 }
 
-/* Graduate a block from its current position to the MRU end of the cache */
-static void bgrad_cache(cache_block_t **cache, int block) {
-    int     i;
-    cache_block_t   *tmp;
+/* Tear down a cache */
+static void bcache_shutdown(block_cache_t *cache) {
+    mutex_destroy(&cache->mutex);
+    free(cache->blocks);
+    free(cache->hash);
+    cache->blocks = NULL;
+    cache->hash = NULL;
+}
+
+/* Throw a block out of the cache, and put it at the LRU end so that it gets
+   reused first. Cache must be locked. */
+static void bdrop_block(block_cache_t *cache, cache_block_t *blk) {
+    if(blk->sector != (uint32)-1) {
+        LIST_REMOVE(blk, hash);
+        blk->sector = (uint32)-1;
+    }
 
-    /* Don't try it with the end block */
-    if(block < 0 || block >= (NUM_CACHE_BLOCKS - 1)) return;
+    TAILQ_REMOVE(&cache->lru, blk, lru);
+    TAILQ_INSERT_HEAD(&cache->lru, blk, lru);
+}
+
+/* Clears all cache blocks */
+static void bclear_cache(block_cache_t *cache) {
+    int i;
 
-    /* Make a copy and scoot everything down */
-    tmp = cache[block];
+    mutex_lock(&cache->mutex);
 
-    for(i = block; i < (NUM_CACHE_BLOCKS - 1); i++)
-        cache[i] = cache[i + 1];
+    for(i = 0; i < cache->count; i++)
+        bdrop_block(cache, &cache->blocks[i]);
 
-    cache[NUM_CACHE_BLOCKS - 1] = tmp;
+    mutex_unlock(&cache->mutex);
 }
 
 /* Pulls the requested sector into a cache block and returns the cache
-   block index. Note that the sector in question may already be in the
-   cache, in which case it just returns the containing block. */
-static void iso_break_all(void);
-static int bread_cache(cache_block_t **cache, uint32 sector) {
-    int i, j, rv;
+   block. Note that the sector in question may already be in the cache, in
+   which case it just returns the containing block. */
+static cache_block_t *bread_cache(block_cache_t *cache, uint32 sector) {
+    cache_block_t *blk;
+    struct cache_chain *chain = &cache->hash[sector & cache->hash_mask];
 
-    rv = -1;
-    mutex_lock(&cache_mutex);
+    mutex_lock(&cache->mutex);
 
     /* Look for a pre-existing cache block */
-    for(i = NUM_CACHE_BLOCKS - 1; i >= 0; i--) {
-        if(cache[i]->sector == sector) {
-            bgrad_cache(cache, i);
-            rv = NUM_CACHE_BLOCKS - 1;
+    LIST_FOREACH(blk, chain, hash) {
+        if(blk->sector == sector) {
+            ++cache->hits;
             goto bread_exit;
         }
     }
 
-    /* If not, look for an open cache slot; if we find one, use it */
-    for(i = 0; i < NUM_CACHE_BLOCKS; i++) {
-        if(cache[i]->sector == (uint32)-1) break;
-    }
+    /* If not, recycle the LRU block (unused blocks are always kept there) */
+    ++cache->misses;
+    blk = TAILQ_FIRST(&cache->lru);
 
-    /* If we didn't find one, kick an LRU block out of cache */
-    if(i >= NUM_CACHE_BLOCKS) {
-        i = 0;
+    if(blk->sector != (uint32)-1) {
+        LIST_REMOVE(blk, hash);
+        blk->sector = (uint32)-1;
     }
 
     /* Load the requested block */
-    j = cdrom_read_sectors(cache[i]->data, sector + 150, 1);
-
-    if(j < 0) {
-        //dbglog(DBG_ERROR, "fs_iso9660: can't read_sectors for %d: %d\n",
-        //  sector+150, j);
-        if(j == ERR_DISC_CHG || j == ERR_NO_DISC) {
-            init_percd();
-        }
-
-        rv = -1;
-        goto bread_exit;
+    if(bread_sectors(blk->data, sector, 1) < 0) {
+        mutex_unlock(&cache->mutex);
+        return NULL;
     }
 
-    cache[i]->sector = sector;
+    blk->sector = sector;
+    LIST_INSERT_HEAD(chain, blk, hash);
 
     /* Move it to the most-recently-used position */
-    bgrad_cache(cache, i);
-    rv = NUM_CACHE_BLOCKS - 1;
-
-    /* Return the new cache block index */
 bread_exit:
-    mutex_unlock(&cache_mutex);
-    return rv;
+    TAILQ_REMOVE(&cache->lru, blk, lru);
+    TAILQ_INSERT_TAIL(&cache->lru, blk, lru);
+    mutex_unlock(&cache->mutex);
+    return blk;
 }
 
 /* read data block */
-static int bdread(uint32 sector) {
-    return bread_cache(dcache, sector);
+static cache_block_t *bdread(uint32 sector) {
+    return bread_cache(&dcache, sector);
 }
 
 /* read inode block */
-static int biread(uint32 sector) {
-    return bread_cache(icache, sector);
+static cache_block_t *biread(uint32 sector) {
+    return bread_cache(&icache, sector);
+}
+
+/* Read one or more whole data sectors into a buffer. DMA is used when the
+   buffer is suitably aligned for it, otherwise this falls back to PIO. */
+static int bread_sectors(void *buf, uint32 sector, int cnt) {
+    int rv;
+
+    if(!((uint32)buf & 31)) {
+        /* Make sure nothing dirty in the cache gets written back over the
+           data after the DMA puts it in memory. */
+        dcache_inval_range((uint32)buf, cnt * 2048);
+        rv = cdrom_read_sectors_ex(buf, sector + 150, cnt, CDROM_READ_DMA);
+    }
+    else {
+        rv = cdrom_read_sectors(buf, sector + 150, cnt);
+    }
+
+    if(rv != ERR_OK) {
+        /* Let the next open re-read the disc info. */
+        if(rv == ERR_DISC_CHG || rv == ERR_NO_DISC)
+            percd_done = 0;
+
+        return -1;
+    }
+
+    return 0;
 }
 
 /* Clear both caches */
 static void bclear(void) {
-    bclear_cache(dcache);
-    bclear_cache(icache);
+    bclear_cache(&dcache);
+    bclear_cache(&icache);
+
+    mutex_lock(&dcache.mutex);
+    ra_count = 0;
+    mutex_unlock(&dcache.mutex);
 }
 
 /********************************************************************************/
@@ -325,7 +411,8 @@ static iso_dirent_t root_dirent;
 /* Per-disc initialization; this is done every time it's discovered that
    a new CD has been inserted. */
 static int init_percd(void) {
-    int     i, blk;
+    int     i;
+    cache_block_t *blk = NULL;
     CDROM_TOC   toc;
 
     dbglog(DBG_NOTICE, "fs_iso9660: disc change detected\n");
@@ -351,10 +438,10 @@ static int init_percd(void) {
     for(i = 1; i <= 3; i++) {
         blk = biread(session_base + i + 16 - 150);
 
-        if(blk < 0) return blk;
+        if(!blk) return -1;
 
-        if(memcmp((char *)icache[blk]->data, "\02CD001", 6) == 0) {
-            joliet = isjoliet((char *)icache[blk]->data + 88);
+        if(memcmp((char *)blk->data, "\02CD001", 6) == 0) {
+            joliet = isjoliet((char *)blk->data + 88);
             dbglog(DBG_NOTICE, "  (joliet level %d extensions detected)\n", joliet);
 
             if(joliet) break;
@@ -366,16 +453,16 @@ static int init_percd(void) {
         /* Grab and check the volume descriptor */
         blk = biread(session_base + 16 - 150);
 
-        if(blk < 0) return i;
+        if(!blk) return -1;
 
-        if(memcmp((char*)icache[blk]->data, "\01CD001", 6)) {
+        if(memcmp((char*)blk->data, "\01CD001", 6)) {
             dbglog(DBG_ERROR, "fs_iso9660: disc is not iso9660\r\n");
             return -1;
         }
     }
 
     /* Locate the root directory */
-    memcpy(&root_dirent, icache[blk]->data + 156, sizeof(iso_dirent_t));
+    memcpy(&root_dirent, blk->data + 156, sizeof(iso_dirent_t));
     root_extent = iso_733(root_dirent.extent);
     root_size = iso_733(root_dirent.size);
 
@@ -424,7 +511,8 @@ static int fncompare(const char *isofn, int isosize, const char *normalfn) {
  */
 static iso_dirent_t *find_object(const char *fn, int dir,
                                  uint32 dir_extent, uint32 dir_size) {
-    int     i, c;
+    int     i;
+    cache_block_t   *c;
     iso_dirent_t    *de;
 
     /* RockRidge */
@@ -447,11 +535,11 @@ static iso_dirent_t *find_object(const char *fn, int dir,
     while(size_left > 0) {
         c = biread(dir_extent);
 
-        if(c < 0) return NULL;
+        if(!c) return NULL;
 
         for(i = 0; i < 2048 && i < size_left;) {
             /* Locate the current dirent */
-            de = (iso_dirent_t *)(icache[c]->data + i);
+            de = (iso_dirent_t *)(c->data + i);
 
             if(!de->length) break;
 
@@ -575,6 +663,8 @@ static struct {
     uint32      size;       /* Length of file in bytes */
     dirent_t    dirent;     /* A static dirent to pass back to clients */
     int     broken;     /* >0 if the CD has been swapped out since open */
+    uint32      ra_next;    /* Sector we expect to be read next */
+    int     ra_window;  /* Current read-ahead window in sectors */
 } fh[FS_CD_MAX_FILES];
 
 /* Mutex for file handles */
@@ -637,6 +727,8 @@ static void * iso_open(vfs_handler_t * vfs, const char *fn, int mode) {
     fh[fd].ptr = 0;
     fh[fd].size = iso_733(de->size);
     fh[fd].broken = 0;
+    fh[fd].ra_next = (uint32)-1;
+    fh[fd].ra_window = 0;
 
     return (void *)fd;
 }
@@ -653,9 +745,70 @@ static int iso_close(void * h) {
     return 0;
 }
 
+/* Copy part of a data sector out for a file. Sequential access through a file
+   grows that file's read-ahead window (doubling each time, up to
+   RA_MAX_SECTORS), and the next run of sectors is pulled into the read-ahead
+   buffer with a single request. Anything else goes through the normal data
+   cache one sector at a time, and resets the window. */
+static int bdread_file(file_t fd, uint8 *out, int off, int len) {
+    uint32 sector = fh[fd].first_extent + fh[fd].ptr / 2048;
+    uint32 left = (fh[fd].size + 2047) / 2048 - fh[fd].ptr / 2048;
+    cache_block_t *c;
+    int cnt;
+
+    mutex_lock(&dcache.mutex);
+
+    /* Already in the read-ahead buffer? */
+    if(sector - ra_first < ra_count) {
+        memcpy(out, ra_buf + (sector - ra_first) * 2048 + off, len);
+        fh[fd].ra_next = sector + 1;
+        ++ra_hits;
+        mutex_unlock(&dcache.mutex);
+        return 0;
+    }
+
+    if(sector == fh[fd].ra_next)
+        fh[fd].ra_window = fh[fd].ra_window ?
+                           fh[fd].ra_window * 2 : 2;
+    else
+        fh[fd].ra_window = 0;
+
+    if(fh[fd].ra_window > RA_MAX_SECTORS)
+        fh[fd].ra_window = RA_MAX_SECTORS;
+
+    fh[fd].ra_next = sector + 1;
+    cnt = fh[fd].ra_window < (int)left ? fh[fd].ra_window : (int)left;
+
+    if(ra_buf && cnt > 1) {
+        ra_count = 0;
+
+        if(bread_sectors(ra_buf, sector, cnt) < 0) {
+            mutex_unlock(&dcache.mutex);
+            return -1;
+        }
+
+        ra_first = sector;
+        ra_count = cnt;
+        ++ra_fills;
+        memcpy(out, ra_buf + off, len);
+        mutex_unlock(&dcache.mutex);
+        return 0;
+    }
+
+    mutex_unlock(&dcache.mutex);
+
+    /* Do the read */
+    c = bdread(sector);
+
+    if(!c) return -1;
+
+    memcpy(out, c->data + off, len);
+    return 0;
+}
+
 /* Read from a file */
 static ssize_t iso_read(void * h, void *buf, size_t bytes) {
-    int rv, toread, thissect, c;
+    int rv, toread, thissect;
     uint8 * outbuf;
     file_t fd = (file_t)h;
 
@@ -677,40 +830,30 @@ static ssize_t iso_read(void * h, void *buf, size_t bytes) {
         /* How much more can we read in the current sector? */
         thissect = 2048 - (fh[fd].ptr % 2048);
 
-        /* If we're on a sector boundary and we have more than one
-           full sector to read, then short-circuit the cache here
-           and use the multi-sector reads from the CD unit (this
-           should theoretically be a lot faster) */
-        /* XXX This code isn't actually faster, but I'm leaving it
-           here commented out in case we could find a better use
-           for it later than speed (i.e., preventing thread context
-           switches). */
-        /* if(thissect == 2048 && toread >= 2048) {
-            // Round it off to an even sector count
+        /* If we're on a sector boundary and we have more than one full sector
+           to read, then short-circuit the cache here and stream the sectors
+           straight into the caller's buffer with one multi-sector request.
+           This is done with DMA if the buffer is 32-byte aligned, which also
+           lets other threads run while the drive is busy. */
+        if(thissect == 2048 && toread >= 4096) {
+            /* Round it off to an even sector count */
             thissect = toread / 2048;
             toread = thissect * 2048;
 
-            printf("cdrom: short-circuit read for %d sectors\n",
-                thissect);
-
-            // Do the read
-            if(cdrom_read_sectors(outbuf,
-                fh[fd].first_extent + fh[fd].ptr/2048 + 150,
-                thissect) < 0)
-            {
-                // Something went wrong...
+            if(bread_sectors(outbuf, fh[fd].first_extent + fh[fd].ptr / 2048,
+                             thissect) < 0)
                 return -1;
-            }
-        } else { */
-        toread = (toread > thissect) ? thissect : toread;
 
-        /* Do the read */
-        c = bdread(fh[fd].first_extent + fh[fd].ptr / 2048);
-
-        if(c < 0) return -1;
+            /* Picking up after this read counts as sequential access. */
+            fh[fd].ra_next = fh[fd].first_extent + fh[fd].ptr / 2048 +
+                             thissect;
+        }
+        else {
+            toread = (toread > thissect) ? thissect : toread;
 
-        memcpy(outbuf, dcache[c]->data + (fh[fd].ptr % 2048), toread);
-        /* } */
+            if(bdread_file(fd, outbuf, fh[fd].ptr % 2048, toread) < 0)
+                return -1;
+        }
 
         /* Adjust pointers */
         outbuf += toread;
@@ -812,7 +955,7 @@ static void fn_postprocess(char *fnin) {
 
 /* Read a directory entry */
 static dirent_t *iso_readdir(void * h) {
-    int     c;
+    cache_block_t   *c;
     iso_dirent_t    *de;
 
     /* RockRidge */
@@ -829,16 +972,16 @@ static dirent_t *iso_readdir(void * h) {
 
     /* Scan forwards until we find the next valid entry, an
        end-of-entry mark, or run out of dir size. */
-    c = -1;
+    c = NULL;
     de = NULL;
 
     while(fh[fd].ptr < fh[fd].size) {
         /* Get the current dirent block */
         c = biread(fh[fd].first_extent + fh[fd].ptr / 2048);
 
-        if(c < 0) return NULL;
+        if(!c) return NULL;
 
-        de = (iso_dirent_t *)(icache[c]->data + (fh[fd].ptr % 2048));
+        de = (iso_dirent_t *)(c->data + (fh[fd].ptr % 2048));
 
         if(de->length) break;
 
@@ -851,9 +994,9 @@ static dirent_t *iso_readdir(void * h) {
     /* If we're at the first, skip the two blank entries */
     if(!de->name[0] && de->name_len == 1) {
         fh[fd].ptr += de->length;
-        de = (iso_dirent_t *)(icache[c]->data + (fh[fd].ptr % 2048));
+        de = (iso_dirent_t *)(c->data + (fh[fd].ptr % 2048));
         fh[fd].ptr += de->length;
-        de = (iso_dirent_t *)(icache[c]->data + (fh[fd].ptr % 2048));
+        de = (iso_dirent_t *)(c->data + (fh[fd].ptr % 2048));
 
         if(!de->length) return NULL;
     }
@@ -979,6 +1122,54 @@ static int iso_fcntl(void *h, int cmd, va_list ap) {
     return rv;
 }
 
+static int iso_ioctl(void *h, int cmd, va_list ap) {
+    file_t fd = (file_t)h;
+    iso_cache_stats_t *st;
+
+    if(fd >= FS_CD_MAX_FILES || !fh[fd].first_extent || fh[fd].broken) {
+        errno = EBADF;
+        return -1;
+    }
+
+    switch(cmd) {
+        case ISO_IOCTL_GET_CACHE_STATS:
+            if(!(st = va_arg(ap, iso_cache_stats_t *))) {
+                errno = EFAULT;
+                return -1;
+            }
+
+            mutex_lock(&icache.mutex);
+            st->inode_blocks = icache.count;
+            st->inode_hits = icache.hits;
+            st->inode_misses = icache.misses;
+            mutex_unlock(&icache.mutex);
+
+            mutex_lock(&dcache.mutex);
+            st->data_blocks = dcache.count;
+            st->data_hits = dcache.hits;
+            st->data_misses = dcache.misses;
+            st->ra_hits = ra_hits;
+            st->ra_fills = ra_fills;
+            mutex_unlock(&dcache.mutex);
+            return 0;
+
+        case ISO_IOCTL_RESET_CACHE_STATS:
+            mutex_lock(&icache.mutex);
+            icache.hits = icache.misses = 0;
+            mutex_unlock(&icache.mutex);
+
+            mutex_lock(&dcache.mutex);
+            dcache.hits = dcache.misses = 0;
+            ra_hits = ra_fills = 0;
+            mutex_unlock(&dcache.mutex);
+            return 0;
+
+        default:
+            errno = EINVAL;
+            return -1;
+    }
+}
+
 static int iso_fstat(void *h, struct stat *st) {
     file_t fd = (file_t)h;
 
@@ -1031,7 +1222,7 @@ static vfs_handler_t vh = {
     iso_tell,
     iso_total,
     iso_readdir,
-    NULL,
+    iso_ioctl,
     NULL,
     NULL,
     NULL,
@@ -1052,8 +1243,12 @@ static vfs_handler_t vh = {
 };
 
 /* Initialize the file system */
-int fs_iso9660_init(void) {
-    int i;
+int fs_iso9660_init_ex(int inode_blocks, int data_blocks) {
+    if(inode_blocks <= 0)
+        inode_blocks = NUM_CACHE_BLOCKS;
+
+    if(data_blocks <= 0)
+        data_blocks = NUM_CACHE_BLOCKS;
 
     /* Reset fd's */
     memset(fh, 0, sizeof(fh));
@@ -1061,17 +1256,23 @@ int fs_iso9660_init(void) {
     /* Mark the first as active so we can have an error FD of zero */
     fh[0].first_extent = -1;
 
+    /* Allocate cache block space */
+    if(bcache_init(&icache, inode_blocks) < 0)
+        return -1;
+
+    if(bcache_init(&dcache, data_blocks) < 0) {
+        bcache_shutdown(&icache);
+        return -1;
+    }
+
     /* Init thread mutexes */
-    mutex_init(&cache_mutex, MUTEX_TYPE_NORMAL);
     mutex_init(&fh_mutex, MUTEX_TYPE_NORMAL);
 
-    /* Allocate cache block space */
-    for(i = 0; i < NUM_CACHE_BLOCKS; i++) {
-        icache[i] = malloc(sizeof(cache_block_t));
-        icache[i]->sector = -1;
-        dcache[i] = malloc(sizeof(cache_block_t));
-        dcache[i]->sector = -1;
-    }
+    /* Allocate the read-ahead buffer. If this fails, we can still get by
+       with just the data cache. */
+    ra_buf = memalign(32, RA_MAX_SECTORS * 2048);
+    ra_count = 0;
+    ra_hits = ra_fills = 0;
 
     percd_done = 0;
     iso_last_status = -1;
@@ -1083,21 +1284,23 @@ int fs_iso9660_init(void) {
     return nmmgr_handler_add(&vh.nmmgr);
 }
 
+int fs_iso9660_init(void) {
+    return fs_iso9660_init_ex(0, 0);
+}
+
 /* De-init the file system */
 int fs_iso9660_shutdown(void) {
-    int i;
-
     /* De-register with vblank */
     vblank_handler_remove(iso_vblank_hnd);
 
     /* Dealloc cache block space */
-    for(i = 0; i < NUM_CACHE_BLOCKS; i++) {
-        free(icache[i]);
-        free(dcache[i]);
-    }
+    bcache_shutdown(&icache);
+    bcache_shutdown(&dcache);
+
+    free(ra_buf);
+    ra_buf = NULL;
 
     /* Free muteces */
-    mutex_destroy(&cache_mutex);
     mutex_destroy(&fh_mutex);
 
     return nmmgr_handler_remove(&vh.nmmgr);
@@ -706,25 +706,8 @@ static int rx_enq(int ring_offset, size_t pkt_size) {
         return 1;
 }
 
-/* Transmit a single packet */
-#ifdef TX_SEMA
-static int bba_rtx(const uint8 * pkt, int len, int wait)
-#else
-static int bba_tx(const uint8 * pkt, int len, int wait)
-#endif
-{
-    /*
-    int i;
-
-    dbglog(DBG_KDEBUG,"Transmitting packet:\r\n");
-    for(i=0; i<len; i++) {
-        dbglog(DBG_KDEBUG,"%02x ", pkt[i]);
-        if(i && !(i % 16))
-            printf("\r\n");
-    }
-    dbglog(DBG_KDEBUG,"\r\n");
-    */
-
+/* Wait for the current TX buffer to be free to put a packet in */
+static int bba_tx_slot_wait(int wait) {
     //wait = BBA_TX_WAIT;
     if(!link_stable) {
         if(wait == BBA_TX_WAIT) {
@@ -749,6 +732,45 @@ static int bba_tx(const uint8 * pkt, int len, int wait)
         }
     }
 
+    return BBA_TX_OK;
+}
+
+/* Send the packet that's been put in the current TX buffer */
+static void bba_tx_slot_send(int len) {
+    /* All packets must be at least 60 bytes, pad them with null bytes if
+       they are not already of an appropriate size. */
+    if(len < 60) {
+        g2_memset_8(txdesc[rtl.cur_tx] + len, 0, 60 - len);
+        len = 60;
+    }
+
+    /* Transmit from the current TX buffer */
+    g2_write_32(NIC(RT_TXSTATUS0 + 4 * rtl.cur_tx), len);
+
+    /* Go to the next TX buffer */
+    rtl.cur_tx = (rtl.cur_tx + 1) % TX_NB_BUFFERS;
+}
+
+/* Transmit a single packet */
+static int bba_rtx(const uint8 * pkt, int len, int wait)
+{
+    int rv;
+
+    /*
+    int i;
+
+    dbglog(DBG_KDEBUG,"Transmitting packet:\r\n");
+    for(i=0; i<len; i++) {
+        dbglog(DBG_KDEBUG,"%02x ", pkt[i]);
+        if(i && !(i % 16))
+            printf("\r\n");
+    }
+    dbglog(DBG_KDEBUG,"\r\n");
+    */
+
+    if((rv = bba_tx_slot_wait(wait)) != BBA_TX_OK)
+        return rv;
+
     /* Copy the packet out to RTL memory */
     /* XXX could use store queues or memcpy8 here */
 
@@ -767,24 +789,68 @@ static int bba_tx(const uint8 * pkt, int len, int wait)
         g2_write_block_8(pkt, txdesc[rtl.cur_tx], len);
     }
 
-    /* All packets must be at least 60 bytes, pad them with null bytes if
-       they are not already of an appropriate size. */
-    if(len < 60) {
-        g2_memset_8(txdesc[rtl.cur_tx] + len, 0, 60 - len);
-        len = 60;
-    }
+    bba_tx_slot_send(len);
 
-    /* Transmit from the current TX buffer */
-    g2_write_32(NIC(RT_TXSTATUS0 + 4 * rtl.cur_tx), len);
+    return BBA_TX_OK;
+}
 
-    /* Go to the next TX buffer */
-    rtl.cur_tx = (rtl.cur_tx + 1) % TX_NB_BUFFERS;
+/* Copy a packet that's in pieces straight out to RTL memory at dst. Whole
+   32-bit words are the quickest way over the G2 bus, so when a piece doesn't
+   end on a 4-byte boundary, the bytes at the end of it are carried over and
+   written along with the start of the next piece. */
+static void bba_tx_copy_iov(uint32 dst, const struct iovec *iov, int iovcnt) {
+    union {
+        uint32 w;
+        uint8 b[4];
+    } carry;
+    const uint8 *src;
+    size_t len, n;
+    int i, held = 0;
+
+    for(i = 0; i < iovcnt; ++i) {
+        src = (const uint8 *)iov[i].iov_base;
+        len = iov[i].iov_len;
+
+        /* Fill out the word carried over from the last piece first. */
+        while(held && len) {
+            carry.b[held++] = *src++;
+            --len;
+
+            if(held == 4) {
+                g2_write_32(dst, carry.w);
+                dst += 4;
+                held = 0;
+            }
+        }
 
-    return BBA_TX_OK;
+        /* If there's anything left, dst is on a word boundary now, so write
+           as many whole words as there are in one go. */
+        if((n = len & ~3)) {
+            if(!((uint32)src & 0x03))
+                g2_write_block_32((const uint32 *)src, dst, n >> 2);
+            else if(!((uint32)src & 0x01))
+                g2_write_block_16((const uint16 *)src, dst, n >> 1);
+            else
+                g2_write_block_8(src, dst, n);
+
+            src += n;
+            dst += n;
+            len -= n;
+        }
+
+        while(len--)
+            carry.b[held++] = *src++;
+    }
+
+    /* Whatever is left over gets written as a whole word too. The bytes past
+       the end of the packet don't matter (and get padded over if the packet
+       is too short). */
+    if(held)
+        g2_write_32(dst, carry.w);
 }
 
-#ifdef TX_SEMA
 int bba_tx(const uint8 * pkt, int len, int wait) {
+#ifdef TX_SEMA
     int res;
 
     if(irq_inside_int()) {
@@ -803,8 +869,10 @@ int bba_tx(const uint8 * pkt, int len, int wait) {
     sem_signal(&tx_sema);
 
     return res;
-}
+#else
+    return bba_rtx(pkt, len, wait);
 #endif
+}
 
 void bba_lock(void) {
     //sem_wait(&bba_rx_sema2);
@@ -1063,7 +1131,7 @@ static int bba_if_start(netif_t *self) {
     sem_init(&bba_rx_sema, 0);
     sem_init(&bba_rx_sema2, 1);
     bba_rx_thread = thd_create(0, bba_rx_threadfunc, 0);
-    bba_rx_thread->prio = 1;
+    thd_set_prio(bba_rx_thread, 1);
     thd_set_label(bba_rx_thread, "BBA-rx-thd");
 
     /* We need something like this to get DHCP to work (since it doesn't
@@ -1119,6 +1187,50 @@ static int bba_if_tx(netif_t *self, const uint8 *data, int len, int blocking) {
     return 0;
 }
 
+/* Transmit a batch of packets. The whole batch goes out under one hold on the
+   transmit semaphore, and the pieces of each packet are written straight to
+   the TX buffer on the card, so it only gets copied the once. */
+static int bba_if_tx_batch(netif_t *self, const netif_txpkt_t *pkts, int count,
+                           int blocking) {
+    int i, rv = BBA_TX_OK;
+
+    (void)self;
+
+    if(!(bba_if.flags & NETIF_RUNNING))
+        return NETIF_TX_ERROR;
+
+#ifdef TX_SEMA
+    if(irq_inside_int()) {
+        if(sem_trywait(&tx_sema))
+            return NETIF_TX_AGAIN;
+    }
+    else
+        sem_wait(&tx_sema);
+#endif
+
+    for(i = 0; i < count; ++i) {
+        if(pkts[i].len > TX_BUFFER_LEN) {
+            rv = BBA_TX_ERROR;
+            break;
+        }
+
+        if((rv = bba_tx_slot_wait(blocking)) != BBA_TX_OK)
+            break;
+
+        bba_tx_copy_iov(txdesc[rtl.cur_tx], pkts[i].iov, pkts[i].iovcnt);
+        bba_tx_slot_send(pkts[i].len);
+    }
+
+#ifdef TX_SEMA
+    sem_signal(&tx_sema);
+#endif
+
+    if(i)
+        return i;
+
+    return rv == BBA_TX_AGAIN ? NETIF_TX_AGAIN : NETIF_TX_ERROR;
+}
+
 /* We'll auto-commit for now */
 static int bba_if_tx_commit(netif_t *self) {
     (void)self;
@@ -1282,6 +1394,7 @@ int bba_init(void) {
     bba_if.if_stop = bba_if_stop;
     bba_if.if_tx = bba_if_tx;
     bba_if.if_tx_commit = bba_if_tx_commit;
+    bba_if.if_tx_batch = bba_if_tx_batch;
     bba_if.if_rx_poll = bba_if_rx_poll;
     bba_if.if_set_flags = bba_if_set_flags;
     bba_if.if_set_mc = bba_if_set_mc;
@@ -489,6 +489,7 @@ static unsigned char current_pkt[1514];
 /* Check for received packets */
 static int la_rx(void) {
     int i, status, len, count;
+    net_pbuf_t *pb;
 
     assert_msg(la_started == LA_RUNNING, "la_rx called out of sequence");
 
@@ -517,12 +518,26 @@ static int la_rx(void) {
             return -2;
         }
 
-        for(i = 0; i < len; i++) {
-            current_pkt[i] = la_read(BMPR8);
+        /* Read it straight into a packet buffer if there's one free, so that
+           the stack can hang onto it without copying it again. */
+        if((pb = net_pbuf_alloc())) {
+            for(i = 0; i < len; i++) {
+                pb->buf[i] = la_read(BMPR8);
+            }
+
+            pb->len = len;
+
+            /* Submit it for processing */
+            net_input_pbuf(&la_if, pb);
         }
+        else {
+            for(i = 0; i < len; i++) {
+                current_pkt[i] = la_read(BMPR8);
+            }
 
-        /* Submit it for processing */
-        net_input(&la_if, current_pkt, len);
+            /* Submit it for processing */
+            net_input(&la_if, current_pkt, len);
+        }
 
         total_pkts_rx++;
     }
@@ -217,6 +217,16 @@ timer_primary_callback_t timer_primary_set_callback(timer_primary_callback_t cal
 */
 void timer_primary_wakeup(uint32 millis);
 
+/** \brief  Request a primary timer wakeup with microsecond resolution.
+
+    This function works just like timer_primary_wakeup(), but takes its delay
+    in microseconds. The timer ticks at P0/64, so the actual resolution is
+    around 1.28 microseconds.
+
+    \param  usecs           The number of microseconds to schedule for.
+*/
+void timer_primary_wakeup_us(uint32 usecs);
+
 /* \cond */
 /* Init function */
 int timer_init(void);
@@ -32,6 +32,39 @@ __BEGIN_DECLS
 #include <kos/limits.h>
 #include <kos/fs.h>
 
+/** \defgroup iso_ioctls      ISO9660 ioctl commands
+
+    These are the commands that can be passed to fs_ioctl() on any file or
+    directory opened on /cd.
+
+    @{
+*/
+/** \brief  Get block cache statistics (arg: iso_cache_stats_t *). */
+#define ISO_IOCTL_GET_CACHE_STATS   1
+
+/** \brief  Reset the block cache statistics (no arg). */
+#define ISO_IOCTL_RESET_CACHE_STATS 2
+/** @} */
+
+/** \brief  ISO9660 block cache statistics.
+
+    This structure is filled in by the ISO_IOCTL_GET_CACHE_STATS ioctl. The
+    counters are reset whenever the file system is initialized, or with the
+    ISO_IOCTL_RESET_CACHE_STATS ioctl.
+
+    \headerfile dc/fs_iso9660.h
+*/
+typedef struct iso_cache_stats {
+    uint32 inode_blocks;    /**< \brief Size of the directory cache */
+    uint32 inode_hits;      /**< \brief Directory cache hits */
+    uint32 inode_misses;    /**< \brief Directory cache misses */
+    uint32 data_blocks;     /**< \brief Size of the data cache */
+    uint32 data_hits;       /**< \brief Data cache hits */
+    uint32 data_misses;     /**< \brief Data cache misses */
+    uint32 ra_hits;         /**< \brief Sectors served from read-ahead */
+    uint32 ra_fills;        /**< \brief Read-ahead requests sent to the drive */
+} iso_cache_stats_t;
+
 /** \brief  Reset the internal ISO9660 cache.
 
     This function resets the cache of the ISO9660 driver, breaking connections
@@ -42,6 +75,28 @@ __BEGIN_DECLS
 */
 int iso_reset(void);
 
+/** \brief  Initialize the ISO9660 file system with custom cache sizes.
+
+    The file system is normally initialized with fs_iso9660_init() when KOS
+    starts up, which uses 16 blocks (of 2048 bytes each) for each cache. To use
+    different sizes, shut the file system down with fs_iso9660_shutdown() and
+    initialize it again with this function.
+
+    Directory lookups go through the inode cache, and file reads that can't be
+    streamed straight into the caller's buffer go through the data cache, so
+    the inode cache can be made larger for directory-heavy workloads without
+    having it evicted by file data.
+
+    \param  inode_blocks    Number of blocks in the inode (directory) cache,
+                            or 0 for the default.
+    \param  data_blocks     Number of blocks in the data cache, or 0 for the
+                            default.
+
+    \retval 0               On success.
+    \retval -1              If the caches could not be allocated.
+*/
+int fs_iso9660_init_ex(int inode_blocks, int data_blocks);
+
 /* \cond */
 int fs_iso9660_init(void);
 int fs_iso9660_shutdown(void);
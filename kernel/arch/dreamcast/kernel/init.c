@@ -113,6 +113,9 @@ int  __attribute__((weak)) arch_auto_init(void) {
 
     thd_init();
 
+    if(__kos_init_flags & INIT_THD_TICKLESS)
+        thd_set_tickless(1);
+
     nmmgr_init();
 
     fs_init();          /* VFS */
@@ -50,12 +50,17 @@ int timer_prime(int which, uint32 speed, int interrupts) {
     return 0;
 }
 
-/* Works like timer_prime, but takes an interval in milliseconds
+/* Works like timer_prime, but takes an interval in microseconds
    instead of a rate. Used by the primary timer stuff. */
-static int timer_prime_wait(int which, uint32 millis, int interrupts) {
-    /* Calculate the countdown, formula is P0 * millis/64000. We
-       rearrange the math a bit here to avoid integer overflows. */
-    uint32 cd = (50000000 / 64) * millis / 1000;
+static int timer_prime_wait(int which, uint32 usecs, int interrupts) {
+    /* Calculate the countdown, formula is P0 * usecs/64000000. With P0 at
+       50MHz, that reduces to usecs * 25/32, which can't overflow since usecs
+       is never more than one second here. */
+    uint32 cd = usecs * 25 / 32;
+
+    /* Never program a zero countdown */
+    if(cd == 0)
+        cd = 1;
 
     /* P0/64 scalar, maybe interrupts */
     if(interrupts)
@@ -205,17 +210,17 @@ uint64 timer_us_gettime64(void) {
 
 /* Primary kernel timer. What we'll do here is handle actual timer IRQs
    internally, and call the callback only after the appropriate number of
-   millis has passed. For the DC you can't have timers spaced out more
+   micros has passed. For the DC you can't have timers spaced out more
    than about one second, so we emulate longer waits with a counter. */
 static timer_primary_callback_t tp_callback;
-static uint32 tp_ms_remaining;
+static uint64 tp_us_remaining;
 
 /* IRQ handler for the primary timer interrupt. */
 static void tp_handler(irq_t src, irq_context_t * cxt) {
     (void)src;
 
     /* Are we at zero? */
-    if(tp_ms_remaining == 0) {
+    if(tp_us_remaining == 0) {
         /* Disable any further timer events. The callback may
            re-enable them of course. */
         timer_stop(TMU0);
@@ -225,16 +230,16 @@ static void tp_handler(irq_t src, irq_context_t * cxt) {
         if(tp_callback)
             tp_callback(cxt);
     } /* Do we have less than a second remaining? */
-    else if(tp_ms_remaining < 1000) {
+    else if(tp_us_remaining < 1000000) {
         /* Schedule a "last leg" timer. */
         timer_stop(TMU0);
-        timer_prime_wait(TMU0, tp_ms_remaining, 1);
+        timer_prime_wait(TMU0, (uint32)tp_us_remaining, 1);
         timer_clear(TMU0);
         timer_start(TMU0);
-        tp_ms_remaining = 0;
+        tp_us_remaining = 0;
     } /* Otherwise, we're just counting down. */
     else {
-        tp_ms_remaining -= 1000;
+        tp_us_remaining -= 1000000;
     }
 }
 
@@ -260,31 +265,45 @@ timer_primary_callback_t timer_primary_set_callback(timer_primary_callback_t cb)
     return cbold;
 }
 
-void timer_primary_wakeup(uint32 millis) {
-    /* Don't allow zero */
-    if(millis == 0) {
-        assert_msg(millis != 0, "Received invalid wakeup delay");
-        millis++;
-    }
-
+static void timer_primary_wakeup_common(uint64 usecs) {
     /* Make sure we stop any previous wakeup */
     timer_stop(TMU0);
 
     /* If we have less than a second to wait, then just schedule the
        timeout event directly. Otherwise schedule a periodic second
        timer. We'll replace this on the last leg in the IRQ. */
-    if(millis >= 1000) {
-        timer_prime_wait(TMU0, 1000, 1);
+    if(usecs >= 1000000) {
+        timer_prime_wait(TMU0, 1000000, 1);
         timer_clear(TMU0);
         timer_start(TMU0);
-        tp_ms_remaining = millis - 1000;
+        tp_us_remaining = usecs - 1000000;
     }
     else {
-        timer_prime_wait(TMU0, millis, 1);
+        timer_prime_wait(TMU0, (uint32)usecs, 1);
         timer_clear(TMU0);
         timer_start(TMU0);
-        tp_ms_remaining = 0;
+        tp_us_remaining = 0;
+    }
+}
+
+void timer_primary_wakeup(uint32 millis) {
+    /* Don't allow zero */
+    if(millis == 0) {
+        assert_msg(millis != 0, "Received invalid wakeup delay");
+        millis++;
     }
+
+    timer_primary_wakeup_common((uint64)millis * 1000);
+}
+
+void timer_primary_wakeup_us(uint32 usecs) {
+    /* Don't allow zero */
+    if(usecs == 0) {
+        assert_msg(usecs != 0, "Received invalid wakeup delay");
+        usecs++;
+    }
+
+    timer_primary_wakeup_common(usecs);
 }
 
 
@@ -166,6 +166,8 @@ static void fs_hnd_ref(fs_hnd_t * ref) {
     ref->refcnt++;
 }
 
+extern void __poll_hnd_closed(vfs_handler_t *hndl, void *hnd);
+
 /* Unreference a file handle. Should be called when a persistent reference
    to a raw handle is no longer applicable. This function may destroy the
    file handle, so under no circumstances should you presume that it will
@@ -178,6 +180,10 @@ static int fs_hnd_unref(fs_hnd_t * ref) {
 
     if(ref->refcnt == 0) {
         if(ref->handler != NULL) {
+            /* Nobody polling on it should hear about whatever gets this
+               handle next. */
+            __poll_hnd_closed(ref->handler, ref->hnd);
+
             if(ref->handler->close == NULL) return retval;
 
             retval = ref->handler->close(ref->hnd);
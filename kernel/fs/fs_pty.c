@@ -35,12 +35,14 @@ or space present.
 #include <stdio.h>
 #include <assert.h>
 #include <errno.h>
+#include <poll.h>
 
 /* pty buffer size */
 #define PTY_BUFFER_SIZE 1024
 
 /* Forward-declare some stuff */
 struct ptyhalf;
+struct pipefd;
 typedef LIST_HEAD(ptylist, ptyhalf) ptylist_t;
 
 /* This struct represents one half of a pty. Each end is openable as a
@@ -61,6 +63,8 @@ typedef struct ptyhalf {
 
     mutex_t     mutex;
     condvar_t   ready_read, ready_write;
+
+    LIST_HEAD(pipefdlist, pipefd) fds;  /* Files open on this end (for poll) */
 } ptyhalf_t;
 
 /* Our global pty list */
@@ -85,6 +89,9 @@ typedef struct dirlist {
 
 /* We'll have one of these for each opened pipe */
 typedef struct pipefd {
+    /* Our entry in the ptyhalf's list of open files */
+    LIST_ENTRY(pipefd) list;
+
     /* Our directory or pty */
     union {
         ptyhalf_t   * p;
@@ -369,14 +376,16 @@ static void * pty_open_file(const char * fn, int mode) {
     }
     memset(fdobj, 0, sizeof(pipefd_t));
 
+    fdobj->d.p = ph;
+    fdobj->type = PF_PTY;
+    fdobj->mode = mode;
+
     /* Now add a refcnt and return it */
     mutex_lock(&ph->mutex);
     ph->refcnt++;
+    LIST_INSERT_HEAD(&ph->fds, fdobj, list);
     mutex_unlock(&ph->mutex);
 
-    fdobj->d.p = ph;
-    fdobj->type = PF_PTY;
-    fdobj->mode = mode;
     return (void *)fdobj;
 }
 
@@ -405,9 +414,25 @@ static void * pty_open(vfs_handler_t * vfs, const char * fn, int mode) {
     }
 }
 
+extern void __poll_event_trigger_hnd(vfs_handler_t *hndl, void *hnd,
+                                     short event);
+static vfs_handler_t vh;
+
+/* Let anyone polling on an end of a pty know about an event on it. The
+   ptyhalf's mutex must be held. */
+static void pty_trigger(ptyhalf_t * ph, short event) {
+    pipefd_t * fdobj;
+
+    LIST_FOREACH(fdobj, &ph->fds, list) {
+        __poll_event_trigger_hnd(&vh, fdobj, event);
+    }
+}
+
 /* Close pty or dirlist */
 static int pty_close(void * h) {
     pipefd_t * fdobj;
+    ptyhalf_t * other;
+    int hup = 0;
 
     assert(h);
     fdobj = (pipefd_t *)h;
@@ -420,15 +445,36 @@ static int pty_close(void * h) {
             mutex_lock(&fdobj->d.p->mutex);
 
         fdobj->d.p->refcnt--;
+        LIST_REMOVE(fdobj, list);
 
         if(fdobj->d.p->refcnt <= 0) {
             /* Unblock anyone who might be waiting on the other end */
             cond_broadcast(&fdobj->d.p->other->ready_read);
             cond_broadcast(&fdobj->d.p->ready_write);
+            hup = 1;
         }
 
         mutex_unlock(&fdobj->d.p->mutex);
 
+        /* Tell anyone polling on the other end that we're gone. If we're in
+           an interrupt and can't get the lock, they don't get woken up, but
+           they'll still see the hangup the next time they check. */
+        if(hup) {
+            other = fdobj->d.p->other;
+
+            if(!irq_inside_int()) {
+                mutex_lock(&other->mutex);
+            }
+            else if(mutex_trylock(&other->mutex)) {
+                other = NULL;
+            }
+
+            if(other) {
+                pty_trigger(other, POLLHUP);
+                mutex_unlock(&other->mutex);
+            }
+        }
+
         pty_destroy_unused();
     }
     else {
@@ -540,6 +586,13 @@ static ssize_t pty_read(void * h, void * buf, size_t bytes) {
 
     /* Wake anyone waiting for write space */
     cond_broadcast(&ph->ready_write);
+    mutex_unlock(&ph->mutex);
+
+    /* The files that can write to us are the ones on the other end. */
+    mutex_lock(&ph->other->mutex);
+    pty_trigger(ph->other, POLLWRNORM);
+    mutex_unlock(&ph->other->mutex);
+    return bytes;
 
 done:
     mutex_unlock(&ph->mutex);
@@ -607,6 +660,7 @@ static ssize_t pty_write(void * h, const void * buf, size_t bytes) {
 
     /* Wake anyone waiting on read */
     cond_broadcast(&ph->ready_read);
+    pty_trigger(ph, POLLRDNORM);
 
 done:
     mutex_unlock(&ph->mutex);
@@ -710,6 +764,33 @@ static int pty_fcntl(void *h, int cmd, va_list ap) {
     return rv;
 }
 
+/* Check for events on a pty endpoint */
+static short pty_poll(void * h, short events) {
+    pipefd_t * fdobj = (pipefd_t *)h;
+    ptyhalf_t * ph;
+    short rv = 0;
+
+    if(fdobj->type != PF_PTY)
+        return POLLNVAL;
+
+    ph = fdobj->d.p;
+
+    /* The unattached console can't tell without reading, so call it ready. */
+    if(ph->id == 0 && !ph->master && ph->other->refcnt == 0)
+        return events & (POLLRDNORM | POLLWRNORM);
+
+    if(ph->other->refcnt <= 0)
+        rv |= POLLHUP;
+
+    if(ph->cnt || (rv & POLLHUP))
+        rv |= POLLRDNORM;
+
+    if(ph->other->cnt < PTY_BUFFER_SIZE)
+        rv |= POLLWRNORM;
+
+    return rv & (events | POLLHUP);
+}
+
 static int pty_fstat(void *h, struct stat *st) {
     pipefd_t *fd = (pipefd_t *)h;
 
@@ -765,7 +846,7 @@ static vfs_handler_t vh = {
     NULL,
     NULL,
     pty_fcntl,
-    NULL,
+    pty_poll,
     NULL,
     NULL,
     NULL,
@@ -14,13 +14,22 @@ many operating systems would do, this file system keeps the directory structure
 and file data in allocated chunks of RAM. This also means that the ramdisk can
 get as big as the memory available, there's no arbitrary limit.
 
+File data is kept in a list of extents rather than in one big block, so that
+growing a file never has to copy what was already written. Each new extent is
+as big as the whole file was before it (up to a limit), so a file that keeps
+getting appended to only ends up with a handful of them. Things that need the
+data in one piece (like mmap) squash the extents back together on demand.
+
 A note of warning about thread usage here as well. This FS is protected against
 thread contention at a file handle and data structure level. This means that the
-directory structures and the file handles will never become inconsistent. However,
-it is not protected at the individual file level. Because of this limitation, only
-one file handle may be open to an individual file for writing at any given time.
-If the file is already open for reading, it cannot be written to. Likewise, if
-the file is open for writing, you can't open it for reading or writing.
+directory structures and the file handles will never become inconsistent. The
+directory structures and the file handle table are protected by one mutex, and
+each file's data is protected by a mutex of its own, so that accessing one file
+doesn't hold up access to any others. However, there is no locking of ranges
+within a file. Because of this limitation, only one file handle may be open to
+an individual file for writing at any given time. If the file is already open
+for reading, it cannot be written to. Likewise, if the file is open for writing,
+you can't open it for reading or writing.
 
 So for example, if you wanted to cache an MP3 in the ramdisk, you'd copy the data
 to the ramdisk in write mode, then close the file and let the library re-open it
@@ -50,25 +59,41 @@ cache data from disk rather than as a general purpose file system.
 char *strdup(const char *);
 #endif
 
+/* A piece of file data */
+typedef struct rd_extent {
+    uint8   * data;     /* Data block -- allocated */
+    uint32  size;       /* Size of the data block */
+} rd_extent_t;
+
+/* All files start out with a 1K extent. Each extent added after that is as big
+   as all of the ones before it put together, but no bigger than the maximum
+   (to keep from needing huge contiguous blocks of memory). */
+#define RD_EXTENT_FIRST 1024
+#define RD_EXTENT_MAX   (256 * 1024)
+
 /* File definition */
 typedef struct rd_file {
     char    * name;     /* File name -- allocated */
     uint32  size;       /* Actual file size */
     int type;       /* File type */
     int openfor;    /* Lock constant */
-    int usage;      /* Usage count (unopened is 0) */
-
-    /* For the following two members:
-      - In files, this is a block of allocated memory containing the
-        actual file data. Each time we need to expand it beyond its
-        current capacity, we realloc() with enough to hold the new
-        data plus 4k (to avoid realloc thrashing). All files start
-        out with a 1K block of space.
-      - In directories, this is just a pointer to an rd_dir struct,
-        which is defined below. datasize has no meaning for a
-        directory. */
-    void    * data;     /* Data block pointer */
-    uint32  datasize;   /* Size of data block pointer */
+    int usage;      /* Usage count (unopened is 0), which also counts
+                       threads waiting on the lock to use a handle */
+
+    /* For the following members:
+      - In files, ext is an array of extcnt blocks of allocated memory
+        containing the actual file data, in order. datasize is the total
+        size of all of them. The array itself has space for extmax
+        entries.
+      - In directories, data is just a pointer to an rd_dir struct, which
+        is defined below. The rest have no meaning for a directory. */
+    void    * data;     /* Directory pointer */
+    rd_extent_t * ext;      /* Data extents */
+    int extcnt;     /* Number of extents in use */
+    int extmax;     /* Number of extents allocated */
+    uint32  datasize;   /* Size of all the data extents */
+
+    mutex_t lock;       /* Protects everything above but the name */
 
     LIST_ENTRY(rd_file) dirlist;    /* Directory list entry */
 } rd_file_t;
@@ -98,9 +123,213 @@ static struct {
     int         omode;      /* Open mode */
 } fh[FS_RAMDISK_MAX_FILES];
 
-/* Mutex for file system structs */
+/* Mutex for file system structs, and the usage counts. Nobody waits for a
+   file's lock while holding this, since one slow operation on one file would
+   hold up everything else; a file is kept from being unlinked while someone is
+   waiting for its lock by counting them in its usage count instead. This can be
+   taken while holding a file's lock, though. */
 static mutex_t rd_mutex;
 
+/* Free all of a file's data. */
+static void ramdisk_free_data(rd_file_t * f) {
+    int i;
+
+    for(i = 0; i < f->extcnt; ++i)
+        free(f->ext[i].data);
+
+    free(f->ext);
+    f->ext = NULL;
+    f->extcnt = f->extmax = 0;
+    f->datasize = 0;
+}
+
+/* Add an extent of the given size to the end of a file's data. */
+static int ramdisk_add_extent(rd_file_t * f, void * data, uint32 size) {
+    rd_extent_t *ne;
+    int nmax;
+
+    if(f->extcnt == f->extmax) {
+        nmax = f->extmax ? f->extmax * 2 : 4;
+        ne = (rd_extent_t *)realloc(f->ext, nmax * sizeof(rd_extent_t));
+
+        if(ne == NULL)
+            return -1;
+
+        f->ext = ne;
+        f->extmax = nmax;
+    }
+
+    f->ext[f->extcnt].data = (uint8 *)data;
+    f->ext[f->extcnt].size = size;
+    f->extcnt++;
+    f->datasize += size;
+
+    return 0;
+}
+
+/* Reset a file to be empty, with just the initial 1K extent. */
+static int ramdisk_reset_data(rd_file_t * f) {
+    void *data;
+
+    ramdisk_free_data(f);
+    f->size = 0;
+
+    if(!(data = malloc(RD_EXTENT_FIRST)))
+        return -1;
+
+    if(ramdisk_add_extent(f, data, RD_EXTENT_FIRST) < 0) {
+        free(data);
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Make sure a file has room for at least the given amount of data. */
+static int ramdisk_grow(rd_file_t * f, uint32 need) {
+    uint32 size;
+    void *data;
+
+    if(need <= f->datasize)
+        return 0;
+
+    size = f->datasize;
+
+    if(size > RD_EXTENT_MAX)
+        size = RD_EXTENT_MAX;
+
+    if(size < need - f->datasize)
+        size = (need - f->datasize + 1023) & ~1023;
+
+    if(!(data = malloc(size)))
+        return -1;
+
+    if(ramdisk_add_extent(f, data, size) < 0) {
+        free(data);
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Copy data into or out of a file at the given offset. The file must already
+   be big enough. */
+static void ramdisk_copy(rd_file_t * f, uint32 off, void * buf, size_t bytes,
+                         int write) {
+    uint8 *b = (uint8 *)buf;
+    uint32 n;
+    int i;
+
+    for(i = 0; i < f->extcnt && bytes; ++i) {
+        if(off >= f->ext[i].size) {
+            off -= f->ext[i].size;
+            continue;
+        }
+
+        n = f->ext[i].size - off;
+
+        if(n > bytes)
+            n = bytes;
+
+        if(write)
+            memcpy(f->ext[i].data + off, b, n);
+        else
+            memcpy(b, f->ext[i].data + off, n);
+
+        b += n;
+        bytes -= n;
+        off = 0;
+    }
+}
+
+/* Squash a file's data down into one block, so it can be handed out as is. */
+static int ramdisk_flatten(rd_file_t * f) {
+    uint32 size = f->size ? f->size : RD_EXTENT_FIRST;
+    uint8 *data;
+    int i;
+
+    if(f->extcnt == 1)
+        return 0;
+
+    if(!(data = (uint8 *)malloc(size)))
+        return -1;
+
+    if(!f->extmax && ramdisk_add_extent(f, NULL, 0) < 0) {
+        free(data);
+        return -1;
+    }
+
+    ramdisk_copy(f, 0, data, f->size, 0);
+
+    /* Keep the extent array around, so this can't fail past this point. */
+    for(i = 0; i < f->extcnt; ++i)
+        free(f->ext[i].data);
+
+    f->ext[0].data = data;
+    f->ext[0].size = size;
+    f->extcnt = 1;
+    f->datasize = size;
+
+    return 0;
+}
+
+/* Drop a reference on a file. If it was the last one, nobody has the file open
+   anymore, so remove the openfor status. Assumes we hold rd_mutex. */
+static void ramdisk_put_file(rd_file_t * f) {
+    f->usage--;
+    assert(f->usage >= 0);
+
+    if(f->usage == 0)
+        f->openfor = OPENFOR_NOTHING;
+}
+
+/* Unlock a file locked by ramdisk_lock_fd, and drop the reference that was
+   taken on it while waiting for the lock. */
+static void ramdisk_unlock_file(rd_file_t * f) {
+    mutex_unlock(&f->lock);
+
+    mutex_lock(&rd_mutex);
+    ramdisk_put_file(f);
+    mutex_unlock(&rd_mutex);
+}
+
+/* Look up an open file handle and lock the file behind it. If dir is 0, the
+   handle must be for a file, if it is 1 it must be for a directory, and if it
+   is -1, it can be either. Unlock it with ramdisk_unlock_file. */
+static rd_file_t *ramdisk_lock_fd(file_t fd, int dir) {
+    rd_file_t *f;
+
+    mutex_lock(&rd_mutex);
+
+    if(fd >= FS_RAMDISK_MAX_FILES || fh[fd].file == NULL ||
+       (dir >= 0 && !fh[fd].dir != !dir)) {
+        mutex_unlock(&rd_mutex);
+        errno = EBADF;
+        return NULL;
+    }
+
+    /* Take a reference, so the file stays around while we wait for it. */
+    f = fh[fd].file;
+    f->usage++;
+    mutex_unlock(&rd_mutex);
+
+    mutex_lock(&f->lock);
+
+    /* The handle may have been closed while we were waiting. */
+    mutex_lock(&rd_mutex);
+
+    if(fh[fd].file != f) {
+        ramdisk_put_file(f);
+        mutex_unlock(&rd_mutex);
+        mutex_unlock(&f->lock);
+        errno = EBADF;
+        return NULL;
+    }
+
+    mutex_unlock(&rd_mutex);
+    return f;
+}
+
 /* Search a directory for the named file; return the struct if
    we find it. Assumes we hold rd_mutex. */
 static rd_file_t * ramdisk_find(rd_dir_t * parent, const char * name, int namelen) {
@@ -216,32 +445,45 @@ static rd_file_t * ramdisk_create_file(rd_dir_t * parent, const char * fn, int d
     f->type = dir ? STAT_TYPE_DIR : STAT_TYPE_FILE;
     f->openfor = OPENFOR_NOTHING;
     f->usage = 0;
+    f->data = NULL;
+    f->ext = NULL;
+    f->extcnt = f->extmax = 0;
+    f->datasize = 0;
 
     if(!dir) {
-        f->data = malloc(1024);
-        f->datasize = 1024;
+        if(ramdisk_reset_data(f) < 0) {
+            ramdisk_free_data(f);
+            free(f->name);
+            free(f);
+            return NULL;
+        }
     }
     else {
         f->data = malloc(sizeof(rd_dir_t));
-        f->datasize = 0;
-    }
 
-    if(f->data == NULL) {
-        free(f->name);
-        free(f);
-        return NULL;
+        if(f->data == NULL) {
+            free(f->name);
+            free(f);
+            return NULL;
+        }
+
+        LIST_INIT((rd_dir_t *)f->data);
     }
 
+    mutex_init(&f->lock, MUTEX_TYPE_NORMAL);
     LIST_INSERT_HEAD(pdir, f, dirlist);
 
     return f;
 }
 
 /* Open a file or directory */
+static int ramdisk_close(void * h);
+
 static void * ramdisk_open(vfs_handler_t * vfs, const char *fn, int mode) {
     file_t      fd = -1;
     rd_file_t   *f;
     int     mm = mode & O_MODE_MASK;
+    int     rv;
 
     (void)vfs;
 
@@ -314,14 +556,6 @@ static void * ramdisk_open(vfs_handler_t * vfs, const char *fn, int mode) {
 
         if(mode & O_APPEND)
             fh[fd].ptr = f->size;
-        /* If we're opening with O_TRUNC, kill the existing contents */
-        else if(mode & O_TRUNC) {
-            free(f->data);
-            f->data = malloc(1024);
-            f->datasize = 1024;
-            f->size = 0;
-            fh[fd].ptr = 0;
-        }
         else
             fh[fd].ptr = 0;
     }
@@ -337,9 +571,23 @@ static void * ramdisk_open(vfs_handler_t * vfs, const char *fn, int mode) {
 
     /* Increase the usage count */
     f->usage++;
+    mutex_unlock(&rd_mutex);
+
+    /* If we're opening with O_TRUNC, kill the existing contents. Nobody else
+       has the file open, but someone might still be finishing up with it
+       through a handle that was just closed, so it needs to be locked. */
+    if((mode & O_TRUNC) && !(mode & O_APPEND) && mm != O_RDONLY) {
+        mutex_lock(&f->lock);
+        rv = ramdisk_reset_data(f);
+        mutex_unlock(&f->lock);
+
+        if(rv < 0) {
+            ramdisk_close((void *)fd);
+            return NULL;
+        }
+    }
 
     /* Should do it... */
-    mutex_unlock(&rd_mutex);
     return (void *)fd;
 
 error_out:
@@ -363,14 +611,10 @@ static int ramdisk_close(void * h) {
         f = fh[fd].file;
         fh[fd].file = NULL;
 
-        /* Decrease the usage count */
-        f->usage--;
-        assert(f->usage >= 0);
-
-        /* If the usage count is back to 0, then no one has the file
-           open. Remove the openfor status. */
-        if(f->usage == 0)
-            f->openfor = OPENFOR_NOTHING;
+        /* Anyone still using the handle has a reference of their own, so the
+           file won't be unlinked (or opened for writing) until they're done
+           with it. */
+        ramdisk_put_file(f);
     }
 
     mutex_unlock(&rd_mutex);
@@ -379,62 +623,57 @@ static int ramdisk_close(void * h) {
 
 /* Read from a file */
 static ssize_t ramdisk_read(void * h, void *buf, size_t bytes) {
-    ssize_t rv = -1;
     file_t  fd = (file_t)h;
+    rd_file_t *f;
 
-    mutex_lock(&rd_mutex);
+    if(!(f = ramdisk_lock_fd(fd, 0)))
+        return -1;
 
-    /* Check that the fd is valid */
-    if(fd < FS_RAMDISK_MAX_FILES && fh[fd].file != NULL && !fh[fd].dir) {
-        /* Is there enough left? */
-        if((fh[fd].ptr + bytes) > fh[fd].file->size)
-            bytes = fh[fd].file->size - fh[fd].ptr;
+    /* Is there enough left? */
+    if((fh[fd].ptr + bytes) > f->size)
+        bytes = f->size - fh[fd].ptr;
 
-        /* Copy out the requested amount */
-        memcpy(buf, ((uint8 *)fh[fd].file->data) + fh[fd].ptr, bytes);
-        fh[fd].ptr += bytes;
+    /* Copy out the requested amount */
+    ramdisk_copy(f, fh[fd].ptr, buf, bytes, 0);
+    fh[fd].ptr += bytes;
 
-        rv = bytes;
-    }
-
-    mutex_unlock(&rd_mutex);
-    return rv;
+    ramdisk_unlock_file(f);
+    return bytes;
 }
 
 /* Write to a file */
 static ssize_t ramdisk_write(void * h, const void *buf, size_t bytes) {
     ssize_t rv = -1;
     file_t  fd = (file_t)h;
+    rd_file_t *f;
 
-    mutex_lock(&rd_mutex);
-
-    /* Check that the fd is valid */
-    if(fd < FS_RAMDISK_MAX_FILES && fh[fd].file != NULL && !fh[fd].dir && fh[fd].file->openfor == OPENFOR_WRITE) {
-        /* Is there enough left? */
-        if((fh[fd].ptr + bytes) > fh[fd].file->datasize) {
-            /* We need to realloc the block */
-            void * np = realloc(fh[fd].file->data, (fh[fd].ptr + bytes) + 4096);
-
-            if(np == NULL)
-                goto error_out;
+    if(!(f = ramdisk_lock_fd(fd, 0)))
+        return -1;
 
-            fh[fd].file->data = np;
-            fh[fd].file->datasize = (fh[fd].ptr + bytes) + 4096;
-        }
+    if(f->openfor != OPENFOR_WRITE) {
+        errno = EBADF;
+        goto error_out;
+    }
 
-        /* Copy out the requested amount */
-        memcpy(((uint8 *)fh[fd].file->data) + fh[fd].ptr, buf, bytes);
-        fh[fd].ptr += bytes;
+    /* Make sure there's enough space; this just adds a new extent on the end
+       if there isn't, so nothing that's already there gets moved. */
+    if(ramdisk_grow(f, fh[fd].ptr + bytes) < 0) {
+        errno = ENOSPC;
+        goto error_out;
+    }
 
-        if(fh[fd].file->size < fh[fd].ptr) {
-            fh[fd].file->size = fh[fd].ptr;
-        }
+    /* Copy in the requested amount */
+    ramdisk_copy(f, fh[fd].ptr, (void *)buf, bytes, 1);
+    fh[fd].ptr += bytes;
 
-        rv = bytes;
+    if(f->size < fh[fd].ptr) {
+        f->size = fh[fd].ptr;
     }
 
+    rv = bytes;
+
 error_out:
-    mutex_unlock(&rd_mutex);
+    ramdisk_unlock_file(f);
     return rv;
 }
 
@@ -442,23 +681,18 @@ error_out:
 static off_t ramdisk_seek(void * h, off_t offset, int whence) {
     off_t   rv = -1;
     file_t  fd = (file_t)h;
-
-    mutex_lock(&rd_mutex);
+    rd_file_t *f;
 
     /* Check that the fd is valid */
-    if(fd >= FS_RAMDISK_MAX_FILES || !fh[fd].file || fh[fd].dir) {
-        errno = EBADF;
-        mutex_unlock(&rd_mutex);
+    if(!(f = ramdisk_lock_fd(fd, 0)))
         return -1;
-    }
 
     /* Update current position according to arguments */
     switch(whence) {
         case SEEK_SET:
             if(offset < 0) {
                 errno = EINVAL;
-                mutex_unlock(&rd_mutex);
-                return -1;
+                goto out;
             }
 
             fh[fd].ptr = offset;
@@ -467,63 +701,62 @@ static off_t ramdisk_seek(void * h, off_t offset, int whence) {
         case SEEK_CUR:
             if(offset < 0 && ((uint32)-offset) > fh[fd].ptr) {
                 errno = EINVAL;
-                mutex_unlock(&rd_mutex);
-                return -1;
+                goto out;
             }
 
             fh[fd].ptr += offset;
             break;
 
         case SEEK_END:
-            if(offset < 0 && ((uint32)-offset) > fh[fd].file->size) {
+            if(offset < 0 && ((uint32)-offset) > f->size) {
                 errno = EINVAL;
-                mutex_unlock(&rd_mutex);
-                return -1;
+                goto out;
             }
 
-            fh[fd].ptr = fh[fd].file->size + offset;
+            fh[fd].ptr = f->size + offset;
             break;
 
         default:
             errno = EINVAL;
-            mutex_unlock(&rd_mutex);
-            return -1;
+            goto out;
     }
 
     /* Check bounds */
     // XXXX: Technically this isn't correct. Fix it sometime.
-    if(fh[fd].ptr > fh[fd].file->size) fh[fd].ptr = fh[fd].file->size;
+    if(fh[fd].ptr > f->size) fh[fd].ptr = f->size;
 
     rv = fh[fd].ptr;
-    mutex_unlock(&rd_mutex);
+
+out:
+    ramdisk_unlock_file(f);
     return rv;
 }
 
 /* Tell where in the file we are */
 static off_t ramdisk_tell(void * h) {
-    off_t   rv = -1;
+    off_t   rv;
     file_t  fd = (file_t)h;
+    rd_file_t *f;
 
-    mutex_lock(&rd_mutex);
-
-    if(fd < FS_RAMDISK_MAX_FILES && fh[fd].file != NULL && !fh[fd].dir)
-        rv = fh[fd].ptr;
+    if(!(f = ramdisk_lock_fd(fd, 0)))
+        return -1;
 
-    mutex_unlock(&rd_mutex);
+    rv = fh[fd].ptr;
+    ramdisk_unlock_file(f);
     return rv;
 }
 
 /* Tell how big the file is */
 static size_t ramdisk_total(void * h) {
-    off_t   rv = -1;
+    off_t   rv;
     file_t  fd = (file_t)h;
+    rd_file_t *f;
 
-    mutex_lock(&rd_mutex);
-
-    if(fd < FS_RAMDISK_MAX_FILES && fh[fd].file != NULL && !fh[fd].dir)
-        rv = fh[fd].file->size;
+    if(!(f = ramdisk_lock_fd(fd, 0)))
+        return -1;
 
-    mutex_unlock(&rd_mutex);
+    rv = f->size;
+    ramdisk_unlock_file(f);
     return rv;
 }
 
@@ -580,7 +813,8 @@ static int ramdisk_unlink(vfs_handler_t * vfs, const char *fn) {
         if(f->usage == 0) {
             /* Free its data */
             free(f->name);
-            free(f->data);
+            ramdisk_free_data(f);
+            mutex_destroy(&f->lock);
 
             /* Remove it from the parent list */
             LIST_REMOVE(f, dirlist);
@@ -598,14 +832,20 @@ static int ramdisk_unlink(vfs_handler_t * vfs, const char *fn) {
 static void * ramdisk_mmap(void * h) {
     void    * rv = NULL;
     file_t  fd = (file_t)h;
+    rd_file_t *f;
 
-    mutex_lock(&rd_mutex);
+    if(!(f = ramdisk_lock_fd(fd, 0)))
+        return NULL;
 
-    if(fd < FS_RAMDISK_MAX_FILES && fh[fd].file != NULL && !fh[fd].dir) {
-        rv = fh[fd].file->data;
-    }
+    /* The data has to be in one piece to hand it out. Note that, much like
+       before, writing to the file after this may add more extents, and then
+       the returned block won't have all of the file in it anymore. */
+    if(ramdisk_flatten(f) < 0)
+        errno = ENOMEM;
+    else
+        rv = f->ext[0].data;
 
-    mutex_unlock(&rd_mutex);
+    ramdisk_unlock_file(f);
 
     return rv;
 }
@@ -613,7 +853,6 @@ static void * ramdisk_mmap(void * h) {
 static int ramdisk_stat(vfs_handler_t *vfs, const char *path, struct stat *buf,
                         int flag) {
     rd_file_t *f;
-    int rv = -1;
 
     (void)vfs;
     (void)flag;
@@ -623,47 +862,51 @@ static int ramdisk_stat(vfs_handler_t *vfs, const char *path, struct stat *buf,
     /* Find the file */
     f = ramdisk_find_path(rootdir, path, 0);
 
-    if(f) {
-        memset(buf, 0, sizeof(struct stat));
-        buf->st_dev = (dev_t)('r' | ('a' << 8) | ('m' << 16));
-        buf->st_mode = S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH |
-            S_IWOTH;
-
-        if(f->type == STAT_TYPE_DIR)
-            buf->st_mode |= S_IFDIR;
-        else
-            buf->st_mode |= S_IFREG;
-
-        buf->st_nlink = 1;
-        buf->st_size = f->datasize;
-        buf->st_blksize = 1024;
-        buf->st_blocks = f->datasize >> 10;
-
-        if(f->datasize & 0x3ff)
-            ++buf->st_blocks;
-    }
-    else {
+    if(!f) {
+        mutex_unlock(&rd_mutex);
         errno = ENOENT;
-        rv = -1;
+        return -1;
     }
 
+    /* Hang on to it while we wait for its lock, like ramdisk_lock_fd. */
+    f->usage++;
     mutex_unlock(&rd_mutex);
-    return rv;
+
+    mutex_lock(&f->lock);
+    memset(buf, 0, sizeof(struct stat));
+    buf->st_dev = (dev_t)('r' | ('a' << 8) | ('m' << 16));
+    buf->st_mode = S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH |
+        S_IWOTH;
+
+    if(f->type == STAT_TYPE_DIR)
+        buf->st_mode |= S_IFDIR;
+    else
+        buf->st_mode |= S_IFREG;
+
+    buf->st_nlink = 1;
+    buf->st_size = f->size;
+    buf->st_blksize = 1024;
+
+    /* The blocks are what's actually allocated, which is usually more. */
+    buf->st_blocks = f->datasize >> 10;
+
+    if(f->datasize & 0x3ff)
+        ++buf->st_blocks;
+
+    ramdisk_unlock_file(f);
+    return 0;
 }
 
 static int ramdisk_fcntl(void *h, int cmd, va_list ap) {
     file_t fd = (file_t)h;
     int rv = -1;
 
-    (void)ap;
+    rd_file_t *f;
 
-    mutex_lock(&rd_mutex);
+    (void)ap;
 
-    if(fd >= FS_RAMDISK_MAX_FILES || !fh[fd].file) {
-        mutex_unlock(&rd_mutex);
-        errno = EBADF;
+    if(!(f = ramdisk_lock_fd(fd, -1)))
         return -1;
-    }
 
     switch(cmd) {
         case F_GETFL:
@@ -680,7 +923,7 @@ static int ramdisk_fcntl(void *h, int cmd, va_list ap) {
             errno = EINVAL;
     }
 
-    mutex_unlock(&rd_mutex);
+    ramdisk_unlock_file(f);
     return rv;
 }
 
@@ -708,16 +951,9 @@ static int ramdisk_fstat(void *h, struct stat *buf) {
     file_t fd = (file_t)h;
     rd_file_t *f;
 
-    mutex_lock(&rd_mutex);
-
-    if(fd >= FS_RAMDISK_MAX_FILES || !fh[fd].file) {
-        mutex_unlock(&rd_mutex);
-        errno = EBADF;
-        return -1;
-    }
-
     /* Grab the file itself... */
-    f = fh[fd].file;
+    if(!(f = ramdisk_lock_fd(fd, -1)))
+        return -1;
 
     /* Fill in the structure. */
     memset(buf, 0, sizeof(struct stat));
@@ -730,14 +966,16 @@ static int ramdisk_fstat(void *h, struct stat *buf) {
         buf->st_mode |= S_IFREG;
 
     buf->st_nlink = 1;
-    buf->st_size = f->datasize;
+    buf->st_size = f->size;
     buf->st_blksize = 1024;
+
+    /* The blocks are what's actually allocated, which is usually more. */
     buf->st_blocks = f->datasize >> 10;
 
     if(f->datasize & 0x3ff)
         ++buf->st_blocks;
 
-    mutex_unlock(&rd_mutex);
+    ramdisk_unlock_file(f);
     return 0;
 }
 
@@ -797,12 +1035,21 @@ int fs_ramdisk_attach(const char * fn, void * obj, size_t size) {
     if(fd == NULL)
         return -1;
 
-    /* Ditch the data block we had and replace it with the user one. */
-    f = fh[(int)fd].file;
-    free(f->data);
-    f->data = obj;
-    f->datasize = size;
+    /* Ditch the data we had and replace it with the user block. */
+    f = ramdisk_lock_fd((file_t)fd, 0);
+    assert(f != NULL);
+    ramdisk_free_data(f);
+
+    if(ramdisk_add_extent(f, obj, size) < 0) {
+        f->size = 0;
+        ramdisk_unlock_file(f);
+        ramdisk_close(fd);
+        ramdisk_unlink(&vh, fn);
+        return -1;
+    }
+
     f->size = size;
+    ramdisk_unlock_file(f);
 
     /* Close the file */
     ramdisk_close(fd);
@@ -826,14 +1073,24 @@ int fs_ramdisk_detach(const char * fn, void ** obj, size_t * size) {
     assert(obj != NULL);
     assert(size != NULL);
 
-    f = fh[(int)fd].file;
-    *obj = f->data;
+    f = ramdisk_lock_fd((file_t)fd, 0);
+    assert(f != NULL);
+
+    /* The data has to be in one block to give it back. */
+    if(ramdisk_flatten(f) < 0) {
+        ramdisk_unlock_file(f);
+        ramdisk_close(fd);
+        return -1;
+    }
+
+    *obj = f->ext[0].data;
     *size = f->size;
 
-    /* Ditch the data block we had and replace it with a fake one. */
-    f->data = malloc(64);
-    f->datasize = 64;
-    f->size = 64;
+    /* Forget about the block, since it isn't ours anymore. */
+    f->ext[0].data = NULL;
+    ramdisk_free_data(f);
+    f->size = 0;
+    ramdisk_unlock_file(f);
 
     /* Close the file */
     ramdisk_close(fd);
@@ -868,7 +1125,10 @@ int fs_ramdisk_init(void) {
     root->openfor = OPENFOR_NOTHING;
     root->usage = 0;
     root->data = rootdir;
+    root->ext = NULL;
+    root->extcnt = root->extmax = 0;
     root->datasize = 0;
+    mutex_init(&root->lock, MUTEX_TYPE_NORMAL);
 
     LIST_INIT(rootdir);
 
@@ -892,12 +1152,19 @@ int fs_ramdisk_shutdown(void) {
     while(f1) {
         f2 = LIST_NEXT(f1, dirlist);
         free(f1->name);
-        free(f1->data);
+
+        if(f1->type == STAT_TYPE_DIR)
+            free(f1->data);
+        else
+            ramdisk_free_data(f1);
+
+        mutex_destroy(&f1->lock);
         free(f1);
         f1 = f2;
     }
 
     free(rootdir);
+    mutex_destroy(&root->lock);
     free(root);
 
     mutex_destroy(&rd_mutex);
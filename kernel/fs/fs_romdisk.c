@@ -56,6 +56,49 @@ static uint32 ntohl_32(const void *data) {
     return (d[0] << 24) | (d[1] << 16) | (d[2] << 8) | (d[3] << 0);
 }
 
+static void htonl_32(void *data, uint32 val) {
+    uint8 *d = (uint8 *)data;
+    d[0] = (uint8)(val >> 24);
+    d[1] = (uint8)(val >> 16);
+    d[2] = (uint8)(val >> 8);
+    d[3] = (uint8)val;
+}
+
+/* Lookup index. This is an open-addressed hash table of every file and
+   directory in the image, keyed on the offset of the directory listing that
+   the entry is in and the (case-folded) name of the entry. Each slot holds
+   the directory offset and the entry offset, or zeroes if the slot is empty.
+   Everything is stored big-endian, so that the same format can be built by
+   genromfs and embedded in the image as a regular file in the root directory
+   called ROMDISK_INDEX_NAME. If an image doesn't have one, it gets built when
+   the image is mounted. */
+#define ROMDISK_INDEX_NAME  ".rdindex"
+#define ROMDISK_INDEX_MAGIC "-rdidx1-"
+
+typedef struct {
+    char    magic[8];       /* Should be ROMDISK_INDEX_MAGIC */
+    uint32  slots;          /* Number of slots (a power of two) */
+    uint32  entries;        /* Number of slots in use */
+} romdisk_idx_hdr_t;
+
+/* Hash a name in a directory. This must match the hash in genromfs. */
+static uint32 romdisk_hash(uint32 dir, const char *fn, size_t fnlen) {
+    uint32 h = 2166136261U ^ dir;
+    size_t i;
+    uint8 c;
+
+    for(i = 0; i < fnlen; ++i) {
+        c = (uint8)fn[i];
+
+        if(c >= 'A' && c <= 'Z')
+            c += 'a' - 'A';
+
+        h = (h ^ c) * 16777619U;
+    }
+
+    return h;
+}
+
 /********************************************************************************/
 
 /* A list of the following */
@@ -72,6 +115,9 @@ typedef struct rd_image {
     const romdisk_hdr_t * hdr;      /* Pointer to the header */
     uint32          files;      /* Offset in the image to the files area */
     vfs_handler_t       * vfsh;     /* Our VFS mount struct */
+    const uint8     * index;    /* Lookup index (or NULL) */
+    int         own_index;  /* Did we build the index? */
+    uint32          index_ent;  /* Offset of the index file's entry (or 0) */
 } rd_image_t;
 
 /* Global list of mounted romdisks */
@@ -146,6 +192,239 @@ static uint32 romdisk_find_object(rd_image_t * mnt, const char *fn, size_t fnlen
     return 0;
 }
 
+/* Same as romdisk_find_object, but using the lookup index if there is one. */
+static uint32 romdisk_lookup(rd_image_t * mnt, const char *fn, size_t fnlen, int dir, uint32 offset) {
+    const romdisk_idx_hdr_t *ihdr = (const romdisk_idx_hdr_t *)mnt->index;
+    const uint8             *slot;
+    const romdisk_file_t    *fhdr;
+    uint32                  mask, i, n, ent;
+
+    if(!ihdr)
+        return romdisk_find_object(mnt, fn, fnlen, dir, offset);
+
+    mask = ntohl_32(&ihdr->slots) - 1;
+    i = romdisk_hash(offset, fn, fnlen) & mask;
+
+    /* There's always an empty slot to stop at, but don't count on it. */
+    for(n = 0; n <= mask; ++n) {
+        slot = mnt->index + sizeof(romdisk_idx_hdr_t) + i * 8;
+
+        if(!(ent = ntohl_32(slot + 4)))
+            return 0;
+
+        if(ntohl_32(slot) == offset) {
+            fhdr = (const romdisk_file_t *)(mnt->image + ent);
+
+            if((ntohl_32(&fhdr->next_header) & 3) == (dir ? 1 : 2) &&
+               strlen(fhdr->filename) == fnlen &&
+               !strncasecmp(fhdr->filename, fn, fnlen))
+                return ent;
+        }
+
+        i = (i + 1) & mask;
+    }
+
+    return 0;
+}
+
+/* Add an entry to a lookup index being built. */
+static void romdisk_index_add(uint8 *idx, uint32 mask, uint32 dir, uint32 ent,
+                              const char *fn) {
+    uint32 i = romdisk_hash(dir, fn, strlen(fn)) & mask;
+    uint8 *slot;
+
+    for(;;) {
+        slot = idx + sizeof(romdisk_idx_hdr_t) + i * 8;
+
+        if(!ntohl_32(slot + 4))
+            break;
+
+        i = (i + 1) & mask;
+    }
+
+    htonl_32(slot, dir);
+    htonl_32(slot + 4, ent);
+}
+
+/* Grow one of the temporary arrays used while building the index. */
+static int romdisk_index_grow(uint32 **arr, uint32 *size, uint32 need) {
+    uint32 *tmp, nsize = *size ? *size : 64;
+
+    if(need <= *size)
+        return 0;
+
+    while(nsize < need)
+        nsize <<= 1;
+
+    if(!(tmp = (uint32 *)realloc(*arr, nsize * sizeof(uint32))))
+        return -1;
+
+    *arr = tmp;
+    *size = nsize;
+    return 0;
+}
+
+/* Build a lookup index for an image that doesn't have one embedded in it. This
+   walks the whole directory tree once, without recursion. If anything looks
+   wrong with the image (or we run out of memory), we just don't build the
+   index and lookups fall back to scanning the directories. */
+static void romdisk_build_index(rd_image_t * mnt) {
+    const romdisk_file_t *fhdr;
+    uint32 *dirs = NULL, *ents = NULL, ndirs = 0, dsize = 0, nents = 0;
+    uint32 esize = 0, limit, dir, i, ni, type, spec, slots;
+    romdisk_idx_hdr_t *ihdr;
+    uint8 *idx;
+
+    limit = ntohl_32(&mnt->hdr->full_size);
+
+    if(romdisk_index_grow(&dirs, &dsize, 1))
+        return;
+
+    dirs[ndirs++] = mnt->files;
+
+    while(ndirs) {
+        dir = i = dirs[--ndirs];
+
+        while(i) {
+            if(i >= limit || (i & 15))
+                goto out;
+
+            fhdr = (const romdisk_file_t *)(mnt->image + i);
+            ni = ntohl_32(&fhdr->next_header);
+            type = ni & 0x0f;
+
+            /* Only index the things that romdisk_find_object would match. */
+            if((type & 3) == 1 || (type & 3) == 2) {
+                if(romdisk_index_grow(&ents, &esize, (nents + 1) * 2))
+                    goto out;
+
+                ents[nents * 2] = dir;
+                ents[nents * 2 + 1] = i;
+                ++nents;
+            }
+
+            /* Descend into real subdirectories. Their contents always come
+               after them in the image, which keeps us from going around in
+               circles on the root's "." entry (or an empty directory, which
+               points at itself). */
+            spec = ntohl_32(&fhdr->spec_info);
+
+            if((type & 7) == 1 && spec > i) {
+                if(romdisk_index_grow(&dirs, &dsize, ndirs + 1))
+                    goto out;
+
+                dirs[ndirs++] = spec;
+            }
+
+            i = ni & 0xfffffff0;
+        }
+    }
+
+    /* Keep the table at most 3/4 full, so that probes stay short. */
+    slots = 16;
+
+    while(slots < nents + nents / 3 + 1)
+        slots <<= 1;
+
+    if(!(idx = (uint8 *)calloc(1, sizeof(romdisk_idx_hdr_t) + slots * 8)))
+        goto out;
+
+    ihdr = (romdisk_idx_hdr_t *)idx;
+    memcpy(ihdr->magic, ROMDISK_INDEX_MAGIC, 8);
+    htonl_32(&ihdr->slots, slots);
+    htonl_32(&ihdr->entries, nents);
+
+    for(i = 0; i < nents; ++i) {
+        fhdr = (const romdisk_file_t *)(mnt->image + ents[i * 2 + 1]);
+        romdisk_index_add(idx, slots - 1, ents[i * 2], ents[i * 2 + 1],
+                          fhdr->filename);
+    }
+
+    mnt->index = idx;
+    mnt->own_index = 1;
+
+out:
+    free(ents);
+    free(dirs);
+}
+
+/* Check that an index embedded in an image (size bytes of it, starting at
+   offset start) can be trusted: that it fits in the image, that every entry in
+   it points at something in the image, and that it has as many entries as it
+   says it does (so that there's at least one empty slot to end each probe). */
+static int romdisk_index_check(rd_image_t * mnt,
+                               const romdisk_idx_hdr_t *ihdr, uint32 start,
+                               uint32 size) {
+    uint32 limit, slots, used = 0, i, dir, ent;
+    const uint8 *slot;
+
+    limit = ntohl_32(&mnt->hdr->full_size);
+
+    if(start > limit || size > limit - start ||
+       size < sizeof(romdisk_idx_hdr_t))
+        return -1;
+
+    slots = ntohl_32(&ihdr->slots);
+
+    if(memcmp(ihdr->magic, ROMDISK_INDEX_MAGIC, 8) ||
+       !slots || (slots & (slots - 1)) ||
+       ntohl_32(&ihdr->entries) >= slots ||
+       (size - sizeof(romdisk_idx_hdr_t)) / 8 < slots)
+        return -1;
+
+    for(i = 0; i < slots; ++i) {
+        slot = (const uint8 *)ihdr + sizeof(romdisk_idx_hdr_t) + i * 8;
+        dir = ntohl_32(slot);
+        ent = ntohl_32(slot + 4);
+
+        if(!ent)
+            continue;
+
+        if(dir >= limit || (dir & 15) || (ent & 15) ||
+           ent > limit - sizeof(romdisk_file_t))
+            return -1;
+
+        ++used;
+    }
+
+    return used == ntohl_32(&ihdr->entries) ? 0 : -1;
+}
+
+/* Set up the lookup index for a newly mounted image, preferably by using the
+   one that genromfs put into it. */
+static void romdisk_setup_index(rd_image_t * mnt) {
+    const romdisk_idx_hdr_t *ihdr;
+    const romdisk_file_t *fhdr;
+    uint32 ent, start;
+
+    mnt->index = NULL;
+    mnt->own_index = 0;
+    mnt->index_ent = 0;
+
+    ent = romdisk_find_object(mnt, ROMDISK_INDEX_NAME,
+                              strlen(ROMDISK_INDEX_NAME), 0, mnt->files);
+
+    if(ent) {
+        /* Whether or not it turns out to be usable, the index file is hidden
+           from open and readdir. */
+        mnt->index_ent = ent;
+        fhdr = (const romdisk_file_t *)(mnt->image + ent);
+        start = ent + sizeof(romdisk_file_t) +
+                (strlen(fhdr->filename) / 16) * 16;
+        ihdr = (const romdisk_idx_hdr_t *)(mnt->image + start);
+
+        if(!romdisk_index_check(mnt, ihdr, start, ntohl_32(&fhdr->size))) {
+            mnt->index = (const uint8 *)ihdr;
+            return;
+        }
+
+        dbglog(DBG_WARNING, "fs_romdisk: ignoring bad lookup index in image "
+               "at %p\n", mnt->image);
+    }
+
+    romdisk_build_index(mnt);
+}
+
 /* Locate an object anywhere in the image, starting at the root, and
    expecting a fully qualified path name. This is analogous to the
    find_object_path in iso9660.
@@ -165,7 +444,7 @@ static uint32 romdisk_find(rd_image_t * mnt, const char *fn, int dir) {
 
     while((cur = strchr(fn, '/'))) {
         if(cur != fn) {
-            i = romdisk_find_object(mnt, fn, cur - fn, 1, i);
+            i = romdisk_lookup(mnt, fn, cur - fn, 1, i);
 
             if(i == 0) return 0;
 
@@ -178,7 +457,7 @@ static uint32 romdisk_find(rd_image_t * mnt, const char *fn, int dir) {
 
     /* Locate the file in the resulting directory */
     if(*fn) {
-        i = romdisk_find_object(mnt, fn, strlen(fn), dir, i);
+        i = romdisk_lookup(mnt, fn, strlen(fn), dir, i);
         return i;
     }
     else {
@@ -209,7 +488,7 @@ static void * romdisk_open(vfs_handler_t * vfs, const char *fn, int mode) {
     /* Look for the file */
     filehdr = romdisk_find(mnt, fn + 1, mode & O_DIR);
 
-    if(filehdr == 0) {
+    if(filehdr == 0 || filehdr == mnt->index_ent) {
         errno = ENOENT;
         return NULL;
     }
@@ -351,6 +630,7 @@ static size_t romdisk_total(void * h) {
 /* Read a directory entry */
 static dirent_t *romdisk_readdir(void * h) {
     romdisk_file_t *fhdr;
+    uint32 ent;
     int type;
     file_t fd = (file_t)h;
 
@@ -359,23 +639,27 @@ static dirent_t *romdisk_readdir(void * h) {
         return NULL;
     }
 
-    /* This happens if we hit the end of the directory on advancing the pointer
-       last time through. */
-    if(fh[fd].ptr == (uint32)-1)
-        return NULL;
-
-    /* Get the current file header */
-    fhdr = (romdisk_file_t *)(fh[fd].mnt->image + fh[fd].index + fh[fd].ptr);
-
-    /* Update the pointer */
-    fh[fd].ptr = ntohl_32(&fhdr->next_header);
-    type = fh[fd].ptr & 0x0f;
-    fh[fd].ptr = fh[fd].ptr & 0xfffffff0;
-
-    if(fh[fd].ptr != 0)
-        fh[fd].ptr = fh[fd].ptr - fh[fd].index;
-    else
-        fh[fd].ptr = (uint32)-1;
+    do {
+        /* This happens if we hit the end of the directory on advancing the
+           pointer last time through. */
+        if(fh[fd].ptr == (uint32)-1)
+            return NULL;
+
+        /* Get the current file header */
+        ent = fh[fd].index + fh[fd].ptr;
+        fhdr = (romdisk_file_t *)(fh[fd].mnt->image + ent);
+
+        /* Update the pointer */
+        fh[fd].ptr = ntohl_32(&fhdr->next_header);
+        type = fh[fd].ptr & 0x0f;
+        fh[fd].ptr = fh[fd].ptr & 0xfffffff0;
+
+        if(fh[fd].ptr != 0)
+            fh[fd].ptr = fh[fd].ptr - fh[fd].index;
+        else
+            fh[fd].ptr = (uint32)-1;
+    }
+    while(ent == fh[fd].mnt->index_ent);    /* Hide the lookup index */
 
     /* Copy out the requested data */
     strcpy(fh[fd].dirent.name, fhdr->filename);
@@ -570,6 +854,9 @@ int fs_romdisk_shutdown(void) {
         if(c->own_buffer)
             free((void *)c->image);
 
+        if(c->own_index)
+            free((void *)c->index);
+
         nmmgr_handler_remove(&c->vfsh->nmmgr);
         free(c->vfsh);
         free(c);
@@ -622,11 +909,15 @@ int fs_romdisk_mount(const char * mountpoint, const uint8 *img, int own_buffer)
     mnt->hdr = hdr;
     mnt->files = sizeof(romdisk_hdr_t)
                  + (strlen(hdr->volume_name) / 16) * 16;
+    romdisk_setup_index(mnt);
 
     /* Make a VFS struct */
     vfsh = (vfs_handler_t *)malloc(sizeof(vfs_handler_t));
 
     if(vfsh == NULL) {
+        if(mnt->own_index)
+            free((void *)mnt->index);
+
         free(mnt);
         errno=ENOMEM;
         return -3;
@@ -680,6 +971,9 @@ int fs_romdisk_unmount(const char * mountpoint) {
         if(n->own_buffer)
             free((void *)n->image);
 
+        if(n->own_index)
+            free((void *)n->index);
+
         /* Free the structs */
         free(n->vfsh);
         free(n);
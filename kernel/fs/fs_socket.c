@@ -508,6 +508,93 @@ ssize_t recvfrom(int sock, void *buffer, size_t length, int flags,
                                    address_len);
 }
 
+/* Receive one message for recvmmsg() with the protocol's recvfrom function,
+   filling in each of the I/O vectors in turn. Datagrams only go into the first
+   vector that has room in it. */
+static ssize_t fs_socket_recvmsg(net_socket_t *hnd, struct msghdr *msg,
+                                 int flags) {
+    ssize_t rv, total = 0;
+    int i;
+
+    msg->msg_controllen = 0;
+    msg->msg_flags = 0;
+
+    for(i = 0; i < msg->msg_iovlen; ++i) {
+        if(!msg->msg_iov[i].iov_len)
+            continue;
+
+        if(!total && msg->msg_name)
+            rv = hnd->protocol->recvfrom(hnd, msg->msg_iov[i].iov_base,
+                                         msg->msg_iov[i].iov_len, flags,
+                                         (struct sockaddr *)msg->msg_name,
+                                         &msg->msg_namelen);
+        else
+            rv = hnd->protocol->recvfrom(hnd, msg->msg_iov[i].iov_base,
+                                         msg->msg_iov[i].iov_len, flags,
+                                         NULL, NULL);
+
+        if(rv < 0)
+            return total ? total : -1;
+
+        total += rv;
+
+        if((size_t)rv < msg->msg_iov[i].iov_len ||
+           hnd->protocol->type == SOCK_DGRAM)
+            break;
+
+        /* Don't wait around for more data to fill the rest of the vectors. */
+        flags |= MSG_DONTWAIT;
+    }
+
+    return total;
+}
+
+int recvmmsg(int sock, struct mmsghdr *msgvec, unsigned int vlen, int flags,
+             struct timespec *timeout) {
+    net_socket_t *hnd;
+    unsigned int i;
+    ssize_t rv;
+
+    hnd = (net_socket_t *)fs_get_handle(sock);
+
+    if(hnd == NULL) {
+        errno = EBADF;
+        return -1;
+    }
+
+    /* Make sure this is actually a socket. */
+    if(fs_get_handler(sock) != &vh) {
+        errno = ENOTSOCK;
+        return -1;
+    }
+
+    if(msgvec == NULL) {
+        errno = EFAULT;
+        return -1;
+    }
+
+    flags &= ~MSG_WAITFORONE;
+
+    if(hnd->protocol->recvmmsg)
+        return hnd->protocol->recvmmsg(hnd, msgvec, vlen, flags, timeout);
+
+    /* The protocol doesn't do batches itself, so do it one message at a time.
+       The timeout isn't supported here, only the first message may block. */
+    for(i = 0; i < vlen; ++i) {
+        if((rv = fs_socket_recvmsg(hnd, &msgvec[i].msg_hdr, flags)) < 0)
+            return i ? (int)i : -1;
+
+        msgvec[i].msg_len = (unsigned int)rv;
+
+        if(!rv || (flags & MSG_PEEK))
+            return (int)i + 1;
+
+        flags |= MSG_DONTWAIT;
+    }
+
+    return (int)i;
+}
+
 ssize_t send(int sock, const void *message, size_t length, int flags) {
     net_socket_t *hnd;
 
@@ -9,7 +9,7 @@
 #include <errno.h>
 
 int thrd_sleep(const struct timespec *duration, struct timespec *remaining) {
-    int ms;
+    int64_t us;
 
     /* Make sure we aren't inside an interrupt first... */
     if(irq_inside_int()) {
@@ -19,17 +19,17 @@ int thrd_sleep(const struct timespec *duration, struct timespec *remaining) {
         return -1;
     }
 
-    /* Calculate the number of milliseconds to sleep for. No, you don't get
+    /* Calculate the number of microseconds to sleep for. No, you don't get
        anywhere near nanosecond precision here. */
-    ms = duration->tv_sec * 1000 + duration->tv_nsec / 1000000;
+    us = (int64_t)duration->tv_sec * 1000000 + duration->tv_nsec / 1000;
 
     /* We need to sleep for *at least* how long is specified, so if they've
-       given us a non-whole number of milliseconds, then add one to the time. */
-    if(duration->tv_nsec % 1000000)
-        ++ms;
+       given us a non-whole number of microseconds, then add one to the time. */
+    if(duration->tv_nsec % 1000)
+        ++us;
 
     /* Make sure they gave us something valid. */
-    if(ms < 0) {
+    if(us < 0) {
         if(remaining)
             *remaining = *duration;
 
@@ -37,10 +37,10 @@ int thrd_sleep(const struct timespec *duration, struct timespec *remaining) {
     }
 
     /* Sleep! */
-    thd_sleep(ms);
+    thd_sleep_us((uint64_t)us);
 
-    /* thd_sleep will always sleep for at least the specified time, so clear out
-       the remaining time, if it was given to us. */
+    /* thd_sleep_us will always sleep for at least the specified time, so
+       clear out the remaining time, if it was given to us. */
     if(remaining) {
         remaining->tv_sec = 0;
         remaining->tv_nsec = 0;
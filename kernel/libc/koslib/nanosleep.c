@@ -10,7 +10,7 @@
 #include <kos/thread.h>
 
 int nanosleep(const struct timespec *rqtp, struct timespec *rmtp) {
-    int ms;
+    int64_t us;
 
     /* Make sure we aren't inside an interrupt first... */
     if(irq_inside_int()) {
@@ -21,17 +21,17 @@ int nanosleep(const struct timespec *rqtp, struct timespec *rmtp) {
         return -1;
     }
 
-    /* Calculate the number of milliseconds to sleep for. No, you don't get
+    /* Calculate the number of microseconds to sleep for. No, you don't get
        anywhere near nanosecond precision here. */
-    ms = rqtp->tv_sec * 1000 + rqtp->tv_nsec / 1000000;
+    us = (int64_t)rqtp->tv_sec * 1000000 + rqtp->tv_nsec / 1000;
 
     /* We need to sleep for *at least* how long is specified, so if they've
-       given us a non-whole number of milliseconds, then add one to the time. */
-    if(rqtp->tv_nsec % 1000000)
-        ++ms;
+       given us a non-whole number of microseconds, then add one to the time. */
+    if(rqtp->tv_nsec % 1000)
+        ++us;
 
     /* Make sure they gave us something valid. */
-    if(ms < 0) {
+    if(us < 0) {
         if(rmtp)
             *rmtp = *rqtp;
 
@@ -40,10 +40,10 @@ int nanosleep(const struct timespec *rqtp, struct timespec *rmtp) {
     }
 
     /* Sleep! */
-    thd_sleep(ms);
+    thd_sleep_us((uint64_t)us);
 
-    /* thd_sleep will always sleep for at least the specified time, so clear out
-       the remaining time, if it was given to us. */
+    /* thd_sleep_us will always sleep for at least the specified time, so
+       clear out the remaining time, if it was given to us. */
     if(rmtp) {
         rmtp->tv_sec = 0;
         rmtp->tv_nsec = 0;
@@ -7,143 +7,679 @@
 
 #include <poll.h>
 #include <errno.h>
+#include <stdlib.h>
+#include <stdint.h>
 #include <sys/queue.h>
+#include <sys/epoll.h>
 
 #include <arch/irq.h>
+#include <arch/timer.h>
 #include <kos/fs.h>
 #include <kos/mutex.h>
-#include <kos/cond.h>
+#include <kos/genwait.h>
 
-struct poll_int {
-    LIST_ENTRY(poll_int) entry;
-    struct pollfd *fds;
-    nfds_t nfds;
-    int nmatched;
-    condvar_t cv;
-};
+/* Anything that wants to hear about events on a file (a thread blocked in
+   poll() or an epoll instance) puts a watch on the file's handle. Handles are
+   only unique within the filesystem they came from (some are just small
+   numbers), so a watch is really on the pair of the VFS handler and the handle.
+   The watches are kept in a hash table keyed by that pair, so signalling an
+   event only has to look at the watches that hash to the same bucket, rather
+   than at every file that anyone is polling on. The table is only touched with
+   interrupts disabled, so events can be signalled from inside an interrupt too.
+   It starts out with POLL_HASH_MIN buckets, and doubles in size whenever there
+   would be more watches than buckets. */
+#define POLL_HASH_MIN   64
+#define POLL_HASH(v, h) ((((uintptr_t)(h) >> 3) ^ ((uintptr_t)(h) >> 9) ^ \
+                          (uintptr_t)(h) ^ ((uintptr_t)(v) >> 4)) & \
+                         (watch_buckets - 1))
 
-LIST_HEAD(polllist, poll_int) poll_list;
+/* These are always reported, whether they were asked for or not. */
+#define POLL_ALWAYS     (POLLERR | POLLHUP | POLLNVAL)
 
-static mutex_t mutex = MUTEX_INITIALIZER;
+typedef struct poll_watch {
+    LIST_ENTRY(poll_watch) entry;
+    vfs_handler_t *hndl;        /* The filesystem the handle belongs to */
+    void *hnd;                  /* The handle being watched */
+    short events;               /* Events of interest (0 = disabled) */
+    short revents;              /* Events signalled since the last check */
+    void (*notify)(struct poll_watch *w);
+    void *owner;
+} poll_watch_t;
 
-void __poll_event_trigger(int fd, short event) {
-    struct poll_int *i;
-    nfds_t j;
-    int gotone = 0;
-    short mask;
+LIST_HEAD(watchlist, poll_watch);
 
-    if(irq_inside_int()) {
-        if(mutex_trylock(&mutex))
-            /* XXXX: Uhh... this is bad... */
-            return;
-    }
-    else {
-        mutex_lock(&mutex);
-    }
-
-    /* Look through the list of poll fds for any that match */
-    LIST_FOREACH(i, &poll_list, entry) {
-        for(j = 0; j < i->nfds; ++j) {
-            if(i->fds[j].fd == fd) {
-                mask = i->fds[j].events | POLLERR | POLLHUP | POLLNVAL;
-                if(event & mask) {
-                    i->fds[j].revents |= event & mask;
-                    ++i->nmatched;
-                    gotone = 1;
-                }
-            }
-        }
+static struct watchlist watches_init[POLL_HASH_MIN];
+static struct watchlist *watches = watches_init;
+static size_t watch_buckets = POLL_HASH_MIN;
+static size_t watch_count;
+
+/* Make room in the table for count more watches. The new table can't be
+   allocated with interrupts disabled, so this has to be done before adding
+   them. If there isn't enough memory, they just go in the table we have. */
+static void watch_reserve(size_t count) {
+    struct watchlist *tbl, *old_tbl;
+    poll_watch_t *w;
+    size_t size, old_size, i;
+    int old;
+
+    if(watch_count + count <= watch_buckets)
+        return;
+
+    for(size = watch_buckets; size < watch_count + count; size <<= 1)
+        ;
+
+    if(!(tbl = (struct watchlist *)malloc(size * sizeof(struct watchlist))))
+        return;
+
+    for(i = 0; i < size; ++i)
+        LIST_INIT(&tbl[i]);
+
+    old = irq_disable();
+
+    /* Someone else might have beaten us to it. */
+    if(size <= watch_buckets) {
+        irq_restore(old);
+        free(tbl);
+        return;
+    }
 
-        /* If we got any events, signal the waiting thread to wake it up. */
-        if(gotone) {
-            cond_signal(&i->cv);
-            gotone = 0;
+    old_tbl = watches;
+    old_size = watch_buckets;
+    watches = tbl;
+    watch_buckets = size;
+
+    for(i = 0; i < old_size; ++i) {
+        while((w = LIST_FIRST(&old_tbl[i]))) {
+            LIST_REMOVE(w, entry);
+            LIST_INSERT_HEAD(&watches[POLL_HASH(w->hndl, w->hnd)], w, entry);
         }
     }
 
-    mutex_unlock(&mutex);
+    irq_restore(old);
+
+    if(old_tbl != watches_init)
+        free(old_tbl);
 }
 
-int poll(struct pollfd fds[], nfds_t nfds, int timeout) {
-    struct poll_int p = { { 0 }, fds, nfds, 0, COND_INITIALIZER };
-    int tmp;
-    nfds_t i;
-    vfs_handler_t *hndl;
-    void *hnd;
+/* Call these with interrupts disabled. */
+static void watch_add(poll_watch_t *w) {
+    LIST_INSERT_HEAD(&watches[POLL_HASH(w->hndl, w->hnd)], w, entry);
+    ++watch_count;
+}
 
-    if(irq_inside_int()) {
-        if(mutex_trylock(&mutex)) {
-            errno = EAGAIN;
-            return -1;
+static void watch_remove(poll_watch_t *w) {
+    LIST_REMOVE(w, entry);
+    --watch_count;
+}
+
+void __poll_event_trigger_hnd(vfs_handler_t *hndl, void *hnd, short event) {
+    poll_watch_t *w;
+    short ev;
+    int old;
+
+    if(!hndl || !hnd)
+        return;
+
+    old = irq_disable();
+
+    LIST_FOREACH(w, &watches[POLL_HASH(hndl, hnd)], entry) {
+        if(w->hnd == hnd && w->hndl == hndl && (ev = event & w->events)) {
+            w->revents |= ev;
+            w->notify(w);
         }
     }
-    else {
-        mutex_lock(&mutex);
+
+    irq_restore(old);
+}
+
+/* Called by the VFS when the last reference to a file goes away, before the
+   handle is closed. The handle could be reused for a new file after this, so
+   none of the watches on it can be allowed to match anything anymore. Whoever
+   owns them is told the file is gone, and removes them later. */
+void __poll_hnd_closed(vfs_handler_t *hndl, void *hnd) {
+    poll_watch_t *w, *next;
+    int old;
+
+    if(!hndl || !hnd)
+        return;
+
+    old = irq_disable();
+
+    for(w = LIST_FIRST(&watches[POLL_HASH(hndl, hnd)]); w; w = next) {
+        next = LIST_NEXT(w, entry);
+
+        if(w->hnd == hnd && w->hndl == hndl) {
+            w->hndl = NULL;
+            w->hnd = NULL;
+            w->revents |= POLLNVAL;
+            w->notify(w);
+        }
     }
 
-    /* Check if any of the fds already match */
+    irq_restore(old);
+}
+
+void __poll_event_trigger(int fd, short event) {
+    vfs_handler_t *hndl;
+    void *hnd;
+    int err = errno;
+
+    if(fd < 0 || fd >= FD_SETSIZE)
+        return;
+
+    /* Don't let a stale fd change errno under whatever we interrupted. */
+    hndl = fs_get_handler(fd);
+    hnd = fs_get_handle(fd);
+    errno = err;
+
+    __poll_event_trigger_hnd(hndl, hnd, event);
+}
+
+/* Check what is pending on a file right now. */
+static short poll_check(vfs_handler_t *hndl, void *hnd, short events) {
+    /* Assume its a regular file if there's no poll method in the handler. */
+    if(!hndl->poll)
+        return events & (POLLRDNORM | POLLWRNORM);
+
+    return hndl->poll(hnd, events);
+}
+
+static int poll_scan(struct pollfd fds[], nfds_t nfds) {
+    vfs_handler_t *hndl;
+    void *hnd;
+    nfds_t i;
+    int nmatched = 0;
+
     for(i = 0; i < nfds; ++i) {
-        hndl = fs_get_handler(fds[i].fd);
-        hnd = fs_get_handle(fds[i].fd);
         fds[i].revents = 0;
 
         /* If we didn't get one of these, then assume its a bad fd. */
-        if(!hndl || !hnd) {
+        if(fds[i].fd < 0 || fds[i].fd >= FD_SETSIZE ||
+           !(hndl = fs_get_handler(fds[i].fd)) ||
+           !(hnd = fs_get_handle(fds[i].fd))) {
             fds[i].revents = POLLNVAL;
-            ++p.nmatched;
+            ++nmatched;
             continue;
         }
 
-        if(!hndl->poll) {
-            /* Assume its a regular file if there's no poll method in the
-               handler. */
-            if(fds[i].events & (POLLRDNORM | POLLWRNORM)) {
-                fds[i].revents |= (POLLRDNORM | POLLWRNORM) & fds[i].events;
-                ++p.nmatched;
-            }
+        if((fds[i].revents = poll_check(hndl, hnd, fds[i].events)))
+            ++nmatched;
+    }
+
+    return nmatched;
+}
+
+struct poll_int {
+    int fired;
+};
+
+static void poll_notify(poll_watch_t *w) {
+    struct poll_int *p = (struct poll_int *)w->owner;
+
+    p->fired = 1;
+    genwait_wake_all(p);
+}
+
+int poll(struct pollfd fds[], nfds_t nfds, int timeout) {
+    struct poll_int p = { 0 };
+    poll_watch_t *w;
+    nfds_t i;
+    int nmatched, old, tmp;
+
+    /* Check if any of the fds already match. If the user specified a 0
+       timeout, or we've already matched something, bail out now. */
+    if((nmatched = poll_scan(fds, nfds)) || !timeout)
+        return nmatched;
+
+    /* We can't actually wait while we're in an interrupt, so if we got this far
+       it is an error. */
+    if(irq_inside_int()) {
+        errno = EPERM;
+        return -1;
+    }
+
+    if(!(w = (poll_watch_t *)calloc(nfds ? nfds : 1, sizeof(poll_watch_t)))) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    /* Put a watch on each file. They were all valid in the scan above. */
+    watch_reserve(nfds);
+    old = irq_disable();
+
+    for(i = 0; i < nfds; ++i) {
+        w[i].hndl = fs_get_handler(fds[i].fd);
+        w[i].hnd = fs_get_handle(fds[i].fd);
+        w[i].events = fds[i].events | POLL_ALWAYS;
+        w[i].notify = &poll_notify;
+        w[i].owner = &p;
+        watch_add(&w[i]);
+    }
+
+    irq_restore(old);
+
+    /* Something could have happened between the first scan and setting up the
+       watches, so check again before going to sleep. */
+    if(!(nmatched = poll_scan(fds, nfds))) {
+        old = irq_disable();
+
+        if(!p.fired) {
+            tmp = errno;
+
+            if(genwait_wait(&p, "poll", timeout > 0 ? timeout : 0, NULL) < 0)
+                errno = tmp;
         }
-        else {
-            if((fds[i].revents = hndl->poll(hnd, fds[i].events))) {
-                ++p.nmatched;
+
+        irq_restore(old);
+        nmatched = poll_scan(fds, nfds);
+    }
+
+    old = irq_disable();
+
+    for(i = 0; i < nfds; ++i)
+        watch_remove(&w[i]);
+
+    irq_restore(old);
+
+    /* Fill in anything that was signalled, but has gone away again by now
+       (like a hangup on a socket that has since been cleaned up). */
+    if(p.fired) {
+        for(i = 0; i < nfds; ++i) {
+            if(!fds[i].revents && w[i].revents) {
+                fds[i].revents = w[i].revents;
+                ++nmatched;
             }
         }
     }
 
-    /* If the user specified a 0 timeout, or we've already matched something,
-       bail out now. */
-    if(p.nmatched || !timeout) {
-        mutex_unlock(&mutex);
-        return p.nmatched;
+    free(w);
+    return nmatched;
+}
+
+/* An epoll instance keeps a watch for each file in its interest set, along
+   with a queue of the ones that have been signalled since the last call to
+   epoll_wait(). The ready queue is protected by disabling interrupts, just like
+   the watches. The interest set itself is protected by the instance's mutex. */
+#define EPOLL_HASH_SIZE 32
+#define EPOLL_HASH(fd)  ((fd) & (EPOLL_HASH_SIZE - 1))
+
+typedef struct epitem {
+    poll_watch_t w;             /* Must be first */
+    LIST_ENTRY(epitem) entry;   /* In the instance's interest set */
+    TAILQ_ENTRY(epitem) ready;  /* On the ready queue */
+    int queued;                 /* Non-zero if on the ready queue */
+    int fd;
+    uint32_t events;
+    epoll_data_t data;
+} epitem_t;
+
+LIST_HEAD(epitem_list, epitem);
+TAILQ_HEAD(epitem_queue, epitem);
+
+typedef struct epoll_inst {
+    struct epitem_list items[EPOLL_HASH_SIZE];
+    struct epitem_queue ready;
+    mutex_t mutex;
+} epoll_inst_t;
+
+static int epoll_close(void *h);
+
+static vfs_handler_t epoll_vh = {
+    /* Name handler */
+    {
+        "/epoll",       /* Name */
+        0,              /* tbfi */
+        0x00010000,     /* Version 1.0 */
+        0,              /* Flags */
+        NMMGR_TYPE_VFS,
+        NMMGR_LIST_INIT,
+    },
+
+    0, NULL,        /* No cache, privdata */
+
+    NULL,            /* open */
+    epoll_close,     /* close */
+    NULL,            /* read */
+    NULL,            /* write */
+    NULL,            /* seek */
+    NULL,            /* tell */
+    NULL,            /* total */
+    NULL,            /* readdir */
+    NULL,            /* ioctl */
+    NULL,            /* rename */
+    NULL,            /* unlink */
+    NULL,            /* mmap */
+    NULL,            /* complete */
+    NULL,            /* stat */
+    NULL,            /* mkdir */
+    NULL,            /* rmdir */
+    NULL,            /* fcntl */
+    NULL,            /* poll */
+    NULL,            /* link */
+    NULL,            /* symlink */
+    NULL,            /* seek64 */
+    NULL,            /* tell64 */
+    NULL,            /* total64 */
+    NULL,            /* readlink */
+    NULL,            /* rewinddir */
+    NULL             /* fstat */
+};
+
+/* Call this with interrupts disabled. */
+static void epoll_notify(poll_watch_t *w) {
+    epitem_t *it = (epitem_t *)w;
+    epoll_inst_t *ep = (epoll_inst_t *)w->owner;
+
+    if(!it->queued) {
+        TAILQ_INSERT_TAIL(&ep->ready, it, ready);
+        it->queued = 1;
+    }
+
+    genwait_wake_all(ep);
+}
+
+static epoll_inst_t *epoll_get(int epfd) {
+    vfs_handler_t *hndl;
+
+    if(epfd < 0 || epfd >= FD_SETSIZE || !(hndl = fs_get_handler(epfd))) {
+        errno = EBADF;
+        return NULL;
+    }
+
+    if(hndl != &epoll_vh) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    return (epoll_inst_t *)fs_get_handle(epfd);
+}
+
+static epitem_t *epoll_find(epoll_inst_t *ep, int fd) {
+    epitem_t *it;
+
+    LIST_FOREACH(it, &ep->items[EPOLL_HASH(fd)], entry) {
+        if(it->fd == fd)
+            return it;
+    }
+
+    return NULL;
+}
+
+static void epoll_remove(epitem_t *it) {
+    epoll_inst_t *ep = (epoll_inst_t *)it->w.owner;
+    int old;
+
+    old = irq_disable();
+    watch_remove(&it->w);
+
+    if(it->queued)
+        TAILQ_REMOVE(&ep->ready, it, ready);
+
+    irq_restore(old);
+
+    LIST_REMOVE(it, entry);
+    free(it);
+}
+
+static int epoll_close(void *h) {
+    epoll_inst_t *ep = (epoll_inst_t *)h;
+    int i;
+
+    for(i = 0; i < EPOLL_HASH_SIZE; ++i) {
+        while(!LIST_EMPTY(&ep->items[i]))
+            epoll_remove(LIST_FIRST(&ep->items[i]));
+    }
+
+    mutex_destroy(&ep->mutex);
+    free(ep);
+    return 0;
+}
+
+int epoll_create1(int flags) {
+    epoll_inst_t *ep;
+    int fd, i;
+
+    if(flags & ~EPOLL_CLOEXEC) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if(!(ep = (epoll_inst_t *)malloc(sizeof(epoll_inst_t)))) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    for(i = 0; i < EPOLL_HASH_SIZE; ++i)
+        LIST_INIT(&ep->items[i]);
+
+    TAILQ_INIT(&ep->ready);
+    mutex_init(&ep->mutex, MUTEX_TYPE_NORMAL);
+
+    if((fd = fs_open_handle(&epoll_vh, ep)) < 0) {
+        mutex_destroy(&ep->mutex);
+        free(ep);
+    }
+
+    return fd;
+}
+
+int epoll_create(int size) {
+    if(size <= 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    return epoll_create1(0);
+}
+
+int epoll_ctl(int epfd, int op, int fd, struct epoll_event *event) {
+    epoll_inst_t *ep;
+    epitem_t *it;
+    vfs_handler_t *hndl;
+    void *hnd;
+    short cur;
+    int old;
+
+    if(!(ep = epoll_get(epfd)))
+        return -1;
+
+    if(fd < 0 || fd >= FD_SETSIZE || !(hndl = fs_get_handler(fd)) ||
+       !(hnd = fs_get_handle(fd))) {
+        errno = EBADF;
+        return -1;
+    }
+
+    if(fd == epfd || (op != EPOLL_CTL_DEL && !event)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    mutex_lock(&ep->mutex);
+
+    /* An item left over from a file that was closed (without being taken out
+       of the interest set) that had the same fd doesn't count. */
+    if((it = epoll_find(ep, fd)) &&
+       (it->w.hnd != hnd || it->w.hndl != hndl)) {
+        epoll_remove(it);
+        it = NULL;
+    }
+
+    switch(op) {
+        case EPOLL_CTL_ADD:
+            if(it) {
+                errno = EEXIST;
+                goto err;
+            }
+
+            if(!(it = (epitem_t *)calloc(1, sizeof(epitem_t)))) {
+                errno = ENOMEM;
+                goto err;
+            }
+
+            it->fd = fd;
+            it->w.hndl = hndl;
+            it->w.hnd = hnd;
+            it->w.notify = &epoll_notify;
+            it->w.owner = ep;
+            LIST_INSERT_HEAD(&ep->items[EPOLL_HASH(fd)], it, entry);
+
+            watch_reserve(1);
+            old = irq_disable();
+            watch_add(&it->w);
+            irq_restore(old);
+            break;
+
+        case EPOLL_CTL_MOD:
+            if(!it) {
+                errno = ENOENT;
+                goto err;
+            }
+
+            break;
+
+        case EPOLL_CTL_DEL:
+            if(!it) {
+                errno = ENOENT;
+                goto err;
+            }
+
+            epoll_remove(it);
+            mutex_unlock(&ep->mutex);
+            return 0;
+
+        default:
+            errno = EINVAL;
+            goto err;
+    }
+
+    /* Set up the events for an add or modify (which also re-arms a one-shot
+       file), and queue the file up if it is already ready. */
+    old = irq_disable();
+    it->events = event->events;
+    it->data = event->data;
+    it->w.events = (short)(event->events & ~(EPOLLET | EPOLLONESHOT)) |
+        POLL_ALWAYS;
+    it->w.revents = 0;
+    irq_restore(old);
+
+    if((cur = poll_check(hndl, hnd, it->w.events))) {
+        old = irq_disable();
+        it->w.revents |= cur;
+        epoll_notify(&it->w);
+        irq_restore(old);
+    }
+
+    mutex_unlock(&ep->mutex);
+    return 0;
+
+err:
+    mutex_unlock(&ep->mutex);
+    return -1;
+}
+
+int epoll_wait(int epfd, struct epoll_event *events, int maxevents,
+               int timeout) {
+    epoll_inst_t *ep;
+    epitem_t *it;
+    struct epitem_queue again;
+    vfs_handler_t *hndl;
+    uint64 deadline = 0, now;
+    uint32_t ev;
+    int n = 0, old, tmp, tmo;
+
+    if(!(ep = epoll_get(epfd)))
+        return -1;
+
+    if(!events || maxevents <= 0) {
+        errno = EINVAL;
+        return -1;
     }
 
-    /* We can't actually wait while we're in an interrupt, so if we got this far
-       it is an error. */
     if(irq_inside_int()) {
-        mutex_unlock(&mutex);
         errno = EPERM;
         return -1;
     }
 
-    /* Map to the value used by cond_wait_timed() */
-    if(timeout == -1)
-        timeout = 0;
+    if(timeout > 0)
+        deadline = timer_ms_gettime64() + timeout;
 
-    /* Add this instance to the list */
-    LIST_INSERT_HEAD(&poll_list, &p, entry);
+    mutex_lock(&ep->mutex);
 
-    tmp = errno;
-    if(cond_wait_timed(&p.cv, &mutex, timeout)) {
-        errno = tmp;
-        tmp = 0;
-        goto out;
-    }
+    for(;;) {
+        TAILQ_INIT(&again);
+        old = irq_disable();
+
+        while(n < maxevents && (it = TAILQ_FIRST(&ep->ready))) {
+            TAILQ_REMOVE(&ep->ready, it, ready);
+            it->queued = 0;
+            ev = (uint16_t)it->w.revents;
+            it->w.revents = 0;
+            irq_restore(old);
+
+            /* If the file was closed without being taken out of the interest
+               set, drop it now. */
+            if(!it->w.hnd || (hndl = fs_get_handler(it->fd)) != it->w.hndl ||
+               fs_get_handle(it->fd) != it->w.hnd) {
+                epoll_remove(it);
+                old = irq_disable();
+                continue;
+            }
+
+            /* Level-triggered files report whatever is pending right now, so
+               they stay ready until it has all been dealt with. Edge-triggered
+               ones report what was signalled since the last time. */
+            if(!(it->events & EPOLLET))
+                ev = (uint16_t)poll_check(hndl, it->w.hnd, it->w.events);
+
+            old = irq_disable();
+
+            if(!ev)
+                continue;
+
+            events[n].events = ev;
+            events[n].data = it->data;
+            ++n;
+
+            if(it->events & EPOLLONESHOT) {
+                it->w.events = 0;
+            }
+            else if(!(it->events & EPOLLET) && !it->queued) {
+                /* Check it again next time around. */
+                TAILQ_INSERT_TAIL(&again, it, ready);
+                it->queued = 1;
+            }
+        }
+
+        TAILQ_CONCAT(&ep->ready, &again, ready);
+        irq_restore(old);
 
-    tmp = p.nmatched;
+        if(n || !timeout)
+            break;
 
-out:
-    /* Remove this instance from the list */
-    LIST_REMOVE(&p, entry);
+        /* Nothing is ready, so sleep until something is. */
+        tmo = 0;
+
+        if(timeout > 0) {
+            if((now = timer_ms_gettime64()) >= deadline)
+                break;
+
+            tmo = (int)(deadline - now);
+        }
+
+        mutex_unlock(&ep->mutex);
+        old = irq_disable();
+
+        if(TAILQ_EMPTY(&ep->ready)) {
+            tmp = errno;
+
+            if(genwait_wait(ep, "epoll_wait", tmo, NULL) < 0)
+                errno = tmp;
+        }
+
+        irq_restore(old);
+        mutex_lock(&ep->mutex);
+    }
 
-    mutex_unlock(&mutex);
-    return tmp;
+    mutex_unlock(&ep->mutex);
+    return n;
 }
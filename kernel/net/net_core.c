@@ -16,6 +16,8 @@
 #include "net_thd.h"
 #include "net_ipv4.h"
 #include "net_ipv6.h"
+#include "net_neigh.h"
+#include "net_frag.h"
 
 /*
 
@@ -147,6 +149,10 @@ int net_init(uint32 ip) {
     if(net_initted)
         return 0;
 
+    /* Set up the packet buffer pool before any devices start receiving */
+    if(net_pbuf_init() < 0)
+        return -1;
+
     /* Detect and potentially initialize devices */
     if(net_dev_init() < 0)
         return -1;
@@ -154,14 +160,17 @@ int net_init(uint32 ip) {
     /* Initialize the network thread. */
     net_thd_init();
 
+    /* Initialize the neighbor table, used by both ARP and NDP */
+    net_neigh_init();
+
     /* Initialize the ARP cache */
     net_arp_init();
 
     /* Initialize the NDP cache */
     net_ndp_init();
 
-    /* Initialize IPv4 fragmentation support */
-    net_ipv4_frag_init();
+    /* Initialize IPv4 and IPv6 fragment reassembly */
+    net_frag_init();
 
     /* Initialize multicast support */
     net_multicast_init();
@@ -233,8 +242,8 @@ void net_shutdown(void) {
     /* Shut down multicast support */
     net_multicast_shutdown();
 
-    /* Shut down IPv4 fragmentation support */
-    net_ipv4_frag_shutdown();
+    /* Shut down IPv4 and IPv6 fragment reassembly */
+    net_frag_shutdown();
 
     /* Shut down the NDP cache */
     net_ndp_shutdown();
@@ -242,6 +251,9 @@ void net_shutdown(void) {
     /* Shut down the ARP cache */
     net_arp_shutdown();
 
+    /* Shut down the neighbor table */
+    net_neigh_shutdown();
+
     /* Shut down the network thread */
     net_thd_shutdown();
 
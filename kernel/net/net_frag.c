@@ -0,0 +1,409 @@
+/* KallistiOS ##version##
+
+   kernel/net/net_frag.c
+   Copyright (C) 2026 The KOS Team and contributors
+
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <sys/queue.h>
+#include <kos/net.h>
+#include <arch/irq.h>
+#include <arch/timer.h>
+
+#include "net_frag.h"
+#include "net_thd.h"
+
+/* This is the fragment reassembly code that's shared between IPv4 and IPv6.
+
+   Each datagram being put back together keeps a list of the pieces of it that
+   have arrived so far, sorted by offset, so finding where a new fragment goes
+   and whether anything is still missing only depends on how many fragments
+   there are (rather than on the size of the datagram, which is what a bitmap
+   of the whole thing would need). Datagrams are found through a hash table
+   keyed on the addresses, identification, and protocol.
+
+   Fragments that overlap data that has already arrived get the whole datagram
+   thrown out, except for exact duplicates which are just ignored. This is what
+   RFC 5722 requires for IPv6, and it's what most stacks do for IPv4 too, since
+   overlapping fragments are only really ever used to sneak things past
+   firewalls.
+
+   The total amount of memory used by incomplete datagrams is capped, with the
+   oldest one being thrown out when a new fragment wouldn't fit. Datagrams that
+   sit around too long without being finished are thrown out by the network
+   thread. This is all reachable from the network input path, which may be in
+   an interrupt, so the tables are protected by disabling interrupts. Copying
+   everything into the finished datagram is done after they're restored. */
+
+/* Size of the hash table. This must be a power of two. */
+#define FRAG_HASH_SIZE          64
+
+/* How much memory incomplete datagrams can take up in total, and how many
+   pieces a single datagram can be in. */
+#define FRAG_MAX_MEM            (256 * 1024)
+#define FRAG_MAX_CHUNKS         128
+
+/* How long to wait for all of the fragments of a datagram (RFC 791 suggests
+   15 seconds as a lower bound for IPv4, RFC 8200 says 60 for IPv6), and how
+   often to check for ones that have taken too long. */
+#define FRAG_TIMEOUT_IPV4       (30 * 1000)
+#define FRAG_TIMEOUT_IPV6       (60 * 1000)
+#define FRAG_GC_INTERVAL        1000
+
+/* Largest header that gets saved from the first fragment */
+#define FRAG_MAX_HDR            60
+
+/* Largest size of the data in a datagram */
+#define FRAG_MAX_SIZE           65535
+
+typedef struct frag_chunk {
+    struct frag_chunk   *next;
+    size_t              start;
+    size_t              end;
+    uint8               data[];
+} frag_chunk_t;
+
+typedef struct frag_dgram {
+    /* Hash table and age list handles */
+    LIST_ENTRY(frag_dgram)  fd_hash;
+    TAILQ_ENTRY(frag_dgram) fd_age;
+
+    net_frag_key_t          key;
+
+    /* Header from the first fragment, once it has arrived */
+    uint8                   hdr[FRAG_MAX_HDR];
+    size_t                  hdr_size;
+
+    /* Size of the data once the last fragment has arrived, or -1 until then,
+       and how much of it has arrived so far */
+    int                     total;
+    size_t                  received;
+
+    /* Memory charged to this datagram, and when it gets thrown out */
+    size_t                  mem;
+    uint64                  expires;
+
+    /* Pieces that have arrived, sorted by offset */
+    frag_chunk_t            *chunks;
+    int                     nchunks;
+} frag_dgram_t;
+
+LIST_HEAD(frag_hash_list, frag_dgram);
+TAILQ_HEAD(frag_age_list, frag_dgram);
+
+static struct frag_hash_list frag_hash[FRAG_HASH_SIZE];
+static struct frag_age_list frag_age;
+static int frag_cb_id = -1;
+static net_frag_stats_t frag_stats;
+
+static inline struct frag_hash_list *frag_bucket(const net_frag_key_t *key) {
+    uint32 h;
+
+    h = key->src.__s6_addr.__s6_addr32[3] ^ key->dst.__s6_addr.__s6_addr32[3];
+    h ^= key->src.__s6_addr.__s6_addr32[2] ^ key->dst.__s6_addr.__s6_addr32[2];
+    h ^= key->ident ^ (key->proto << 24);
+    h ^= h >> 16;
+    h *= 0x45D9F3B;
+    h ^= h >> 16;
+
+    return &frag_hash[h & (FRAG_HASH_SIZE - 1)];
+}
+
+static inline int frag_key_eq(const net_frag_key_t *a,
+                              const net_frag_key_t *b) {
+    return a->domain == b->domain && a->ident == b->ident &&
+        a->proto == b->proto &&
+        !memcmp(&a->src, &b->src, sizeof(struct in6_addr)) &&
+        !memcmp(&a->dst, &b->dst, sizeof(struct in6_addr));
+}
+
+/* Unlink a datagram from the tables. Interrupts must be disabled. */
+static void frag_unlink(frag_dgram_t *d) {
+    LIST_REMOVE(d, fd_hash);
+    TAILQ_REMOVE(&frag_age, d, fd_age);
+
+    frag_stats.mem_used -= d->mem;
+    --frag_stats.dgrams_pending;
+}
+
+/* Free a datagram that has been unlinked. */
+static void frag_free(frag_dgram_t *d) {
+    frag_chunk_t *c, *n;
+
+    for(c = d->chunks; c; c = n) {
+        n = c->next;
+        free(c);
+    }
+
+    free(d);
+}
+
+/* Throw away a datagram. Interrupts must be disabled. */
+static void frag_drop(frag_dgram_t *d) {
+    frag_unlink(d);
+    frag_free(d);
+}
+
+/* Throw out the oldest datagrams until there's room for size more bytes.
+   Interrupts must be disabled. Returns 0 if there's room, -1 if there can't
+   be. */
+static int frag_make_room(size_t size, frag_dgram_t *keep) {
+    frag_dgram_t *d;
+
+    if(size > FRAG_MAX_MEM)
+        return -1;
+
+    while(frag_stats.mem_used + size > FRAG_MAX_MEM) {
+        d = TAILQ_FIRST(&frag_age);
+
+        if(d == keep)
+            d = TAILQ_NEXT(d, fd_age);
+
+        if(!d)
+            return -1;
+
+        frag_drop(d);
+        ++frag_stats.dgrams_evicted;
+    }
+
+    return 0;
+}
+
+/* Put together a finished datagram. It must already be unlinked. */
+static int frag_assemble(frag_dgram_t *d, uint8 **out, size_t *out_size) {
+    frag_chunk_t *c;
+    uint8 *buf;
+
+    if(!(buf = (uint8 *)malloc(d->hdr_size + d->total))) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    memcpy(buf, d->hdr, d->hdr_size);
+
+    for(c = d->chunks; c; c = c->next)
+        memcpy(buf + d->hdr_size + c->start, c->data, c->end - c->start);
+
+    *out = buf;
+    *out_size = d->hdr_size + d->total;
+    return 0;
+}
+
+static void frag_gc_cb(void *data) {
+    frag_dgram_t *d, *n;
+    uint64 now = timer_ms_gettime64();
+    int old;
+
+    (void)data;
+
+    old = irq_disable();
+
+    /* The age list is in the order that datagrams were started, but IPv4 and
+       IPv6 have different timeouts, so look through all of it. */
+    for(d = TAILQ_FIRST(&frag_age); d; d = n) {
+        n = TAILQ_NEXT(d, fd_age);
+
+        if(d->expires <= now) {
+            frag_drop(d);
+            ++frag_stats.dgrams_timeout;
+        }
+    }
+
+    irq_restore(old);
+}
+
+int net_frag_input(const net_frag_key_t *key, const void *hdr, size_t hdr_size,
+                   size_t offset, int more, const uint8 *data, size_t size,
+                   uint8 **out, size_t *out_size) {
+    frag_dgram_t *d;
+    frag_chunk_t *c, **pp;
+    struct frag_hash_list *b;
+    size_t end = offset + size;
+    int old, rv;
+
+    ++frag_stats.frags_recv;
+
+    /* Make sure the fragment makes sense before looking any further. */
+    if(end > FRAG_MAX_SIZE || hdr_size > FRAG_MAX_HDR ||
+       (!size && more)) {
+        ++frag_stats.frags_dropped;
+        errno = EINVAL;
+        return -1;
+    }
+
+    b = frag_bucket(key);
+    old = irq_disable();
+
+    LIST_FOREACH(d, b, fd_hash) {
+        if(frag_key_eq(&d->key, key))
+            break;
+    }
+
+    if(!d) {
+        /* Charge the datagram structure to the memory limit too, so a flood of
+           first fragments can't get around it. */
+        if(frag_make_room(sizeof(frag_dgram_t) + sizeof(frag_chunk_t) + size,
+                          NULL) < 0 ||
+           !(d = (frag_dgram_t *)malloc(sizeof(frag_dgram_t)))) {
+            irq_restore(old);
+            ++frag_stats.frags_dropped;
+            errno = ENOMEM;
+            return -1;
+        }
+
+        d->key = *key;
+        d->hdr_size = 0;
+        d->total = -1;
+        d->received = 0;
+        d->mem = sizeof(frag_dgram_t);
+        d->expires = timer_ms_gettime64() + (key->domain == AF_INET ?
+                                             FRAG_TIMEOUT_IPV4 :
+                                             FRAG_TIMEOUT_IPV6);
+        d->chunks = NULL;
+        d->nchunks = 0;
+
+        LIST_INSERT_HEAD(b, d, fd_hash);
+        TAILQ_INSERT_TAIL(&frag_age, d, fd_age);
+
+        frag_stats.mem_used += d->mem;
+        ++frag_stats.dgrams_pending;
+    }
+
+    /* If this is the last fragment, it tells us how big the whole thing is.
+       It can't disagree with another last fragment or cut off data that has
+       already arrived. Likewise, nothing can come after the end. */
+    if(!more) {
+        if(d->total >= 0 && (size_t)d->total != end)
+            goto bad;
+
+        /* Find the end of the data that's arrived so far. */
+        for(c = d->chunks; c && c->next; c = c->next) ;
+
+        if(c && c->end > end)
+            goto bad;
+
+        d->total = (int)end;
+    }
+    else if(d->total >= 0 && end > (size_t)d->total) {
+        goto bad;
+    }
+
+    /* Find where this piece goes. */
+    for(pp = &d->chunks; *pp && (*pp)->end <= offset; pp = &(*pp)->next) ;
+
+    if(*pp && (*pp)->start < end) {
+        /* It overlaps something. If it's an exact duplicate, it's harmless. */
+        if((*pp)->start == offset && (*pp)->end == end &&
+           !memcmp((*pp)->data, data, size)) {
+            irq_restore(old);
+            ++frag_stats.frags_dropped;
+            return 0;
+        }
+
+        goto bad;
+    }
+
+    if(d->nchunks >= FRAG_MAX_CHUNKS)
+        goto bad;
+
+    if(frag_make_room(sizeof(frag_chunk_t) + size, d) < 0 ||
+       !(c = (frag_chunk_t *)malloc(sizeof(frag_chunk_t) + size))) {
+        irq_restore(old);
+        ++frag_stats.frags_dropped;
+        errno = ENOMEM;
+        return -1;
+    }
+
+    c->start = offset;
+    c->end = end;
+    memcpy(c->data, data, size);
+    c->next = *pp;
+    *pp = c;
+
+    ++d->nchunks;
+    d->received += size;
+    d->mem += sizeof(frag_chunk_t) + size;
+    frag_stats.mem_used += sizeof(frag_chunk_t) + size;
+
+    if(frag_stats.mem_used > frag_stats.mem_peak)
+        frag_stats.mem_peak = frag_stats.mem_used;
+
+    if(!offset) {
+        memcpy(d->hdr, hdr, hdr_size);
+        d->hdr_size = hdr_size;
+    }
+
+    /* Since nothing overlaps, everything has arrived once the amounts match. */
+    if(d->total < 0 || d->received != (size_t)d->total || !d->hdr_size) {
+        irq_restore(old);
+        return 0;
+    }
+
+    frag_unlink(d);
+    irq_restore(old);
+
+    if((rv = frag_assemble(d, out, out_size)) < 0)
+        ++frag_stats.frags_dropped;
+    else
+        ++frag_stats.dgrams_ok;
+
+    frag_free(d);
+    return rv < 0 ? -1 : 1;
+
+bad:
+    frag_drop(d);
+    irq_restore(old);
+
+    ++frag_stats.dgrams_bad;
+    ++frag_stats.frags_dropped;
+    errno = EINVAL;
+    return -1;
+}
+
+net_frag_stats_t net_frag_get_stats(void) {
+    net_frag_stats_t rv;
+    int old;
+
+    old = irq_disable();
+    rv = frag_stats;
+    irq_restore(old);
+
+    return rv;
+}
+
+int net_frag_init(void) {
+    int i;
+
+    for(i = 0; i < FRAG_HASH_SIZE; ++i)
+        LIST_INIT(&frag_hash[i]);
+
+    TAILQ_INIT(&frag_age);
+    memset(&frag_stats, 0, sizeof(frag_stats));
+
+    if((frag_cb_id = net_thd_add_callback(&frag_gc_cb, NULL,
+                                          FRAG_GC_INTERVAL)) < 0)
+        return -1;
+
+    return 0;
+}
+
+void net_frag_shutdown(void) {
+    frag_dgram_t *d;
+    int old;
+
+    if(frag_cb_id >= 0) {
+        net_thd_del_callback(frag_cb_id);
+        frag_cb_id = -1;
+    }
+
+    old = irq_disable();
+
+    while((d = TAILQ_FIRST(&frag_age)))
+        frag_drop(d);
+
+    irq_restore(old);
+}
@@ -0,0 +1,49 @@
+/* KallistiOS ##version##
+
+   kernel/net/net_frag.h
+   Copyright (C) 2026 The KOS Team and contributors
+
+*/
+
+#ifndef __LOCAL_NET_FRAG_H
+#define __LOCAL_NET_FRAG_H
+
+#include <sys/cdefs.h>
+
+__BEGIN_DECLS
+
+#include <netinet/in.h>
+#include <kos/net.h>
+
+/* What identifies the fragments of one datagram. For IPv4, the addresses are
+   IPv4-mapped and the identification is only 16 bits. For IPv6, the protocol
+   isn't part of it, so it should be left as 0. */
+typedef struct net_frag_key {
+    int domain;
+    struct in6_addr src;
+    struct in6_addr dst;
+    uint32 ident;
+    uint8 proto;
+} net_frag_key_t;
+
+/* Hand a fragment over for reassembly. The header (of hdr_size bytes) is only
+   looked at for the fragment at offset 0, and is what the reassembled datagram
+   will start with. The offset and size of the fragment's data are in bytes,
+   and more is nonzero if there are more fragments after this one.
+
+   Returns 1 when this fragment finished off the datagram, in which case *out
+   is set to a buffer that must be freed with free(), holding the header and
+   then all of the data, and *out_size is set to the total size of that. The
+   header is just as it was in the first fragment, so the caller has to fix up
+   the length (and whatever else) in it. Returns 0 if the fragment was kept
+   for later, or -1 (and sets errno) if it was dropped. */
+int net_frag_input(const net_frag_key_t *key, const void *hdr, size_t hdr_size,
+                   size_t offset, int more, const uint8 *data, size_t size,
+                   uint8 **out, size_t *out_size);
+
+int net_frag_init(void);
+void net_frag_shutdown(void);
+
+__END_DECLS
+
+#endif /* !__LOCAL_NET_FRAG_H */
@@ -57,11 +57,11 @@ static void icmp_default_echo_cb(const uint8 *ip, uint16 seq, uint64 delta_us,
 
     if(delta_us != (uint64) - 1) {
         printf("%d bytes from %d.%d.%d.%d: icmp_seq=%d ttl=%d time=%.3f ms\n",
-               data_sz, ip[0], ip[1], ip[2], ip[3], seq, ttl,
+               (int)data_sz, ip[0], ip[1], ip[2], ip[3], seq, ttl,
                delta_us / 1000.0);
     }
     else {
-        printf("%d bytes from %d.%d.%d.%d: icmp_seq=%d ttl=%d\n", data_sz,
+        printf("%d bytes from %d.%d.%d.%d: icmp_seq=%d ttl=%d\n", (int)data_sz,
                ip[0], ip[1], ip[2], ip[3], seq, ttl);
     }
 }
@@ -160,6 +160,7 @@ int net_icmp_send_echo(netif_t *net, const uint8 ipaddr[4], uint16 ident,
     uint16 sz = sizeof(icmp_hdr_t) + size + 8;
     uint8 databuf[sz];
     uint32 src;
+    uint16 cs;
     uint64 t;
 
     icmp = (icmp_hdr_t *)databuf;
@@ -170,7 +171,11 @@ int net_icmp_send_echo(netif_t *net, const uint8 ipaddr[4], uint16 ident,
     icmp->checksum = 0;
     icmp->misc.m16[0] = htons(ident);
     icmp->misc.m16[1] = htons(seq);
-    memcpy(databuf + sizeof(icmp_hdr_t) + 8, data, size);
+
+    /* Add up the data as it gets copied in, rather than going back over it
+       again later. */
+    cs = ~net_ipv4_checksum_copy(databuf + sizeof(icmp_hdr_t) + 8, data, size,
+                                 0);
 
     /* Put the time in now, at the latest possible time (since we have to
        calculate the checksum over it) */
@@ -185,7 +190,7 @@ int net_icmp_send_echo(netif_t *net, const uint8 ipaddr[4], uint16 ident,
     databuf[sizeof(icmp_hdr_t) + 7] = t >>  0;
 
     /* Compute the ICMP Checksum */
-    icmp->checksum = net_ipv4_checksum(databuf, sz, 0);
+    icmp->checksum = net_ipv4_checksum(databuf, sizeof(icmp_hdr_t) + 8, cs);
 
     /* If we're sending to the loopback, set that as our source too. */
     if(ipaddr[0] == 127) {
@@ -51,12 +51,12 @@ static void icmp6_default_echo_cb(const struct in6_addr *ip, uint16 seq,
     inet_ntop(AF_INET6, ip, ipstr, INET6_ADDRSTRLEN);
 
     if(delta_us != (uint64) - 1) {
-        printf("%d bytes from %s, icmp_seq=%d hlim=%d time=%.3f ms\n", data_sz,
-               ipstr, seq, hlim, delta_us / 1000.0);
+        printf("%d bytes from %s, icmp_seq=%d hlim=%d time=%.3f ms\n",
+               (int)data_sz, ipstr, seq, hlim, delta_us / 1000.0);
     }
     else {
-        printf("%d bytes from %s, icmp_seq=%d hlim=%d\n", data_sz, ipstr, seq,
-               hlim);
+        printf("%d bytes from %s, icmp_seq=%d hlim=%d\n", (int)data_sz, ipstr,
+               seq, hlim);
     }
 }
 
@@ -511,7 +511,12 @@ int net_icmp6_send_echo(netif_t *net, const struct in6_addr *dst, uint16 ident,
     echo->checksum = 0;
     echo->ident = htons(ident);
     echo->seq = htons(seq);
-    memcpy(databuf + sizeof(icmp6_echo_hdr_t) + 8, data, size);
+
+    /* Add up the data as it gets copied in, rather than going back over it
+       again later. */
+    cs = ~net_ipv4_checksum_copy(databuf + sizeof(icmp6_echo_hdr_t) + 8, data,
+                                 size, net_ipv6_checksum_pseudo(&src, dst, sz,
+                                                                IPV6_HDR_ICMP));
 
     /* Put the time in now, at the latest possible time (since we have to
        calculate the checksum over it) */
@@ -526,8 +531,8 @@ int net_icmp6_send_echo(netif_t *net, const struct in6_addr *dst, uint16 ident,
     databuf[sizeof(icmp6_echo_hdr_t) + 7] = t >>  0;
 
     /* Compute the ICMP Checksum */
-    cs = net_ipv6_checksum_pseudo(&src, dst, sz, IPV6_HDR_ICMP);
-    echo->checksum = net_ipv4_checksum(databuf, sz, cs);
+    echo->checksum = net_ipv4_checksum(databuf, sizeof(icmp6_echo_hdr_t) + 8,
+                                       cs);
 
     return net_ipv6_send(net, databuf, sz, 0, IPV6_HDR_ICMP, &src, dst);
 }
@@ -724,18 +729,15 @@ static int send_err_pkt(netif_t *net, uint8 buf[1240], int ptr,
         return -1;
     }
 
-    if(size > pktsz) {
-        memcpy(&buf[ptr], ppkt, pktsz);
-        size = ptr + pktsz;
-    }
-    else {
-        memcpy(&buf[ptr], ppkt, size);
-        size = 1240;
-    }
+    if(size > pktsz)
+        size = pktsz;
 
-    /* Compute the ICMP Checksum */
-    cs = net_ipv6_checksum_pseudo(&src, &osrc, size, IPV6_HDR_ICMP);
-    pkt->checksum = net_ipv4_checksum(buf, size, cs);
+    /* Compute the ICMP Checksum, adding up the original packet while it gets
+       copied in. */
+    cs = net_ipv6_checksum_pseudo(&src, &osrc, ptr + size, IPV6_HDR_ICMP);
+    cs = ~net_ipv4_checksum_copy(&buf[ptr], ppkt, size, cs);
+    size += ptr;
+    pkt->checksum = net_ipv4_checksum(buf, ptr, cs);
 
     /* Send it away */
     return net_ipv6_send(net, buf, size, 0, IPV6_HDR_ICMP, &src, &osrc);
@@ -58,6 +58,22 @@ int net_input(netif_t *device, const uint8 *data, int len) {
         return 0;
 }
 
+/* Process an incoming packet that is in a packet buffer. If nothing claims the
+   buffer while the packet is being processed, it goes back to the pool. */
+int net_input_pbuf(netif_t *device, net_pbuf_t *pb) {
+    int rv;
+
+    device->rx_pbuf = pb;
+    rv = net_input(device, pb->data, (int)pb->len);
+
+    if(device->rx_pbuf == pb) {
+        device->rx_pbuf = NULL;
+        net_pbuf_free(pb);
+    }
+
+    return rv;
+}
+
 /* Setup an input target; returns the old target */
 net_input_func net_input_set_target(net_input_func t) {
     net_input_func old = net_input_target;
@@ -21,50 +21,11 @@
 
 #include "net_ipv4.h"
 #include "net_icmp.h"
+#include "net_neigh.h"
+#include "net_output.h"
 
 static net_ipv4_stats_t ipv4_stats = { 0 };
 
-/* Perform an IP-style checksum on a block of data */
-uint16 net_ipv4_checksum(const uint8 *data, size_t bytes, uint16 start) {
-    uint32 sum = start;
-    size_t i = bytes;
-
-    /* Make sure we don't do any unaligned memory accesses */
-    if(((uint32)data) & 0x01) {
-        const uint8 *ptr = data;
-
-        while(i > 1) {
-            sum += *ptr | ((*ptr + 1) << 8);
-            ptr += 2;
-            i -= 2;
-
-            while(sum >> 16)
-                sum = (sum >> 16) + (sum & 0xFFFF);
-        }
-    }
-    else {
-        const uint16 *ptr = (const uint16 *)data;
-
-        while(i > 1) {
-            sum += *ptr++;
-            i -= 2;
-
-            while(sum >> 16)
-                sum = (sum >> 16) + (sum & 0xFFFF);
-        }
-    }
-
-    /* Handle the last byte, if we have an odd byte count */
-    if(i)
-        sum += data[bytes - 1];
-
-    /* Take care of any carry bits */
-    while(sum >> 16)
-        sum = (sum >> 16) + (sum & 0xFFFF);
-
-    return sum ^ 0xFFFF;
-}
-
 /* Determine if a given IP is in the current network */
 static int is_in_network(const uint8 src[4], const uint8 dest[4],
                          const uint8 netmask[4]) {
@@ -90,14 +51,24 @@ static int is_broadcast(const uint8 dest[4], const uint8 bc[4]) {
     return 1;
 }
 
-/* Send a packet on the specified network adapter */
-int net_ipv4_send_packet(netif_t *net, ip_hdr_t *hdr, const uint8 *data,
-                         size_t size) {
+/* Send a packet on the specified network adapter. The packet is made up of the
+   IPv4 header, then the transport layer header (if there is one), then the
+   pieces of the data. The headers get put together in front of the link-layer
+   header, but the data is handed to the driver where it is. If a queue is
+   given, the packet is added to it rather than being sent right away, so the
+   data has to stay put until the queue is flushed. */
+static int ipv4_output(netif_t *net, net_txq_t *q, const ip_hdr_t *hdr,
+                       const uint8 *thdr, size_t thdr_size,
+                       const struct iovec *iov, int iovcnt) {
     uint8 dest_ip[4];
     uint8 dest_mac[6];
-    uint8 pkt[size + sizeof(ip_hdr_t) + sizeof(eth_hdr_t)];
+    uint8 fhdr[NET_TX_HDR_MAX];
+    struct iovec piov[NETIF_TX_MAX_IOV];
+    struct in6_addr addr;
+    int ihl = 4 * (hdr->version_ihl & 0x0f);
+    size_t lsz = sizeof(eth_hdr_t), size = thdr_size, pos;
     eth_hdr_t *ehdr;
-    int err;
+    int err, i;
 
     if(net == NULL) {
         net = net_default_dev;
@@ -108,35 +79,38 @@ int net_ipv4_send_packet(netif_t *net, ip_hdr_t *hdr, const uint8 *data,
         }
     }
 
+    for(i = 0; i < iovcnt; ++i)
+        size += iov[i].iov_len;
+
     net_ipv4_parse_address(ntohl(hdr->dest), dest_ip);
 
     /* Is this a loopback address (127/8)? */
     if(dest_ip[0] == 0x7F) {
+        uint8 pkt[ihl + size];
+
         /* Put the IP header / data into our packet */
-        memcpy(pkt, hdr, 4 * (hdr->version_ihl & 0x0f));
-        memcpy(pkt + 4 * (hdr->version_ihl & 0x0f), data, size);
+        memcpy(pkt, hdr, ihl);
+
+        if(thdr_size)
+            memcpy(pkt + ihl, thdr, thdr_size);
+
+        for(i = 0, pos = ihl + thdr_size; i < iovcnt; ++i) {
+            memcpy(pkt + pos, iov[i].iov_base, iov[i].iov_len);
+            pos += iov[i].iov_len;
+        }
 
         ++ipv4_stats.pkt_sent;
 
         /* Send it "away" */
-        net_ipv4_input(NULL, pkt, 4 * (hdr->version_ihl & 0x0f) + size, NULL);
+        net_ipv4_input(NULL, pkt, ihl + size, NULL);
 
         return 0;
     }
     else if(net->flags & NETIF_NOETH) {
-        /* Put the IP header / data into our packet */
-        memcpy(pkt, hdr, 4 * (hdr->version_ihl & 0x0f));
-        memcpy(pkt + 4 * (hdr->version_ihl & 0x0f), data, size);
-
-        ++ipv4_stats.pkt_sent;
-
-        /* Send it away */
-        return net->if_tx(net, pkt, 4 * (hdr->version_ihl & 0x0f) + size,
-                          NETIF_BLOCK);
+        lsz = 0;
     }
-
     /* Are we sending a broadcast packet? */
-    if(hdr->dest == 0xFFFFFFFF || is_broadcast(dest_ip, net->broadcast)) {
+    else if(hdr->dest == 0xFFFFFFFF || is_broadcast(dest_ip, net->broadcast)) {
         /* Set the destination to the datalink layer broadcast address. */
         memset(dest_mac, 0xFF, 6);
     }
@@ -148,45 +122,88 @@ int net_ipv4_send_packet(netif_t *net, ip_hdr_t *hdr, const uint8 *data,
 
         /* Get our destination's MAC address. If we do not have the MAC address
            cached, return a distinguished error to the upper-level protocol so
-           that it can decide what to do. */
-        err = net_arp_lookup(net, dest_ip, dest_mac, hdr, data, size);
-
-        if(err == -1) {
-            errno = ENETUNREACH;
-            ++ipv4_stats.pkt_send_failed;
-            return -1;
+           that it can decide what to do. If it can't be sent yet, everything
+           after the IP header is queued up along with it. */
+        memset(&addr, 0, sizeof(addr));
+        addr.__s6_addr.__s6_addr16[5] = 0xFFFF;
+        memcpy(addr.s6_addr + 12, dest_ip, 4);
+
+        pos = 0;
+
+        if(thdr_size) {
+            piov[0].iov_base = (void *)thdr;
+            piov[0].iov_len = thdr_size;
+            pos = 1;
         }
-        else if(err == -2) {
+
+        for(i = 0; i < iovcnt; ++i)
+            piov[pos++] = iov[i];
+
+        err = net_neigh_lookup(net, &addr, dest_mac, hdr, ihl, piov, pos);
+
+        if(err == -2) {
             /* It'll send when the ARP reply comes in (assuming one does), so
                return success. */
             return 0;
         }
+        else if(err < 0) {
+            errno = ENETUNREACH;
+            ++ipv4_stats.pkt_send_failed;
+            return -1;
+        }
     }
 
     /* Fill in the ethernet header */
-    ehdr = (eth_hdr_t *)pkt;
-    memcpy(ehdr->dest, dest_mac, 6);
-    memcpy(ehdr->src, net->mac_addr, 6);
-    ehdr->type[0] = 0x08;
-    ehdr->type[1] = 0x00;
+    if(lsz) {
+        ehdr = (eth_hdr_t *)fhdr;
+        memcpy(ehdr->dest, dest_mac, 6);
+        memcpy(ehdr->src, net->mac_addr, 6);
+        ehdr->type[0] = 0x08;
+        ehdr->type[1] = 0x00;
+    }
 
-    /* Put the IP header / data into our ethernet packet */
-    memcpy(pkt + sizeof(eth_hdr_t), hdr, 4 * (hdr->version_ihl & 0x0f));
-    memcpy(pkt + sizeof(eth_hdr_t) + 4 * (hdr->version_ihl & 0x0f), data,
-           size);
+    /* Put the IP header and the transport header in after it */
+    memcpy(fhdr + lsz, hdr, ihl);
+
+    if(thdr_size)
+        memcpy(fhdr + lsz + ihl, thdr, thdr_size);
 
     ++ipv4_stats.pkt_sent;
 
     /* Send it away */
-    net->if_tx(net, pkt, sizeof(ip_hdr_t) + size + sizeof(eth_hdr_t),
-               NETIF_BLOCK);
+    err = net_tx_frame(net, q, fhdr, lsz + ihl + thdr_size, iov, iovcnt);
 
-    return 0;
+    return lsz ? 0 : err;
 }
 
-int net_ipv4_send(netif_t *net, const uint8 *data, size_t size, int id, int ttl,
-                  int proto, uint32 src, uint32 dst) {
+int net_ipv4_send_packet(netif_t *net, ip_hdr_t *hdr, const uint8 *data,
+                         size_t size) {
+    struct iovec iov;
+
+    iov.iov_base = (void *)data;
+    iov.iov_len = size;
+
+    return ipv4_output(net, NULL, hdr, NULL, 0, &iov, size ? 1 : 0);
+}
+
+int net_ipv4_sendv(netif_t *net, net_txq_t *q, const uint8 *thdr,
+                   size_t thdr_size, const struct iovec *iov, int iovcnt,
+                   int id, int ttl, int proto, uint32 src, uint32 dst) {
     ip_hdr_t hdr;
+    size_t size = thdr_size, pos;
+    int i;
+
+    if(net == NULL) {
+        net = net_default_dev;
+
+        if(!net) {
+            errno = ENETDOWN;
+            return -1;
+        }
+    }
+
+    for(i = 0; i < iovcnt; ++i)
+        size += iov[i].iov_len;
 
     /* If the ID is -1, generate a random ID value that can be used in case the
        packet gets fragmented. */
@@ -208,7 +225,38 @@ int net_ipv4_send(netif_t *net, const uint8 *data, size_t size, int id, int ttl,
 
     hdr.checksum = net_ipv4_checksum((uint8 *)&hdr, sizeof(ip_hdr_t), 0);
 
-    return net_ipv4_frag_send(net, &hdr, data, size);
+    /* If it needs to be fragmented, put it all together in one place first.
+       That doesn't happen often enough for the copy to matter. Anything that's
+       already queued up has to go out ahead of it. */
+    if(size + sizeof(ip_hdr_t) > (size_t)net->mtu) {
+        uint8 buf[size];
+
+        if(q)
+            net_txq_flush(q);
+
+        if(thdr_size)
+            memcpy(buf, thdr, thdr_size);
+
+        for(i = 0, pos = thdr_size; i < iovcnt; ++i) {
+            memcpy(buf + pos, iov[i].iov_base, iov[i].iov_len);
+            pos += iov[i].iov_len;
+        }
+
+        return net_ipv4_frag_send(net, &hdr, buf, size);
+    }
+
+    return ipv4_output(net, q, &hdr, thdr, thdr_size, iov, iovcnt);
+}
+
+int net_ipv4_send(netif_t *net, const uint8 *data, size_t size, int id, int ttl,
+                  int proto, uint32 src, uint32 dst) {
+    struct iovec iov;
+
+    iov.iov_base = (void *)data;
+    iov.iov_len = size;
+
+    return net_ipv4_sendv(net, NULL, NULL, 0, &iov, 1, id, ttl, proto, src,
+                          dst);
 }
 
 int net_ipv4_input(netif_t *src, const uint8 *pkt, size_t pktsize,
@@ -227,8 +275,10 @@ int net_ipv4_input(netif_t *src, const uint8 *pkt, size_t pktsize,
     ip = (const ip_hdr_t *)pkt;
     hdrlen = (ip->version_ihl & 0x0F) << 2;
 
-    if(pktsize < hdrlen) {
-        /* The packet is smaller than the listed header length, bail */
+    if(pktsize < hdrlen || ntohs(ip->length) < hdrlen ||
+       ntohs(ip->length) > pktsize) {
+        /* The packet is smaller than the listed header length (or the listed
+           total length doesn't make sense), bail */
         ++ipv4_stats.pkt_recv_bad_size;
         return -1;
     }
@@ -8,8 +8,11 @@
 #ifndef __LOCAL_NET_IPV4_H
 #define __LOCAL_NET_IPV4_H
 
+#include <sys/uio.h>
 #include <kos/net.h>
 
+#include "net_output.h"
+
 /* These structs are from AndrewK's dcload-ip. */
 #define packed __attribute__((packed))
 typedef struct {
@@ -27,11 +30,19 @@ typedef struct {
 } packed ipv4_pseudo_hdr_t;
 #undef packed
 
-uint16 net_ipv4_checksum(const uint8 *data, size_t bytes, uint16 start);
 int net_ipv4_send_packet(netif_t *net, ip_hdr_t *hdr, const uint8 *data,
                          size_t size);
 int net_ipv4_send(netif_t *net, const uint8 *data, size_t size, int id, int ttl,
                   int proto, uint32 src, uint32 dst);
+
+/* Send a packet made up of a transport layer header (which is copied) and the
+   pieces of data after it (which aren't, and of which there can be no more
+   than NETIF_TX_MAX_IOV - 1). If q is non-NULL, the packet may be added to it
+   rather than being sent right away, so the data has to stay put until the
+   queue is flushed. */
+int net_ipv4_sendv(netif_t *net, net_txq_t *q, const uint8 *thdr,
+                   size_t thdr_size, const struct iovec *iov, int iovcnt,
+                   int id, int ttl, int proto, uint32 src, uint32 dst);
 int net_ipv4_input(netif_t *src, const uint8 *pkt, size_t pktsize,
                    const eth_hdr_t *eth);
 int net_ipv4_input_proto(netif_t *net, const ip_hdr_t *ip, const uint8 *data);
@@ -39,12 +50,20 @@ int net_ipv4_input_proto(netif_t *net, const ip_hdr_t *ip, const uint8 *data);
 uint16 net_ipv4_checksum_pseudo(in_addr_t src, in_addr_t dst, uint8 proto,
                                 uint16 len);
 
+/* In net_crc.c */
+uint16 net_ipv4_checksum(const uint8 *data, size_t bytes, uint16 start);
+uint16 net_ipv4_checksum_iov(const struct iovec *iov, int iovcnt,
+                             uint16 start);
+
+/* Copy bytes bytes from src to dst, and return the checksum of them, which
+   is the same as net_ipv4_checksum() on either one would give afterwards. */
+uint16 net_ipv4_checksum_copy(uint8 *dst, const uint8 *src, size_t bytes,
+                              uint16 start);
+
 /* In net_ipv4_frag.c */
 int net_ipv4_frag_send(netif_t *net, ip_hdr_t *hdr, const uint8 *data,
                        size_t size);
 int net_ipv4_reassemble(netif_t *net, const ip_hdr_t *hdr, const uint8 *data,
                         size_t size);
-int net_ipv4_frag_init(void);
-void net_ipv4_frag_shutdown(void);
 
 #endif /* __LOCAL_NET_IPV4_H */
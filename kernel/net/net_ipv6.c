@@ -6,6 +6,7 @@
 */
 
 #include <string.h>
+#include <stdlib.h>
 #include <netinet/in.h>
 #include <kos/net.h>
 #include <kos/fs_socket.h>
@@ -14,6 +15,9 @@
 #include "net_ipv6.h"
 #include "net_icmp6.h"
 #include "net_ipv4.h"
+#include "net_frag.h"
+#include "net_neigh.h"
+#include "net_output.h"
 
 #if __GNUC__ >= 9
 #pragma GCC diagnostic push
@@ -59,12 +63,18 @@ static int is_in_network(netif_t *net, const struct in6_addr *ip) {
     return 0;
 }
 
-/* Send a packet on the specified network adapter */
-int net_ipv6_send_packet(netif_t *net, ipv6_hdr_t *hdr, const uint8 *data,
-                         size_t data_size) {
-    uint8 pkt[data_size + sizeof(ipv6_hdr_t) + sizeof(eth_hdr_t)];
+/* Send a packet on the specified network adapter. This works just like the
+   IPv4 version: the transport layer header is put together with the others,
+   the data is handed to the driver where it is, and if a queue is given, the
+   packet might be added to it instead of going out right away. */
+static int ipv6_output(netif_t *net, net_txq_t *q, const ipv6_hdr_t *hdr,
+                       const uint8 *thdr, size_t thdr_size,
+                       const struct iovec *iov, int iovcnt) {
     uint8 dst_mac[6];
-    int err;
+    uint8 fhdr[NET_TX_HDR_MAX];
+    struct iovec piov[NETIF_TX_MAX_IOV];
+    size_t lsz = sizeof(eth_hdr_t), size = thdr_size, pos;
+    int err, i;
     struct in6_addr dst = hdr->dst_addr;
     eth_hdr_t *ehdr;
 
@@ -77,26 +87,31 @@ int net_ipv6_send_packet(netif_t *net, ipv6_hdr_t *hdr, const uint8 *data,
         }
     }
 
+    for(i = 0; i < iovcnt; ++i)
+        size += iov[i].iov_len;
+
     /* Are we sending a packet to loopback? */
     if(IN6_IS_ADDR_LOOPBACK(&hdr->dst_addr)) {
+        uint8 pkt[sizeof(ipv6_hdr_t) + size];
+
         memcpy(pkt, hdr, sizeof(ipv6_hdr_t));
-        memcpy(pkt + sizeof(ipv6_hdr_t), data, data_size);
+
+        if(thdr_size)
+            memcpy(pkt + sizeof(ipv6_hdr_t), thdr, thdr_size);
+
+        for(i = 0, pos = sizeof(ipv6_hdr_t) + thdr_size; i < iovcnt; ++i) {
+            memcpy(pkt + pos, iov[i].iov_base, iov[i].iov_len);
+            pos += iov[i].iov_len;
+        }
 
         ++ipv6_stats.pkt_sent;
 
         /* Send the packet "away" */
-        net_ipv6_input(NULL, pkt, sizeof(ipv6_hdr_t) + data_size, NULL);
+        net_ipv6_input(NULL, pkt, sizeof(ipv6_hdr_t) + size, NULL);
         return 0;
     }
     else if(net->flags & NETIF_NOETH) {
-        memcpy(pkt, hdr, sizeof(ipv6_hdr_t));
-        memcpy(pkt + sizeof(ipv6_hdr_t), data, data_size);
-
-        ++ipv6_stats.pkt_sent;
-
-        /* Send the packet away */
-        return net->if_tx(net, pkt, sizeof(ipv6_hdr_t) + data_size,
-                          NETIF_BLOCK);
+        lsz = 0;
     }
     else if(IN6_IS_ADDR_MULTICAST(&hdr->dst_addr)) {
         dst_mac[0] = dst_mac[1] = 0x33;
@@ -110,42 +125,71 @@ int net_ipv6_send_packet(netif_t *net, ipv6_hdr_t *hdr, const uint8 *data,
             dst = net->ip6_gateway;
         }
 
-        err = net_ndp_lookup(net, &dst, dst_mac, hdr, data, data_size);
+        pos = 0;
 
-        if(err == -1) {
-            errno = ENETUNREACH;
-            ++ipv6_stats.pkt_send_failed;
-            return err;
+        if(thdr_size) {
+            piov[0].iov_base = (void *)thdr;
+            piov[0].iov_len = thdr_size;
+            pos = 1;
         }
-        else if(err == -2) {
+
+        for(i = 0; i < iovcnt; ++i)
+            piov[pos++] = iov[i];
+
+        err = net_neigh_lookup(net, &dst, dst_mac, hdr, sizeof(ipv6_hdr_t),
+                               piov, pos);
+
+        if(err == -2) {
             return 0;
         }
+        else if(err < 0) {
+            errno = ENETUNREACH;
+            ++ipv6_stats.pkt_send_failed;
+            return -1;
+        }
     }
 
     /* Fill in the ethernet header */
-    ehdr = (eth_hdr_t *)pkt;
-    memcpy(ehdr->dest, dst_mac, 6);
-    memcpy(ehdr->src, net->mac_addr, 6);
-    ehdr->type[0] = 0x86;
-    ehdr->type[1] = 0xDD;
+    if(lsz) {
+        ehdr = (eth_hdr_t *)fhdr;
+        memcpy(ehdr->dest, dst_mac, 6);
+        memcpy(ehdr->src, net->mac_addr, 6);
+        ehdr->type[0] = 0x86;
+        ehdr->type[1] = 0xDD;
+    }
+
+    /* Put the IP header and the transport header in after it */
+    memcpy(fhdr + lsz, hdr, sizeof(ipv6_hdr_t));
 
-    /* Put the IP header / data into our ethernet packet */
-    memcpy(pkt + sizeof(eth_hdr_t), hdr, sizeof(ipv6_hdr_t));
-    memcpy(pkt + sizeof(eth_hdr_t) + sizeof(ipv6_hdr_t), data, data_size);
+    if(thdr_size)
+        memcpy(fhdr + lsz + sizeof(ipv6_hdr_t), thdr, thdr_size);
 
     ++ipv6_stats.pkt_sent;
 
     /* Send it away */
-    net->if_tx(net, pkt, sizeof(ipv6_hdr_t) + data_size + sizeof(eth_hdr_t),
-               NETIF_BLOCK);
+    err = net_tx_frame(net, q, fhdr, lsz + sizeof(ipv6_hdr_t) + thdr_size,
+                       iov, iovcnt);
 
-    return 0;
+    return lsz ? 0 : err;
 }
 
-int net_ipv6_send(netif_t *net, const uint8 *data, size_t data_size,
-                  int hop_limit, int proto, const struct in6_addr *src,
-                  const struct in6_addr *dst) {
+int net_ipv6_send_packet(netif_t *net, ipv6_hdr_t *hdr, const uint8 *data,
+                         size_t data_size) {
+    struct iovec iov;
+
+    iov.iov_base = (void *)data;
+    iov.iov_len = data_size;
+
+    return ipv6_output(net, NULL, hdr, NULL, 0, &iov, data_size ? 1 : 0);
+}
+
+int net_ipv6_sendv(netif_t *net, net_txq_t *q, const uint8 *thdr,
+                   size_t thdr_size, const struct iovec *iov, int iovcnt,
+                   int hop_limit, int proto, const struct in6_addr *src,
+                   const struct in6_addr *dst) {
     ipv6_hdr_t hdr;
+    size_t size = thdr_size;
+    int i;
 
     if(!net) {
         net = net_default_dev;
@@ -170,35 +214,139 @@ int net_ipv6_send(netif_t *net, const uint8 *data, size_t data_size,
        send function to do the rest. Note that only V4-mapped addresses are
        supported here (::ffff:x.y.z.w) */
     if(IN6_IS_ADDR_V4MAPPED(src) && IN6_IS_ADDR_V4MAPPED(dst)) {
-        return net_ipv4_send(net, data, data_size, -1, hop_limit, proto,
-                             src->__s6_addr.__s6_addr32[3],
-                             dst->__s6_addr.__s6_addr32[3]);
+        return net_ipv4_sendv(net, q, thdr, thdr_size, iov, iovcnt, -1,
+                              hop_limit, proto, src->__s6_addr.__s6_addr32[3],
+                              dst->__s6_addr.__s6_addr32[3]);
     }
     else if(IN6_IS_ADDR_V4MAPPED(src) || IN6_IS_ADDR_V4MAPPED(dst) ||
             IN6_IS_ADDR_V4COMPAT(src) || IN6_IS_ADDR_V4COMPAT(dst)) {
         return -1;
     }
 
+    for(i = 0; i < iovcnt; ++i)
+        size += iov[i].iov_len;
+
     hdr.version_lclass = 0x60;
     hdr.hclass_lflow = 0;
     hdr.lclass = 0;
-    hdr.length = ntohs(data_size);
+    hdr.length = ntohs(size);
     hdr.next_header = proto;
     hdr.hop_limit = hop_limit;
     hdr.src_addr = *src;
     hdr.dst_addr = *dst;
 
     /* XXXX: Handle fragmentation... */
-    return net_ipv6_send_packet(net, &hdr, data, data_size);
+    return ipv6_output(net, q, &hdr, thdr, thdr_size, iov, iovcnt);
+}
+
+int net_ipv6_send(netif_t *net, const uint8 *data, size_t data_size,
+                  int hop_limit, int proto, const struct in6_addr *src,
+                  const struct in6_addr *dst) {
+    struct iovec iov;
+
+    iov.iov_base = (void *)data;
+    iov.iov_len = data_size;
+
+    return net_ipv6_sendv(net, NULL, NULL, 0, &iov, 1, hop_limit, proto, src,
+                          dst);
+}
+
+/* Hand the payload of a packet off to whatever protocol it's for. */
+static int ipv6_input_proto(netif_t *src, const uint8 *pkt, size_t pktsize,
+                            uint8 next_hdr, const uint8 *data, size_t len) {
+    int rv;
+
+    switch(next_hdr) {
+        case IPV6_HDR_ICMP:
+            return net_icmp6_input(src, (ipv6_hdr_t *)pkt, data, len);
+
+        default:
+            rv = fs_socket_input(src, AF_INET6, next_hdr, pkt, data, len);
+
+            if(rv == -2) {
+                /* We don't know what to do with this packet, so send an ICMPv6
+                   message indicating that. */
+                ++ipv6_stats.pkt_recv_bad_proto;
+                return net_icmp6_send_param_prob(src,
+                                                 ICMP6_PARAM_PROB_UNK_HEADER, 6,
+                                                 pkt, pktsize);
+            }
+
+            ++ipv6_stats.pkt_recv;
+            return rv;
+    }
+}
+
+/* Deal with a packet that has a Fragment header right after the IPv6 header.
+   The fragments get put back together in net_frag.c, and the datagram that
+   comes out of that is given the header of the first fragment, with the
+   Fragment header taken out. */
+static int ipv6_input_frag(netif_t *src, const uint8 *pkt, size_t pktsize,
+                           size_t len) {
+    const ipv6_hdr_t *ip = (const ipv6_hdr_t *)pkt;
+    const ipv6_frag_hdr_t *fh;
+    const uint8 *data;
+    net_frag_key_t key;
+    ipv6_hdr_t hdr, *nip;
+    uint16 offs;
+    uint8 *buf;
+    size_t blen;
+    int rv;
+
+    if(len < sizeof(ipv6_frag_hdr_t)) {
+        ++ipv6_stats.pkt_recv_bad_ext;
+        return net_icmp6_send_param_prob(src, ICMP6_PARAM_PROB_BAD_HEADER, 4,
+                                         pkt, pktsize);
+    }
+
+    fh = (const ipv6_frag_hdr_t *)(pkt + sizeof(ipv6_hdr_t));
+    data = pkt + sizeof(ipv6_hdr_t) + sizeof(ipv6_frag_hdr_t);
+    len -= sizeof(ipv6_frag_hdr_t);
+    offs = ntohs(fh->frag_offs);
+
+    /* An "atomic" fragment (RFC 6946) is the whole datagram on its own, so it
+       doesn't need to wait on anything. */
+    if(!(offs & 0xFFF9))
+        return ipv6_input_proto(src, pkt, pktsize, fh->next_header, data, len);
+
+    /* Every fragment but the last has to be a multiple of 8 bytes long. */
+    if((offs & 0x0001) && (len & 0x07)) {
+        ++ipv6_stats.pkt_recv_bad_size;
+        return net_icmp6_send_param_prob(src, ICMP6_PARAM_PROB_BAD_HEADER, 4,
+                                         pkt, pktsize);
+    }
+
+    memset(&key, 0, sizeof(key));
+    key.domain = AF_INET6;
+    key.src = ip->src_addr;
+    key.dst = ip->dst_addr;
+    key.ident = fh->ident;
+
+    /* The next header value that counts is the one in the first fragment, so
+       save it in the header that the datagram will end up with. */
+    hdr = *ip;
+    hdr.next_header = fh->next_header;
+
+    rv = net_frag_input(&key, &hdr, sizeof(ipv6_hdr_t), offs & 0xFFF8,
+                        offs & 0x0001, data, len, &buf, &blen);
+
+    if(rv <= 0)
+        return rv;
+
+    nip = (ipv6_hdr_t *)buf;
+    nip->length = htons(blen - sizeof(ipv6_hdr_t));
+
+    rv = ipv6_input_proto(src, buf, blen, nip->next_header,
+                          buf + sizeof(ipv6_hdr_t), blen - sizeof(ipv6_hdr_t));
+    free(buf);
+
+    return rv;
 }
 
 int net_ipv6_input(netif_t *src, const uint8 *pkt, size_t pktsize,
                    const eth_hdr_t *eth) {
     ipv6_hdr_t *ip;
-    uint8 next_hdr;
-    //int pos;
     size_t len;
-    int rv;
 
     if(pktsize < sizeof(ipv6_hdr_t)) {
         /* This is obviously a bad packet, drop it */
@@ -216,36 +364,15 @@ int net_ipv6_input(netif_t *src, const uint8 *pkt, size_t pktsize,
         return -1;
     }
 
-    /* Parse the header to find the payload */
-    //pos = sizeof(ipv6_hdr_t); // Currently unused, but will be needed later.
-    next_hdr = ip->next_header;
-
     if(eth)
         net_ndp_insert(src, eth->src, &ip->src_addr, 1);
 
-    /* XXXX: Parse options and deal with fragmentation */
-    switch(next_hdr) {
-        case IPV6_HDR_ICMP:
-            return net_icmp6_input(src, ip, pkt + sizeof(ipv6_hdr_t), len);
-
-        default:
-            rv = fs_socket_input(src, AF_INET6, next_hdr, pkt,
-                                 pkt + sizeof(ipv6_hdr_t), len);
-
-            if(rv == -2) {
-                /* We don't know what to do with this packet, so send an ICMPv6
-                   message indicating that. */
-                ++ipv6_stats.pkt_recv_bad_proto;
-                return net_icmp6_send_param_prob(src,
-                                                 ICMP6_PARAM_PROB_UNK_HEADER, 6,
-                                                 pkt, pktsize);
-            }
-
-            ++ipv6_stats.pkt_recv;
-            return rv;
-    }
+    /* XXXX: Parse the other extension headers */
+    if(ip->next_header == IPV6_HDR_EXT_FRAGMENT)
+        return ipv6_input_frag(src, pkt, pktsize, len);
 
-    return 0;
+    return ipv6_input_proto(src, pkt, pktsize, ip->next_header,
+                            pkt + sizeof(ipv6_hdr_t), len);
 }
 
 net_ipv6_stats_t net_ipv6_get_stats(void) {
@@ -24,6 +24,13 @@ typedef struct ipv6_ext_hdr_s {
     uint8       data[];
 } PACKED ipv6_ext_hdr_t;
 
+typedef struct ipv6_frag_hdr_s {
+    uint8       next_header;
+    uint8       reserved;
+    uint16      frag_offs;
+    uint32      ident;
+} PACKED ipv6_frag_hdr_t;
+
 typedef struct ipv6_pseudo_hdr_s {
     struct in6_addr src_addr;
     struct in6_addr dst_addr;
@@ -48,6 +55,13 @@ int net_ipv6_send_packet(netif_t *net, ipv6_hdr_t *hdr, const uint8 *data,
 int net_ipv6_send(netif_t *net, const uint8 *data, size_t data_size,
                   int hop_limit, int proto, const struct in6_addr *src,
                   const struct in6_addr *dst);
+
+/* Send a packet made up of a transport layer header and the pieces of data
+   after it. See net_ipv4_sendv() for the details. */
+int net_ipv6_sendv(netif_t *net, net_txq_t *q, const uint8 *thdr,
+                   size_t thdr_size, const struct iovec *iov, int iovcnt,
+                   int hop_limit, int proto, const struct in6_addr *src,
+                   const struct in6_addr *dst);
 int net_ipv6_input(netif_t *src, const uint8 *pkt, size_t pktsize,
                    const eth_hdr_t *eth);
 uint16 net_ipv6_checksum_pseudo(const struct in6_addr *src,
@@ -57,6 +71,9 @@ uint16 net_ipv6_checksum_pseudo(const struct in6_addr *src,
 extern const struct in6_addr in6addr_linklocal_allnodes;
 extern const struct in6_addr in6addr_linklocal_allrouters;
 
+/* In net_ndp.c */
+void net_ndp_solicit(netif_t *net, const struct in6_addr *ip);
+
 /* Init and Shutdown */
 int net_ipv6_init(void);
 void net_ipv6_shutdown(void);
@@ -0,0 +1,539 @@
+/* KallistiOS ##version##
+
+   kernel/net/net_neigh.c
+   Copyright (C) 2026 The KOS Team and contributors
+
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <sys/queue.h>
+#include <kos/net.h>
+#include <arch/irq.h>
+#include <arch/timer.h>
+
+#include "net_ipv4.h"
+#include "net_ipv6.h"
+#include "net_neigh.h"
+#include "net_thd.h"
+
+/* This is the neighbor table that's shared between ARP and NDP. It maps the
+   network addresses of hosts on the local link to their link-layer addresses.
+   IPv4 addresses are kept as IPv4-mapped IPv6 addresses, which is also what
+   tells us whether to use ARP or NDP to look one up.
+
+   Entries are hashed on the device and address, so finding one doesn't get
+   any slower as the table fills up. While an address is being resolved, a
+   handful of packets for it can be queued up (in packet buffers) so that a
+   burst of them doesn't get lost, with the oldest being dropped if there are
+   too many. The table can be updated from the network input path, which may
+   be in an interrupt, so it's protected by disabling interrupts. Anything that
+   sends packets is done after interrupts have been restored.
+
+   Aging is done by the network thread, a few buckets at a time, so that the
+   work is spread out instead of sweeping the whole table on every packet. */
+
+/* Size of the hash table. This must be a power of two. */
+#define NEIGH_HASH_SIZE         256
+
+/* How many buckets get aged on each run of the timer callback, and how often
+   that happens. This goes through the whole table once a second. */
+#define NEIGH_AGE_BUCKETS       32
+#define NEIGH_AGE_INTERVAL      125
+
+/* Limits on the size of the table and on how much can be queued up waiting on
+   answers. Queued packets take up packet buffers, which are also needed for
+   receiving, so only a quarter of the pool can be used for them. */
+#define NEIGH_MAX_ENTRIES       1024
+#define NEIGH_MAX_PENDING       8
+#define NEIGH_MAX_PENDING_ALL   (NET_PBUF_COUNT / 4)
+
+/* How long to wait for an answer before asking again, and how many times to
+   ask before giving up on an address. */
+#define NEIGH_RETRANS_TIME      1000
+#define NEIGH_MAX_PROBES        3
+
+/* How long an entry lasts after it's last been confirmed. */
+#define NEIGH_ARP_TIMEOUT       (120 * 1000)
+#define NEIGH_NDP_TIMEOUT       (600 * 1000)
+
+/* Most queries that a single run of aging will send */
+#define NEIGH_AGE_QUERIES       8
+
+typedef struct net_neigh {
+    /* Hash table handle */
+    LIST_ENTRY(net_neigh)   nb_list;
+
+    /* The device this neighbor is on, and its addresses */
+    netif_t                 *nif;
+    struct in6_addr         ip;
+    uint8                   mac[6];
+
+    /* One of the NET_NEIGH_* states */
+    int                     state;
+
+    /* Number of queries sent since the address was last confirmed */
+    int                     probes;
+
+    /* When the address was last confirmed (or used, for IPv4) */
+    uint64                  updated;
+
+    /* When the last query for the address was sent */
+    uint64                  probed;
+
+    /* Packets waiting on the address to be resolved */
+    int                     npending;
+    struct net_pbuf_queue   pending;
+} net_neigh_t;
+
+LIST_HEAD(net_neigh_list, net_neigh);
+
+static struct net_neigh_list neigh_hash[NEIGH_HASH_SIZE];
+static int neigh_count = 0;
+static int neigh_pending = 0;
+static int neigh_age_next = 0;
+static int neigh_cb_id = -1;
+static net_neigh_stats_t neigh_stats;
+
+static inline struct net_neigh_list *neigh_bucket(netif_t *nif,
+                                                  const struct in6_addr *ip) {
+    uint32 h;
+
+    h = ip->__s6_addr.__s6_addr32[0] ^ ip->__s6_addr.__s6_addr32[1] ^
+        ip->__s6_addr.__s6_addr32[2] ^ ip->__s6_addr.__s6_addr32[3];
+    h ^= (uint32)(uintptr_t)nif;
+    h ^= h >> 16;
+    h *= 0x45D9F3B;
+    h ^= h >> 16;
+
+    return &neigh_hash[h & (NEIGH_HASH_SIZE - 1)];
+}
+
+/* Find an entry. Interrupts must be disabled. */
+static net_neigh_t *neigh_find(netif_t *nif, const struct in6_addr *ip) {
+    net_neigh_t *n;
+
+    LIST_FOREACH(n, neigh_bucket(nif, ip), nb_list) {
+        if(n->nif == nif && !memcmp(&n->ip, ip, sizeof(struct in6_addr)))
+            return n;
+    }
+
+    return NULL;
+}
+
+/* Send out a query for an address. Interrupts must not be disabled. */
+static void neigh_query(netif_t *nif, const struct in6_addr *ip) {
+    if(IN6_IS_ADDR_V4MAPPED(ip))
+        net_arp_query(nif, ip->s6_addr + 12);
+    else
+        net_ndp_solicit(nif, ip);
+
+    ++neigh_stats.queries;
+}
+
+/* Send a packet that was queued up waiting on an address. The size of the
+   network layer header is stashed in the buffer's scratch space. */
+static void neigh_send(netif_t *nif, const struct in6_addr *ip,
+                       net_pbuf_t *pb) {
+    size_t hdr_size = pb->priv[0];
+
+    if(IN6_IS_ADDR_V4MAPPED(ip))
+        net_ipv4_send_packet(nif, (ip_hdr_t *)pb->data, pb->data + hdr_size,
+                             pb->len - hdr_size);
+    else
+        net_ipv6_send_packet(nif, (ipv6_hdr_t *)pb->data, pb->data + hdr_size,
+                             pb->len - hdr_size);
+
+    ++neigh_stats.pkt_sent;
+}
+
+/* Throw out everything that's queued on an entry. Interrupts must be
+   disabled. */
+static void neigh_drop_pending(net_neigh_t *n) {
+    net_pbuf_t *pb;
+
+    while((pb = TAILQ_FIRST(&n->pending))) {
+        TAILQ_REMOVE(&n->pending, pb, pb_queue);
+        net_pbuf_free(pb);
+        ++neigh_stats.pkt_dropped;
+    }
+
+    neigh_pending -= n->npending;
+    n->npending = 0;
+}
+
+/* Remove an entry from the table. Interrupts must be disabled. */
+static void neigh_remove(net_neigh_t *n) {
+    LIST_REMOVE(n, nb_list);
+    neigh_drop_pending(n);
+    free(n);
+    --neigh_count;
+}
+
+/* Queue up a packet on an entry that's being resolved. Interrupts must be
+   disabled. Returns 0 if it was queued, -1 otherwise. */
+static int neigh_queue(net_neigh_t *n, const void *hdr, size_t hdr_size,
+                       const struct iovec *iov, int iovcnt) {
+    net_pbuf_t *pb;
+    size_t len = hdr_size;
+    int i;
+
+    for(i = 0; i < iovcnt; ++i)
+        len += iov[i].iov_len;
+
+    if(len > NET_PBUF_SIZE) {
+        ++neigh_stats.pkt_dropped;
+        return -1;
+    }
+
+    /* If we're out of room, make some by dropping the oldest packet on this
+       entry. Newer packets are more likely to still be useful. */
+    if(n->npending >= NEIGH_MAX_PENDING ||
+       neigh_pending >= NEIGH_MAX_PENDING_ALL) {
+        if(!(pb = TAILQ_FIRST(&n->pending))) {
+            ++neigh_stats.pkt_dropped;
+            return -1;
+        }
+
+        TAILQ_REMOVE(&n->pending, pb, pb_queue);
+        --n->npending;
+        --neigh_pending;
+        ++neigh_stats.pkt_dropped;
+    }
+    else if(!(pb = net_pbuf_alloc())) {
+        ++neigh_stats.pkt_dropped;
+        return -1;
+    }
+
+    memcpy(pb->buf, hdr, hdr_size);
+    pb->data = pb->buf;
+    pb->len = hdr_size;
+
+    for(i = 0; i < iovcnt; ++i) {
+        memcpy(pb->buf + pb->len, iov[i].iov_base, iov[i].iov_len);
+        pb->len += iov[i].iov_len;
+    }
+
+    pb->priv[0] = hdr_size;
+
+    TAILQ_INSERT_TAIL(&n->pending, pb, pb_queue);
+    ++n->npending;
+    ++neigh_pending;
+    ++neigh_stats.pkt_queued;
+
+    return 0;
+}
+
+/* Make a new entry and put it in the table. Interrupts must be disabled. */
+static net_neigh_t *neigh_create(netif_t *nif, const struct in6_addr *ip,
+                                 net_neigh_t *n) {
+    memset(n, 0, sizeof(net_neigh_t));
+    n->nif = nif;
+    n->ip = *ip;
+    n->state = NET_NEIGH_INCOMPLETE;
+    TAILQ_INIT(&n->pending);
+
+    LIST_INSERT_HEAD(neigh_bucket(nif, ip), n, nb_list);
+    ++neigh_count;
+
+    return n;
+}
+
+/* Allocate memory for a new entry, if there's room in the table. The
+   allocation is done with interrupts enabled, so the caller has to look for
+   the entry again afterwards, in case someone else added it. */
+static net_neigh_t *neigh_alloc(void) {
+    if(neigh_count >= NEIGH_MAX_ENTRIES) {
+        ++neigh_stats.table_full;
+        return NULL;
+    }
+
+    return (net_neigh_t *)malloc(sizeof(net_neigh_t));
+}
+
+int net_neigh_lookup(netif_t *nif, const struct in6_addr *ip, uint8 mac_out[6],
+                     const void *hdr, size_t hdr_size,
+                     const struct iovec *iov, int iovcnt) {
+    net_neigh_t *n, *nn = NULL;
+    uint64 now = timer_ms_gettime64();
+    int old, query = 0, rv;
+
+    old = irq_disable();
+    ++neigh_stats.lookups;
+
+    /* The common case: we already know where it goes. */
+    if((n = neigh_find(nif, ip)) && n->state != NET_NEIGH_INCOMPLETE) {
+        memcpy(mac_out, n->mac, 6);
+
+        /* IPv4 entries stay around as long as they're in use. Stale IPv6
+           entries get checked on, but they can still be used meanwhile. */
+        if(n->state == NET_NEIGH_REACHABLE && IN6_IS_ADDR_V4MAPPED(ip)) {
+            n->updated = now;
+        }
+        else if(n->state == NET_NEIGH_STALE &&
+                n->probed + NEIGH_RETRANS_TIME <= now) {
+            n->probed = now;
+            query = 1;
+        }
+
+        irq_restore(old);
+
+        if(query)
+            neigh_query(nif, ip);
+
+        return 0;
+    }
+
+    ++neigh_stats.misses;
+    memset(mac_out, 0, 6);
+
+    if(!n) {
+        irq_restore(old);
+
+        if(!(nn = neigh_alloc()))
+            return -3;
+
+        old = irq_disable();
+
+        if(!(n = neigh_find(nif, ip))) {
+            n = neigh_create(nif, ip, nn);
+            n->updated = n->probed = now;
+            n->probes = 1;
+            nn = NULL;
+            query = 1;
+        }
+    }
+
+    /* Hang onto the packet until we know where to send it. */
+    if(hdr && iovcnt)
+        rv = neigh_queue(n, hdr, hdr_size, iov, iovcnt) ? -1 : -2;
+    else
+        rv = query ? -2 : -1;
+
+    /* If it's only just been made, we always have to say so, even if the
+       packet didn't fit. Otherwise the caller would never know to ask again
+       when the query gets answered. */
+    if(query)
+        rv = -2;
+
+    irq_restore(old);
+
+    /* Someone else beat us to making the entry. */
+    if(nn)
+        free(nn);
+
+    if(query)
+        neigh_query(nif, ip);
+
+    return rv;
+}
+
+int net_neigh_update(netif_t *nif, const struct in6_addr *ip,
+                     const uint8 mac[6], int state) {
+    net_neigh_t *n, *nn = NULL;
+    struct net_pbuf_queue pending;
+    net_pbuf_t *pb;
+    uint64 now = timer_ms_gettime64();
+    int old;
+
+    TAILQ_INIT(&pending);
+    old = irq_disable();
+
+    if(!(n = neigh_find(nif, ip))) {
+        irq_restore(old);
+
+        if(!(nn = neigh_alloc()))
+            return -1;
+
+        old = irq_disable();
+
+        if(!(n = neigh_find(nif, ip))) {
+            n = neigh_create(nif, ip, nn);
+            nn = NULL;
+        }
+    }
+
+    /* An unsolicited update that doesn't change anything is as good as a
+       confirmation. Permanent entries stay that way, no matter what. */
+    if(state == NET_NEIGH_STALE && n->state != NET_NEIGH_INCOMPLETE &&
+       !memcmp(n->mac, mac, 6))
+        state = NET_NEIGH_REACHABLE;
+
+    if(n->state == NET_NEIGH_PERMANENT)
+        state = NET_NEIGH_PERMANENT;
+
+    if(n->state == NET_NEIGH_INCOMPLETE)
+        ++neigh_stats.resolved;
+
+    memcpy(n->mac, mac, 6);
+    n->state = state;
+    n->updated = now;
+    n->probes = 0;
+
+    /* Take everything that was waiting on this address. It gets sent once
+       interrupts are back on. */
+    TAILQ_CONCAT(&pending, &n->pending, pb_queue);
+    neigh_pending -= n->npending;
+    n->npending = 0;
+
+    irq_restore(old);
+
+    if(nn)
+        free(nn);
+
+    while((pb = TAILQ_FIRST(&pending))) {
+        TAILQ_REMOVE(&pending, pb, pb_queue);
+        neigh_send(nif, ip, pb);
+        net_pbuf_free(pb);
+    }
+
+    return 0;
+}
+
+int net_neigh_revlookup(netif_t *nif, int domain, struct in6_addr *ip_out,
+                        const uint8 mac[6]) {
+    net_neigh_t *n;
+    int i, old, rv = -1;
+
+    /* This is rare enough that there's no point in having another table for
+       it, so just go through everything. */
+    old = irq_disable();
+
+    for(i = 0; i < NEIGH_HASH_SIZE && rv; ++i) {
+        LIST_FOREACH(n, &neigh_hash[i], nb_list) {
+            if(n->nif != nif || n->state == NET_NEIGH_INCOMPLETE ||
+               (domain == AF_INET) != !!IN6_IS_ADDR_V4MAPPED(&n->ip))
+                continue;
+
+            if(!memcmp(n->mac, mac, 6)) {
+                *ip_out = n->ip;
+
+                if(n->state == NET_NEIGH_REACHABLE)
+                    n->updated = timer_ms_gettime64();
+
+                rv = 0;
+                break;
+            }
+        }
+    }
+
+    irq_restore(old);
+
+    return rv;
+}
+
+/* Age the entries in some of the buckets of the table. Entries that have been
+   around too long are removed, as are addresses that didn't get resolved after
+   a few tries. Anything still being resolved gets asked about again. */
+static void neigh_age(int first, int count) {
+    net_neigh_t *n, *tmp;
+    netif_t *qnif[NEIGH_AGE_QUERIES];
+    struct in6_addr qip[NEIGH_AGE_QUERIES];
+    uint64 now = timer_ms_gettime64(), timeout;
+    int i, old, nq = 0;
+
+    old = irq_disable();
+
+    for(i = first; i < first + count; ++i) {
+        n = LIST_FIRST(&neigh_hash[i & (NEIGH_HASH_SIZE - 1)]);
+
+        while(n) {
+            tmp = LIST_NEXT(n, nb_list);
+
+            if(n->state == NET_NEIGH_INCOMPLETE) {
+                if(n->probed + NEIGH_RETRANS_TIME <= now) {
+                    if(n->probes >= NEIGH_MAX_PROBES) {
+                        ++neigh_stats.unresolved;
+                        neigh_remove(n);
+                    }
+                    else if(nq < NEIGH_AGE_QUERIES) {
+                        /* If there's too much to ask about, the rest can wait
+                           until the next time around. */
+                        ++n->probes;
+                        n->probed = now;
+                        qnif[nq] = n->nif;
+                        qip[nq++] = n->ip;
+                    }
+                }
+            }
+            else if(n->state != NET_NEIGH_PERMANENT) {
+                timeout = IN6_IS_ADDR_V4MAPPED(&n->ip) ? NEIGH_ARP_TIMEOUT :
+                          NEIGH_NDP_TIMEOUT;
+
+                if(n->updated + timeout <= now) {
+                    ++neigh_stats.expired;
+                    neigh_remove(n);
+                }
+            }
+
+            n = tmp;
+        }
+    }
+
+    irq_restore(old);
+
+    for(i = 0; i < nq; ++i)
+        neigh_query(qnif[i], &qip[i]);
+}
+
+static void neigh_age_cb(void *arg) {
+    (void)arg;
+
+    neigh_age(neigh_age_next, NEIGH_AGE_BUCKETS);
+    neigh_age_next = (neigh_age_next + NEIGH_AGE_BUCKETS) &
+                     (NEIGH_HASH_SIZE - 1);
+}
+
+void net_neigh_gc(void) {
+    neigh_age(0, NEIGH_HASH_SIZE);
+}
+
+net_neigh_stats_t net_neigh_get_stats(void) {
+    net_neigh_stats_t rv;
+    int old;
+
+    old = irq_disable();
+    rv = neigh_stats;
+    rv.entries = neigh_count;
+    rv.pkt_pending = neigh_pending;
+    irq_restore(old);
+
+    return rv;
+}
+
+int net_neigh_init(void) {
+    int i;
+
+    for(i = 0; i < NEIGH_HASH_SIZE; ++i)
+        LIST_INIT(&neigh_hash[i]);
+
+    neigh_count = neigh_pending = 0;
+    neigh_age_next = 0;
+    memset(&neigh_stats, 0, sizeof(neigh_stats));
+
+    if((neigh_cb_id = net_thd_add_callback(&neigh_age_cb, NULL,
+                                           NEIGH_AGE_INTERVAL)) < 0)
+        return -1;
+
+    return 0;
+}
+
+void net_neigh_shutdown(void) {
+    net_neigh_t *n;
+    int i, old;
+
+    if(neigh_cb_id >= 0) {
+        net_thd_del_callback(neigh_cb_id);
+        neigh_cb_id = -1;
+    }
+
+    old = irq_disable();
+
+    for(i = 0; i < NEIGH_HASH_SIZE; ++i) {
+        while((n = LIST_FIRST(&neigh_hash[i])))
+            neigh_remove(n);
+    }
+
+    irq_restore(old);
+}
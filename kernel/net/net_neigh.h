@@ -0,0 +1,57 @@
+/* KallistiOS ##version##
+
+   kernel/net/net_neigh.h
+   Copyright (C) 2026 The KOS Team and contributors
+
+*/
+
+#ifndef __LOCAL_NET_NEIGH_H
+#define __LOCAL_NET_NEIGH_H
+
+#include <sys/cdefs.h>
+
+__BEGIN_DECLS
+
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <kos/net.h>
+
+/* States of a neighbor table entry. IPv4 entries are only ever incomplete,
+   reachable, or permanent, since ARP doesn't have any notion of staleness. */
+#define NET_NEIGH_INCOMPLETE    0
+#define NET_NEIGH_REACHABLE     1
+#define NET_NEIGH_STALE         2
+#define NET_NEIGH_PERMANENT     3
+
+/* Look up the link-layer address of a neighbor. IPv4 addresses are given as
+   IPv4-mapped IPv6 addresses. If the address isn't known yet, a query is sent
+   for it, and the packet (if one is given, as a header and data) is queued up
+   to be sent once the answer comes in. The packet is given as its network
+   layer header and the pieces of what follows it. Returns 0 if the address was
+   found, -1 if it wasn't and the packet couldn't be queued, -2 if a query has
+   been sent or the packet has been queued, or -3 if memory couldn't be
+   allocated for a new entry. */
+int net_neigh_lookup(netif_t *nif, const struct in6_addr *ip, uint8 mac_out[6],
+                     const void *hdr, size_t hdr_size,
+                     const struct iovec *iov, int iovcnt);
+
+/* Add or update an entry, sending anything that was waiting on it. A STALE
+   update of an entry that already has the same address makes it REACHABLE.
+   Returns 0 on success, -1 if there's no room for a new entry. */
+int net_neigh_update(netif_t *nif, const struct in6_addr *ip,
+                     const uint8 mac[6], int state);
+
+/* Find the network address (of the given family) that goes with a link-layer
+   address. Returns 0 on success, -1 if there isn't one. */
+int net_neigh_revlookup(netif_t *nif, int domain, struct in6_addr *ip_out,
+                        const uint8 mac[6]);
+
+/* Age out every entry that is due for it, right now. */
+void net_neigh_gc(void);
+
+int net_neigh_init(void);
+void net_neigh_shutdown(void);
+
+__END_DECLS
+
+#endif /* !__LOCAL_NET_NEIGH_H */
@@ -0,0 +1,134 @@
+/* KallistiOS ##version##
+
+   kernel/net/net_output.c
+   Copyright (C) 2026 The KOS Team and contributors
+
+*/
+
+#include <string.h>
+#include <errno.h>
+#include <kos/net.h>
+
+#include "net_output.h"
+
+/*
+
+  Main packet output system
+
+  Everything the stack sends to a device goes through net_tx_batch(), as a list
+  of packets, each of which is a list of pieces. Drivers that can deal with that
+  directly (with if_tx_batch) get the whole list at once, and drivers that only
+  know how to send one contiguous packet (with if_tx) get one at a time.
+
+*/
+
+/* Put a packet that's in pieces together in one buffer and send it with
+   if_tx. */
+static int tx_gather(netif_t *nif, const netif_txpkt_t *pkt, int blocking) {
+    uint8 buf[pkt->len];
+    int i, pos = 0;
+
+    for(i = 0; i < pkt->iovcnt; ++i) {
+        memcpy(buf + pos, pkt->iov[i].iov_base, pkt->iov[i].iov_len);
+        pos += pkt->iov[i].iov_len;
+    }
+
+    return nif->if_tx(nif, buf, pkt->len, blocking);
+}
+
+int net_tx_batch(netif_t *nif, const netif_txpkt_t *pkts, int count,
+                 int blocking) {
+    int i, rv = NETIF_TX_OK;
+
+    if(count <= 0)
+        return 0;
+
+    if(nif->if_tx_batch) {
+        rv = nif->if_tx_batch(nif, pkts, count, blocking);
+    }
+    else {
+        for(i = 0; i < count; ++i) {
+            if(pkts[i].iovcnt == 1)
+                rv = nif->if_tx(nif, (const uint8 *)pkts[i].iov[0].iov_base,
+                                pkts[i].len, blocking);
+            else
+                rv = tx_gather(nif, pkts + i, blocking);
+
+            if(rv != NETIF_TX_OK)
+                break;
+        }
+
+        if(i)
+            rv = i;
+    }
+
+    if(nif->if_tx_commit)
+        nif->if_tx_commit(nif);
+
+    return rv;
+}
+
+void net_txq_init(net_txq_t *q) {
+    q->nif = NULL;
+    q->count = 0;
+}
+
+int net_txq_flush(net_txq_t *q) {
+    int rv;
+
+    if(!q->count)
+        return 0;
+
+    rv = net_tx_batch(q->nif, q->pkts, q->count, NETIF_BLOCK);
+    q->count = 0;
+
+    return rv < 0 ? -1 : 0;
+}
+
+int net_tx_frame(netif_t *nif, net_txq_t *q, const uint8 *hdr,
+                 size_t hdr_size, const struct iovec *iov, int iovcnt) {
+    struct iovec liov[NETIF_TX_MAX_IOV];
+    netif_txpkt_t lpkt;
+    struct iovec *fiov = liov;
+    netif_txpkt_t *pkt = &lpkt;
+    int i;
+
+    if(hdr_size > NET_TX_HDR_MAX || iovcnt >= NETIF_TX_MAX_IOV) {
+        errno = EMSGSIZE;
+        return NETIF_TX_ERROR;
+    }
+
+    if(q) {
+        /* Packets can only be batched up if they're all going to the same
+           place, and there has to be room for them. */
+        if(q->count && (q->nif != nif || q->count == NET_TXQ_SIZE))
+            net_txq_flush(q);
+
+        q->nif = nif;
+        fiov = q->iov[q->count];
+        pkt = q->pkts + q->count;
+
+        memcpy(q->hdrs[q->count], hdr, hdr_size);
+        hdr = q->hdrs[q->count];
+    }
+
+    fiov[0].iov_base = (void *)hdr;
+    fiov[0].iov_len = hdr_size;
+    pkt->len = hdr_size;
+
+    for(i = 0; i < iovcnt; ++i) {
+        fiov[i + 1] = iov[i];
+        pkt->len += iov[i].iov_len;
+    }
+
+    pkt->iov = fiov;
+    pkt->iovcnt = iovcnt + 1;
+
+    if(q) {
+        ++q->count;
+        return NETIF_TX_OK;
+    }
+
+    i = net_tx_batch(nif, pkt, 1, NETIF_BLOCK);
+    return i > 0 ? NETIF_TX_OK : i;
+}
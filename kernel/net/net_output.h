@@ -0,0 +1,55 @@
+/* KallistiOS ##version##
+
+   kernel/net/net_output.h
+   Copyright (C) 2026 The KOS Team and contributors
+
+*/
+
+#ifndef __LOCAL_NET_OUTPUT_H
+#define __LOCAL_NET_OUTPUT_H
+
+#include <sys/cdefs.h>
+
+__BEGIN_DECLS
+
+#include <sys/uio.h>
+#include <kos/net.h>
+
+/* How many packets can be held in a transmit queue before it gets flushed. */
+#define NET_TXQ_SIZE        8
+
+/* Room for the headers of each packet in a queue: Ethernet, the biggest IP
+   header (IPv4 with options, or IPv6), and a TCP header with as many options
+   as it can have. */
+#define NET_TX_HDR_MAX      136
+
+/* A queue of packets waiting to be handed to a driver all at once. The headers
+   of each packet are copied in, but the data after them isn't, so it has to
+   stay put until the queue is flushed. These are meant to be short-lived, and
+   are generally kept on the stack of whoever is sending a burst of packets. */
+typedef struct net_txq {
+    netif_t *nif;
+    int count;
+    netif_txpkt_t pkts[NET_TXQ_SIZE];
+    struct iovec iov[NET_TXQ_SIZE][NETIF_TX_MAX_IOV];
+    uint8 hdrs[NET_TXQ_SIZE][NET_TX_HDR_MAX] __attribute__((aligned(4)));
+} net_txq_t;
+
+void net_txq_init(net_txq_t *q);
+
+/* Send everything in the queue. Returns 0 on success, -1 if the driver
+   couldn't take any of it. */
+int net_txq_flush(net_txq_t *q);
+
+/* Send a packet made up of a link-layer frame's headers (hdr_size bytes, which
+   are copied) and the data after them (in no more than NETIF_TX_MAX_IOV - 1
+   pieces, which aren't). If a queue is given, the packet is added to it (and
+   anything for another device that's in it is sent first), otherwise it's sent
+   right away. Returns the driver's result (or NETIF_TX_OK, if it was queued),
+   and sets errno on failure. */
+int net_tx_frame(netif_t *nif, net_txq_t *q, const uint8 *hdr,
+                 size_t hdr_size, const struct iovec *iov, int iovcnt);
+
+__END_DECLS
+
+#endif /* !__LOCAL_NET_OUTPUT_H */
@@ -0,0 +1,135 @@
+/* KallistiOS ##version##
+
+   kernel/net/net_pbuf.c
+   Copyright (C) 2026 The KOS Team and contributors
+
+*/
+
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <malloc.h>
+
+#include <kos/net.h>
+#include <arch/irq.h>
+
+/* The pool of packet buffers. These are all allocated in one go when the
+   network is brought up and then handed out from a free list. Since drivers
+   allocate buffers in their interrupt handlers, the free list is protected by
+   disabling interrupts, rather than with a mutex. The pool stays around after
+   the network is shut down, since sockets that are still open may have buffers
+   queued up on them.
+
+   When the data given to net_pbuf_claim() won't fit in a buffer from the pool
+   (a reassembled datagram, for instance), or the pool has run dry, the buffer
+   comes from the heap instead, sized to fit the data (as do the ones from
+   net_pbuf_copy()). Those go back to the heap when they're freed, which is how
+   net_pbuf_free() tells the two apart. */
+static net_pbuf_t *pool;
+static struct net_pbuf_queue free_bufs = TAILQ_HEAD_INITIALIZER(free_bufs);
+
+int net_pbuf_pooled(const net_pbuf_t *pb) {
+    return pool && pb >= pool && pb < pool + NET_PBUF_COUNT;
+}
+
+/* Allocate a buffer from the heap with room for len bytes of data. */
+static net_pbuf_t *pbuf_heap_alloc(size_t len) {
+    net_pbuf_t *pb;
+
+    if(irq_inside_int() && !malloc_irq_safe())
+        return NULL;
+
+    if(!(pb = (net_pbuf_t *)memalign(32, offsetof(net_pbuf_t, buf) + len)))
+        return NULL;
+
+    pb->data = pb->buf;
+    return pb;
+}
+
+net_pbuf_t *net_pbuf_alloc(void) {
+    net_pbuf_t *pb;
+    int old;
+
+    old = irq_disable();
+
+    if((pb = TAILQ_FIRST(&free_bufs)))
+        TAILQ_REMOVE(&free_bufs, pb, pb_queue);
+
+    irq_restore(old);
+
+    if(pb) {
+        pb->data = pb->buf;
+        pb->len = 0;
+    }
+
+    return pb;
+}
+
+void net_pbuf_free(net_pbuf_t *pb) {
+    int old;
+
+    if(!pb)
+        return;
+
+    if(!net_pbuf_pooled(pb)) {
+        free(pb);
+        return;
+    }
+
+    old = irq_disable();
+    TAILQ_INSERT_HEAD(&free_bufs, pb, pb_queue);
+    irq_restore(old);
+}
+
+net_pbuf_t *net_pbuf_claim(netif_t *nif, const uint8 *data, size_t len) {
+    net_pbuf_t *pb = nif ? nif->rx_pbuf : NULL;
+
+    /* If the data is in the buffer being processed, just take it over. This
+       clears out rx_pbuf so that net_input_pbuf() knows not to free it. */
+    if(pb && data >= pb->buf && data + len <= pb->buf + NET_PBUF_SIZE) {
+        nif->rx_pbuf = NULL;
+        pb->data = (uint8 *)data;
+        pb->len = len;
+        return pb;
+    }
+
+    /* Otherwise, copy it into a buffer from the pool, or one from the heap if
+       it doesn't fit or the pool is empty (as long as the heap can be used). */
+    if(len > NET_PBUF_SIZE || !(pb = net_pbuf_alloc())) {
+        if(!(pb = pbuf_heap_alloc(len)))
+            return NULL;
+    }
+
+    memcpy(pb->data, data, len);
+    pb->len = len;
+
+    return pb;
+}
+
+net_pbuf_t *net_pbuf_copy(const uint8 *data, size_t len) {
+    net_pbuf_t *pb;
+
+    if(!(pb = pbuf_heap_alloc(len)))
+        return NULL;
+
+    memcpy(pb->data, data, len);
+    pb->len = len;
+
+    return pb;
+}
+
+int net_pbuf_init(void) {
+    int i;
+
+    if(pool)
+        return 0;
+
+    if(!(pool = (net_pbuf_t *)memalign(32, sizeof(net_pbuf_t) *
+                                       NET_PBUF_COUNT)))
+        return -1;
+
+    for(i = 0; i < NET_PBUF_COUNT; ++i)
+        TAILQ_INSERT_TAIL(&free_bufs, &pool[i], pb_queue);
+
+    return 0;
+}
@@ -11,6 +11,7 @@
 #include <stdint.h>
 #include <poll.h>
 #include <sys/socket.h>
+#include <netinet/tcp.h>
 
 #include <kos/fs.h>
 #include <kos/net.h>
@@ -26,6 +27,7 @@
 #include "net_ipv4.h"
 #include "net_ipv6.h"
 #include "net_thd.h"
+#include "net_output.h"
 
 /* Since some of this is a bit odd in its implementation, here's a few notes on
    what my thinking was while writing all of this...
@@ -52,13 +54,11 @@
    an individual socket, grab that mutex in addition to the read or write lock,
    as is appropriate. The only function that is somewhat counter-intuitive in
    its locking is bind(). The bind() function, even though it does not modify
-   the list itself, does grab the write lock. The reason for this is fairly
-   simple. If bind() were to grab the read lock, then iterate through the list
-   of sockets looking for duplicate binds, there is a possibility that a second
-   call to bind() in another thread could cause a deadlock due to the locking
-   and unlocking of the mutexes on the individual sockets. To prevent this
-   problem, I have it grab the write lock instead. That way, no two bind() calls
-   can be active at a time.
+   the list itself, does grab the write lock. It moves the socket to another
+   bucket in the hash tables, and the local port of a socket is only ever
+   changed with the write lock held, so holding it is what lets bind() (and
+   connect()) check the ports of the other sockets without taking their
+   mutexes. That way, no two bind() calls can be active at a time, either.
 
    On listening:
    When a connection comes in for a socket that is in the listening state, that
@@ -71,22 +71,59 @@
    real socket created for them until they are accept()ed.
 
    On matching sockets:
-   All new sockets (including those created by accept()) are added to the head
-   of the list. Since we cannot bind a socket to an already used port for
-   listening, that means that any fully-created sockets should appear in the
-   list in front of those created for listening to a port (and thus that are
-   only partially-created). This simplifies the procedure for finding matching
-   sockets for incoming packets, since this makes sure that the fully-created
-   socket will be found first if it exists when simply iterating through the
-   list of sockets.
+   Besides the list of all sockets, each socket is also in one of two hash
+   tables that are used for matching incoming packets. Sockets that have a
+   remote end set (those created by accept() or connect()) are hashed on the
+   remote address and port and the local port. Everything else (which is to
+   say, listening sockets) is hashed on just the local port. An incoming packet
+   is first looked up in the table of connections, then in the table of
+   listening sockets, so a fully-created socket will always be found in front
+   of the listening socket that it came from. Either way, only the sockets that
+   land in the same bucket have to be looked at. On top of that, every socket
+   is in a third table, hashed on just its local port, so that bind() and
+   connect() can tell whether a port is in use without going through every
+   socket there is. The hash tables are protected by the same reader/writer
+   semaphore as the list. They have as many buckets as there can be file
+   descriptors (and thus sockets), so there shouldn't ever be much more than
+   one socket in a bucket.
+
+   On retransmission and congestion control:
+   The retransmission timer follows RFC 6298. If the other end does timestamps,
+   the round-trip time is measured from the one echoed back in every ACK.
+   Otherwise, it's measured on one segment at a time (and never on a
+   retransmitted one). The
+   congestion window is handled as described in RFC 5681, with NewReno's fast
+   recovery (RFC 6582) on top of that. A timeout goes back to the first
+   unacknowledged byte and starts over from there, as in slow start.
+
+   On receiving out of order:
+   Segments that come in ahead of what we're expecting are written straight
+   into the receive buffer, where they belong, and the sequence numbers they
+   cover are kept in a small sorted list of blocks. When the hole in front of
+   them gets filled in, they're simply added onto the readable data. If the
+   other end says it supports selective acknowledgements (RFC 2018), the blocks
+   are sent back along with our ACKs. We don't do anything with the SACK blocks
+   that the other end sends us though, so they're just ignored.
+
+   On ACKs and small segments:
+   Incoming data isn't ACKed right away, unless it's the second segment since
+   the last ACK went out (or it's out of order, fills in a hole, or has a FIN).
+   Otherwise, the ACK is held until there's something to send that it can ride
+   along on, or until the next run of the timer callback, whichever is first.
+   On the sending side, Nagle's algorithm holds back a small segment at the end
+   of the data while there is data that hasn't been acknowledged yet, unless
+   TCP_NODELAY is set (or the send buffer is full).
 
    On what's actually here:
-   I didn't bother implementing any TCP extensions beyond RFC 793. That means
-   that I just ignore things like the timestamp option and the selective
-   acknowledgement option. That also means that the window size maxes out at
-   65535. Some extensions may be implemented in the future, if I see fit to do
-   so. That all said, everything in here works just fine over IPv4 or IPv6, and
-   can be used just fine to communicate with "normal" TCP/IP implementations.
+   Other than the above, the window scale and timestamp options from RFC 7323
+   are supported, so the windows are only limited by how big the socket
+   buffers are (which can be set with SO_RCVBUF and SO_SNDBUF before the
+   connection is made). Timestamps are used for measuring round-trip times,
+   but not for protecting against wrapped sequence numbers (PAWS). Beyond that,
+   I didn't bother implementing any TCP extensions beyond RFC 793. Some may be
+   implemented in the future, if I see fit to do so. That all said, everything
+   in here works just fine over IPv4 or IPv6, and can be used just fine to
+   communicate with "normal" TCP/IP implementations.
 */
 
 typedef struct tcp_hdr {
@@ -110,6 +147,10 @@ struct lsock {
     uint32_t isn;
     uint32_t wnd;
     uint16_t mss;
+    int sack;
+    int wscale;
+    int ts;
+    uint32_t tsval;
 };
 
 /* Send/receive variables... */
@@ -121,7 +162,9 @@ struct sndrec {
     uint32_t wl1;
     uint32_t wl2;
     uint32_t iss;
+    uint32_t max;
     uint16_t mss;
+    uint8_t wscale;
 };
 
 struct rcvrec {
@@ -129,10 +172,34 @@ struct rcvrec {
     uint32_t wnd;
     uint32_t up;
     uint32_t irs;
+    uint8_t wscale;
+};
+
+/* A block of data that was received out of order: [start, end) */
+struct rcvblk {
+    uint32_t start;
+    uint32_t end;
+};
+
+/* How many out of order blocks we keep track of, and how many of them we send
+   in a SACK option (which is one less if there's a timestamp option too). */
+#define TCP_MAX_OOO         8
+#define TCP_SACK_BLOCKS     4
+
+/* Options that we care about in an incoming segment */
+struct tcp_opts {
+    int mss;
+    int wscale;
+    int sack;
+    int ts;
+    uint32_t tsval;
+    uint32_t tsecr;
 };
 
 struct tcp_sock {
     LIST_ENTRY(tcp_sock) sock_list;
+    LIST_ENTRY(tcp_sock) hash_list;
+    LIST_ENTRY(tcp_sock) bind_list;
     struct sockaddr_in6 local_addr;
     struct sockaddr_in6 remote_addr;
 
@@ -171,6 +238,30 @@ struct tcp_sock {
             uint64_t timer;
             condvar_t send_cv;
             condvar_t recv_cv;
+
+            /* Retransmission timer (RFC 6298). srtt is scaled by 8 and rttvar
+               by 4, and everything's in milliseconds. */
+            uint32_t srtt;
+            uint32_t rttvar;
+            uint32_t rto;
+            int backoff;
+            uint32_t rtt_seq;
+            uint64_t rtt_time;
+
+            /* Congestion control (RFC 5681 and RFC 6582) */
+            uint32_t cwnd;
+            uint32_t ssthresh;
+            uint32_t recover;
+            int dupacks;
+
+            /* Data received out of order, sorted by sequence number */
+            struct rcvblk ooo[TCP_MAX_OOO];
+            int ooo_count;
+            uint32_t ooo_recent;
+
+            /* Timestamps (RFC 7323) */
+            uint32_t ts_recent;
+            uint32_t last_ack_sent;
         } data;
     };
 };
@@ -181,9 +272,118 @@ static struct tcp_sock_list tcp_socks = LIST_HEAD_INITIALIZER(0);
 static rw_semaphore_t tcp_sem = RWSEM_INITIALIZER;
 static int thd_cb_id = 0;
 
+/* Hash tables for matching incoming packets to sockets. See the comment at the
+   top of the file for how these work. */
+#define TCP_HASH_SIZE   FD_SETSIZE
+
+static struct tcp_sock_list tcp_conn_hash[TCP_HASH_SIZE];
+static struct tcp_sock_list tcp_port_hash[TCP_HASH_SIZE];
+static struct tcp_sock_list tcp_bind_hash[TCP_HASH_SIZE];
+
+/* The range that ports get picked from when one isn't given, and where to start
+   looking the next time. */
+#define TCP_EPHEMERAL_MIN   1024
+#define TCP_EPHEMERAL_MAX   65535
+
+static uint16_t tcp_next_port = TCP_EPHEMERAL_MIN;
+
+static inline struct tcp_sock_list *tcp_conn_bucket(const struct in6_addr *ra,
+                                                    uint16_t rport,
+                                                    uint16_t lport) {
+    uint32_t h;
+
+    h = ra->__s6_addr.__s6_addr32[0] ^ ra->__s6_addr.__s6_addr32[1] ^
+        ra->__s6_addr.__s6_addr32[2] ^ ra->__s6_addr.__s6_addr32[3];
+    h ^= ((uint32_t)rport << 16) | lport;
+    h ^= h >> 16;
+    h *= 0x45D9F3B;
+    h ^= h >> 16;
+
+    return &tcp_conn_hash[h & (TCP_HASH_SIZE - 1)];
+}
+
+static inline struct tcp_sock_list *tcp_port_bucket(uint16_t lport) {
+    return &tcp_port_hash[ntohs(lport) & (TCP_HASH_SIZE - 1)];
+}
+
+static inline struct tcp_sock_list *tcp_bind_bucket(uint16_t lport) {
+    return &tcp_bind_hash[ntohs(lport) & (TCP_HASH_SIZE - 1)];
+}
+
+/* Add a socket to the right hash tables for its addresses. The caller must hold
+   the write lock on tcp_sem. */
+static void tcp_hash_sock(struct tcp_sock *sock) {
+    struct tcp_sock_list *b;
+
+    if(IN6_IS_ADDR_UNSPECIFIED(&sock->remote_addr.sin6_addr))
+        b = tcp_port_bucket(sock->local_addr.sin6_port);
+    else
+        b = tcp_conn_bucket(&sock->remote_addr.sin6_addr,
+                            sock->remote_addr.sin6_port,
+                            sock->local_addr.sin6_port);
+
+    LIST_INSERT_HEAD(b, sock, hash_list);
+    LIST_INSERT_HEAD(tcp_bind_bucket(sock->local_addr.sin6_port), sock,
+                     bind_list);
+}
+
+/* Take a socket back out of the hash tables. */
+static void tcp_unhash_sock(struct tcp_sock *sock) {
+    LIST_REMOVE(sock, hash_list);
+    LIST_REMOVE(sock, bind_list);
+}
+
+/* Move a socket to the right buckets after its addresses have changed. */
+static void tcp_rehash_sock(struct tcp_sock *sock) {
+    tcp_unhash_sock(sock);
+    tcp_hash_sock(sock);
+}
+
+/* Is there a socket (other than the one given) using the local port given? The
+   local port of a socket only ever changes with the write lock on tcp_sem held,
+   so holding that is enough to look at them. */
+static int tcp_port_in_use(const struct tcp_sock *sock, uint16_t lport) {
+    struct tcp_sock *i;
+
+    LIST_FOREACH(i, tcp_bind_bucket(lport), bind_list) {
+        if(i != sock && i->local_addr.sin6_port == lport)
+            return 1;
+    }
+
+    return 0;
+}
+
+/* Pick an unused local port for a socket. This carries on from wherever the
+   last one was picked, so that a port that was just let go of doesn't get
+   handed right back out again. Returns the port (in network byte order), or 0
+   if every one of them is taken. The caller must hold the write lock on
+   tcp_sem. */
+static uint16_t tcp_pick_port(const struct tcp_sock *sock) {
+    uint16_t port;
+    int i;
+
+    for(i = TCP_EPHEMERAL_MIN; i <= TCP_EPHEMERAL_MAX; ++i) {
+        port = tcp_next_port;
+
+        if(tcp_next_port++ == TCP_EPHEMERAL_MAX)
+            tcp_next_port = TCP_EPHEMERAL_MIN;
+
+        if(!tcp_port_in_use(sock, htons(port)))
+            return htons(port);
+    }
+
+    return 0;
+}
+
 /* Default starting window size for connections. This should be big enough as a
-   starting point, in general. If you need to adjust it, you can do so... */
-#define TCP_DEFAULT_WINDOW  8192
+   starting point, in general. If you need to adjust it, you can do so with
+   SO_RCVBUF and SO_SNDBUF, within these limits... */
+#define TCP_DEFAULT_WINDOW  16384
+#define TCP_MIN_BUFFER      2048
+#define TCP_MAX_BUFFER      (1024 * 1024)
+
+/* The most we'll shift the window by (RFC 7323 says this is the max) */
+#define TCP_MAX_WSCALE      14
 
 /* Default MSS */
 #define TCP_DEFAULT_MSS     1460
@@ -192,8 +392,15 @@ static int thd_cb_id = 0;
    to be 15 seconds, since that's what Mac OS X does. */
 #define TCP_DEFAULT_MSL     15000
 
-/* Default retransmission timeout (in milliseconds). */
-#define TCP_DEFAULT_RTTO    2000
+/* Default retransmission timeout (in milliseconds), used until we have a
+   measurement of the round-trip time. This is what RFC 6298 says to use. */
+#define TCP_DEFAULT_RTTO    1000
+
+/* Limits on the retransmission timeout (in milliseconds). RFC 6298 says the
+   minimum should be a second, but that's awfully long on a LAN, so this goes
+   with what most other stacks do instead. */
+#define TCP_MIN_RTTO        200
+#define TCP_MAX_RTTO        60000
 
 /* Default hop limit (or ttl for IPv4) for new sockets */
 #define TCP_DEFAULT_HOPS    64
@@ -228,10 +435,24 @@ static int thd_cb_id = 0;
 #define TCP_IFLAG_CANBEDEL      0x00000001
 #define TCP_IFLAG_QUEUEDCLOSE   0x00000002
 #define TCP_IFLAG_ACCEPTWAIT    0x00000004
+#define TCP_IFLAG_RECOVERY      0x00000008
+#define TCP_IFLAG_TIMING        0x00000010
+#define TCP_IFLAG_SACK          0x00000020
+#define TCP_IFLAG_WSCALE        0x00000040
+#define TCP_IFLAG_TS            0x00000080
+#define TCP_IFLAG_DELACK        0x00000100
+#define TCP_IFLAG_NODELAY       0x00000200
 
 #define TCP_OPT_EOL             0
 #define TCP_OPT_NOP             1
 #define TCP_OPT_MSS             2
+#define TCP_OPT_WSCALE          3
+#define TCP_OPT_SACK_PERM       4
+#define TCP_OPT_SACK            5
+#define TCP_OPT_TS              8
+
+/* Length of the timestamp option, with the NOPs in front of it */
+#define TCP_TS_LEN              12
 
 /* A few macros for comparing sequence numbers */
 #define SEQ_LT(x, y)    (((int32_t)((x) - (y))) < 0)
@@ -239,7 +460,18 @@ static int thd_cb_id = 0;
 #define SEQ_GT(x, y)    (((int32_t)((x) - (y))) > 0)
 #define SEQ_GE(x, y)    (((int32_t)((x) - (y))) >= 0)
 
-#define MAX(x, y)       (x > y ? x : y)
+#define MAX(x, y)       ((x) > (y) ? (x) : (y))
+#define MIN(x, y)       ((x) < (y) ? (x) : (y))
+
+/* The most data that fits in one segment (snd.mss includes the header, and
+   we leave room for the timestamp option if we're sending it) */
+#define TCP_SMSS(s)     ((uint32_t)((s)->data.snd.mss - sizeof(tcp_hdr_t) - \
+                                    (((s)->intflags & TCP_IFLAG_TS) ? \
+                                     TCP_TS_LEN : 0)))
+
+/* The window to put in the header of a segment */
+#define TCP_WND(s)      htons(MIN((s)->data.rcv.wnd >> (s)->data.rcv.wscale, \
+                                  65535))
 
 /* Forward declarations */
 static fs_socket_proto_t proto;
@@ -251,6 +483,10 @@ static int tcp_send_syn(struct tcp_sock *sock, int ack);
 static void tcp_send_ack(struct tcp_sock *sock);
 static void tcp_send_data(struct tcp_sock *sock, int resend);
 static void tcp_send_fin_ack(struct tcp_sock *sock);
+static void tcp_cc_init(struct tcp_sock *sock);
+static void tcp_syn_opts(struct tcp_sock *sock, int sack, int wscale, int ts,
+                         uint32_t tsval);
+static uint8_t tcp_wscale(uint32_t bufsz);
 
 /* Sockets interface... */
 static int net_tcp_socket(net_socket_t *hnd, int domain, int type, int proto) {
@@ -292,6 +528,7 @@ static int net_tcp_socket(net_socket_t *hnd, int domain, int type, int proto) {
     hnd->data = sock;
 
     LIST_INSERT_HEAD(&tcp_socks, sock, sock_list);
+    tcp_hash_sock(sock);
     rwsem_write_unlock(&tcp_sem);
 
     return 0;
@@ -427,6 +664,7 @@ retry:
 
 ret_remove:
     LIST_REMOVE(sock, sock_list);
+    tcp_unhash_sock(sock);
     mutex_unlock(&sock->mutex);
     mutex_destroy(&sock->mutex);
     free(sock);
@@ -436,7 +674,7 @@ ret_remove:
 
 ret_no_remove:
     if(sock->state != TCP_STATE_LISTEN)
-        sock->intflags = TCP_IFLAG_CANBEDEL;
+        sock->intflags |= TCP_IFLAG_CANBEDEL;
 
     if(sock->state == TCP_STATE_ESTABLISHED ||
             sock->state == TCP_STATE_CLOSE_WAIT)
@@ -528,6 +766,7 @@ static int net_tcp_accept(net_socket_t *hnd, struct sockaddr *addr,
             free(sock->listen.queue);
             cond_destroy(&sock->listen.cv);
             LIST_REMOVE(sock, sock_list);
+            tcp_unhash_sock(sock);
             mutex_unlock(&sock->mutex);
             mutex_destroy(&sock->mutex);
             free(sock);
@@ -723,6 +962,10 @@ static int net_tcp_accept(net_socket_t *hnd, struct sockaddr *addr,
     sock2->data.snd.mss = lsock.mss;
     sock2->data.rcv.nxt = lsock.isn + 1;
     sock2->data.rcv.irs = lsock.isn;
+    sock2->data.rcv.wscale = tcp_wscale(sock2->rcvbuf_sz);
+    sock2->intflags = sock->intflags & TCP_IFLAG_NODELAY;
+    tcp_syn_opts(sock2, lsock.sack, lsock.wscale, lsock.ts, lsock.tsval);
+    tcp_cc_init(sock2);
 
     /* Since nothing else has a pointer to this socket, this will not fail. */
     mutex_trylock(&sock2->mutex);
@@ -732,6 +975,7 @@ static int net_tcp_accept(net_socket_t *hnd, struct sockaddr *addr,
     sock2->data.timer = timer_ms_gettime64();
     fd = sock2->sock;
     LIST_INSERT_HEAD(&tcp_socks, sock2, sock_list);
+    tcp_hash_sock(sock2);
     mutex_unlock(&sock2->mutex);
 
     sock->state &= ~TCP_STATE_ACCEPTING;
@@ -743,7 +987,7 @@ static int net_tcp_accept(net_socket_t *hnd, struct sockaddr *addr,
 
 static int net_tcp_bind(net_socket_t *hnd, const struct sockaddr *addr,
                         socklen_t addr_len) {
-    struct tcp_sock *sock, *iter;
+    struct tcp_sock *sock;
     struct sockaddr_in *realaddr4;
     struct sockaddr_in6 realaddr6;
 
@@ -854,71 +1098,31 @@ static int net_tcp_bind(net_socket_t *hnd, const struct sockaddr *addr,
     if(realaddr6.sin6_port != 0) {
         /* Make sure we don't already have a socket bound to the port
            specified */
-        LIST_FOREACH(iter, &tcp_socks, sock_list) {
-            if(iter == sock)
-                continue;
-
-            if(irq_inside_int()) {
-                if(mutex_trylock(&iter->mutex)) {
-                    mutex_unlock(&sock->mutex);
-                    rwsem_write_unlock(&tcp_sem);
-                    errno = EWOULDBLOCK;
-                    return -1;
-                }
-            }
-            else {
-                mutex_lock(&iter->mutex);
-            }
-
-            if(iter->local_addr.sin6_port == realaddr6.sin6_port) {
-                mutex_unlock(&iter->mutex);
-                mutex_unlock(&sock->mutex);
-                rwsem_write_unlock(&tcp_sem);
-                errno = EADDRINUSE;
-                return -1;
-            }
-
-            mutex_unlock(&iter->mutex);
+        if(tcp_port_in_use(sock, realaddr6.sin6_port)) {
+            mutex_unlock(&sock->mutex);
+            rwsem_write_unlock(&tcp_sem);
+            errno = EADDRINUSE;
+            return -1;
         }
 
         sock->local_addr = realaddr6;
     }
     else {
-        uint16_t port = 1024, tmp = 0;
-
-        /* Grab the first unused port >= 1024. This is, unfortunately, O(n^2) */
-        while(tmp != port) {
-            tmp = port;
-
-            LIST_FOREACH(iter, &tcp_socks, sock_list) {
-                if(iter == sock)
-                    continue;
-
-                if(irq_inside_int()) {
-                    if(mutex_trylock(&iter->mutex)) {
-                        mutex_unlock(&sock->mutex);
-                        rwsem_write_unlock(&tcp_sem);
-                        errno = EWOULDBLOCK;
-                        return -1;
-                    }
-                }
-                else {
-                    mutex_lock(&iter->mutex);
-                }
-
-                if(iter->local_addr.sin6_port == port) {
-                    ++port;
-                    break;
-                }
+        uint16_t port;
 
-                mutex_unlock(&iter->mutex);
-            }
+        if(!(port = tcp_pick_port(sock))) {
+            mutex_unlock(&sock->mutex);
+            rwsem_write_unlock(&tcp_sem);
+            errno = EADDRINUSE;
+            return -1;
         }
 
         sock->local_addr = realaddr6;
-        sock->local_addr.sin6_port = htons(port);
+        sock->local_addr.sin6_port = port;
     }
 
+    tcp_rehash_sock(sock);
+
     /* Release the locks, we're done */
     mutex_unlock(&sock->mutex);
     rwsem_write_unlock(&tcp_sem);
@@ -928,7 +1132,7 @@ static int net_tcp_bind(net_socket_t *hnd, const struct sockaddr *addr,
 
 static int net_tcp_connect(net_socket_t *hnd, const struct sockaddr *addr,
                            socklen_t addr_len) {
-    struct tcp_sock *sock, *iter;
+    struct tcp_sock *sock;
     struct sockaddr_in *realaddr4;
     struct sockaddr_in6 realaddr6;
 
@@ -1045,38 +1249,16 @@ static int net_tcp_connect(net_socket_t *hnd, const struct sockaddr *addr,
 
     /* See if the socket is already bound to a local port */
     if(!sock->local_addr.sin6_port) {
-        uint16_t port = 1024, tmp = 0;
-
-        /* Grab the first unused port >= 1024. This is, unfortunately, O(n^2) */
-        while(tmp != port) {
-            tmp = port;
-
-            LIST_FOREACH(iter, &tcp_socks, sock_list) {
-                if(iter == sock)
-                    continue;
-
-                if(irq_inside_int()) {
-                    if(mutex_trylock(&iter->mutex)) {
-                        mutex_unlock(&sock->mutex);
-                        rwsem_write_unlock(&tcp_sem);
-                        errno = EWOULDBLOCK;
-                        return -1;
-                    }
-                }
-                else {
-                    mutex_lock(&iter->mutex);
-                }
-
-                if(iter->local_addr.sin6_port == port) {
-                    ++port;
-                    break;
-                }
+        uint16_t port;
 
-                mutex_unlock(&iter->mutex);
-            }
+        if(!(port = tcp_pick_port(sock))) {
+            mutex_unlock(&sock->mutex);
+            rwsem_write_unlock(&tcp_sem);
+            errno = EADDRNOTAVAIL;
+            return -1;
         }
 
-        sock->local_addr.sin6_port = htons(port);
+        sock->local_addr.sin6_port = port;
 
         if(addr->sa_family == AF_INET) {
             sock->local_addr.sin6_addr.__s6_addr.__s6_addr16[5] = 0xFFFF;
@@ -1088,6 +1270,7 @@ static int net_tcp_connect(net_socket_t *hnd, const struct sockaddr *addr,
     /* Set the remote address on the socket and go to the SYN-SENT state (this
        includes setting up all the data we need for that). */
     sock->remote_addr = realaddr6;
+    tcp_rehash_sock(sock);
 
     if(!(sock->data.rcvbuf = (uint8_t *)malloc(sock->rcvbuf_sz))) {
         errno = ENOBUFS;
@@ -1124,6 +1307,7 @@ static int net_tcp_connect(net_socket_t *hnd, const struct sockaddr *addr,
     }
 
     sock->data.rcv.wnd = sock->rcvbuf_sz;
+    sock->data.rcv.wscale = tcp_wscale(sock->rcvbuf_sz);
     sock->data.rcvbuf_head = sock->data.rcvbuf_tail = 0;
     sock->data.net = net_default_dev;
     sock->data.snd.iss = timer_us_gettime64() >> 2;
@@ -1262,6 +1446,7 @@ static ssize_t net_tcp_recvfrom(net_socket_t *hnd, void *buffer, size_t length,
     uint8_t *buf = (uint8_t *)buffer;
     uint8_t *rb;
     int tmp;
+    uint32_t oldwnd, thresh;
 
     /* Check the parameters first */
     if(buffer == NULL || (addr != NULL && addr_len == NULL)) {
@@ -1380,8 +1565,20 @@ static ssize_t net_tcp_recvfrom(net_socket_t *hnd, void *buffer, size_t length,
 
     /* Advance the window if we're pulling data out of the queue. */
     if(!(flags & MSG_PEEK)) {
+        oldwnd = sock->data.rcv.wnd;
         sock->data.rcv.wnd += size;
         sock->data.rcvbuf_cur_sz -= size;
+
+        /* If the window had gotten too small for the other side to send
+           anything worthwhile, let it know that it has opened back up (see
+           section 4.2.3.3 of RFC 1122). */
+        thresh = MIN(sock->rcvbuf_sz / 2, TCP_DEFAULT_MSS);
+
+        if(oldwnd < thresh && sock->data.rcv.wnd >= thresh &&
+           (sock->state == TCP_STATE_ESTABLISHED ||
+            sock->state == TCP_STATE_FIN_WAIT_1 ||
+            sock->state == TCP_STATE_FIN_WAIT_2))
+            tcp_send_ack(sock);
     }
 
     if(sock->data.rcvbuf_head + size <= sock->rcvbuf_sz) {
@@ -1403,8 +1600,10 @@ static ssize_t net_tcp_recvfrom(net_socket_t *hnd, void *buffer, size_t length,
             sock->data.rcvbuf_head = size - tmp;
     }
 
-    /* If we've got nothing left, move the pointers back to the beginning */
-    if(!sock->data.rcvbuf_cur_sz) {
+    /* If we've got nothing left, move the pointers back to the beginning. This
+       can't be done if there's data past the tail that came in out of order,
+       since it would end up in the wrong place. */
+    if(!sock->data.rcvbuf_cur_sz && !sock->data.ooo_count) {
         sock->data.rcvbuf_head = sock->data.rcvbuf_tail = 0;
     }
 
@@ -1703,6 +1902,16 @@ static int net_tcp_getsockopt(net_socket_t *hnd, int level, int option_name,
 
             break;
 
+        case IPPROTO_TCP:
+
+            switch(option_name) {
+                case TCP_NODELAY:
+                    tmp = !!(sock->intflags & TCP_IFLAG_NODELAY);
+                    goto copy_int;
+            }
+
+            break;
+
         case IPPROTO_IP:
 
             if(sock->domain != AF_INET)
@@ -1803,6 +2012,58 @@ static int net_tcp_setsockopt(net_socket_t *hnd, int level, int option_name,
                 case SO_ERROR:
                 case SO_TYPE:
                     goto ret_inval;
+
+                case SO_RCVBUF:
+                case SO_SNDBUF:
+
+                    if(option_len != sizeof(int))
+                        goto ret_inval;
+
+                    /* The buffers get allocated when the connection is set up,
+                       so it's too late to change them after that. A listening
+                       socket passes its sizes on to the ones it accepts. */
+                    if(sock->state != TCP_STATE_CLOSED &&
+                       sock->state != TCP_STATE_LISTEN)
+                        goto ret_inval;
+
+                    tmp = *((int *)option_value);
+
+                    if(tmp < TCP_MIN_BUFFER)
+                        tmp = TCP_MIN_BUFFER;
+                    else if(tmp > TCP_MAX_BUFFER)
+                        tmp = TCP_MAX_BUFFER;
+
+                    if(option_name == SO_RCVBUF)
+                        sock->rcvbuf_sz = tmp;
+                    else
+                        sock->sndbuf_sz = tmp;
+
+                    goto ret_success;
+            }
+
+            break;
+
+        case IPPROTO_TCP:
+
+            switch(option_name) {
+                case TCP_NODELAY:
+
+                    if(option_len != sizeof(int))
+                        goto ret_inval;
+
+                    tmp = *((int *)option_value);
+
+                    if(tmp)
+                        sock->intflags |= TCP_IFLAG_NODELAY;
+                    else
+                        sock->intflags &= ~TCP_IFLAG_NODELAY;
+
+                    /* Anything that was being held back can go now. */
+                    if(tmp && (sock->state == TCP_STATE_ESTABLISHED ||
+                               sock->state == TCP_STATE_CLOSE_WAIT))
+                        tcp_send_data(sock, 0);
+
+                    goto ret_success;
             }
 
             break;
@@ -2187,177 +2448,437 @@ static void tcp_bpkt_rst(netif_t *net, const struct in6_addr *src,
                   dst, src);
 }
 
+/* Put a timestamp option in a segment we're about to send, if we're using
+   them, and note what we're acknowledging. Since every segment we send has an
+   ACK on it, this also takes care of any ACK that's being held back. Returns
+   how much space the option took. */
+static int tcp_fill_ts(struct tcp_sock *sock, uint8_t *opts) {
+    uint32_t tmp;
+
+    sock->data.last_ack_sent = sock->data.rcv.nxt;
+    sock->intflags &= ~TCP_IFLAG_DELACK;
+
+    if(!(sock->intflags & TCP_IFLAG_TS))
+        return 0;
+
+    opts[0] = TCP_OPT_NOP;
+    opts[1] = TCP_OPT_NOP;
+    opts[2] = TCP_OPT_TS;
+    opts[3] = 10;
+    tmp = htonl((uint32_t)timer_ms_gettime64());
+    memcpy(opts + 4, &tmp, 4);
+    tmp = htonl(sock->data.ts_recent);
+    memcpy(opts + 8, &tmp, 4);
+
+    return TCP_TS_LEN;
+}
+
 static int tcp_send_syn(struct tcp_sock *sock, int ack) {
-    uint8_t rawpkt[sizeof(tcp_hdr_t) + 4];
+    uint8_t rawpkt[sizeof(tcp_hdr_t) + 24];
     tcp_hdr_t *hdr = (tcp_hdr_t *)rawpkt;
+    uint8_t *opts = hdr->options;
+    int sz;
     uint16_t cs;
 
-    /* Fill in the base packet */
+    /* Fill in the base packet. The window is never scaled in a SYN. */
     hdr->src_port = sock->local_addr.sin6_port;
     hdr->dst_port = sock->remote_addr.sin6_port;
     hdr->seq = htonl(sock->data.snd.iss);
     hdr->ack = htonl(sock->data.rcv.nxt);
+    hdr->wnd = htons(MIN(sock->data.rcv.wnd, 65535));
+    hdr->checksum = 0;
+    hdr->urg = 0;
 
-    if(ack) {
-        hdr->off_flags = htons(TCP_FLAG_SYN | TCP_FLAG_ACK | TCP_OFFSET(6));
+    /* Fill in our SYN options. We always send our MSS. On a <SYN>, we offer up
+       everything else we support. On a <SYN,ACK>, we only send the ones that
+       the other side offered. */
+    opts[0] = TCP_OPT_MSS;
+    opts[1] = 4;
+    opts[2] = (TCP_DEFAULT_MSS >> 8) & 0xFF;
+    opts[3] = TCP_DEFAULT_MSS & 0xFF;
+    opts += 4;
+
+    if(!ack)
+        sock->intflags |= TCP_IFLAG_TS | TCP_IFLAG_WSCALE | TCP_IFLAG_SACK;
+
+    opts += tcp_fill_ts(sock, opts);
+
+    if(sock->intflags & TCP_IFLAG_WSCALE) {
+        opts[0] = TCP_OPT_NOP;
+        opts[1] = TCP_OPT_WSCALE;
+        opts[2] = 3;
+        opts[3] = sock->data.rcv.wscale;
+        opts += 4;
     }
-    else {
-        hdr->off_flags = htons(TCP_FLAG_SYN | TCP_OFFSET(6));
+
+    if(sock->intflags & TCP_IFLAG_SACK) {
+        opts[0] = TCP_OPT_NOP;
+        opts[1] = TCP_OPT_NOP;
+        opts[2] = TCP_OPT_SACK_PERM;
+        opts[3] = 2;
+        opts += 4;
     }
 
-    hdr->wnd = htons(sock->data.rcv.wnd);
-    hdr->checksum = 0;
-    hdr->urg = 0;
+    sz = opts - rawpkt;
 
-    /* Fill in our SYN options. The only one we worry about right now is MSS. */
-    hdr->options[0] = TCP_OPT_MSS;
-    hdr->options[1] = 4;
-    hdr->options[2] = (TCP_DEFAULT_MSS >> 8) & 0xFF;
-    hdr->options[3] = TCP_DEFAULT_MSS & 0xFF;
+    if(ack) {
+        hdr->off_flags = htons(TCP_FLAG_SYN | TCP_FLAG_ACK |
+                               TCP_OFFSET(sz >> 2));
+    }
+    else {
+        hdr->off_flags = htons(TCP_FLAG_SYN | TCP_OFFSET(sz >> 2));
+    }
 
     /* Calculate the real checksum */
     cs = net_ipv6_checksum_pseudo(&sock->local_addr.sin6_addr,
                                   &sock->remote_addr.sin6_addr,
-                                  sizeof(tcp_hdr_t) + 4, IPPROTO_TCP);
-    hdr->checksum = net_ipv4_checksum(rawpkt, sizeof(tcp_hdr_t) + 4, cs);
+                                  sz, IPPROTO_TCP);
+    hdr->checksum = net_ipv4_checksum(rawpkt, sz, cs);
 
-    return net_ipv6_send(sock->data.net, rawpkt, sizeof(tcp_hdr_t) + 4,
+    return net_ipv6_send(sock->data.net, rawpkt, sz,
                          sock->hop_limit, IPPROTO_TCP,
                          &sock->local_addr.sin6_addr,
                          &sock->remote_addr.sin6_addr);
 }
 
 static void tcp_send_fin_ack(struct tcp_sock *sock) {
-    uint8_t rawpkt[sizeof(tcp_hdr_t)];
+    uint8_t rawpkt[sizeof(tcp_hdr_t) + TCP_TS_LEN];
     tcp_hdr_t *hdr = (tcp_hdr_t *)rawpkt;
+    int sz = sizeof(tcp_hdr_t);
     uint16_t cs;
 
+    sz += tcp_fill_ts(sock, hdr->options);
+
     /* Fill in the base packet */
     hdr->src_port = sock->local_addr.sin6_port;
     hdr->dst_port = sock->remote_addr.sin6_port;
     hdr->seq = htonl(sock->data.snd.nxt);
     hdr->ack = htonl(sock->data.rcv.nxt);
-    hdr->off_flags = htons(TCP_FLAG_FIN | TCP_FLAG_ACK | TCP_OFFSET(5));
-    hdr->wnd = htons(sock->data.rcv.wnd);
+    hdr->off_flags = htons(TCP_FLAG_FIN | TCP_FLAG_ACK | TCP_OFFSET(sz >> 2));
+    hdr->wnd = TCP_WND(sock);
     hdr->checksum = 0;
     hdr->urg = 0;
 
     /* Calculate the real checksum */
     cs = net_ipv6_checksum_pseudo(&sock->local_addr.sin6_addr,
                                   &sock->remote_addr.sin6_addr,
-                                  sizeof(tcp_hdr_t), IPPROTO_TCP);
-    hdr->checksum = net_ipv4_checksum(rawpkt, sizeof(tcp_hdr_t), cs);
+                                  sz, IPPROTO_TCP);
+    hdr->checksum = net_ipv4_checksum(rawpkt, sz, cs);
 
-    net_ipv6_send(sock->data.net, rawpkt, sizeof(tcp_hdr_t), sock->hop_limit,
+    net_ipv6_send(sock->data.net, rawpkt, sz, sock->hop_limit,
                   IPPROTO_TCP, &sock->local_addr.sin6_addr,
                   &sock->remote_addr.sin6_addr);
 }
 
+/* Fill in a SACK option with (up to max of) the blocks of data we have out of
+   order, and return how long it is. The block with the most recently received
+   data in it goes first, as RFC 2018 asks. */
+static int tcp_fill_sack(struct tcp_sock *sock, uint8_t *opts, int max) {
+    uint32_t tmp;
+    int i, j, first = 0, n = 0;
+
+    for(i = 0; i < sock->data.ooo_count; ++i) {
+        if(SEQ_LE(sock->data.ooo[i].start, sock->data.ooo_recent) &&
+           SEQ_LT(sock->data.ooo_recent, sock->data.ooo[i].end)) {
+            first = i;
+            break;
+        }
+    }
+
+    opts[0] = TCP_OPT_NOP;
+    opts[1] = TCP_OPT_NOP;
+    opts[2] = TCP_OPT_SACK;
+
+    for(i = -1; i < sock->data.ooo_count && n < max; ++i) {
+        if(i == first)
+            continue;
+
+        j = i < 0 ? first : i;
+        tmp = htonl(sock->data.ooo[j].start);
+        memcpy(opts + 4 + n * 8, &tmp, 4);
+        tmp = htonl(sock->data.ooo[j].end);
+        memcpy(opts + 8 + n * 8, &tmp, 4);
+        ++n;
+    }
+
+    opts[3] = 2 + n * 8;
+    return 4 + n * 8;
+}
+
 static void tcp_send_ack(struct tcp_sock *sock) {
-    tcp_hdr_t hdr;
+    uint8_t rawpkt[sizeof(tcp_hdr_t) + TCP_TS_LEN + 4 + TCP_SACK_BLOCKS * 8];
+    tcp_hdr_t *hdr = (tcp_hdr_t *)rawpkt;
+    int sz = sizeof(tcp_hdr_t);
     uint16_t c;
 
+    sz += tcp_fill_ts(sock, hdr->options);
+
+    /* Tell the other side about any holes in what we've got, if it can make
+       sense of that. */
+    if((sock->intflags & TCP_IFLAG_SACK) && sock->data.ooo_count)
+        sz += tcp_fill_sack(sock, rawpkt + sz, sz > (int)sizeof(tcp_hdr_t) ?
+                            TCP_SACK_BLOCKS - 1 : TCP_SACK_BLOCKS);
+
     /* Fill in the base packet */
-    hdr.src_port = sock->local_addr.sin6_port;
-    hdr.dst_port = sock->remote_addr.sin6_port;
-    hdr.seq = htonl(sock->data.snd.nxt);
-    hdr.ack = htonl(sock->data.rcv.nxt);
-    hdr.off_flags = htons(TCP_FLAG_ACK | TCP_OFFSET(5));
-    hdr.wnd = htons(sock->data.rcv.wnd);
-    hdr.checksum = 0;
-    hdr.urg = 0;
+    hdr->src_port = sock->local_addr.sin6_port;
+    hdr->dst_port = sock->remote_addr.sin6_port;
+    hdr->seq = htonl(sock->data.snd.nxt);
+    hdr->ack = htonl(sock->data.rcv.nxt);
+    hdr->off_flags = htons(TCP_FLAG_ACK | TCP_OFFSET(sz >> 2));
+    hdr->wnd = TCP_WND(sock);
+    hdr->checksum = 0;
+    hdr->urg = 0;
 
     /* Calculate the real checksum */
     c = net_ipv6_checksum_pseudo(&sock->local_addr.sin6_addr,
                                  &sock->remote_addr.sin6_addr,
-                                 sizeof(tcp_hdr_t), IPPROTO_TCP);
-    hdr.checksum = net_ipv4_checksum((const uint8 *)&hdr, sizeof(tcp_hdr_t), c);
+                                 sz, IPPROTO_TCP);
+    hdr->checksum = net_ipv4_checksum(rawpkt, sz, c);
 
-    net_ipv6_send(sock->data.net, (const uint8 *)&hdr, sizeof(tcp_hdr_t),
-                  sock->hop_limit, IPPROTO_TCP, &sock->local_addr.sin6_addr,
-                  &sock->remote_addr.sin6_addr);
+    net_ipv6_send(sock->data.net, rawpkt, sz, sock->hop_limit, IPPROTO_TCP,
+                  &sock->local_addr.sin6_addr, &sock->remote_addr.sin6_addr);
 }
 
-static void tcp_send_data(struct tcp_sock *sock, int resend) {
-    uint32_t wnd = sock->data.snd.wnd, snd;
-    int sz = sizeof(tcp_hdr_t);
-    uint8_t rawpkt[1500];
+/* Send one segment of data from the send buffer, starting at the given
+   sequence number and offset into the buffer. The data goes down to the driver
+   straight out of the send buffer, so if a queue is given, nothing can be done
+   to the buffer until it's been flushed. */
+static void tcp_send_seg(struct tcp_sock *sock, net_txq_t *q, uint32_t seq,
+                         uint32_t head, uint32_t len) {
+    uint8_t rawpkt[sizeof(tcp_hdr_t) + TCP_TS_LEN];
     tcp_hdr_t *hdr = (tcp_hdr_t *)rawpkt;
+    struct iovec iov[3];
+    int sz = sizeof(tcp_hdr_t), n = 1;
     uint16_t cs;
-    uint8_t *sb, *buf;
-    uint32_t seq, unacked, head;
 
-    if(!resend) {
-        seq = sock->data.snd.nxt;
-        unacked = sock->data.snd.nxt - sock->data.snd.una;
-        wnd -= unacked;
-        head = sock->data.sndbuf_head;
-    }
-    else {
-        seq = sock->data.snd.una;
-        unacked = 0;
-        head = sock->data.sndbuf_acked;
-    }
-
-    if(!wnd)
-        wnd = 1;
+    sz += tcp_fill_ts(sock, hdr->options);
 
     /* Fill in the base packet */
     hdr->src_port = sock->local_addr.sin6_port;
     hdr->dst_port = sock->remote_addr.sin6_port;
+    hdr->seq = htonl(seq);
     hdr->ack = htonl(sock->data.rcv.nxt);
-    hdr->off_flags = htons(TCP_FLAG_ACK | TCP_OFFSET(5));
-    hdr->wnd = htons(sock->data.rcv.wnd);
+    hdr->off_flags = htons(TCP_FLAG_ACK | TCP_OFFSET(sz >> 2));
+    hdr->wnd = TCP_WND(sock);
+    hdr->checksum = 0;
     hdr->urg = 0;
 
-    /* Put on some data if we should do so */
-    while(sock->data.sndbuf_cur_sz - unacked && wnd) {
-        hdr->seq = htonl(seq);
-        hdr->checksum = 0;
-        buf = rawpkt + sizeof(tcp_hdr_t);
-        sb = sock->data.sndbuf + head;
-        snd = wnd;
+    /* Point at the data, which might wrap around the end of the buffer */
+    iov[0].iov_base = rawpkt;
+    iov[0].iov_len = sz;
+    iov[1].iov_base = sock->data.sndbuf + head;
 
-        if(snd > sock->data.snd.mss - sizeof(tcp_hdr_t))
-            snd = sock->data.snd.mss - sizeof(tcp_hdr_t);
+    if(head + len <= sock->sndbuf_sz) {
+        iov[1].iov_len = len;
+        n = 2;
+    }
+    else {
+        iov[1].iov_len = sock->sndbuf_sz - head;
+        iov[2].iov_base = sock->data.sndbuf;
+        iov[2].iov_len = len - iov[1].iov_len;
+        n = 3;
+    }
 
-        if(snd > sock->data.sndbuf_cur_sz - unacked)
-            snd = sock->data.sndbuf_cur_sz - unacked;
+    /* Calculate the checksum */
+    cs = net_ipv6_checksum_pseudo(&sock->local_addr.sin6_addr,
+                                  &sock->remote_addr.sin6_addr, sz + len,
+                                  IPPROTO_TCP);
+    hdr->checksum = net_ipv4_checksum_iov(iov, n, cs);
 
-        /* Copy in the data */
-        if(head + snd <= sock->sndbuf_sz) {
-            memcpy(buf, sb, snd);
-            head += snd;
+    net_ipv6_sendv(sock->data.net, q, rawpkt, sz, iov + 1, n - 1,
+                   sock->hop_limit, IPPROTO_TCP, &sock->local_addr.sin6_addr,
+                   &sock->remote_addr.sin6_addr);
+}
 
-            if(head == sock->sndbuf_sz)
-                head = 0;
-        }
-        else {
-            sz = sock->sndbuf_sz - head;
-            memcpy(buf, sb, sz);
-            memcpy(buf + sz, sock->data.sndbuf, snd - sz);
-            head = snd - sz;
+/* Send whatever data the windows allow. If resend is set, this instead sends
+   the first unacknowledged segment again (for fast retransmit). */
+static void tcp_send_data(struct tcp_sock *sock, int resend) {
+    net_txq_t q;
+    uint32_t smss = TCP_SMSS(sock);
+    uint32_t flight = sock->data.snd.nxt - sock->data.snd.una;
+    uint32_t wnd, left, snd;
+    uint64_t now = timer_ms_gettime64();
+
+    if(resend) {
+        if((snd = MIN(smss, sock->data.sndbuf_cur_sz)))
+            tcp_send_seg(sock, NULL, sock->data.snd.una,
+                         sock->data.sndbuf_acked, snd);
+
+        /* Don't time a segment that's been sent more than once. */
+        sock->intflags &= ~TCP_IFLAG_TIMING;
+        sock->data.timer = now;
+        return;
+    }
+
+    /* We can have whichever is smaller of the two windows in flight. If the
+       other side's window is closed and there's nothing out there that would
+       get us an update to it, probe it with a single byte. */
+    wnd = MIN(sock->data.snd.wnd, sock->data.cwnd);
+
+    if(!sock->data.snd.wnd && !flight)
+        wnd = 1;
+
+    if(wnd <= flight || sock->data.sndbuf_cur_sz <= flight)
+        return;
+
+    left = sock->data.sndbuf_cur_sz - flight;
+    wnd -= flight;
+
+    /* Start the retransmission timer, if it isn't already running. */
+    if(!flight)
+        sock->data.timer = now;
+
+    /* Hand everything to the driver in batches, rather than one segment at a
+       time. */
+    net_txq_init(&q);
+
+    while(left && wnd) {
+        snd = MIN(MIN(left, wnd), smss);
+
+        /* Nagle's algorithm: if all we've got is less than a full segment,
+           hold onto it while there's still data waiting to be acknowledged.
+           Either more will get written in the meantime, or the ACK will get
+           it sent. If the buffer is full, nothing more can be written, so
+           there's no point in waiting. */
+        if(snd == left && snd < smss && flight &&
+           sock->data.sndbuf_cur_sz < sock->sndbuf_sz &&
+           !(sock->intflags & TCP_IFLAG_NODELAY))
+            break;
+
+        /* Time this segment, if we aren't already timing one. */
+        if(!(sock->intflags & TCP_IFLAG_TIMING)) {
+            sock->intflags |= TCP_IFLAG_TIMING;
+            sock->data.rtt_seq = sock->data.snd.nxt;
+            sock->data.rtt_time = now;
         }
 
-        sz = snd + sizeof(tcp_hdr_t);
+        tcp_send_seg(sock, &q, sock->data.snd.nxt, sock->data.sndbuf_head,
+                     snd);
+
+        sock->data.snd.nxt += snd;
+        sock->data.sndbuf_head += snd;
+
+        if(sock->data.sndbuf_head >= sock->sndbuf_sz)
+            sock->data.sndbuf_head -= sock->sndbuf_sz;
+
+        left -= snd;
         wnd -= snd;
-        seq += snd;
-        unacked += snd;
+        flight += snd;
+    }
+
+    net_txq_flush(&q);
+
+    if(SEQ_GT(sock->data.snd.nxt, sock->data.snd.max))
+        sock->data.snd.max = sock->data.snd.nxt;
+}
 
-        /* Calculate the checksum */
-        cs = net_ipv6_checksum_pseudo(&sock->local_addr.sin6_addr,
-                                      &sock->remote_addr.sin6_addr, sz,
-                                      IPPROTO_TCP);
-        hdr->checksum = net_ipv4_checksum(rawpkt, sz, cs);
+/* Work out the smallest window scale that lets us advertise all of a receive
+   buffer of the given size. */
+static uint8_t tcp_wscale(uint32_t bufsz) {
+    uint8_t shift = 0;
 
-        net_ipv6_send(sock->data.net, rawpkt, sz, sock->hop_limit, IPPROTO_TCP,
-                      &sock->local_addr.sin6_addr,
-                      &sock->remote_addr.sin6_addr);
+    while(shift < TCP_MAX_WSCALE && (bufsz >> shift) > 65535)
+        ++shift;
+
+    return shift;
+}
+
+/* Record which of the options we offer in our <SYN> the other side has agreed
+   to use. Window scaling only happens if both sides send the option, so if the
+   other end didn't, we can't scale our window either. */
+static void tcp_syn_opts(struct tcp_sock *sock, int sack, int wscale, int ts,
+                         uint32_t tsval) {
+    sock->intflags &= ~(TCP_IFLAG_SACK | TCP_IFLAG_WSCALE | TCP_IFLAG_TS);
+
+    if(sack)
+        sock->intflags |= TCP_IFLAG_SACK;
+
+    if(wscale >= 0) {
+        sock->intflags |= TCP_IFLAG_WSCALE;
+        sock->data.snd.wscale = (uint8_t)MIN(wscale, TCP_MAX_WSCALE);
+    }
+    else {
+        sock->data.snd.wscale = sock->data.rcv.wscale = 0;
+    }
+
+    if(ts) {
+        sock->intflags |= TCP_IFLAG_TS;
+        sock->data.ts_recent = tsval;
+    }
+}
+
+/* Set up the retransmission and congestion control state for a connection.
+   This has to be done once we know the MSS. */
+static void tcp_cc_init(struct tcp_sock *sock) {
+    uint32_t smss = TCP_SMSS(sock);
+
+    sock->data.snd.max = sock->data.snd.nxt;
+    sock->data.rto = TCP_DEFAULT_RTTO;
+    sock->data.srtt = sock->data.rttvar = 0;
+    sock->data.backoff = 0;
+
+    /* RFC 5681's initial window, and an arbitrarily high slow start threshold
+       (so the first loss is what sets it). */
+    sock->data.cwnd = MIN(4 * smss, MAX(2 * smss, 4380));
+    sock->data.ssthresh = UINT32_MAX;
+    sock->data.recover = sock->data.snd.iss;
+    sock->data.dupacks = 0;
+}
+
+/* Update the retransmission timeout with a new round-trip time measurement, as
+   in section 2 of RFC 6298. */
+static void tcp_rtt_sample(struct tcp_sock *sock, uint32_t rtt) {
+    int32_t delta;
+    uint32_t rto;
+
+    if(!sock->data.srtt) {
+        sock->data.srtt = rtt << 3;
+        sock->data.rttvar = rtt << 1;
     }
+    else {
+        delta = (int32_t)rtt - (int32_t)(sock->data.srtt >> 3);
+        sock->data.srtt += delta;
+
+        if(delta < 0)
+            delta = -delta;
 
-    sock->data.timer = timer_ms_gettime64();
-    sock->data.sndbuf_head = head;
-    sock->data.snd.nxt = seq;
+        delta -= sock->data.rttvar >> 2;
+        sock->data.rttvar += delta;
+    }
+
+    /* RTO = SRTT + max(G, 4 * RTTVAR), where the clock granularity is 1ms. */
+    rto = (sock->data.srtt >> 3) + MAX(sock->data.rttvar, 1);
+    sock->data.rto = MIN(MAX(rto, TCP_MIN_RTTO), TCP_MAX_RTTO);
+    sock->data.backoff = 0;
+}
+
+/* Handle the retransmission timer going off. */
+static void tcp_rto(struct tcp_sock *sock) {
+    uint32_t smss = TCP_SMSS(sock);
+    uint32_t flight = sock->data.snd.nxt - sock->data.snd.una;
+
+    /* A timeout while probing a closed window isn't a sign of congestion, but
+       anything else is. Only cut the threshold on the first timeout for a
+       segment though, since the flight size is meaningless after that. */
+    if(sock->data.snd.wnd) {
+        if(!sock->data.backoff)
+            sock->data.ssthresh = MAX(flight / 2, 2 * smss);
+
+        sock->data.cwnd = smss;
+    }
+
+    sock->intflags &= ~(TCP_IFLAG_RECOVERY | TCP_IFLAG_TIMING);
+    sock->data.dupacks = 0;
+    sock->data.recover = sock->data.snd.max;
+
+    /* Back off the timer... */
+    sock->data.rto = MIN(sock->data.rto * 2, TCP_MAX_RTTO);
+    ++sock->data.backoff;
+
+    /* ... and start over from the first unacknowledged byte. */
+    sock->data.snd.nxt = sock->data.snd.una;
+    sock->data.sndbuf_head = sock->data.sndbuf_acked;
+    tcp_send_data(sock, 0);
 }
 
 #define ADDR_EQUAL(a1, a2) \
@@ -2366,6 +2887,36 @@ static void tcp_send_data(struct tcp_sock *sock, int resend) {
      ((a1).__s6_addr.__s6_addr32[2] == (a2).__s6_addr.__s6_addr32[2]) && \
      ((a1).__s6_addr.__s6_addr32[3] == (a2).__s6_addr.__s6_addr32[3]))
 
+/* Check if a socket matches an incoming packet. */
+static int sock_matches(const struct tcp_sock *i, const struct in6_addr *src,
+                        const struct in6_addr *dst, uint16_t sport,
+                        uint16_t dport, int domain) {
+    /* Ignore any closed sockets */
+    if(i->state == TCP_STATE_CLOSED)
+        return 0;
+
+    /* Ignore any sockets that are IPv6 only when we have an incoming IPv4
+       packet, or any that are IPv4 only when we have an incoming IPv6
+       packet. */
+    if((domain == AF_INET && (i->flags & FS_SOCKET_V6ONLY)) ||
+            (domain == AF_INET6 && i->domain == AF_INET))
+        return 0;
+
+    /* See if the remote end matches what's in the socket */
+    if(!IN6_IS_ADDR_UNSPECIFIED(&i->remote_addr.sin6_addr) &&
+            (!ADDR_EQUAL(i->remote_addr.sin6_addr, *src) ||
+             i->remote_addr.sin6_port != sport))
+        return 0;
+
+    /* See if it matches the local end */
+    if((!IN6_IS_ADDR_UNSPECIFIED(&i->local_addr.sin6_addr) &&
+            !ADDR_EQUAL(i->local_addr.sin6_addr, *dst)) ||
+            i->local_addr.sin6_port != dport)
+        return 0;
+
+    return 1;
+}
+
 /* Match a socket to an incoming packet. If an actual socket is returned, it is
    the caller's responsibility  to release the socket's mutex when they're done
    with it. */
@@ -2374,49 +2925,104 @@ static struct tcp_sock *find_sock(const struct in6_addr *src,
                                   uint16_t sport, uint16_t dport, int domain) {
     struct tcp_sock *i;
 
-    LIST_FOREACH(i, &tcp_socks, sock_list) {
-        /* Ignore any closed sockets */
-        if(i->state == TCP_STATE_CLOSED)
-            continue;
+    /* Look for a connection first, and fall back to a listening socket if
+       there isn't one. See the comment at the top of the file for more
+       discussion of this, if you're interested. */
+    LIST_FOREACH(i, tcp_conn_bucket(src, sport, dport), hash_list) {
+        if(sock_matches(i, src, dst, sport, dport, domain))
+            goto found;
+    }
 
-        /* Ignore any sockets that are IPv6 only when we have an incoming IPv4
-           packet, or any that are IPv4 only when we have an incoming IPv6
-           packet. */
-        if((domain == AF_INET && (i->flags & FS_SOCKET_V6ONLY)) ||
-                (domain == AF_INET6 && i->domain == AF_INET))
-            continue;
+    LIST_FOREACH(i, tcp_port_bucket(dport), hash_list) {
+        if(sock_matches(i, src, dst, sport, dport, domain))
+            goto found;
+    }
 
-        /* See if the remote end matches what's in the socket */
-        if(!IN6_IS_ADDR_UNSPECIFIED(&i->remote_addr.sin6_addr) &&
-                (!ADDR_EQUAL(i->remote_addr.sin6_addr, *src) ||
-                 i->remote_addr.sin6_port != sport))
-            continue;
+    return NULL;
 
-        /* See if it matches the local end */
-        if((!IN6_IS_ADDR_UNSPECIFIED(&i->local_addr.sin6_addr) &&
-                !ADDR_EQUAL(i->local_addr.sin6_addr, *dst)) ||
-                i->local_addr.sin6_port != dport)
-            continue;
+found:
+    if(irq_inside_int()) {
+        if(mutex_trylock(&i->mutex))
+            return (struct tcp_sock *) - 1;
+    }
+    else {
+        mutex_lock(&i->mutex);
+    }
 
-        if(irq_inside_int()) {
-            if(mutex_trylock(&i->mutex))
-                return (struct tcp_sock *) - 1;
+    return i;
+}
+
+extern void __poll_event_trigger(int fd, short event);
+
+/* Pull the options we care about out of an incoming segment. Anything that
+   isn't there is left as -1 (or 0, for the flags). Returns -1 if the options
+   are malformed. */
+static int tcp_parse_opts(const tcp_hdr_t *tcp, uint16_t flags,
+                          struct tcp_opts *opts) {
+    const uint8_t *o = tcp->options;
+    int j = 0, len, end_of_opts = TCP_GET_OFFSET(flags) - 20;
+
+    opts->mss = opts->wscale = -1;
+    opts->sack = opts->ts = 0;
+
+    while(j < end_of_opts) {
+        if(o[j] == TCP_OPT_EOL)
+            break;
+
+        if(o[j] == TCP_OPT_NOP) {
+            ++j;
+            continue;
         }
-        else {
-            mutex_lock(&i->mutex);
+
+        /* Everything else has a length */
+        if(j + 1 >= end_of_opts || (len = o[j + 1]) < 2 ||
+           j + len > end_of_opts)
+            return -1;
+
+        switch(o[j]) {
+            case TCP_OPT_MSS:
+
+                if(len != 4)
+                    return -1;
+
+                opts->mss = (o[j + 2] << 8) | o[j + 3];
+                break;
+
+            case TCP_OPT_WSCALE:
+
+                if(len != 3)
+                    return -1;
+
+                opts->wscale = MIN(o[j + 2], TCP_MAX_WSCALE);
+                break;
+
+            case TCP_OPT_SACK_PERM:
+
+                if(len != 2)
+                    return -1;
+
+                opts->sack = 1;
+                break;
+
+            case TCP_OPT_TS:
+
+                if(len != 10)
+                    return -1;
+
+                opts->ts = 1;
+                opts->tsval = ((uint32_t)o[j + 2] << 24) | (o[j + 3] << 16) |
+                              (o[j + 4] << 8) | o[j + 5];
+                opts->tsecr = ((uint32_t)o[j + 6] << 24) | (o[j + 7] << 16) |
+                              (o[j + 8] << 8) | o[j + 9];
+                break;
         }
 
-        /* Because we always add new sockets to the head of the list, this
-           should be sufficient to match the socket. See the comment at the top
-           of the file for more discussion of this, if you're interested. */
-        return i;
+        j += len;
     }
 
-    return NULL;
+    return 0;
 }
 
-extern void __poll_event_trigger(int fd, short event);
-
 /* This function is basically a direct implementation of the first two and a
    half steps of the SEGMENT ARRIVES event processing defined in RFC 793 on
    pages 65 and 66. There are a few parts that are omitted and some are put off
@@ -2424,9 +3030,10 @@ extern void __poll_event_trigger(int fd, short event);
 static int listen_pkt(netif_t *src, const struct in6_addr *srca,
                       const struct in6_addr *dsta, const tcp_hdr_t *tcp,
                       struct tcp_sock *s, uint16_t flags, int size) {
-    int j = 0;
-    int end_of_opts;
+    int j;
     uint16_t mss = 576;
+    struct tcp_opts opts;
+    struct lsock *ls;
 
     (void)size;
 
@@ -2439,39 +3046,12 @@ static int listen_pkt(netif_t *src, const struct in6_addr *srca,
         return -1;
 
     /* Parse options now, in case we need to update the max segment size. */
-    end_of_opts = TCP_GET_OFFSET(flags) - 20;
-
-    while(j < end_of_opts) {
-        switch(tcp->options[j]) {
-            case TCP_OPT_EOL:
-                j = end_of_opts;
-                break;
-
-            case TCP_OPT_NOP:
-                ++j;
-                break;
-
-            case TCP_OPT_MSS:
-                if(j + 4 > end_of_opts || tcp->options[j + 1] != 4)
-                    return -1;
-
-                mss = (tcp->options[j + 2] << 8) | tcp->options[j + 3];
-                j += 4;
-                break;
-
-            default:
-
-                /* Skip unknown options */
-                if(j + 1 > end_of_opts || j + tcp->options[j + 1] > end_of_opts)
-                    return -1;
-
-                j += tcp->options[j + 1];
-        }
-    }
+    if(tcp_parse_opts(tcp, flags, &opts))
+        return -1;
 
     /* Silently cap the MSS... */
-    if(mss > 1460)
-        mss = 1460;
+    if(opts.mss >= 0)
+        mss = opts.mss > 1460 ? 1460 : opts.mss;
 
     /* If the SYN bit is set, we should check the security/compartment. We just
        silently ignore them for now. We also ignore the precidence... Thus, the
@@ -2481,9 +3061,8 @@ static int listen_pkt(netif_t *src, const struct in6_addr *srca,
         if(ADDR_EQUAL(s->listen.queue[j].remote_addr.sin6_addr, *srca) &&
                 ADDR_EQUAL(s->listen.queue[j].local_addr.sin6_addr, *dsta) &&
                 s->listen.queue[j].remote_addr.sin6_port == tcp->src_port) {
-            s->listen.queue[j].isn = ntohl(tcp->seq);
-            s->listen.queue[j].mss = mss;
-            return 0;
+            ls = s->listen.queue + j;
+            goto fill_opts;
         }
     }
 
@@ -2498,9 +3077,8 @@ static int listen_pkt(netif_t *src, const struct in6_addr *srca,
     s->listen.queue[s->listen.tail].remote_addr.sin6_port = tcp->src_port;
     s->listen.queue[s->listen.tail].local_addr.sin6_addr = *dsta;
     s->listen.queue[s->listen.tail].local_addr.sin6_port = tcp->dst_port;
-    s->listen.queue[s->listen.tail].isn = ntohl(tcp->seq);
-    s->listen.queue[s->listen.tail].mss = mss;
     s->listen.queue[s->listen.tail].wnd = ntohs(tcp->wnd);
+    ls = s->listen.queue + s->listen.tail;
     ++s->listen.count;
     ++s->listen.tail;
 
@@ -2511,6 +3089,15 @@ static int listen_pkt(netif_t *src, const struct in6_addr *srca,
     __poll_event_trigger(s->sock, POLLRDNORM);
     cond_signal(&s->listen.cv);
 
+fill_opts:
+    /* Save what the other side told us in its options for later. */
+    ls->isn = ntohl(tcp->seq);
+    ls->mss = mss;
+    ls->sack = opts.sack;
+    ls->wscale = opts.wscale;
+    ls->ts = opts.ts;
+    ls->tsval = opts.tsval;
+
     /* We're done, return success. */
     return 0;
 }
@@ -2522,7 +3109,8 @@ static int synsent_pkt(netif_t *src, const struct in6_addr *srca,
                        struct tcp_sock *s, uint16_t flags, int size) {
     uint32_t ack, seq;
     int sz = size - TCP_GET_OFFSET(flags), gotack = 0;
-    int j = 0, end_of_opts, mss = 536;
+    int mss = 536;
+    struct tcp_opts opts;
 
     (void)src;
 
@@ -2558,40 +3146,17 @@ static int synsent_pkt(netif_t *src, const struct in6_addr *srca,
         s->data.rcv.nxt = seq + 1;
         s->data.rcv.irs = seq;
 
-        end_of_opts = TCP_GET_OFFSET(flags) - 20;
-
-        while(j < end_of_opts) {
-            switch(tcp->options[j]) {
-                case TCP_OPT_EOL:
-                    j = end_of_opts;
-                    break;
-
-                case TCP_OPT_NOP:
-                    ++j;
-                    break;
-
-                case TCP_OPT_MSS:
-
-                    if(j + 4 > end_of_opts || tcp->options[j + 1] != 4)
-                        return -1;
-
-                    mss = (tcp->options[j + 2] << 8) | tcp->options[j + 3];
-                    j += 4;
-                    break;
-
-                default:
+        if(tcp_parse_opts(tcp, flags, &opts))
+            return -1;
 
-                    /* Skip unknown options */
-                    if(j + 1 > end_of_opts ||
-                            j + tcp->options[j + 1] > end_of_opts)
-                        return -1;
+        if(opts.mss >= 0)
+            mss = opts.mss;
 
-                    j += tcp->options[j + 1];
-            }
-        }
+        tcp_syn_opts(s, opts.sack, opts.wscale, opts.ts, opts.tsval);
 
         s->data.snd.mss = mss > 1460 ? 1460 : mss;
         s->data.snd.wnd = htons(tcp->wnd);
+        tcp_cc_init(s);
 
         if(gotack) {
             s->data.snd.una = ack;
@@ -2616,22 +3181,213 @@ static int synsent_pkt(netif_t *src, const struct in6_addr *srca,
     return 0;
 }
 
+/* Copy incoming data into the receive buffer, the given distance past the end
+   of what's already there. */
+static void tcp_rcvbuf_put(struct tcp_sock *s, uint32_t off,
+                           const uint8_t *buf, uint32_t sz) {
+    uint32_t pos = s->data.rcvbuf_tail + off, tmp;
+
+    if(pos >= s->rcvbuf_sz)
+        pos -= s->rcvbuf_sz;
+
+    if(pos + sz <= s->rcvbuf_sz) {
+        memcpy(s->data.rcvbuf + pos, buf, sz);
+    }
+    else {
+        tmp = s->rcvbuf_sz - pos;
+        memcpy(s->data.rcvbuf + pos, buf, tmp);
+        memcpy(s->data.rcvbuf, buf + tmp, sz - tmp);
+    }
+}
+
+/* Add data that's already in the receive buffer onto what can be read. */
+static void tcp_rcvbuf_advance(struct tcp_sock *s, uint32_t sz) {
+    s->data.rcv.nxt += sz;
+    s->data.rcv.wnd -= sz;
+    s->data.rcvbuf_cur_sz += sz;
+    s->data.rcvbuf_tail += sz;
+
+    if(s->data.rcvbuf_tail >= s->rcvbuf_sz)
+        s->data.rcvbuf_tail -= s->rcvbuf_sz;
+}
+
+/* Keep track of a block of data that came in out of order, merging it with any
+   blocks that it overlaps or touches. Returns -1 if there's no room. */
+static int tcp_ooo_add(struct tcp_sock *s, uint32_t start, uint32_t end) {
+    struct rcvblk *b = s->data.ooo;
+    int i, j, n = s->data.ooo_count;
+
+    /* Find the first block that doesn't end before this one starts... */
+    for(i = 0; i < n && SEQ_LT(b[i].end, start); ++i);
+
+    /* ... and swallow up any that this one runs into. */
+    for(j = i; j < n && SEQ_LE(b[j].start, end); ++j) {
+        if(SEQ_LT(b[j].start, start))
+            start = b[j].start;
+
+        if(SEQ_GT(b[j].end, end))
+            end = b[j].end;
+    }
+
+    if(i == j) {
+        if(n == TCP_MAX_OOO)
+            return -1;
+
+        memmove(b + i + 1, b + i, (n - i) * sizeof(struct rcvblk));
+        ++n;
+    }
+    else if(j > i + 1) {
+        memmove(b + i + 1, b + j, (n - j) * sizeof(struct rcvblk));
+        n -= j - i - 1;
+    }
+
+    b[i].start = start;
+    b[i].end = end;
+    s->data.ooo_count = n;
+
+    return 0;
+}
+
+/* After the hole at the front of the receive buffer has been (at least partly)
+   filled in, pick up any out of order data that's now in order. */
+static void tcp_ooo_collect(struct tcp_sock *s) {
+    struct rcvblk *b = s->data.ooo;
+
+    while(s->data.ooo_count && SEQ_LE(b[0].start, s->data.rcv.nxt)) {
+        if(SEQ_GT(b[0].end, s->data.rcv.nxt))
+            tcp_rcvbuf_advance(s, b[0].end - s->data.rcv.nxt);
+
+        --s->data.ooo_count;
+        memmove(b, b + 1, s->data.ooo_count * sizeof(struct rcvblk));
+    }
+}
+
+/* Handle an ACK that covers new data. If the segment it came on had a
+   timestamp echoed back in it, tsecr is that value, otherwise it is zero. */
+static void tcp_ack_new(struct tcp_sock *s, uint32_t ack, int acksyn,
+                        uint32_t tsecr) {
+    uint32_t smss = TCP_SMSS(s);
+    uint32_t acked = ack - s->data.snd.una - acksyn;
+    uint64_t now = timer_ms_gettime64();
+
+    /* The FIN takes up a sequence number, but no space in the buffer. */
+    if(acked > s->data.sndbuf_cur_sz)
+        acked = s->data.sndbuf_cur_sz;
+
+    s->data.sndbuf_acked += acked;
+    s->data.sndbuf_cur_sz -= acked;
+    s->data.snd.una = ack;
+
+    if(s->data.sndbuf_acked >= s->sndbuf_sz)
+        s->data.sndbuf_acked -= s->sndbuf_sz;
+
+    /* If we went back to resend something after a timeout and the other side
+       already had more than that, skip ahead. */
+    if(SEQ_GT(ack, s->data.snd.nxt)) {
+        s->data.snd.nxt = ack;
+        s->data.sndbuf_head = s->data.sndbuf_acked;
+    }
+
+    /* With timestamps, every ACK gives us a measurement (RFC 7323 section
+       4.1), even for data that was retransmitted. Without them, we can only
+       time one segment at a time. */
+    if(tsecr) {
+        s->intflags &= ~TCP_IFLAG_TIMING;
+        tcp_rtt_sample(s, (uint32_t)now - tsecr);
+    }
+    else if((s->intflags & TCP_IFLAG_TIMING) &&
+            SEQ_GT(ack, s->data.rtt_seq)) {
+        s->intflags &= ~TCP_IFLAG_TIMING;
+        tcp_rtt_sample(s, (uint32_t)(now - s->data.rtt_time));
+    }
+
+    /* Restart the retransmission timer. */
+    s->data.timer = now;
+    s->data.backoff = 0;
+    s->data.dupacks = 0;
+
+    if(s->intflags & TCP_IFLAG_RECOVERY) {
+        if(SEQ_GE(ack, s->data.recover)) {
+            /* Everything that was out when we went into fast recovery has been
+               acknowledged, so we're done with it. */
+            s->data.cwnd = MIN(s->data.ssthresh,
+                               MAX(s->data.snd.max - ack, smss) + smss);
+            s->intflags &= ~TCP_IFLAG_RECOVERY;
+        }
+        else {
+            /* A partial acknowledgement means the next hole is lost too, so
+               resend it now and deflate the window by what was acked. */
+            tcp_send_data(s, 1);
+            s->data.cwnd -= MIN(acked, s->data.cwnd);
+
+            if(acked >= smss)
+                s->data.cwnd += smss;
+
+            s->data.cwnd = MAX(s->data.cwnd, smss);
+        }
+    }
+    else if(s->data.cwnd < s->data.ssthresh) {
+        /* Slow start */
+        s->data.cwnd += MIN(acked, smss);
+    }
+    else {
+        /* Congestion avoidance: roughly one segment per round trip */
+        s->data.cwnd += MAX(smss * smss / s->data.cwnd, 1);
+    }
+
+    /* There's no sense in having more in flight than we can buffer. */
+    if(s->data.cwnd > s->sndbuf_sz)
+        s->data.cwnd = s->sndbuf_sz;
+}
+
+/* Handle a duplicate ACK (as defined in RFC 5681). */
+static void tcp_ack_dup(struct tcp_sock *s, uint32_t ack) {
+    uint32_t smss = TCP_SMSS(s);
+    uint32_t flight = s->data.snd.nxt - s->data.snd.una;
+
+    /* While in fast recovery, each duplicate means another segment has left
+       the network, so let another one in. */
+    if(s->intflags & TCP_IFLAG_RECOVERY) {
+        s->data.cwnd += smss;
+        return;
+    }
+
+    /* Three in a row means the segment is probably lost, so resend it without
+       waiting for the timer, unless we've already done that for this stretch
+       of data. */
+    if(++s->data.dupacks == 3 && SEQ_GT(ack, s->data.recover)) {
+        s->data.ssthresh = MAX(flight / 2, 2 * smss);
+        s->data.recover = s->data.snd.max;
+        s->intflags |= TCP_IFLAG_RECOVERY;
+        tcp_send_data(s, 1);
+        s->data.cwnd = s->data.ssthresh + 3 * smss;
+    }
+}
+
 /* This implements the processing described for the synchronized states, as
    described in pages 69-76 of the RFC. */
 static int process_pkt(netif_t *src, const struct in6_addr *srca,
                        const struct in6_addr *dsta, const tcp_hdr_t *tcp,
                        struct tcp_sock *s, uint16_t flags, size_t size) {
-    uint32_t seq, ack, up;
+    uint32_t seq, ack, up, snd_max, off, wnd;
     size_t sz;
-    int bad_pkt = 0, tmp, acksyn = 0;
+    int bad_pkt = 0, acksyn = 0, dupack, had_ooo;
     const uint8_t *buf = (const uint8_t *)tcp;
-    uint8_t *rb;
+    struct tcp_opts opts;
 
     (void)src;
 
     /* Grab the seq and ack values from the header. */
     seq = ntohl(tcp->seq);
     ack = ntohl(tcp->ack);
+    wnd = (uint32_t)ntohs(tcp->wnd) << s->data.snd.wscale;
+
+    if(tcp_parse_opts(tcp, flags, &opts))
+        return 0;
+
+    /* Timestamps only count if we agreed to use them. */
+    if(!(s->intflags & TCP_IFLAG_TS))
+        opts.ts = 0;
 
     /* Check the validity of the incoming segment's sequence number */
     sz = size - TCP_GET_OFFSET(flags);
@@ -2648,7 +3404,9 @@ static int process_pkt(netif_t *src, const struct in6_addr *srca,
                 bad_pkt = 1;
         }
         else {
-            if(!(SEQ_GE(seq, s->data.rcv.nxt) &&
+            /* Take the segment if any of it is in the window. Anything at the
+               front that we already have gets trimmed off later. */
+            if(!(SEQ_GT(seq + sz, s->data.rcv.nxt) &&
                     SEQ_LT(seq, s->data.rcv.nxt + s->data.rcv.wnd)))
                 bad_pkt = 1;
         }
@@ -2703,6 +3461,12 @@ static int process_pkt(netif_t *src, const struct in6_addr *srca,
         return 0;
     }
 
+    /* Keep track of the timestamp to echo back, as described in section 4.3 of
+       RFC 7323. We don't do the PAWS check, though. */
+    if(opts.ts && SEQ_LE(seq, s->data.last_ack_sent) &&
+       SEQ_GE(opts.tsval, s->data.ts_recent))
+        s->data.ts_recent = opts.tsval;
+
     /* The state changes how we handle the rest... */
     if(s->state == TCP_STATE_SYN_RECEIVED) {
         if(SEQ_LE(s->data.snd.una, ack) && SEQ_LE(ack, s->data.snd.nxt)) {
@@ -2715,25 +3479,38 @@ static int process_pkt(netif_t *src, const struct in6_addr *srca,
         }
     }
 
-    /* Check the ack number for validity */
-    if(SEQ_LT(s->data.snd.una, ack) && SEQ_LE(ack, s->data.snd.nxt)) {
-        s->data.sndbuf_acked += (int32_t)(ack - s->data.snd.una - acksyn);
-        s->data.sndbuf_cur_sz -= (int32_t)(ack - s->data.snd.una - acksyn);
-        s->data.snd.una = ack;
-        __poll_event_trigger(s->sock, POLLWRNORM | POLLWRBAND);
-        cond_signal(&s->data.send_cv);
+    /* Check the ack number for validity. Anything up to the furthest we've
+       sent is fine, even if we've gone back to resend from before that. */
+    snd_max = SEQ_GT(s->data.snd.nxt, s->data.snd.max) ? s->data.snd.nxt :
+              s->data.snd.max;
 
-        if(s->data.sndbuf_acked >= s->sndbuf_sz)
-            s->data.sndbuf_acked -= s->sndbuf_sz;
+    if(SEQ_LE(s->data.snd.una, ack) && SEQ_LE(ack, snd_max)) {
+        /* Figure out if this is a duplicate before the window gets updated. */
+        dupack = ack == s->data.snd.una && ack != snd_max && !sz &&
+                 !(flags & TCP_FLAG_FIN) && wnd == s->data.snd.wnd;
+
+        if(ack != s->data.snd.una) {
+            tcp_ack_new(s, ack, acksyn, opts.ts ? opts.tsecr : 0);
+            __poll_event_trigger(s->sock, POLLWRNORM | POLLWRBAND);
+            cond_signal(&s->data.send_cv);
+        }
 
         if(SEQ_LT(s->data.snd.wl1, seq) ||
                 (s->data.snd.wl1 == seq && SEQ_LE(s->data.snd.wl2, ack))) {
-            s->data.snd.wnd = ntohs(tcp->wnd);
+            s->data.snd.wnd = wnd;
             s->data.snd.wl1 = seq;
             s->data.snd.wl2 = ack;
         }
+
+        if(dupack)
+            tcp_ack_dup(s, ack);
+
+        /* Send whatever the windows allow now. */
+        if(s->state == TCP_STATE_ESTABLISHED ||
+                s->state == TCP_STATE_CLOSE_WAIT)
+            tcp_send_data(s, 0);
     }
-    else if(SEQ_GT(ack, s->data.snd.nxt)) {
+    else if(SEQ_GT(ack, snd_max)) {
         /* This ACKs something we haven't sent, so try to correct the other side
            and return */
         tcp_send_ack(s);
@@ -2792,37 +3569,57 @@ static int process_pkt(netif_t *src, const struct in6_addr *srca,
 
     if(s->state == TCP_STATE_ESTABLISHED || s->state == TCP_STATE_FIN_WAIT_1 ||
             s->state == TCP_STATE_FIN_WAIT_2) {
+        /* Trim off anything at the front that we already have. */
+        if(sz && SEQ_LT(seq, s->data.rcv.nxt)) {
+            off = s->data.rcv.nxt - seq;
+            buf += off;
+            sz -= off;
+            seq = s->data.rcv.nxt;
+        }
+
         /* Next, check the data size versus our window. If its more than the
            window, truncate the data and copy out what we can. */
-        if(sz > s->data.rcv.wnd) {
-            sz = s->data.rcv.wnd;
+        off = seq - s->data.rcv.nxt;
+
+        if(off + sz > s->data.rcv.wnd) {
+            sz = s->data.rcv.wnd - off;
             bad_pkt = 1;
         }
 
-        /* Copy the data out */
-        if(sz) {
-            rb = s->data.rcvbuf + s->data.rcvbuf_tail;
-            s->data.rcv.nxt += sz;
-            s->data.rcv.wnd -= sz;
-            s->data.rcvbuf_cur_sz += sz;
-
-            if(s->data.rcvbuf_tail + sz <= s->rcvbuf_sz) {
-                memcpy(rb, buf, sz);
-                s->data.rcvbuf_tail += sz;
-            }
-            else {
-                tmp = s->rcvbuf_sz - s->data.rcvbuf_tail;
-                memcpy(rb, buf, tmp);
-                sz -= tmp;
-                buf += tmp;
-                memcpy(s->data.rcvbuf, buf, sz);
-                s->data.rcvbuf_tail = sz;
+        if(off) {
+            /* This is past a hole, so put it where it goes (if we have room to
+               keep track of it) and let the other side know what we're still
+               missing. Any FIN on it will have to be sent again. */
+            if(sz && !tcp_ooo_add(s, seq, seq + sz)) {
+                tcp_rcvbuf_put(s, off, buf, sz);
+                s->data.ooo_recent = seq;
             }
 
-            /* Signal any waiting thread and send an ack for what we read */
+            if(sz || (flags & TCP_FLAG_FIN))
+                tcp_send_ack(s);
+
+            bad_pkt = 1;
+        }
+        else if(sz) {
+            /* Copy the data out, along with anything out of order that it
+               connects up with. */
+            had_ooo = s->data.ooo_count;
+            tcp_rcvbuf_put(s, 0, buf, sz);
+            tcp_rcvbuf_advance(s, sz);
+            tcp_ooo_collect(s);
+
+            /* Signal any waiting thread */
             __poll_event_trigger(s->sock, POLLRDNORM);
             cond_signal(&s->data.recv_cv);
-            tcp_send_ack(s);
+
+            /* Only ACK every second segment, unless this one filled in a hole
+               or didn't all fit. Anything that doesn't get ACKed here will be
+               by the next thing we send, or by the timer thread. A FIN will
+               also get ACKed right away down below. */
+            if(had_ooo || bad_pkt || (s->intflags & TCP_IFLAG_DELACK))
+                tcp_send_ack(s);
+            else
+                s->intflags |= TCP_IFLAG_DELACK;
         }
     }
     else if(sz) {
@@ -3027,12 +3824,24 @@ static void tcp_thd_cb(void *arg) {
 
                 break;
 
+            case TCP_STATE_FIN_WAIT_1:
+            case TCP_STATE_FIN_WAIT_2:
+
+                /* Send any ACK that we've been holding back. */
+                if(i->intflags & TCP_IFLAG_DELACK)
+                    tcp_send_ack(i);
+
+                break;
+
             case TCP_STATE_ESTABLISHED:
             case TCP_STATE_CLOSE_WAIT:
 
+                if(i->intflags & TCP_IFLAG_DELACK)
+                    tcp_send_ack(i);
+
                 if(i->data.sndbuf_cur_sz &&
-                        i->data.timer + TCP_DEFAULT_RTTO <= timer) {
-                    tcp_send_data(i, 1);
+                        i->data.timer + i->data.rto <= timer) {
+                    tcp_rto(i);
                 }
                 else if(!i->data.sndbuf_cur_sz &&
                         (i->intflags & TCP_IFLAG_QUEUEDCLOSE)) {
@@ -3066,6 +3875,7 @@ static void tcp_thd_cb(void *arg) {
         if((i->intflags & TCP_IFLAG_CANBEDEL) &&
                 (i->state & 0x0F) == TCP_STATE_CLOSED) {
             LIST_REMOVE(i, sock_list);
+            tcp_unhash_sock(i);
             cond_destroy(&i->data.send_cv);
             cond_destroy(&i->data.recv_cv);
             mutex_destroy(&i->mutex);
@@ -3100,7 +3910,8 @@ static fs_socket_proto_t proto = {
     net_tcp_setsockopt,                 /* setsockopt */
     net_tcp_getsockname,                /* getsockname */
     net_tcp_fcntl,                      /* fcntl */
-    net_tcp_poll                        /* poll */
+    net_tcp_poll,                       /* poll */
+    NULL                                /* recvmmsg */
 };
 
 int net_tcp_init(void) {
@@ -3112,7 +3923,7 @@ int net_tcp_init(void) {
 
 void net_tcp_shutdown(void) {
     struct tcp_sock *i, *tmp;
-    int old;
+    int old, j;
 
     /* Kill the thread and make sure we can grab the lock */
     if(thd_cb_id >= 0)
@@ -3132,6 +3943,7 @@ void net_tcp_shutdown(void) {
         }
         else {
             LIST_REMOVE(i, sock_list);
+            tcp_unhash_sock(i);
             cond_destroy(&i->data.send_cv);
             cond_destroy(&i->data.recv_cv);
             mutex_destroy(&i->mutex);
@@ -3145,6 +3957,12 @@ void net_tcp_shutdown(void) {
 
     LIST_INIT(&tcp_socks);
 
+    for(j = 0; j < TCP_HASH_SIZE; ++j) {
+        LIST_INIT(&tcp_conn_hash[j]);
+        LIST_INIT(&tcp_port_hash[j]);
+        LIST_INIT(&tcp_bind_hash[j]);
+    }
+
     /* Remove us from fs_socket and clean up the semaphore */
     fs_socket_proto_remove(&proto);
 
@@ -11,13 +11,16 @@
 #include <errno.h>
 #include <poll.h>
 #include <stdint.h>
+#include <time.h>
 #include <arpa/inet.h>
+#include <kos/fs.h>
 #include <kos/net.h>
 #include <kos/mutex.h>
 #include <kos/genwait.h>
 #include <sys/queue.h>
 #include <kos/fs_socket.h>
 #include <arch/irq.h>
+#include <arch/timer.h>
 #include <sys/socket.h>
 
 #include "net_ipv4.h"
@@ -40,20 +43,23 @@ typedef struct {
 } udp_hdr_t;
 #undef packed
 
-struct udp_pkt {
-    TAILQ_ENTRY(udp_pkt) pkt_queue;
-    struct sockaddr_in6 from;
-    uint8 *data;
-    uint16 datasize;
-};
+/* Received datagrams are queued on sockets in packet buffers, with the data
+   pointing at the payload and the address it came from in the scratch space of
+   the buffer. */
+#define UDP_PKT_FROM(pb)    ((struct sockaddr_in6 *)(pb)->priv)
 
-TAILQ_HEAD(udp_pkt_queue, udp_pkt);
+/* Maximum number of datagrams queued up on any one socket in buffers from the
+   pool, so that one socket that isn't being read from can't take all of them.
+   Past that, datagrams are copied into buffers from the heap, so there is no
+   limit on how many can be queued. */
+#define UDP_MAX_POOLED      (NET_PBUF_COUNT / 2)
 
 #define UDPSOCK_NO_CHECKSUM 0x00000001
 #define UDPSOCK_LITE_RCVCOV 0x00000002
 
 struct udp_sock {
     LIST_ENTRY(udp_sock) sock_list;
+    LIST_ENTRY(udp_sock) hash_list;
     struct sockaddr_in6 local_addr;
     struct sockaddr_in6 remote_addr;
 
@@ -69,7 +75,8 @@ struct udp_sock {
         uint16_t recv_cscov;
     } udp_lite;
 
-    struct udp_pkt_queue packets;
+    struct net_pbuf_queue packets;
+    int pooled;                     /* How many of them are from the pool */
 };
 
 LIST_HEAD(udp_sock_list, udp_sock);
@@ -78,6 +85,63 @@ static struct udp_sock_list net_udp_sockets = LIST_HEAD_INITIALIZER(0);
 static mutex_t udp_mutex = MUTEX_INITIALIZER;
 static net_udp_stats_t udp_stats = { 0 };
 
+/* Sockets are also hashed on their local port, so that incoming packets (and
+   checks for ports that are in use) only have to look at the sockets that
+   could possibly match. Sockets that aren't bound yet are in the bucket for
+   port 0. The hash table is protected by udp_mutex, like the list. It has as
+   many buckets as there can be file descriptors (and thus sockets), so there
+   shouldn't ever be much more than one socket in a bucket. */
+#define UDP_HASH_SIZE   FD_SETSIZE
+#define UDP_HASH(port)  (ntohs(port) & (UDP_HASH_SIZE - 1))
+
+static struct udp_sock_list udp_port_hash[UDP_HASH_SIZE];
+
+/* The range that ports get picked from when one isn't given, and where to start
+   looking the next time. */
+#define UDP_EPHEMERAL_MIN   1024
+#define UDP_EPHEMERAL_MAX   65535
+
+static uint16 udp_next_port = UDP_EPHEMERAL_MIN;
+
+/* Move a socket into the right bucket after changing its local port. */
+static void udp_rehash_sock(struct udp_sock *sock) {
+    LIST_REMOVE(sock, hash_list);
+    LIST_INSERT_HEAD(&udp_port_hash[UDP_HASH(sock->local_addr.sin6_port)],
+                     sock, hash_list);
+}
+
+/* Check if a port (in network byte order) is already in use. */
+static int udp_port_used(uint16 port) {
+    struct udp_sock *iter;
+
+    LIST_FOREACH(iter, &udp_port_hash[UDP_HASH(port)], hash_list) {
+        if(iter->local_addr.sin6_port == port)
+            return 1;
+    }
+
+    return 0;
+}
+
+/* Pick an unused port (in network byte order). This carries on from wherever
+   the last one was picked, so that a port that was just let go of doesn't get
+   handed right back out again. Returns 0 if every one of them is taken. */
+static uint16 udp_free_port(void) {
+    uint16 port;
+    int i;
+
+    for(i = UDP_EPHEMERAL_MIN; i <= UDP_EPHEMERAL_MAX; ++i) {
+        port = udp_next_port;
+
+        if(udp_next_port++ == UDP_EPHEMERAL_MAX)
+            udp_next_port = UDP_EPHEMERAL_MIN;
+
+        if(!udp_port_used(htons(port)))
+            return htons(port);
+    }
+
+    return 0;
+}
+
 static int net_udp_send_raw(netif_t *net, const struct sockaddr_in6 *src,
                             const struct sockaddr_in6 *dst, const uint8 *data,
                             size_t size, uint32_t flags, int hops,
@@ -94,7 +158,7 @@ static int net_udp_accept(net_socket_t *hnd, struct sockaddr *addr,
 
 static int net_udp_bind(net_socket_t *hnd, const struct sockaddr *addr,
                         socklen_t addr_len) {
-    struct udp_sock *udpsock, *iter;
+    struct udp_sock *udpsock;
     struct sockaddr_in *realaddr4;
     struct sockaddr_in6 realaddr6;
 
@@ -174,38 +238,30 @@ static int net_udp_bind(net_socket_t *hnd, const struct sockaddr *addr,
     if(realaddr6.sin6_port != 0) {
         /* Make sure we don't already have a socket bound to the port
            specified */
-        LIST_FOREACH(iter, &net_udp_sockets, sock_list) {
-            if(iter == udpsock)
-                continue;
-
-            if(iter->local_addr.sin6_port == realaddr6.sin6_port) {
-                mutex_unlock(&udp_mutex);
-                errno = EADDRINUSE;
-                return -1;
-            }
+        if(udpsock->local_addr.sin6_port != realaddr6.sin6_port &&
+           udp_port_used(realaddr6.sin6_port)) {
+            mutex_unlock(&udp_mutex);
+            errno = EADDRINUSE;
+            return -1;
         }
 
         udpsock->local_addr = realaddr6;
     }
     else {
-        uint16 port = 1024, tmp = 0;
-
-        /* Grab the first unused port >= 1024. This is, unfortunately, O(n^2) */
-        while(tmp != port) {
-            tmp = port;
+        uint16 port;
 
-            LIST_FOREACH(iter, &net_udp_sockets, sock_list) {
-                if(iter->local_addr.sin6_port == port) {
-                    ++port;
-                    break;
-                }
-            }
+        if(!(port = udp_free_port())) {
+            mutex_unlock(&udp_mutex);
+            errno = EADDRINUSE;
+            return -1;
         }
 
         udpsock->local_addr = realaddr6;
-        udpsock->local_addr.sin6_port = htons(port);
+        udpsock->local_addr.sin6_port = port;
     }
 
+    udp_rehash_sock(udpsock);
+
     udpsock->sock = hnd->fd;
 
     mutex_unlock(&udp_mutex);
@@ -319,11 +375,86 @@ static int net_udp_listen(net_socket_t *hnd, int backlog) {
     return -1;
 }
 
+/* Wait for a datagram to be queued on a socket, for up to timeout
+   milliseconds (0 for no limit). This must be called with udp_mutex held, and
+   drops it while waiting. */
+static int udp_wait_packet(struct udp_sock *udpsock, int flags, int timeout) {
+    uint64 deadline = 0, now;
+    int wait = 0;
+
+    if(TAILQ_EMPTY(&udpsock->packets) &&
+       ((udpsock->flags & FS_SOCKET_NONBLOCK) || (flags & MSG_DONTWAIT) ||
+        irq_inside_int())) {
+        errno = EWOULDBLOCK;
+        return -1;
+    }
+
+    if(timeout)
+        deadline = timer_ms_gettime64() + timeout;
+
+    while(TAILQ_EMPTY(&udpsock->packets)) {
+        if(deadline) {
+            if((now = timer_ms_gettime64()) >= deadline) {
+                errno = EAGAIN;
+                return -1;
+            }
+
+            wait = (int)(deadline - now);
+        }
+
+        mutex_unlock(&udp_mutex);
+        genwait_wait(udpsock, "net_udp_recvfrom", wait, NULL);
+        mutex_lock(&udp_mutex);
+    }
+
+    return 0;
+}
+
+/* Fill in the address that a queued datagram came from, in the form that the
+   socket uses. */
+static void udp_copy_from(struct udp_sock *udpsock, net_pbuf_t *pb,
+                          struct sockaddr *addr, socklen_t *addr_len) {
+    struct sockaddr_in6 *from = UDP_PKT_FROM(pb);
+
+    if(udpsock->domain == AF_INET) {
+        struct sockaddr_in realaddr;
+
+        memset(&realaddr, 0, sizeof(struct sockaddr_in));
+        realaddr.sin_family = AF_INET;
+        realaddr.sin_addr.s_addr = from->sin6_addr.__s6_addr.__s6_addr32[3];
+        realaddr.sin_port = from->sin6_port;
+
+        if(*addr_len < sizeof(struct sockaddr_in)) {
+            memcpy(addr, &realaddr, *addr_len);
+        }
+        else {
+            memcpy(addr, &realaddr, sizeof(struct sockaddr_in));
+            *addr_len = sizeof(struct sockaddr_in);
+        }
+    }
+    else if(udpsock->domain == AF_INET6) {
+        struct sockaddr_in6 realaddr6;
+
+        memset(&realaddr6, 0, sizeof(struct sockaddr_in6));
+        realaddr6.sin6_family = AF_INET6;
+        realaddr6.sin6_addr = from->sin6_addr;
+        realaddr6.sin6_port = from->sin6_port;
+
+        if(*addr_len < sizeof(struct sockaddr_in6)) {
+            memcpy(addr, &realaddr6, *addr_len);
+        }
+        else {
+            memcpy(addr, &realaddr6, sizeof(struct sockaddr_in6));
+            *addr_len = sizeof(struct sockaddr_in6);
+        }
+    }
+}
+
 static ssize_t net_udp_recvfrom(net_socket_t *hnd, void *buffer, size_t length,
                                 int flags, struct sockaddr *addr,
                                 socklen_t *addr_len) {
     struct udp_sock *udpsock;
-    struct udp_pkt *pkt;
+    net_pbuf_t *pb;
 
     if(irq_inside_int()) {
         if(mutex_trylock(&udp_mutex) == -1) {
@@ -354,76 +485,113 @@ static ssize_t net_udp_recvfrom(net_socket_t *hnd, void *buffer, size_t length,
         return -1;
     }
 
-    if(TAILQ_EMPTY(&udpsock->packets) &&
-       ((udpsock->flags & FS_SOCKET_NONBLOCK) || (flags & MSG_DONTWAIT) ||
-        irq_inside_int())) {
+    if(udp_wait_packet(udpsock, flags, 0)) {
         mutex_unlock(&udp_mutex);
-        errno = EWOULDBLOCK;
         return -1;
     }
 
-    while(TAILQ_EMPTY(&udpsock->packets)) {
-        mutex_unlock(&udp_mutex);
-        genwait_wait(udpsock, "net_udp_recvfrom", 0, NULL);
-        mutex_lock(&udp_mutex);
+    pb = TAILQ_FIRST(&udpsock->packets);
+
+    if(pb->len < length)
+        length = pb->len;
+
+    memcpy(buffer, pb->data, length);
+
+    if(addr != NULL)
+        udp_copy_from(udpsock, pb, addr, addr_len);
+
+    /* Remove the packet if we're pulling data out of the queue. */
+    if(!(flags & MSG_PEEK)) {
+        TAILQ_REMOVE(&udpsock->packets, pb, pb_queue);
+        udpsock->pooled -= net_pbuf_pooled(pb);
+        net_pbuf_free(pb);
     }
 
-    pkt = TAILQ_FIRST(&udpsock->packets);
+    mutex_unlock(&udp_mutex);
 
-    if(pkt->datasize > length) {
-        memcpy(buffer, pkt->data, length);
+    return length;
+}
+
+static int net_udp_recvmmsg(net_socket_t *hnd, struct mmsghdr *msgvec,
+                            unsigned int vlen, int flags,
+                            struct timespec *timeout) {
+    struct udp_sock *udpsock;
+    struct msghdr *msg;
+    net_pbuf_t *pb, *next;
+    unsigned int i;
+    int j, tmo = 0;
+    size_t off, cnt;
+
+    if(irq_inside_int()) {
+        if(mutex_trylock(&udp_mutex) == -1) {
+            errno = EWOULDBLOCK;
+            return -1;
+        }
     }
     else {
-        memcpy(buffer, pkt->data, pkt->datasize);
-        length = pkt->datasize;
+        mutex_lock(&udp_mutex);
     }
 
-    if(addr != NULL) {
-        if(udpsock->domain == AF_INET) {
-            struct sockaddr_in realaddr;
+    udpsock = (struct udp_sock *)hnd->data;
 
-            memset(&realaddr, 0, sizeof(struct sockaddr_in));
-            realaddr.sin_family = AF_INET;
-            realaddr.sin_addr.s_addr =
-                pkt->from.sin6_addr.__s6_addr.__s6_addr32[3];
-            realaddr.sin_port = pkt->from.sin6_port;
+    if(udpsock == NULL) {
+        mutex_unlock(&udp_mutex);
+        errno = EBADF;
+        return -1;
+    }
 
-            if(*addr_len < sizeof(struct sockaddr_in)) {
-                memcpy(addr, &realaddr, *addr_len);
-            }
-            else {
-                memcpy(addr, &realaddr, sizeof(struct sockaddr_in));
-                *addr_len = sizeof(struct sockaddr_in);
-            }
-        }
-        else if(udpsock->domain == AF_INET6) {
-            struct sockaddr_in6 realaddr6;
+    if((udpsock->flags & (SHUT_RD << 24)) || !vlen) {
+        mutex_unlock(&udp_mutex);
+        return 0;
+    }
 
-            memset(&realaddr6, 0, sizeof(struct sockaddr_in6));
-            realaddr6.sin6_family = AF_INET6;
-            realaddr6.sin6_addr = pkt->from.sin6_addr;
-            realaddr6.sin6_port = pkt->from.sin6_port;
+    if(timeout) {
+        tmo = timeout->tv_sec * 1000 + timeout->tv_nsec / 1000000;
 
-            if(*addr_len < sizeof(struct sockaddr_in6)) {
-                memcpy(addr, &realaddr6, *addr_len);
-            }
-            else {
-                memcpy(addr, &realaddr6, sizeof(struct sockaddr_in6));
-                *addr_len = sizeof(struct sockaddr_in6);
-            }
-        }
+        if(!tmo)
+            flags |= MSG_DONTWAIT;
     }
 
-    /* Remove the packet if we're pulling data out of the queue. */
-    if(!(flags & MSG_PEEK)) {
-        TAILQ_REMOVE(&udpsock->packets, pkt, pkt_queue);
-        free(pkt->data);
-        free(pkt);
+    if(udp_wait_packet(udpsock, flags, tmo)) {
+        mutex_unlock(&udp_mutex);
+        return -1;
+    }
+
+    /* Grab everything that's queued up, until we run out of messages. */
+    pb = TAILQ_FIRST(&udpsock->packets);
+
+    for(i = 0; i < vlen && pb; ++i, pb = next) {
+        msg = &msgvec[i].msg_hdr;
+        next = TAILQ_NEXT(pb, pb_queue);
+
+        for(j = 0, off = 0; j < msg->msg_iovlen && off < pb->len; ++j) {
+            cnt = pb->len - off;
+
+            if(cnt > msg->msg_iov[j].iov_len)
+                cnt = msg->msg_iov[j].iov_len;
+
+            memcpy(msg->msg_iov[j].iov_base, pb->data + off, cnt);
+            off += cnt;
+        }
+
+        msgvec[i].msg_len = off;
+        msg->msg_flags = off < pb->len ? MSG_TRUNC : 0;
+        msg->msg_controllen = 0;
+
+        if(msg->msg_name)
+            udp_copy_from(udpsock, pb, (struct sockaddr *)msg->msg_name,
+                          &msg->msg_namelen);
+
+        if(!(flags & MSG_PEEK)) {
+            TAILQ_REMOVE(&udpsock->packets, pb, pb_queue);
+            udpsock->pooled -= net_pbuf_pooled(pb);
+            net_pbuf_free(pb);
+        }
     }
 
     mutex_unlock(&udp_mutex);
 
-    return length;
+    return (int)i;
 }
 
 static ssize_t net_udp_sendto(net_socket_t *hnd, const void *message,
@@ -512,22 +680,12 @@ static ssize_t net_udp_sendto(net_socket_t *hnd, const void *message,
     }
 
     if(udpsock->local_addr.sin6_port == 0) {
-        uint16 port = 1024, tmp = 0;
-        struct udp_sock *iter;
-
-        /* Grab the first unused port >= 1024. This is, unfortunately, O(n^2) */
-        while(tmp != port) {
-            tmp = port;
-
-            LIST_FOREACH(iter, &net_udp_sockets, sock_list) {
-                if(iter->local_addr.sin6_port == port) {
-                    ++port;
-                    break;
-                }
-            }
+        if(!(udpsock->local_addr.sin6_port = udp_free_port())) {
+            errno = EAGAIN;
+            goto err;
         }
 
-        udpsock->local_addr.sin6_port = htons(port);
+        udp_rehash_sock(udpsock);
     }
 
     local_addr = udpsock->local_addr;
@@ -620,6 +778,7 @@ static int net_udp_socket(net_socket_t *hnd, int domain, int type, int proto) {
     }
 
     LIST_INSERT_HEAD(&net_udp_sockets, udpsock, sock_list);
+    LIST_INSERT_HEAD(&udp_port_hash[0], udpsock, hash_list);
     hnd->data = udpsock;
     mutex_unlock(&udp_mutex);
 
@@ -628,8 +787,7 @@ static int net_udp_socket(net_socket_t *hnd, int domain, int type, int proto) {
 
 static void net_udp_close(net_socket_t *hnd) {
     struct udp_sock *udpsock;
-    struct udp_pkt *pkt;
-    struct udp_pkt *it;
+    net_pbuf_t *pb;
 
     if(irq_inside_int()) {
         if(mutex_trylock(&udp_mutex) == -1) {
@@ -649,17 +807,13 @@ static void net_udp_close(net_socket_t *hnd) {
         return;
     }
 
-    it = udpsock->packets.tqh_first;
-    while(it) {
-        pkt = it;
-        it = it->pkt_queue.tqe_next;
-
-        free(pkt->data);
-        TAILQ_REMOVE(&udpsock->packets, pkt, pkt_queue);
-        free(pkt);
+    while((pb = TAILQ_FIRST(&udpsock->packets))) {
+        TAILQ_REMOVE(&udpsock->packets, pb, pb_queue);
+        net_pbuf_free(pb);
     }
 
     LIST_REMOVE(udpsock, sock_list);
+    LIST_REMOVE(udpsock, hash_list);
 
     free(udpsock);
     mutex_unlock(&udp_mutex);
@@ -1114,9 +1268,8 @@ static int net_udp_input4(netif_t *src, const ip_hdr_t *ip, const uint8 *data,
     uint16 cs, cscov = 0;
     int partial = 1;
     struct udp_sock *sock;
-    struct udp_pkt *pkt;
-
-    (void)src;
+    struct sockaddr_in6 *from;
+    net_pbuf_t *pb;
 
     if(size <= sizeof(udp_hdr_t)) {
         /* Discard the packet, since it is too short to be of any interest. */
@@ -1172,7 +1325,7 @@ static int net_udp_input4(netif_t *src, const ip_hdr_t *ip, const uint8 *data,
            mutex is locked, there isn't much that can be done. */
         return -1;
 
-    LIST_FOREACH(sock, &net_udp_sockets, sock_list) {
+    LIST_FOREACH(sock, &udp_port_hash[UDP_HASH(hdr->dst_port)], hash_list) {
         /* Don't even bother looking at IPv6-only sockets */
         if(sock->domain == AF_INET6 && (sock->flags & FS_SOCKET_V6ONLY))
             continue;
@@ -1210,29 +1363,29 @@ static int net_udp_input4(netif_t *src, const ip_hdr_t *ip, const uint8 *data,
             return 0;
         }
 
-        if(!(pkt = (struct udp_pkt *)malloc(sizeof(struct udp_pkt)))) {
-            mutex_unlock(&udp_mutex);
-            return -1;
-        }
-
-        memset(pkt, 0, sizeof(struct udp_pkt));
+        /* Hang onto the packet buffer that the data is in, if we can. */
+        if(sock->pooled < UDP_MAX_POOLED)
+            pb = net_pbuf_claim(src, data + sizeof(udp_hdr_t),
+                                size - sizeof(udp_hdr_t));
+        else
+            pb = net_pbuf_copy(data + sizeof(udp_hdr_t),
+                               size - sizeof(udp_hdr_t));
 
-        pkt->datasize = size - sizeof(udp_hdr_t);
-
-        if(!(pkt->data = (uint8 *)malloc(pkt->datasize))) {
-            free(pkt);
+        if(!pb) {
+            ++udp_stats.pkt_recv_no_buf;
             mutex_unlock(&udp_mutex);
             return -1;
         }
 
-        pkt->from.sin6_family = AF_INET6;
-        pkt->from.sin6_addr.__s6_addr.__s6_addr16[5] = 0xFFFF;
-        pkt->from.sin6_addr.__s6_addr.__s6_addr32[3] = ip->src;
-        pkt->from.sin6_port = hdr->src_port;
-
-        memcpy(pkt->data, data + sizeof(udp_hdr_t), pkt->datasize);
+        from = UDP_PKT_FROM(pb);
+        memset(from, 0, sizeof(struct sockaddr_in6));
+        from->sin6_family = AF_INET6;
+        from->sin6_addr.__s6_addr.__s6_addr16[5] = 0xFFFF;
+        from->sin6_addr.__s6_addr.__s6_addr32[3] = ip->src;
+        from->sin6_port = hdr->src_port;
 
-        TAILQ_INSERT_TAIL(&sock->packets, pkt, pkt_queue);
+        TAILQ_INSERT_TAIL(&sock->packets, pb, pb_queue);
+        sock->pooled += net_pbuf_pooled(pb);
 
         ++udp_stats.pkt_recv;
         __poll_event_trigger(sock->sock, POLLRDNORM);
@@ -1254,9 +1407,8 @@ static int net_udp_input6(netif_t *src, const ipv6_hdr_t *ip, const uint8 *data,
     uint16 cs, cscov = 0;
     int partial = 1;
     struct udp_sock *sock;
-    struct udp_pkt *pkt;
-
-    (void)src;
+    struct sockaddr_in6 *from;
+    net_pbuf_t *pb;
 
     if(size <= sizeof(udp_hdr_t)) {
         /* Discard the packet, since it is too short to be of any interest. */
@@ -1310,7 +1462,7 @@ static int net_udp_input6(netif_t *src, const ipv6_hdr_t *ip, const uint8 *data,
            mutex is locked, there isn't much that can be done. */
         return -1;
 
-    LIST_FOREACH(sock, &net_udp_sockets, sock_list) {
+    LIST_FOREACH(sock, &udp_port_hash[UDP_HASH(hdr->dst_port)], hash_list) {
         /* Don't even bother looking at IPv4 sockets */
         if(sock->domain == AF_INET)
             continue;
@@ -1348,28 +1500,28 @@ static int net_udp_input6(netif_t *src, const ipv6_hdr_t *ip, const uint8 *data,
             return 0;
         }
 
-        if(!(pkt = (struct udp_pkt *)malloc(sizeof(struct udp_pkt)))) {
-            mutex_unlock(&udp_mutex);
-            return -1;
-        }
-
-        memset(pkt, 0, sizeof(struct udp_pkt));
+        /* Hang onto the packet buffer that the data is in, if we can. */
+        if(sock->pooled < UDP_MAX_POOLED)
+            pb = net_pbuf_claim(src, data + sizeof(udp_hdr_t),
+                                size - sizeof(udp_hdr_t));
+        else
+            pb = net_pbuf_copy(data + sizeof(udp_hdr_t),
+                               size - sizeof(udp_hdr_t));
 
-        pkt->datasize = size - sizeof(udp_hdr_t);
-
-        if(!(pkt->data = (uint8 *)malloc(pkt->datasize))) {
-            free(pkt);
+        if(!pb) {
+            ++udp_stats.pkt_recv_no_buf;
             mutex_unlock(&udp_mutex);
             return -1;
         }
 
-        pkt->from.sin6_family = AF_INET6;
-        pkt->from.sin6_addr = ip->src_addr;
-        pkt->from.sin6_port = hdr->src_port;
-
-        memcpy(pkt->data, data + sizeof(udp_hdr_t), pkt->datasize);
+        from = UDP_PKT_FROM(pb);
+        memset(from, 0, sizeof(struct sockaddr_in6));
+        from->sin6_family = AF_INET6;
+        from->sin6_addr = ip->src_addr;
+        from->sin6_port = hdr->src_port;
 
-        TAILQ_INSERT_TAIL(&sock->packets, pkt, pkt_queue);
+        TAILQ_INSERT_TAIL(&sock->packets, pb, pb_queue);
+        sock->pooled += net_pbuf_pooled(pb);
 
         ++udp_stats.pkt_recv;
         __poll_event_trigger(sock->sock, POLLRDNORM);
@@ -1403,8 +1555,8 @@ static int net_udp_send_raw(netif_t *net, const struct sockaddr_in6 *src,
                             const struct sockaddr_in6 *dst, const uint8 *data,
                             size_t size, uint32_t flags, int hops,
                             uint32_t iflags, int proto, uint16_t cscov) {
-    uint8 buf[size + sizeof(udp_hdr_t)];
-    udp_hdr_t *hdr = (udp_hdr_t *)buf;
+    udp_hdr_t hdr;
+    struct iovec iov[2];
     uint16 cs;
     int err;
     struct in6_addr srcaddr = src->sin6_addr;
@@ -1447,39 +1599,44 @@ static int net_udp_send_raw(netif_t *net, const struct sockaddr_in6 *src,
         }
     }
 
-    memcpy(buf + sizeof(udp_hdr_t), data, size);
+    /* The data goes down to the driver from where it is, so there's no need
+       to copy it in behind the header. */
+    iov[0].iov_base = &hdr;
+    iov[0].iov_len = sizeof(udp_hdr_t);
+    iov[1].iov_base = (void *)data;
+    iov[1].iov_len = size;
     size += sizeof(udp_hdr_t);
 
-    hdr->src_port = src->sin6_port;
-    hdr->dst_port = dst->sin6_port;
-    hdr->checksum = 0;
+    hdr.src_port = src->sin6_port;
+    hdr.dst_port = dst->sin6_port;
+    hdr.checksum = 0;
 
     /* Is this UDP or UDP-Lite? */
     if(proto == IPPROTO_UDP) {
-        hdr->length = htons(size);
+        hdr.length = htons(size);
 
         if(!(iflags & UDPSOCK_NO_CHECKSUM)) {
             cs = net_ipv6_checksum_pseudo(&srcaddr, &dst->sin6_addr, size,
                                           proto);
-            hdr->checksum = net_ipv4_checksum(buf, size, cs);
+            hdr.checksum = net_ipv4_checksum_iov(iov, 2, cs);
         }
     }
     else {
         if(cscov <= size) {
-            hdr->length = htons(cscov);
+            hdr.length = htons(cscov);
         }
         else {
-            hdr->length = 0;
+            hdr.length = 0;
             cscov = size;
         }
 
         cs = net_ipv6_checksum_pseudo(&srcaddr, &dst->sin6_addr, size, proto);
-        hdr->checksum = net_ipv4_checksum(buf, size, cs);
+        hdr.checksum = net_ipv4_checksum_iov(iov, 2, cs);
     }
 
     /* Pass everything off to the network layer to do the rest. */
-    err = net_ipv6_send(net, buf, size, hops, proto, &srcaddr,
-                        &dst->sin6_addr);
+    err = net_ipv6_sendv(net, NULL, (const uint8 *)&hdr, sizeof(udp_hdr_t),
+                         iov + 1, 1, hops, proto, &srcaddr, &dst->sin6_addr);
 
     if(err < 0) {
         ++udp_stats.pkt_send_failed;
@@ -1515,7 +1672,8 @@ static fs_socket_proto_t proto = {
     net_udp_setsockopt,
     net_udp_getsockname,
     net_udp_fcntl,
-    net_udp_poll
+    net_udp_poll,
+    net_udp_recvmmsg
 };
 
 static fs_socket_proto_t proto_lite = {
@@ -1537,7 +1695,8 @@ static fs_socket_proto_t proto_lite = {
     net_udp_setsockopt,
     net_udp_getsockname,
     net_udp_fcntl,
-    net_udp_poll
+    net_udp_poll,
+    net_udp_recvmmsg
 };
 
 int net_udp_init(void) {
@@ -15,6 +15,7 @@
    as well as some more advanced stuff. */
 
 #include <string.h>
+#include <stdlib.h>
 #include <malloc.h>
 #include <stdio.h>
 #include <assert.h>
@@ -22,6 +23,7 @@
 
 #include <arch/timer.h>
 #include <kos/genwait.h>
+#include <kos/sched_trace.h>
 #include <kos/sem.h>
 
 /* Our sleep queues table. This is also modeled after the BSD numbers. I
@@ -35,41 +37,122 @@ static TAILQ_HEAD(slpquehead, kthread) slpque[TABLESIZE];
    ready to run at a later time will be placed here. Note that this doesn't
    deal with pre-emptive timeslice context switching, only things that are
    specifically blocked for a timed event (thd_sleep, genwait_wait, etc).
-   This queue is sorted by remaining time (smallest at the front). */
-static struct ktqueue timer_queue;
+   This is a binary min-heap keyed on the wait timeout, so the next thread to
+   time out is always at the top. Each thread remembers its position in the
+   heap in its timer_idx field, so that it can be pulled out in logarithmic
+   time if it is woken before the timeout expires. Threads with the same
+   timeout are ordered by when they got there (timer_seq), so they still time
+   out in the order they started waiting.
+
+   A thread can only be on the queue once, so the heap is kept big enough to
+   hold every thread there is (see genwait_reserve(), which gets called when a
+   thread is created). That way, nothing ever has to be allocated while a
+   thread is going to sleep with interrupts disabled. */
+#define TQ_INITIAL_SIZE 32
+static kthread_t **timer_queue = NULL;
+static int tq_count = 0, tq_size = 0;
+static uint32 tq_seq = 0;
+
+/* Internal function to check if a thread times out before another. */
+static inline int tq_before(const kthread_t *a, const kthread_t *b) {
+    if(a->wait_timeout != b->wait_timeout)
+        return a->wait_timeout < b->wait_timeout;
+
+    return (int32)(a->timer_seq - b->timer_seq) < 0;
+}
 
-/* Internal function to insert a thread on the timer queue. Maintains
-   sorting order by wait time. */
-static void tq_insert(kthread_t * thd) {
-    kthread_t * t;
+/* Internal function to place a thread at the given heap slot. */
+static inline void tq_set(int idx, kthread_t *thd) {
+    timer_queue[idx] = thd;
+    thd->timer_idx = idx;
+}
 
-    /* Search for its place; note that new threads will be placed at
-       the end of a group with the same timeout. */
-    TAILQ_FOREACH(t, &timer_queue, timerq) {
-        if(thd->wait_timeout < t->wait_timeout) {
-            TAILQ_INSERT_BEFORE(t, thd, timerq);
-            return;
-        }
+/* Internal function to move the thread at the given slot up the heap until
+   its parent times out no later than it does. */
+static void tq_sift_up(int idx) {
+    kthread_t *thd = timer_queue[idx];
+    int parent;
+
+    while(idx > 0) {
+        parent = (idx - 1) >> 1;
+
+        if(!tq_before(thd, timer_queue[parent]))
+            break;
+
+        tq_set(idx, timer_queue[parent]);
+        idx = parent;
     }
 
-    /* Couldn't find anything scheduled later, put this at the end. */
-    TAILQ_INSERT_TAIL(&timer_queue, thd, timerq);
+    tq_set(idx, thd);
+}
+
+/* Internal function to move the thread at the given slot down the heap until
+   both of its children time out no earlier than it does. */
+static void tq_sift_down(int idx) {
+    kthread_t *thd = timer_queue[idx];
+    int child;
+
+    while((child = (idx << 1) + 1) < tq_count) {
+        if(child + 1 < tq_count &&
+           tq_before(timer_queue[child + 1], timer_queue[child]))
+            ++child;
+
+        if(!tq_before(timer_queue[child], thd))
+            break;
+
+        tq_set(idx, timer_queue[child]);
+        idx = child;
+    }
+
+    tq_set(idx, thd);
+}
+
+/* Internal function to insert a thread on the timer queue. Returns -1 if there
+   isn't any room for it, which shouldn't ever happen (see above). */
+static int tq_insert(kthread_t *thd) {
+    if(tq_count == tq_size)
+        return -1;
+
+    thd->timer_seq = tq_seq++;
+    tq_set(tq_count++, thd);
+    tq_sift_up(thd->timer_idx);
+    return 0;
 }
 
 /* Internal function to remove a thread from the timer queue. */
-static void tq_remove(kthread_t * thd) {
-    TAILQ_REMOVE(&timer_queue, thd, timerq);
+static void tq_remove(kthread_t *thd) {
+    int idx = thd->timer_idx;
+    kthread_t *last = timer_queue[--tq_count];
+
+    if(last == thd)
+        return;
+
+    /* Fill the hole with the last thread in the heap and then restore the
+       heap property in whichever direction it is now broken. */
+    tq_set(idx, last);
+
+    if(idx > 0 && tq_before(last, timer_queue[(idx - 1) >> 1]))
+        tq_sift_up(idx);
+    else
+        tq_sift_down(idx);
 }
 
 /* Returns the top thread on the timer queue (next event). If nothing is
    queued, we'll return NULL. */
 static kthread_t * tq_next(void) {
-    return TAILQ_FIRST(&timer_queue);
+    return tq_count ? timer_queue[0] : NULL;
 }
 
 int genwait_wait(void * obj, const char * mesg, int timeout, void (*callback)(void *)) {
+    return genwait_wait_us(obj, mesg, timeout > 0 ? (uint64)timeout * 1000 : 0,
+                           callback);
+}
+
+int genwait_wait_us(void *obj, const char *mesg, uint64 timeout,
+                    void (*callback)(void *)) {
     int     old, rv;
     kthread_t   * me;
+    uint64  now;
 
     /* Twiddle interrupt state */
     if(irq_inside_int()) {
@@ -78,23 +161,32 @@ int genwait_wait(void * obj, const char * mesg, int timeout, void (*callback)(vo
     }
 
     old = irq_disable();
-
-    /* Prepare us for sleep */
     me = thd_current;
-    thd_current = NULL;
-    me->state = STATE_WAIT;
-    me->wait_obj = obj;
-    me->wait_msg = mesg;
+    now = timer_us_gettime64();
 
     if(timeout > 0) {
         /* If we have a timeout, insert us on the timer queue. */
-        me->wait_timeout = timer_ms_gettime64() + timeout;
-        tq_insert(me);
+        me->wait_timeout = now + timeout;
+
+        if(tq_insert(me) < 0) {
+            me->wait_timeout = 0;
+            irq_restore(old);
+            errno = ENOMEM;
+            return -1;
+        }
     }
     else
         me->wait_timeout = 0;
 
+    /* Prepare us for sleep */
+    thd_current = NULL;
+    me->state = STATE_WAIT;
+    me->wait_obj = obj;
+    me->wait_msg = mesg;
+
     me->wait_callback = callback;
+    me->stats.wait_start = now;
+    sched_trace(SCHED_TRACE_WAIT, me, (uint32)obj);
 
     /* Insert us on the appropriate wait queue */
     TAILQ_INSERT_TAIL(&slpque[LOOKUP(obj)], me, thdq);
@@ -148,6 +240,7 @@ int genwait_wake_cnt(void * obj, int cntmax, int err) {
         /* Is this thread a match? */
         if(t->wait_obj == obj) {
             /* Yes, remove it from the wait queue */
+            sched_trace(SCHED_TRACE_WAKE, t, (uint32)obj);
             genwait_unqueue(t);
 
             /* Set the wake return value */
@@ -210,6 +303,7 @@ int genwait_wake_thd(void *obj, kthread_t *thd, int err) {
         /* Is this thread a match? */
         if(t->wait_obj == obj && t == thd) {
             /* Yes, remove it from the wait queue */
+            sched_trace(SCHED_TRACE_WAKE, t, (uint32)obj);
             genwait_unqueue(t);
 
             /* Set the wake return value */
@@ -253,6 +347,7 @@ void genwait_check_timeouts(uint64 tm) {
             t->wait_callback(t->wait_obj);
 
         /* Re-activate it */
+        sched_trace(SCHED_TRACE_TIMEOUT, t, (uint32)t->wait_obj);
         genwait_unqueue(t);
 
         /* Get the next one */
@@ -271,18 +366,51 @@ uint64 genwait_next_timeout(void) {
         return t->wait_timeout;
 }
 
+int genwait_reserve(size_t count) {
+    kthread_t **tmp;
+    size_t nsize;
+    int old, rv = 0;
+
+    old = irq_disable();
+
+    if(count > (size_t)tq_size) {
+        nsize = tq_size ? (size_t)tq_size : TQ_INITIAL_SIZE;
+
+        while(nsize < count)
+            nsize <<= 1;
+
+        if(!(tmp = (kthread_t **)realloc(timer_queue,
+                                         nsize * sizeof(kthread_t *)))) {
+            errno = ENOMEM;
+            rv = -1;
+        }
+        else {
+            timer_queue = tmp;
+            tq_size = nsize;
+        }
+    }
+
+    irq_restore(old);
+    return rv;
+}
+
 int genwait_init(void) {
     int i;
 
     for(i = 0; i < TABLESIZE; i++)
         TAILQ_INIT(&slpque[i]);
 
-    TAILQ_INIT(&timer_queue);
-    return 0;
+    /* The threads that were set up before we got here have already made
+       sure there's room for them. */
+    tq_count = 0;
+    return genwait_reserve(TQ_INITIAL_SIZE);
 }
 
 void genwait_shutdown(void) {
     /* XXX Do something about queued up procs */
+    free(timer_queue);
+    timer_queue = NULL;
+    tq_count = tq_size = 0;
 }
 
 
@@ -30,6 +30,9 @@ mutex_t *mutex_create(void) {
     rv->dynamic = 1;
     rv->holder = NULL;
     rv->count = 0;
+    rv->pi.owner = NULL;
+    rv->pi.protocol = THD_PI_NONE;
+    LIST_INIT(&rv->pi.waiters);
 
     return rv;
 }
@@ -46,10 +49,41 @@ int mutex_init(mutex_t *m, int mtype) {
     m->dynamic = 0;
     m->holder = NULL;
     m->count = 0;
+    m->pi.owner = NULL;
+    m->pi.protocol = THD_PI_NONE;
+    LIST_INIT(&m->pi.waiters);
 
     return 0;
 }
 
+int mutex_set_protocol(mutex_t *m, int protocol, prio_t ceiling) {
+    int old, rv = 0;
+
+    if(protocol < THD_PI_NONE || protocol > THD_PI_CEILING ||
+       ceiling < 0 || ceiling > PRIO_MAX) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    old = irq_disable();
+
+    if(m->type < MUTEX_TYPE_NORMAL || m->type > MUTEX_TYPE_RECURSIVE) {
+        errno = EINVAL;
+        rv = -1;
+    }
+    else if(m->count) {
+        errno = EBUSY;
+        rv = -1;
+    }
+    else {
+        m->pi.protocol = protocol;
+        m->pi.ceiling = ceiling;
+    }
+
+    irq_restore(old);
+    return rv;
+}
+
 int mutex_destroy(mutex_t *m) {
     int rv = 0, old;
 
@@ -108,6 +142,9 @@ int mutex_lock_timed(mutex_t *m, int timeout) {
     else if(!m->count) {
         m->count = 1;
         m->holder = thd_current;
+
+        if(m->pi.protocol != THD_PI_NONE)
+            thd_pi_acquire(&m->pi, thd_current);
     }
     else if(m->type == MUTEX_TYPE_RECURSIVE && m->holder == thd_current) {
         if(m->count == INT_MAX) {
@@ -122,6 +159,21 @@ int mutex_lock_timed(mutex_t *m, int timeout) {
         errno = EDEADLK;
         rv = -1;
     }
+    else if(m->pi.protocol != THD_PI_NONE) {
+        /* Boost the holder while we wait. The unlock hands the mutex straight
+           over to us, so there's nothing left to do if we get woken up. */
+        thd_pi_block(&m->pi, thd_current);
+
+        if(genwait_wait(m, timeout ? "mutex_lock_timed" : "mutex_lock",
+                        timeout, NULL)) {
+            thd_pi_unblock(thd_current);
+
+            if(errno == EAGAIN)
+                errno = ETIMEDOUT;
+
+            rv = -1;
+        }
+    }
     else {
         if(!(rv = genwait_wait(m, timeout ? "mutex_lock_timed" : "mutex_lock",
                                timeout, NULL))) {
@@ -129,7 +181,9 @@ int mutex_lock_timed(mutex_t *m, int timeout) {
             m->count = 1;
         }
         else {
-            errno = ETIMEDOUT;
+            if(errno == EAGAIN)
+                errno = ETIMEDOUT;
+
             rv = -1;
         }
     }
@@ -188,12 +242,40 @@ int mutex_trylock(mutex_t *m) {
                 }
                 break;
         }
+
+        /* There's no thread to boost if we're inside an interrupt. */
+        if(!rv && m->count == 1 && m->pi.protocol != THD_PI_NONE &&
+           thd != (kthread_t *)0xFFFFFFFF)
+            thd_pi_acquire(&m->pi, thd);
     }
 
     irq_restore(old);
     return rv;
 }
 
+/* Undo any boost the holder got from the mutex, and pass it directly to the
+   highest priority thread waiting for it (if any). Handing it over instead of
+   just waking the waiter up means that nobody else can sneak in and grab the
+   mutex before the waiter gets to run. Ints must be disabled. */
+static void mutex_pi_handoff(mutex_t *m) {
+    kthread_t *t;
+
+    thd_pi_release(&m->pi);
+
+    while((t = thd_pi_best_waiter(&m->pi))) {
+        thd_pi_unblock(t);
+
+        /* A waiter that has timed out but not run yet is still on the list,
+           so skip anyone that genwait no longer knows about. */
+        if(genwait_wake_thd(m, t, 0)) {
+            m->holder = t;
+            m->count = 1;
+            thd_pi_acquire(&m->pi, t);
+            break;
+        }
+    }
+}
+
 static int mutex_unlock_common(mutex_t *m, kthread_t *thd) {
     int old, rv = 0, wakeup = 0;
 
@@ -236,7 +318,9 @@ static int mutex_unlock_common(mutex_t *m, kthread_t *thd) {
     }
 
     /* If we need to wake up a thread, do so. */
-    if(wakeup)
+    if(wakeup && m->pi.protocol != THD_PI_NONE)
+        mutex_pi_handoff(m);
+    else if(wakeup)
         genwait_wake_one(m);
 
     irq_restore(old);
@@ -29,6 +29,9 @@ rw_semaphore_t *rwsem_create(void) {
     s->read_count = 0;
     s->write_lock = NULL;
     s->reader_waiting = NULL;
+    s->pi.owner = NULL;
+    s->pi.protocol = THD_PI_NONE;
+    LIST_INIT(&s->pi.waiters);
 
     return s;
 }
@@ -38,6 +41,60 @@ int rwsem_init(rw_semaphore_t *s) {
     s->read_count = 0;
     s->write_lock = NULL;
     s->reader_waiting = NULL;
+    s->pi.owner = NULL;
+    s->pi.protocol = THD_PI_NONE;
+    LIST_INIT(&s->pi.waiters);
+
+    return 0;
+}
+
+int rwsem_set_protocol(rw_semaphore_t *s, int protocol, prio_t ceiling) {
+    int old, rv = 0;
+
+    if(protocol < THD_PI_NONE || protocol > THD_PI_CEILING ||
+       ceiling < 0 || ceiling > PRIO_MAX) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    old = irq_disable();
+
+    if(s->read_count || s->write_lock) {
+        errno = EBUSY;
+        rv = -1;
+    }
+    else {
+        s->pi.protocol = protocol;
+        s->pi.ceiling = ceiling;
+    }
+
+    irq_restore(old);
+    return rv;
+}
+
+/* Give the write lock to a thread. Ints must be disabled. */
+static void rwsem_set_writer(rw_semaphore_t *s, kthread_t *thd) {
+    s->write_lock = thd;
+
+    if(s->pi.protocol != THD_PI_NONE)
+        thd_pi_acquire(&s->pi, thd);
+}
+
+/* Pass the write lock directly to the highest priority writer waiting for it,
+   if there is one. Returns non-zero if the lock was handed over. Ints must be
+   disabled. */
+static int rwsem_pi_handoff(rw_semaphore_t *s) {
+    kthread_t *t;
+
+    while((t = thd_pi_best_waiter(&s->pi))) {
+        thd_pi_unblock(t);
+
+        /* Skip writers that have timed out, but haven't run yet. */
+        if(genwait_wake_thd(&s->write_lock, t, 0)) {
+            rwsem_set_writer(s, t);
+            return 1;
+        }
+    }
 
     return 0;
 }
@@ -128,21 +185,27 @@ int rwsem_write_lock_timed(rw_semaphore_t *s, int timeout) {
     /* If the write lock is not held and there are no readers in their critical
        sections, let the thread proceed. */
     if(!s->write_lock && !s->read_count) {
-        s->write_lock = thd_current;
+        rwsem_set_writer(s, thd_current);
     }
     else {
+        /* Boost the current writer (if any) while we wait. */
+        if(s->pi.protocol != THD_PI_NONE)
+            thd_pi_block(&s->pi, thd_current);
+
         /* Block until the write lock is not held and there are no readers
            inside their critical sections */
         rv = genwait_wait(&s->write_lock, timeout ? "rwsem_write_lock_timed" :
                           "rwsem_write_lock", timeout, NULL);
 
         if(rv < 0) {
+            thd_pi_unblock(thd_current);
             rv = -1;
             if(errno == EAGAIN)
                 errno = ETIMEDOUT;
         }
-        else {
-            s->write_lock = thd_current;
+        else if(s->write_lock != thd_current) {
+            /* With priority inheritance, the lock was handed to us already. */
+            rwsem_set_writer(s, thd_current);
         }
     }
 
@@ -174,6 +237,9 @@ int rwsem_read_unlock(rw_semaphore_t *s) {
             genwait_wake_thd(&s->write_lock, s->reader_waiting, 0);
             s->reader_waiting = NULL;
         }
+        else if(s->pi.protocol != THD_PI_NONE) {
+            rwsem_pi_handoff(s);
+        }
         else {
             genwait_wake_one(&s->write_lock);
         }
@@ -198,8 +264,18 @@ int rwsem_write_unlock(rw_semaphore_t *s) {
 
     s->write_lock = NULL;
 
-    /* Give writers priority, attempt to wake any writers first. */
-    woken = genwait_wake_cnt(&s->write_lock, 1, 0);
+    /* Give writers priority, attempt to wake any writers first. With priority
+       inheritance, that means the most important one. */
+    if(s->pi.protocol != THD_PI_NONE) {
+        thd_pi_release(&s->pi);
+        woken = rwsem_pi_handoff(s);
+    }
+    else {
+        woken = 0;
+    }
+
+    if(!woken)
+        woken = genwait_wake_cnt(&s->write_lock, 1, 0);
 
     if(!woken) {
         /* No writers were waiting, wake up any readers. */
@@ -267,7 +343,7 @@ int rwsem_write_trylock(rw_semaphore_t *s) {
     }
     else {
         rv = 0;
-        s->write_lock = thd_current;
+        rwsem_set_writer(s, thd_current);
     }
 
     irq_restore(old);
@@ -318,13 +394,13 @@ int rwsem_read_upgrade_timed(rw_semaphore_t *s, int timeout) {
                     errno = ETIMEDOUT;
             }
             else {
-                s->write_lock = thd_current;
+                rwsem_set_writer(s, thd_current);
             }
         }
     }
     else {
         s->read_count = 0;
-        s->write_lock = thd_current;
+        rwsem_set_writer(s, thd_current);
     }
 
     irq_restore(old);
@@ -352,7 +428,7 @@ int rwsem_read_tryupgrade(rw_semaphore_t *s) {
     else {
         rv = 0;
         s->read_count = 0;
-        s->write_lock = thd_current;
+        rwsem_set_writer(s, thd_current);
     }
 
     irq_restore(old);
@@ -0,0 +1,168 @@
+/* KallistiOS ##version##
+
+   sched_trace.c
+   Copyright (C) 2026 The KOS Team and contributors
+*/
+
+/* This is a small binary trace ring for the scheduler and genwait. All of the
+   recording happens inside the scheduler with interrupts disabled, so there's
+   no locking at all on the recording side. The ring size is always a power of
+   two so that the write index can just be masked. */
+
+#include <stdlib.h>
+#include <errno.h>
+#include <kos/fs.h>
+#include <kos/sched_trace.h>
+#include <arch/irq.h>
+#include <arch/timer.h>
+
+int __sched_trace_on = 0;
+
+static sched_trace_evt_t *trace_buf = NULL;
+static uint32_t trace_mask;
+static uint32_t trace_head;
+
+void __sched_trace_record(int type, kthread_t *thd, uint32_t arg) {
+    sched_trace_evt_t *evt = &trace_buf[trace_head++ & trace_mask];
+
+    evt->time = (uint32_t)timer_us_gettime64();
+    evt->type = (uint16_t)type;
+    evt->prio = thd ? (uint16_t)thd->prio : 0;
+    evt->tid = thd ? thd->tid : -1;
+    evt->arg = arg;
+}
+
+int sched_trace_start(size_t count) {
+    sched_trace_evt_t *buf, *old;
+    uint32_t size = 1;
+    int irqs;
+
+    while(size < count)
+        size <<= 1;
+
+    if(!(buf = (sched_trace_evt_t *)calloc(size, sizeof(sched_trace_evt_t)))) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    irqs = irq_disable();
+    old = trace_buf;
+    trace_buf = buf;
+    trace_mask = size - 1;
+    trace_head = 0;
+    __sched_trace_on = 1;
+    irq_restore(irqs);
+
+    free(old);
+    return 0;
+}
+
+void sched_trace_stop(void) {
+    __sched_trace_on = 0;
+}
+
+void sched_trace_free(void) {
+    sched_trace_evt_t *old;
+    int irqs;
+
+    irqs = irq_disable();
+    __sched_trace_on = 0;
+    old = trace_buf;
+    trace_buf = NULL;
+    irq_restore(irqs);
+
+    free(old);
+}
+
+/* Figure out where the oldest event in the ring is and how many events there
+   are to read. */
+static uint32_t trace_span(uint32_t *first) {
+    if(trace_head > trace_mask) {
+        *first = trace_head - trace_mask - 1;
+        return trace_mask + 1;
+    }
+
+    *first = 0;
+    return trace_head;
+}
+
+static const char *trace_type_str(int type) {
+    switch(type) {
+        case SCHED_TRACE_SWITCH_PREEMPT:
+            return "preempt";
+        case SCHED_TRACE_SWITCH_YIELD:
+            return "yield";
+        case SCHED_TRACE_WAIT:
+            return "wait";
+        case SCHED_TRACE_WAKE:
+            return "wake";
+        case SCHED_TRACE_TIMEOUT:
+            return "timeout";
+        case SCHED_TRACE_CREATE:
+            return "create";
+        case SCHED_TRACE_EXIT:
+            return "exit";
+        default:
+            return "unknown";
+    }
+}
+
+int sched_trace_dump(int (*pf)(const char *fmt, ...)) {
+    uint32_t first, cnt, i;
+    int on = __sched_trace_on;
+    sched_trace_evt_t *evt;
+
+    if(!trace_buf)
+        return -1;
+
+    /* Pause recording so the ring doesn't move underneath us. */
+    __sched_trace_on = 0;
+    cnt = trace_span(&first);
+
+    pf("Scheduler trace (%lu events):\n", cnt);
+    pf("time\t\ttype\t\ttid\tprio\targ\n");
+
+    for(i = 0; i < cnt; ++i) {
+        evt = &trace_buf[(first + i) & trace_mask];
+        pf("%10lu\t%-8s\t%d\t%u\t%08lx\n", evt->time,
+           trace_type_str(evt->type), evt->tid, evt->prio, evt->arg);
+    }
+
+    pf("--end of trace--\n");
+    __sched_trace_on = on;
+
+    return 0;
+}
+
+int sched_trace_save(const char *fn) {
+    uint32_t first, cnt, start, len;
+    int on = __sched_trace_on, rv = -1;
+    file_t fd;
+
+    if(!trace_buf)
+        return -1;
+
+    if((fd = fs_open(fn, O_WRONLY | O_CREAT | O_TRUNC)) == FILEHND_INVALID)
+        return -1;
+
+    __sched_trace_on = 0;
+    cnt = trace_span(&first);
+    start = first & trace_mask;
+
+    /* The ring may wrap, so this can take two writes. */
+    len = cnt < trace_mask + 1 - start ? cnt : trace_mask + 1 - start;
+
+    if(fs_write(fd, trace_buf + start, len * sizeof(sched_trace_evt_t)) < 0)
+        goto out;
+
+    if(len < cnt && fs_write(fd, trace_buf, (cnt - len) *
+                             sizeof(sched_trace_evt_t)) < 0)
+        goto out;
+
+    rv = (int)cnt;
+
+out:
+    __sched_trace_on = on;
+    fs_close(fd);
+    return rv;
+}
@@ -19,6 +19,7 @@
 #include <kos/rwsem.h>
 #include <kos/cond.h>
 #include <kos/genwait.h>
+#include <kos/sched_trace.h>
 #include <arch/irq.h>
 #include <arch/timer.h>
 #include <arch/arch.h>
@@ -53,14 +54,24 @@ static inline size_t align_to(size_t address, size_t alignment) {
 /* Thread list. This includes all threads except dead ones. */
 static struct ktlist thd_list;
 
-/* Run queue. This is more like on a standard time sharing system than the
-   previous versions. The top element of this priority queue should be the
-   thread that is ready to run next. When a thread is scheduled, it will be
-   removed from this queue. When it's de-scheduled, it will be re-inserted
-   by its priority value at the end of its priority group. Note that right
-   now this condition is being broken because sleeping threads are on the
-   same queue. We deal with those in thd_switch below. */
-static struct ktqueue run_queue;
+/* Run queue. This is a set of per-priority FIFO buckets along with a bitmap
+   of which buckets are non-empty, so that adding a thread, removing a thread
+   and finding the next thread to run are all constant time operations no
+   matter how many threads are in the system. When a thread is scheduled, it
+   will be removed from its bucket. When it's de-scheduled, it will be
+   re-inserted at the end of its priority bucket (or the front, see
+   thd_schedule for why that is useful).
+
+   The bitmap has two levels: run_bitmap has one bit per priority value, and
+   run_bitmap_top has one bit per word of run_bitmap that has anything set in
+   it. The lowest set bit is always the highest priority runnable thread. */
+#define RUNQ_BUCKETS    (PRIO_MAX + 1)
+#define RUNQ_WORDS      ((RUNQ_BUCKETS + 31) / 32)
+#define RUNQ_TOP_WORDS  ((RUNQ_WORDS + 31) / 32)
+
+static struct ktqueue run_queue[RUNQ_BUCKETS];
+static uint32_t run_bitmap[RUNQ_WORDS];
+static uint32_t run_bitmap_top[RUNQ_TOP_WORDS];
 
 /* The currently executing thread. This thread should not be on any queues. */
 kthread_t *thd_current = NULL;
@@ -68,6 +79,11 @@ kthread_t *thd_current = NULL;
 /* Thread mode: uninitialized or pre-emptive. */
 static int thd_mode = THD_MODE_NONE;
 
+/* Zombie list. Detached threads that have exited are placed here (on their
+   run/wait queue handle, which is otherwise unused at that point) until the
+   reaper gets around to destroying them. */
+static struct ktqueue thd_zombies;
+
 /* Reaper semaphore. Counts the number of threads waiting to be reaped. */
 static semaphore_t thd_reap_sem;
 
@@ -77,6 +93,25 @@ static uint32_t thd_count = 0;
 /* The idle task */
 static kthread_t *thd_idle_thd = NULL;
 
+/* Tickless idle mode: when set, the periodic timeslice tick is skipped while
+   the idle task is the only thing that can run. */
+static int thd_tickless = 0;
+
+/* The thread that owns the current timeslice and when that slice runs out (in
+   microseconds since boot). The primary timer is programmed for whichever
+   comes first of this and the next genwait timeout. */
+static kthread_t *thd_slice_owner = NULL;
+static uint64_t thd_slice_end = 0;
+
+/* The thread that was last switched in. Unlike thd_current, this isn't
+   cleared when a thread blocks itself, so that the scheduler knows whose
+   statistics to update when it switches away. */
+static kthread_t *thd_running = NULL;
+
+/* Set while the scheduler is being run on behalf of a thread that is giving
+   up the CPU on its own (blocking, yielding or exiting). */
+static int thd_voluntary = 0;
+
 /*****************************************************************************/
 /* Debug */
 
@@ -141,23 +176,57 @@ int thd_pslist(int (*pf)(const char *fmt, ...)) {
 
 int thd_pslist_queue(int (*pf)(const char *fmt, ...)) {
     kthread_t *cur;
+    int i;
 
     pf("Queued threads:\n");
     pf("addr\t\ttid\tprio\tflags\twait_timeout\tstate     name\n");
-    TAILQ_FOREACH(cur, &run_queue, thdq) {
-        pf("%08lx\t", CONTEXT_PC(cur->context));
-        pf("%d\t", cur->tid);
 
-        if(cur->prio == PRIO_MAX)
-            pf("MAX\t");
-        else
-            pf("%d\t", cur->prio);
+    for(i = 0; i < RUNQ_BUCKETS; ++i) {
+        if(!(run_bitmap[i >> 5] & (1UL << (i & 31))))
+            continue;
 
-        pf("%08lx\t", cur->flags);
-        pf("%ld\t\t", (uint32_t)cur->wait_timeout);
-        pf("%10s", thd_state_to_str(cur));
+        TAILQ_FOREACH(cur, &run_queue[i], thdq) {
+            pf("%08lx\t", CONTEXT_PC(cur->context));
+            pf("%d\t", cur->tid);
+
+            if(cur->prio == PRIO_MAX)
+                pf("MAX\t");
+            else
+                pf("%d\t", cur->prio);
+
+            pf("%08lx\t", cur->flags);
+            pf("%ld\t\t", (uint32_t)cur->wait_timeout);
+            pf("%10s", thd_state_to_str(cur));
+            pf("%s\n", cur->label);
+        }
+    }
+
+    return 0;
+}
+
+int thd_pslist_stats(int (*pf)(const char *fmt, ...)) {
+    kthread_t *cur;
+    uint64_t now = timer_us_gettime64(), run;
+
+    pf("Thread statistics (may not be deterministic):\n");
+    pf("tid\tswitches\tvoluntary\tpreempted\trun (ms)\tmax wait (us)\t"
+       "name\n");
+
+    LIST_FOREACH(cur, &thd_list, t_list) {
+        run = cur->stats.run_time;
+
+        if(cur == thd_running)
+            run += now - cur->stats.last_start;
+
+        pf("%d\t", cur->tid);
+        pf("%lu\t\t", cur->stats.switches);
+        pf("%lu\t\t", cur->stats.voluntary);
+        pf("%lu\t\t", cur->stats.preempted);
+        pf("%lu\t\t", (uint32_t)(run / 1000));
+        pf("%lu\t\t", (uint32_t)cur->stats.max_wait);
         pf("%s\n", cur->label);
     }
+    pf("--end of list--\n");
 
     return 0;
 }
@@ -165,22 +234,41 @@ int thd_pslist_queue(int (*pf)(const char *fmt, ...)) {
 /*****************************************************************************/
 /* Returns a fresh thread ID for each new thread */
 
-/* Highest thread id (used when assigning next thread id) */
-static tid_t tid_highest;
+/* Thread ID hash table. Every thread on thd_list is also in here, hashed by
+   its thread ID, so that looking up a thread is constant time. */
+#define TID_HASH_SIZE   256
+#define TID_HASH(tid)   ((tid) & (TID_HASH_SIZE - 1))
+static struct ktlist tid_hash[TID_HASH_SIZE];
 
-/* Return the next available thread id (assumes wraparound will not run
-   into old processes). */
-static tid_t thd_next_free(void) {
-    int id;
-    id = tid_highest++;
-    return id;
+/* Thread pointer hash table. Every thread on thd_list is in this one too,
+   hashed by the address of its structure, so that a pointer that may or may not
+   still be a thread can be checked without looking at what it points to. */
+#define THD_PTR_HASH_SIZE   256
+static struct ktlist thd_ptr_hash[THD_PTR_HASH_SIZE];
+
+static inline struct ktlist *thd_ptr_bucket(const kthread_t *thd) {
+    uint32_t h = (uint32_t)(uintptr_t)thd;
+
+    /* Allocations are at least 8-byte aligned, so the low bits don't say
+       much. Mix them all in. */
+    h ^= h >> 16;
+    h *= 0x45D9F3B;
+    h ^= h >> 16;
+
+    return &thd_ptr_hash[h & (THD_PTR_HASH_SIZE - 1)];
 }
 
+/* Largest thread ID we'll hand out before wrapping around */
+#define TID_MAX         0x7fffffff
+
+/* Highest thread id (used when assigning next thread id) */
+static tid_t tid_highest;
+
 /* Given a thread ID, locates the thread structure */
 kthread_t *thd_by_tid(tid_t tid) {
     kthread_t *np;
 
-    LIST_FOREACH(np, &thd_list, t_list) {
+    LIST_FOREACH(np, &tid_hash[TID_HASH(tid)], t_hash) {
         if(np->tid == tid)
             return np;
     }
@@ -188,6 +276,37 @@ kthread_t *thd_by_tid(tid_t tid) {
     return NULL;
 }
 
+/* Return the next available thread id. Thread IDs are handed out in
+   increasing order so that a stale ID doesn't immediately refer to a new
+   thread, but once we run out they wrap around, skipping any that are still
+   in use. */
+static tid_t thd_next_free(void) {
+    tid_t id;
+
+    if(thd_count >= TID_MAX)
+        return -1;
+
+    do {
+        id = tid_highest;
+        tid_highest = (tid_highest == TID_MAX) ? 1 : tid_highest + 1;
+    } while(thd_by_tid(id));
+
+    return id;
+}
+
+/* Check whether the given pointer is still a live thread. The thread's memory
+   may already have been freed (and possibly reused), so nothing in it can be
+   looked at until we've found the pointer in the pointer hash. */
+static int thd_is_valid(kthread_t *thd) {
+    kthread_t *np;
+
+    LIST_FOREACH(np, thd_ptr_bucket(thd), t_phash) {
+        if(np == thd)
+            return 1;
+    }
+
+    return 0;
+}
 
 /*****************************************************************************/
 /* Thread support routines: idle task and start task wrapper */
@@ -216,6 +335,7 @@ static void *thd_idle_task(void *param) {
    created. */
 static void *thd_reaper(void *param) {
     kthread_t *thd;
+    int old;
 
     (void)param;
 
@@ -223,14 +343,14 @@ static void *thd_reaper(void *param) {
         /* Wait til we have something to reap */
         sem_wait(&thd_reap_sem);
 
-        /* Find the first zombie thread and reap it (only do one at a time so
+        /* Grab the first zombie thread and reap it (only do one at a time so
            that the semaphore stays current) */
-        LIST_FOREACH(thd, &thd_list, t_list) {
-            if(thd->state == STATE_ZOMBIE) {
-                thd_destroy(thd);
-                break;
-            }
-        }
+        old = irq_disable();
+
+        if((thd = TAILQ_FIRST(&thd_zombies)) != NULL)
+            thd_destroy(thd);
+
+        irq_restore(old);
     }
 
     /* Never reached */
@@ -257,6 +377,7 @@ void thd_exit(void *rv) {
 
     /* Set the return value of the thread */
     thd_current->rv = rv;
+    sched_trace(SCHED_TRACE_EXIT, thd_current, 0);
 
     /* Call newlib's thread cleanup function */
     _reclaim_reent(&thd_current->thd_reent);
@@ -265,6 +386,7 @@ void thd_exit(void *rv) {
         /* Call Dr. Kevorkian; after this executes we could be killed
            at any time. */
         thd_current->state = STATE_ZOMBIE;
+        TAILQ_INSERT_TAIL(&thd_zombies, thd_current, thdq);
         sem_signal(&thd_reap_sem);
     }
     else {
@@ -285,49 +407,55 @@ void thd_exit(void *rv) {
 /*****************************************************************************/
 /* Thread creation and deletion */
 
-/* Enqueue a process in the runnable queue; adds it right after the
-   process group of the same priority (front_of_line==0) or
-   right before the process group of the same priority (front_of_line!=0).
-   See thd_schedule for why this is helpful. */
-void thd_add_to_runnable(kthread_t *t, int front_of_line) {
-    kthread_t *i;
-    int done;
+/* Mark a run queue bucket as non-empty in the bitmap. */
+static inline void runq_mark(prio_t prio) {
+    run_bitmap[prio >> 5] |= 1UL << (prio & 31);
+    run_bitmap_top[prio >> 10] |= 1UL << ((prio >> 5) & 31);
+}
 
-    if(t->flags & THD_QUEUED)
-        return;
+/* Mark a run queue bucket as empty in the bitmap. */
+static inline void runq_clear(prio_t prio) {
+    run_bitmap[prio >> 5] &= ~(1UL << (prio & 31));
 
-    done = 0;
-
-    if(!front_of_line) {
-        /* Look for a thread of lower priority and insert
-           before it. If there is nothing on the run queue, we'll
-           fall through to the bottom. */
-        TAILQ_FOREACH(i, &run_queue, thdq) {
-            if(i->prio > t->prio) {
-                TAILQ_INSERT_BEFORE(i, t, thdq);
-                done = 1;
-                break;
-            }
-        }
-    }
-    else {
-        /* Look for a thread of the same or lower priority and
-           insert before it. If there is nothing on the run queue,
-           we'll fall through to the bottom. */
-        TAILQ_FOREACH(i, &run_queue, thdq) {
-            if(i->prio >= t->prio) {
-                TAILQ_INSERT_BEFORE(i, t, thdq);
-                done = 1;
-                break;
-            }
+    if(!run_bitmap[prio >> 5])
+        run_bitmap_top[prio >> 10] &= ~(1UL << ((prio >> 5) & 31));
+}
+
+/* Returns the highest priority thread on the run queue, or NULL if the run
+   queue is completely empty. */
+static kthread_t *runq_first(void) {
+    int i, word;
+
+    for(i = 0; i < RUNQ_TOP_WORDS; ++i) {
+        if(run_bitmap_top[i]) {
+            word = (i << 5) + __builtin_ctz(run_bitmap_top[i]);
+            return TAILQ_FIRST(&run_queue[(word << 5) +
+                                          __builtin_ctz(run_bitmap[word])]);
         }
     }
 
-    /* Didn't find one, put it at the end */
-    if(!done)
-        TAILQ_INSERT_TAIL(&run_queue, t, thdq);
+    return NULL;
+}
+
+/* Enqueue a process in the runnable queue; adds it at the end of the bucket
+   for its priority (front_of_line==0) or at the start of the bucket for its
+   priority (front_of_line!=0). See thd_schedule for why this is helpful. */
+void thd_add_to_runnable(kthread_t *t, int front_of_line) {
+    if(t->flags & THD_QUEUED)
+        return;
+
+    if(!front_of_line)
+        TAILQ_INSERT_TAIL(&run_queue[t->prio], t, thdq);
+    else
+        TAILQ_INSERT_HEAD(&run_queue[t->prio], t, thdq);
 
+    runq_mark(t->prio);
     t->flags |= THD_QUEUED;
+
+    /* If we're idling with the tick turned off, then nothing would get around
+       to switching to this thread, so ask for a reschedule right away. */
+    if(thd_tickless && thd_current == thd_idle_thd && t != thd_idle_thd)
+        timer_primary_wakeup_us(1);
 }
 
 /* Removes a thread from the runnable queue, if it's there. */
@@ -335,7 +463,11 @@ int thd_remove_from_runnable(kthread_t *thd) {
     if(!(thd->flags & THD_QUEUED)) return 0;
 
     thd->flags &= ~THD_QUEUED;
-    TAILQ_REMOVE(&run_queue, thd, thdq);
+    TAILQ_REMOVE(&run_queue[thd->prio], thd, thdq);
+
+    if(TAILQ_EMPTY(&run_queue[thd->prio]))
+        runq_clear(thd->prio);
+
     return 0;
 }
 
@@ -450,9 +582,13 @@ kthread_t *thd_create_ex(const kthread_attr_t *restrict attr,
 
     oldirq = irq_disable();
 
-    /* Get a new thread id */
+    /* Get a new thread id, and make sure there will be room for the new
+       thread on the timeout queue if it ever does a timed wait. */
     tid = thd_next_free();
 
+    if(tid >= 0 && genwait_reserve(thd_count + 1) < 0)
+        tid = -1;
+
     if(tid >= 0) {
         /* Create a new thread structure */
         nt = malloc(sizeof(kthread_t));
@@ -493,6 +629,7 @@ kthread_t *thd_create_ex(const kthread_attr_t *restrict attr,
             nt->context.gbr = (uint32_t)nt->tcbhead;
             nt->tid = tid;
             nt->prio = real_attr.prio;
+            nt->base_prio = real_attr.prio;
             nt->flags = THD_DEFAULTS;
             nt->state = STATE_READY;
 
@@ -515,17 +652,20 @@ kthread_t *thd_create_ex(const kthread_attr_t *restrict attr,
             if(real_attr.create_detached)
                 nt->flags |= THD_DETACHED;
 
-            /* Initialize thread-local storage. */
-            LIST_INIT(&nt->tls_list);
+            /* Initialize the priority inheritance state. */
+            LIST_INIT(&nt->pi_held);
 
-            /* Insert it into the thread list */
+            /* Insert it into the thread list and the hashes */
             LIST_INSERT_HEAD(&thd_list, nt, t_list);
+            LIST_INSERT_HEAD(&tid_hash[TID_HASH(tid)], nt, t_hash);
+            LIST_INSERT_HEAD(thd_ptr_bucket(nt), nt, t_phash);
 
             /* Add it to our count */
             ++thd_count;
 
             /* Schedule it */
             thd_add_to_runnable(nt, 0);
+            sched_trace(SCHED_TRACE_CREATE, nt, 0);
         }
     }
 
@@ -542,7 +682,7 @@ kthread_t *thd_create(int detach, void *(*routine)(void *), void *param) {
    the execution chain. */
 int thd_destroy(kthread_t *thd) {
     int oldirq = 0;
-    kthread_tls_kv_t *i, *i2;
+    kthread_pi_t *pi;
 
     /* Make sure there are no ints */
     oldirq = irq_disable();
@@ -555,22 +695,28 @@ int thd_destroy(kthread_t *thd) {
        thread structure */
     thd_remove_from_runnable(thd);
     LIST_REMOVE(thd, t_list);
+    LIST_REMOVE(thd, t_hash);
+    LIST_REMOVE(thd, t_phash);
 
-    /* Clean up any thread-local data */
-    LIST_FOREACH(i, &thd->tls_list, kv_list) {
-        if(i->destructor) {
-            i->destructor(i->data);
-        }
-    }
+    if(thd->state == STATE_ZOMBIE)
+        TAILQ_REMOVE(&thd_zombies, thd, thdq);
 
-    i = LIST_FIRST(&thd->tls_list);
+    if(thd_running == thd)
+        thd_running = NULL;
 
-    while(i != NULL) {
-        i2 = LIST_NEXT(i, kv_list);
-        free(i);
-        i = i2;
+    /* Let go of any priority inheritance state. Locks that the thread still
+       holds stay locked, but nobody can inherit from a dead thread. */
+    thd_pi_unblock(thd);
+
+    while(!LIST_EMPTY(&thd->pi_held)) {
+        pi = LIST_FIRST(&thd->pi_held);
+        LIST_REMOVE(pi, held);
+        pi->owner = NULL;
     }
 
+    /* Clean up any thread-local data */
+    kthread_tls_destroy(thd);
+
     /* Free its stack */
     free(thd->stack);
 
@@ -592,22 +738,165 @@ int thd_destroy(kthread_t *thd) {
 /*****************************************************************************/
 /* Thread attribute functions */
 
+/* How far down a chain of blocked lock owners a boost gets passed along. */
+#define THD_PI_MAX_DEPTH    16
+
+/* Change a thread's effective priority, moving the thread over to the right
+   run queue bucket if it is currently queued. Ints must be disabled. */
+static void thd_change_prio(kthread_t *thd, prio_t prio) {
+    if(thd->flags & THD_QUEUED) {
+        thd_remove_from_runnable(thd);
+        thd->prio = prio;
+        thd_add_to_runnable(thd, 0);
+    }
+    else {
+        thd->prio = prio;
+    }
+}
+
+/* Recompute the effective priority of a thread from its base priority and
+   the locks it holds. If that changes anything and the thread is blocked on
+   a priority inheritance lock itself, the change has to be passed along to
+   that lock's owner too, and so on down the chain. The depth limit is just
+   there to keep a deadlock cycle from hanging us with ints disabled. */
+static void thd_pi_update(kthread_t *thd) {
+    kthread_pi_t *pi;
+    kthread_t *w;
+    prio_t prio;
+    int depth;
+
+    for(depth = 0; thd && depth < THD_PI_MAX_DEPTH; ++depth) {
+        prio = thd->base_prio;
+
+        LIST_FOREACH(pi, &thd->pi_held, held) {
+            if(pi->protocol == THD_PI_CEILING) {
+                if(pi->ceiling < prio)
+                    prio = pi->ceiling;
+            }
+            else if(pi->protocol == THD_PI_INHERIT) {
+                LIST_FOREACH(w, &pi->waiters, pi_wlist) {
+                    if(w->prio < prio)
+                        prio = w->prio;
+                }
+            }
+        }
+
+        if(prio == thd->prio)
+            break;
+
+        thd_change_prio(thd, prio);
+        thd = thd->pi_wait ? thd->pi_wait->owner : NULL;
+    }
+}
+
+void thd_pi_acquire(kthread_pi_t *pi, kthread_t *thd) {
+    pi->owner = thd;
+    LIST_INSERT_HEAD(&thd->pi_held, pi, held);
+    thd_pi_update(thd);
+}
+
+void thd_pi_release(kthread_pi_t *pi) {
+    kthread_t *owner = pi->owner;
+
+    if(!owner)
+        return;
+
+    LIST_REMOVE(pi, held);
+    pi->owner = NULL;
+    thd_pi_update(owner);
+}
+
+void thd_pi_block(kthread_pi_t *pi, kthread_t *thd) {
+    thd->pi_wait = pi;
+    LIST_INSERT_HEAD(&pi->waiters, thd, pi_wlist);
+
+    if(pi->owner)
+        thd_pi_update(pi->owner);
+}
+
+void thd_pi_unblock(kthread_t *thd) {
+    kthread_pi_t *pi = thd->pi_wait;
+
+    if(!pi)
+        return;
+
+    LIST_REMOVE(thd, pi_wlist);
+    thd->pi_wait = NULL;
+
+    if(pi->owner)
+        thd_pi_update(pi->owner);
+}
+
+kthread_t *thd_pi_best_waiter(kthread_pi_t *pi) {
+    kthread_t *w, *best = NULL;
+
+    /* Ties go to the thread that has been waiting longest, which is the one
+       furthest down the list. */
+    LIST_FOREACH(w, &pi->waiters, pi_wlist) {
+        if(!best || w->prio <= best->prio)
+            best = w;
+    }
+
+    return best;
+}
+
 /* Set a thread's priority */
 int thd_set_prio(kthread_t *thd, prio_t prio) {
+    int old;
+
     if(thd == NULL)
         return -1;
 
     if((prio < 0) || (prio > PRIO_MAX))
         return -2;
 
-    /* Set the new priority */
-    thd->prio = prio;
+    /* Set the new base priority. The effective priority might still be
+       higher than this, if the thread is holding a boosted lock. */
+    old = irq_disable();
+    thd->base_prio = prio;
+    thd_pi_update(thd);
+    irq_restore(old);
+
     return 0;
 }
 
 /*****************************************************************************/
 /* Scheduling routines */
 
+/* Update the scheduling statistics (and the trace ring, if it's on) when we
+   switch from whichever thread was running last over to thd. */
+static void thd_account_switch(kthread_t *thd, uint64_t now, int voluntary) {
+    kthread_t *prev = thd_running;
+
+    if(prev == thd)
+        return;
+
+    if(prev) {
+        prev->stats.run_time += now - prev->stats.last_start;
+
+        if(voluntary)
+            ++prev->stats.voluntary;
+        else
+            ++prev->stats.preempted;
+
+        sched_trace(voluntary ? SCHED_TRACE_SWITCH_YIELD :
+                    SCHED_TRACE_SWITCH_PREEMPT, prev, thd->tid);
+    }
+
+    ++thd->stats.switches;
+    thd->stats.last_start = now;
+
+    /* If it was woken up from a genwait, see how long that took. */
+    if(thd->stats.wait_start) {
+        if(now - thd->stats.wait_start > thd->stats.max_wait)
+            thd->stats.max_wait = now - thd->stats.wait_start;
+
+        thd->stats.wait_start = 0;
+    }
+
+    thd_running = thd;
+}
+
 /* Thread scheduler; this function will find a new thread to run when a
    context switch is requested. No work is done in here except to change
    out the thd_current variable contents. Assumed that we are in an
@@ -629,7 +918,7 @@ void thd_schedule(int front_of_line, uint64_t now) {
     kthread_t *thd;
 
     if(now == 0)
-        now = timer_ms_gettime64();
+        now = timer_us_gettime64();
 
     /* We won't re-enqueue the current thread if it's NULL (i.e., the
        thread blocked itself somewhere) or if it's a zombie (below) */
@@ -652,14 +941,11 @@ void thd_schedule(int front_of_line, uint64_t now) {
     /* Look for timed out waits */
     genwait_check_timeouts(now);
 
-    /* Search downwards through the run queue for a runnable thread; if
+    /* Grab the first thread in the highest priority non-empty bucket; if
        we don't find a normal runnable thread, the idle process will
-       always be there at the bottom. */
-    TAILQ_FOREACH(thd, &run_queue, thdq) {
-        /* Is it runnable? If not, keep going */
-        if(thd->state == STATE_READY)
-            break;
-    }
+       always be there at the bottom. Only ready threads are ever put on
+       the run queue, so there's no need to check the state here. */
+    thd = runq_first();
 
     /* If we didn't already re-enqueue the thread and we are supposed to do so,
        do it now. */
@@ -682,6 +968,7 @@ void thd_schedule(int front_of_line, uint64_t now) {
     /* We should now have a runnable thread, so remove it from the
        run queue and switch to it. */
     thd_remove_from_runnable(thd);
+    thd_account_switch(thd, now, dontenq || thd_voluntary);
 
     thd_current = thd;
     _impure_ptr = &thd->thd_reent;
@@ -722,20 +1009,52 @@ void thd_schedule_next(kthread_t *thd) {
     }
 
     thd_remove_from_runnable(thd);
+    thd_account_switch(thd, timer_us_gettime64(), 0);
     thd_current = thd;
     _impure_ptr = &thd->thd_reent;
     thd_current->state = STATE_RUNNING;
     irq_set_context(&thd_current->context);
 }
 
+/* Program the primary timer for the next scheduling event: the end of the
+   current thread's timeslice or the next genwait timeout, whichever comes
+   first. In tickless mode, the idle thread doesn't get a timeslice at all, so
+   we only wake up for timeouts (or once a second, just to be safe). */
+static void thd_program_timer(uint64_t now) {
+    uint64_t next, delay;
+
+    /* Start a new timeslice if we switched to a different thread. */
+    if(thd_current != thd_slice_owner || now >= thd_slice_end) {
+        thd_slice_owner = thd_current;
+        thd_slice_end = now + 1000000 / HZ;
+    }
+
+    if(thd_tickless && thd_current == thd_idle_thd)
+        delay = 1000000;
+    else
+        delay = thd_slice_end - now;
+
+    if((next = genwait_next_timeout()) != 0) {
+        if(next <= now)
+            delay = 1;
+        else if(next - now < delay)
+            delay = next - now;
+    }
+
+    timer_primary_wakeup_us((uint32_t)delay);
+}
+
 /* See kos/thread.h for description */
 irq_context_t *thd_choose_new(void) {
-    uint64_t now = timer_ms_gettime64();
+    uint64_t now = timer_us_gettime64();
 
     //printf("thd_choose_new() woken at %d\n", (uint32_t)now);
 
     /* Do any re-scheduling */
+    thd_voluntary = 1;
     thd_schedule(0, now);
+    thd_voluntary = 0;
+    thd_program_timer(now);
 
     /* Return the new IRQ context back to the caller */
     return &thd_current->context;
@@ -744,19 +1063,35 @@ irq_context_t *thd_choose_new(void) {
 /*****************************************************************************/
 
 /* Timer function. Check to see if we were woken because of a timeout event
-   or because of a pre-empt. For timeouts, just go take care of it and sleep
-   again until our next context switch (if any). For pre-empts, re-schedule
-   threads, swap out contexts, and sleep. */
+   or because of a pre-empt. For timeouts, just go take care of it without
+   rotating the current thread to the back of its priority group, since its
+   timeslice isn't up yet. For pre-empts, re-schedule threads, swap out
+   contexts, and sleep. */
 static void thd_timer_hnd(irq_context_t *context) {
     /* Get the system time */
-    uint64_t now = timer_ms_gettime64();
+    uint64_t now = timer_us_gettime64();
 
     (void)context;
 
     //printf("timer woke at %d\n", (uint32_t)now);
 
-    thd_schedule(0, now);
-    timer_primary_wakeup(1000 / HZ);
+    thd_schedule(thd_current == thd_slice_owner && now < thd_slice_end, now);
+    thd_program_timer(now);
+}
+
+/* Turn tickless idle on or off */
+int thd_set_tickless(int enable) {
+    int old = irq_disable();
+    int rv = thd_tickless;
+
+    thd_tickless = !!enable;
+
+    /* Reprogram the timer, in case we're switching modes while idle. */
+    if(thd_mode != THD_MODE_NONE)
+        thd_program_timer(timer_us_gettime64());
+
+    irq_restore(old);
+    return rv;
 }
 
 /*****************************************************************************/
@@ -788,6 +1123,23 @@ void thd_sleep(int ms) {
     genwait_wait((void *)0xffffffff, "thd_sleep", ms, NULL);
 }
 
+/* Microsecond resolution version of the above. */
+void thd_sleep_us(uint64_t us) {
+    if(thd_mode == THD_MODE_NONE) {
+        dbglog(DBG_WARNING, "thd_sleep_us called when threading not "
+               "initialized.\n");
+        timer_spin_sleep((int)((us + 999) / 1000));
+        return;
+    }
+
+    if(!us) {
+        thd_pass();
+        return;
+    }
+
+    genwait_wait_us((void *)0xffffffff, "thd_sleep", us, NULL);
+}
+
 /* Manually cause a re-schedule */
 void thd_pass(void) {
     /* Makes no sense inside int */
@@ -800,7 +1152,6 @@ void thd_pass(void) {
 /* Wait for a thread to exit */
 int thd_join(kthread_t *thd, void **value_ptr) {
     int old, rv;
-    kthread_t * t = NULL;
 
     /* Can't scan for NULL threads */
     if(thd == NULL)
@@ -815,15 +1166,9 @@ int thd_join(kthread_t *thd, void **value_ptr) {
 
     old = irq_disable();
 
-    /* Search the thread list and make sure that this thread hasn't
-       already died and been deallocated. */
-    LIST_FOREACH(t, &thd_list, t_list) {
-        if(t == thd)
-            break;
-    }
-
-    /* Did we find anything? */
-    if(t != thd) {
+    /* Make sure that this thread hasn't already died and been
+       deallocated. */
+    if(!thd_is_valid(thd)) {
         rv = -2;
     }
     else if((thd->flags & THD_DETACHED)) {
@@ -853,7 +1198,6 @@ int thd_join(kthread_t *thd, void **value_ptr) {
 /* Detach a joinable thread */
 int thd_detach(kthread_t *thd) {
     int old, rv = 0;
-    kthread_t * t = NULL;
 
     /* Can't scan for NULL threads */
     if(thd == NULL)
@@ -861,15 +1205,9 @@ int thd_detach(kthread_t *thd) {
 
     old = irq_disable();
 
-    /* Search the thread list and make sure that this thread hasn't
-       already died and been deallocated. */
-    LIST_FOREACH(t, &thd_list, t_list) {
-        if(t == thd)
-            break;
-    }
-
-    /* Did we find anything? */
-    if(t != thd) {
+    /* Make sure that this thread hasn't already died and been
+       deallocated. */
+    if(!thd_is_valid(thd)) {
         rv = -2;
     }
     else if(thd->flags & THD_DETACHED) {
@@ -944,31 +1282,20 @@ int thd_get_mode(void) {
 int kthread_key_delete(kthread_key_t key) {
     int old = irq_disable();
     kthread_t *cur;
-    kthread_tls_kv_t *i;
+    void **slot;
 
-    /* Make sure the key is valid. */
-    if(key >= kthread_key_next() || key < 1) {
+    /* Make sure the key is valid, and hasn't been deleted already. */
+    if(!kthread_key_valid(key)) {
         irq_restore(old);
         errno = EINVAL;
         return -1;
     }
 
-    /* Make sure we can actually use free below. */
-    if(!malloc_irq_safe()) {
-        irq_restore(old);
-        errno = EPERM;
-        return -1;
-    }
-
-    /* Go through each thread searching for (and removing) the data. */
+    /* Go through each thread clearing out the data, so that nothing is left
+       behind if the key gets reused. */
     LIST_FOREACH(cur, &thd_list, t_list) {
-        LIST_FOREACH(i, &cur->tls_list, kv_list) {
-            if(i->key == key) {
-                LIST_REMOVE(i, kv_list);
-                free(i);
-                break;
-            }
-        }
+        if((slot = kthread_tls_slot(cur, key)))
+            *slot = NULL;
     }
 
     kthread_key_delete_destructor(key);
@@ -983,6 +1310,7 @@ int kthread_key_delete(kthread_key_t key) {
 /* Init */
 int thd_init(void) {
     kthread_t *kern, *reaper;
+    int i;
 
     /* Make sure we're not already running */
     if(thd_mode != THD_MODE_NONE)
@@ -994,11 +1322,23 @@ int thd_init(void) {
     /* Initialize handle counters */
     tid_highest = 1;
 
-    /* Initialize the thread list */
+    /* Initialize the thread list, the hashes and the zombie list */
     LIST_INIT(&thd_list);
 
+    for(i = 0; i < TID_HASH_SIZE; ++i)
+        LIST_INIT(&tid_hash[i]);
+
+    for(i = 0; i < THD_PTR_HASH_SIZE; ++i)
+        LIST_INIT(&thd_ptr_hash[i]);
+
+    TAILQ_INIT(&thd_zombies);
+
     /* Initialize the run queue */
-    TAILQ_INIT(&run_queue);
+    for(i = 0; i < RUNQ_BUCKETS; ++i)
+        TAILQ_INIT(&run_queue[i]);
+
+    memset(run_bitmap, 0, sizeof(run_bitmap));
+    memset(run_bitmap_top, 0, sizeof(run_bitmap_top));
 
     /* Start off with no "current" thread */
     thd_current = NULL;
@@ -1035,6 +1375,8 @@ int thd_init(void) {
 
     /* Main thread -- the kern thread */
     thd_current = kern;
+    thd_running = kern;
+    kern->stats.last_start = timer_us_gettime64();
     irq_set_context(&kern->context);
 
     /* Initialize thread sync primitives */
@@ -1044,6 +1386,8 @@ int thd_init(void) {
     timer_primary_set_callback(thd_timer_hnd);
 
     /* Schedule our first wakeup */
+    thd_slice_owner = kern;
+    thd_slice_end = timer_us_gettime64() + 1000000 / HZ;
     timer_primary_wakeup(1000 / HZ);
 
     dbglog(DBG_INFO, "thd: pre-emption enabled, HZ=%d\n", HZ);
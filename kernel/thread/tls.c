@@ -10,6 +10,7 @@
 #include <stdlib.h>
 #include <assert.h>
 #include <errno.h>
+#include <string.h>
 #include <malloc.h>
 
 #include <kos/tls.h>
@@ -20,57 +21,74 @@
 static spinlock_t mutex = SPINLOCK_INITIALIZER;
 static kthread_key_t next_key = 1;
 
-typedef struct kthread_tls_dest {
-    /* List handle */
-    LIST_ENTRY(kthread_tls_dest) dest_list;
+typedef void (*destructor)(void *);
 
-    /* The key */
-    kthread_key_t key;
+/* Per-key state, indexed directly by the key. */
+typedef struct kthread_tls_key {
+    /* Is the key currently allocated? */
+    int in_use;
 
     /* Destructor for the key */
-    void (*destructor)(void *);
-} kthread_tls_dest_t;
-
-LIST_HEAD(kthread_tls_dest_list, kthread_tls_dest);
+    destructor dest;
+} kthread_tls_key_t;
 
-static struct kthread_tls_dest_list dest_list;
+static kthread_tls_key_t *key_tab;
+static int key_tab_size;
 
-/* What is the next key that will be given out? */
+/* What is the next key that will be given out? Since deleted keys get reused,
+   this is really one more than the highest key that has been given out. */
 kthread_key_t kthread_key_next(void) {
     return next_key;
 }
 
-typedef void (*destructor)(void *);
-
-/* Get the destructor for a given key. */
-static destructor kthread_key_get_destructor(kthread_key_t key) {
-    kthread_tls_dest_t *i;
+/* Is the given key currently allocated? This is called with interrupts
+   disabled, like kthread_key_delete_destructor(). */
+int kthread_key_valid(kthread_key_t key) {
+    return key > 0 && key < next_key && key_tab[key].in_use;
+}
 
-    LIST_FOREACH(i, &dest_list, dest_list) {
-        if(i->key == key) {
-            return i->destructor;
-        }
+/* Delete the destructor for a given key. This is called with interrupts
+   disabled, so the key table can't be swapped out from under us. */
+void kthread_key_delete_destructor(kthread_key_t key) {
+    if(key > 0 && key < next_key) {
+        key_tab[key].in_use = 0;
+        key_tab[key].dest = NULL;
     }
-
-    return NULL;
 }
 
-/* Delete the destructor for a given key. */
-void kthread_key_delete_destructor(kthread_key_t key) {
-    kthread_tls_dest_t *i;
+/* Make sure the key table has room for the given key. The old table is swapped
+   out with interrupts disabled, since thd_destroy() reads it from the reaper.
+   Must be called with the spinlock held. */
+static int kthread_key_grow(kthread_key_t key) {
+    kthread_tls_key_t *tab, *old;
+    int size = key_tab_size ? key_tab_size : KTHREAD_TLS_SLOTS + 1, irqs;
 
-    LIST_FOREACH(i, &dest_list, dest_list) {
-        if(i->key == key) {
-            LIST_REMOVE(i, dest_list);
-            free(i);
-            return;
-        }
-    }
+    if(key < key_tab_size)
+        return 0;
+
+    while(size <= key)
+        size <<= 1;
+
+    if(!(tab = (kthread_tls_key_t *)calloc(size, sizeof(kthread_tls_key_t))))
+        return -1;
+
+    irqs = irq_disable();
+    old = key_tab;
+
+    if(old)
+        memcpy(tab, old, key_tab_size * sizeof(kthread_tls_key_t));
+
+    key_tab = tab;
+    key_tab_size = size;
+    irq_restore(irqs);
+
+    free(old);
+    return 0;
 }
 
 /* Create a new TLS key. */
 int kthread_key_create(kthread_key_t *key, void (*destructor)(void *)) {
-    kthread_tls_dest_t *dest;
+    kthread_key_t k;
 
     if(irq_inside_int() &&
        (spinlock_is_locked(&mutex) || !malloc_irq_safe())) {
@@ -80,40 +98,80 @@ int kthread_key_create(kthread_key_t *key, void (*destructor)(void *)) {
 
     spinlock_lock(&mutex);
 
-    /* Store the destructor if need be. */
-    if(destructor) {
-        dest = (kthread_tls_dest_t *)malloc(sizeof(kthread_tls_dest_t));
-
-        if(!dest) {
-            errno = ENOMEM;
-            spinlock_unlock(&mutex);
-            return -1;
-        }
+    /* Reuse a deleted key if there is one, so the keys stay small enough to
+       (usually) fit in the threads' direct slots. */
+    for(k = 1; k < next_key; ++k) {
+        if(!key_tab[k].in_use)
+            break;
+    }
 
-        dest->key = next_key;
-        dest->destructor = destructor;
-        LIST_INSERT_HEAD(&dest_list, dest, dest_list);
+    if(kthread_key_grow(k) < 0) {
+        errno = ENOMEM;
+        spinlock_unlock(&mutex);
+        return -1;
     }
 
-    *key = next_key++;
+    key_tab[k].in_use = 1;
+    key_tab[k].dest = destructor;
+
+    if(k == next_key)
+        ++next_key;
+
+    *key = k;
     spinlock_unlock(&mutex);
 
     return 0;
 }
 
+void **kthread_tls_slot(kthread_t *thd, kthread_key_t key) {
+    if(key < 1)
+        return NULL;
+
+    if(key <= KTHREAD_TLS_SLOTS)
+        return &thd->tls_slots[key - 1];
+
+    key -= KTHREAD_TLS_SLOTS + 1;
+
+    if(key < thd->tls_ext_size)
+        return &thd->tls_ext[key];
+
+    return NULL;
+}
+
 /* Get the value stored for a given TLS key. Returns NULL if the key is invalid
    or there is no data there for the current thread. */
 void *kthread_getspecific(kthread_key_t key) {
-    kthread_t *cur = thd_get_current();
-    kthread_tls_kv_t *i;
+    void **slot = kthread_tls_slot(thd_get_current(), key);
 
-    LIST_FOREACH(i, &cur->tls_list, kv_list) {
-        if(i->key == key) {
-            return i->data;
-        }
-    }
+    return slot ? *slot : NULL;
+}
 
-    return NULL;
+/* Grow a thread's overflow table so that it has a slot for the given key. The
+   table is swapped out with interrupts disabled, since kthread_key_delete() may
+   be clearing slots in it from another thread. */
+static int kthread_tls_ext_grow(kthread_t *thd, kthread_key_t key) {
+    void **tab, **old;
+    int size = thd->tls_ext_size ? thd->tls_ext_size : KTHREAD_TLS_SLOTS, irqs;
+    int idx = key - KTHREAD_TLS_SLOTS - 1;
+
+    while(size <= idx)
+        size <<= 1;
+
+    if(!(tab = (void **)calloc(size, sizeof(void *))))
+        return -1;
+
+    irqs = irq_disable();
+    old = thd->tls_ext;
+
+    if(old)
+        memcpy(tab, old, thd->tls_ext_size * sizeof(void *));
+
+    thd->tls_ext = tab;
+    thd->tls_ext_size = size;
+    irq_restore(irqs);
+
+    free(old);
+    return 0;
 }
 
 /* Set the value for a given TLS key. Returns -1 on failure. errno will be
@@ -122,7 +180,7 @@ void *kthread_getspecific(kthread_key_t key) {
    in progress already. */
 int kthread_setspecific(kthread_key_t key, const void *value) {
     kthread_t *cur = thd_get_current();
-    kthread_tls_kv_t *i;
+    void **slot;
 
     if(irq_inside_int() && spinlock_is_locked(&mutex)) {
         errno = EPERM;
@@ -132,7 +190,7 @@ int kthread_setspecific(kthread_key_t key, const void *value) {
     spinlock_lock(&mutex);
 
     /* Make sure the key is valid. */
-    if(key >= next_key || key < 1) {
+    if(key >= next_key || key < 1 || !key_tab[key].in_use) {
         errno = EINVAL;
         spinlock_unlock(&mutex);
         return -1;
@@ -140,46 +198,61 @@ int kthread_setspecific(kthread_key_t key, const void *value) {
 
     spinlock_unlock(&mutex);
 
-    /* Check if we already have an entry for this key. */
-    LIST_FOREACH(i, &cur->tls_list, kv_list) {
-        if(i->key == key) {
-            i->data = (void *)value;
-            return 0;
+    /* Only keys past the direct slots can need more room. */
+    if(!(slot = kthread_tls_slot(cur, key))) {
+        if(irq_inside_int() && !malloc_irq_safe()) {
+            errno = EPERM;
+            return -1;
         }
-    }
 
-    /* No entry, create a new one. */
-    i = (kthread_tls_kv_t *)malloc(sizeof(kthread_tls_kv_t));
+        if(kthread_tls_ext_grow(cur, key) < 0) {
+            errno = ENOMEM;
+            return -1;
+        }
 
-    if(!i) {
-        errno = ENOMEM;
-        return -1;
+        slot = kthread_tls_slot(cur, key);
     }
 
-    i->key = key;
-    i->data = (void *)value;
-    i->destructor = kthread_key_get_destructor(key);
-    LIST_INSERT_HEAD(&cur->tls_list, i, kv_list);
+    *slot = (void *)value;
 
     return 0;
 }
 
+/* Run the destructors for all of a thread's non-NULL values. This is called
+   from thd_destroy() with interrupts disabled. */
+void kthread_tls_destroy(kthread_t *thd) {
+    kthread_key_t k;
+    void **slot;
+
+    for(k = 1; k < next_key; ++k) {
+        if(!key_tab[k].dest)
+            continue;
+
+        if(!(slot = kthread_tls_slot(thd, k)))
+            continue;
+
+        if(*slot)
+            key_tab[k].dest(*slot);
+    }
+
+    free(thd->tls_ext);
+    thd->tls_ext = NULL;
+    thd->tls_ext_size = 0;
+}
+
 int kthread_tls_init(void) {
-    /* Initialize the destructor list. */
-    LIST_INIT(&dest_list);
+    /* Start off with room for the keys that fit in the direct slots. */
+    next_key = 1;
+
+    if(kthread_key_grow(KTHREAD_TLS_SLOTS) < 0)
+        return -1;
 
     return 0;
 }
 
 void kthread_tls_shutdown(void) {
-    kthread_tls_dest_t *n1, *n2;
-
-    /* Tear down the destructor list. */
-    n1 = LIST_FIRST(&dest_list);
-
-    while(n1 != NULL) {
-        n2 = LIST_NEXT(n1, dest_list);
-        free(n1);
-        n1 = n2;
-    }
+    /* Tear down the key table. */
+    free(key_tab);
+    key_tab = NULL;
+    key_tab_size = 0;
 }
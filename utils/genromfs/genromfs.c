@@ -202,6 +202,12 @@ struct aligns *alignlist = NULL;
 struct excludes *excludelist = NULL;
 int realbase;
 
+/* Lookup index for the KOS romdisk driver (see fs_romdisk.c) */
+#define INDEX_NAME  ".rdindex"
+#define INDEX_MAGIC "-rdidx1-"
+static struct filenode *indexnode = NULL;
+static uint32_t *indexdata = NULL;
+
 /* helper function to match an exclusion or align pattern */
 
 int nodematch(char *pattern, struct filenode *node) {
@@ -354,6 +360,11 @@ int dumpnode(struct filenode *node, FILE *f) {
         ri.spec = htonl(node->orig_link->offset);
         dumpri(&ri, node, f);
     }
+    else if(node == indexnode) {
+        ri.nextfh |= htonl(ROMFH_REG);
+        dumpri(&ri, node, f);
+        dumpdata(indexdata, node->size, f);
+    }
     else if(S_ISDIR(node->modes)) {
         ri.nextfh |= htonl(ROMFH_DIR);
 
@@ -779,6 +790,133 @@ int processdir(int level, const char *base, const char *dirname, struct stat *sb
     return curroffset;
 }
 
+/* The romfs type that dumpnode will give a node */
+int nodetype(struct filenode *node) {
+    if(node->orig_link)
+        return ROMFH_HRD;
+    else if(S_ISDIR(node->modes))
+        return ROMFH_DIR;
+    else if(S_ISREG(node->modes))
+        return ROMFH_REG;
+#if !defined(_WIN32) || defined(__CYGWIN__)
+    else if(S_ISLNK(node->modes))
+        return ROMFH_LNK;
+    else if(S_ISCHR(node->modes))
+        return ROMFH_CHR;
+    else if(S_ISBLK(node->modes))
+        return ROMFH_BLK;
+    else if(S_ISFIFO(node->modes))
+        return ROMFH_FIF;
+    else if(S_ISSOCK(node->modes))
+        return ROMFH_SCK;
+#endif
+
+    return -1;
+}
+
+/* KOS only looks up the things that it sees as files or directories, which
+   it figures out from the low two bits of the type. */
+int nodeindexed(struct filenode *node) {
+    int type = nodetype(node);
+
+    return type >= 0 && ((type & 3) == 1 || (type & 3) == 2);
+}
+
+/* Hash a name in a directory. This must match the hash in fs_romdisk.c. */
+uint32_t indexhash(uint32_t dir, const char *name) {
+    uint32_t h = 2166136261U ^ dir;
+    unsigned char c;
+
+    while((c = (unsigned char)*name++)) {
+        if(c >= 'A' && c <= 'Z')
+            c += 'a' - 'A';
+
+        h = (h ^ c) * 16777619U;
+    }
+
+    return h;
+}
+
+int countindex(struct filenode *dir) {
+    struct filenode *p;
+    int cnt = 0;
+
+    for(p = dir->dirlist.head; p->next; p = p->next) {
+        if(nodeindexed(p))
+            cnt++;
+
+        cnt += countindex(p);
+    }
+
+    return cnt;
+}
+
+void fillindex(struct filenode *dir, uint32_t key, uint32_t mask) {
+    struct filenode *p;
+    uint32_t i;
+
+    for(p = dir->dirlist.head; p->next; p = p->next) {
+        if(nodeindexed(p)) {
+            i = indexhash(key, p->name) & mask;
+
+            while(indexdata[4 + i * 2 + 1])
+                i = (i + 1) & mask;
+
+            indexdata[4 + i * 2] = htonl(key);
+            indexdata[4 + i * 2 + 1] = htonl(p->offset);
+        }
+
+        if(!listisempty(&p->dirlist))
+            fillindex(p, p->dirlist.head->offset, mask);
+    }
+}
+
+/* Add the lookup index to the end of the root directory. This has to be done
+   once everything else has been laid out, since the index holds the offsets
+   of all the headers in the image. */
+int addindex(struct filenode *root, int curroffset) {
+    struct filenode *p;
+    uint32_t cnt, slots;
+
+    for(p = root->dirlist.head; p->next; p = p->next) {
+        if(!strcmp(p->name, INDEX_NAME)) {
+            fprintf(stderr, "Can't add the lookup index, '%s' already "
+                    "exists\n", INDEX_NAME);
+            return -1;
+        }
+    }
+
+    /* Keep the table at most 3/4 full, like the kernel does. */
+    cnt = countindex(root) + 1;
+
+    for(slots = 16; slots < cnt + cnt / 3 + 1; slots <<= 1)
+        ;
+
+    indexnode = newnode("", INDEX_NAME, curroffset);
+    indexnode->modes = S_IFREG | 0444;
+    indexnode->size = 16 + slots * 8;
+    append(&root->dirlist, indexnode);
+    curroffset = alignnode(indexnode, curroffset, spaceneeded(indexnode));
+    curroffset += spaceneeded(indexnode);
+
+    indexdata = calloc(1, indexnode->size);
+
+    if(!indexdata) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+
+    memcpy(indexdata, INDEX_MAGIC, 8);
+    indexdata[2] = htonl(slots);
+    indexdata[3] = htonl(cnt);
+
+    /* The kernel finds the root's entries from the end of the image header,
+       so that's the key for them rather than the offset of the first one. */
+    fillindex(root, spaceneeded(root), slots - 1);
+
+    return curroffset;
+}
+
 void showhelp(const char *argv0) {
     printf("genromfs %s\n", VERSION);
     printf("Usage: %s [OPTIONS] -f IMAGE\n", argv0);
@@ -791,6 +929,7 @@ void showhelp(const char *argv0) {
     printf("  -a ALIGN               Align regular file data to ALIGN bytes\n");
     printf("  -A ALIGN,PATTERN       Align all objects matching pattern to at least ALIGN bytes\n");
     printf("  -x PATTERN             Exclude all objects matching pattern\n");
+    printf("  -I                     Add a lookup index for the KOS romdisk driver\n");
     printf("  -h                     Show this help\n");
     printf("\n");
     printf("Report bugs to chexum@shadow.banki.hu\n");
@@ -802,6 +941,7 @@ int main(int argc, char *argv[]) {
     char *outf = NULL;
     char *volname = NULL;
     int verbose = 0;
+    int mkindex = 0;
     char buf[256];
     struct filenode *root;
     struct stat sb;
@@ -812,7 +952,7 @@ int main(int argc, char *argv[]) {
     struct excludes *pe, *pe2;
     FILE *f;
 
-    while((c = getopt(argc, argv, "V:vd:f:ha:A:x:")) != EOF) {
+    while((c = getopt(argc, argv, "V:vd:f:ha:A:x:I")) != EOF) {
         switch(c) {
             case 'd':
                 dir = optarg;
@@ -826,6 +966,9 @@ int main(int argc, char *argv[]) {
             case 'v':
                 verbose = 1;
                 break;
+            case 'I':
+                mkindex = 1;
+                break;
             case 'h':
                 showhelp(argv[0]);
                 exit(0);
@@ -918,6 +1061,9 @@ int main(int argc, char *argv[]) {
         return 1;
     }
 
+    if(mkindex && (lastoff = addindex(root, lastoff)) < 0)
+        return 1;
+
     if(verbose)
         shownode(0, root, stderr);
 
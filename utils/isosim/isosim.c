@@ -0,0 +1,563 @@
+/* KallistiOS ##version##
+
+   utils/isosim/isosim.c
+   Copyright (C) 2026 The KOS Team and contributors
+
+   This runs the real ISO9660 file system (kernel/arch/dreamcast/fs/
+   fs_iso9660.c) on the host, on top of a fake GD-ROM drive that serves
+   sectors out of a disc image in memory and logs every request it gets. It
+   reads a file on that image in various ways, checking that the data that
+   comes back is right, and that the requests the drive sees are the ones they
+   should be:
+
+   - Reading through a file a bit at a time has the read-ahead window start out
+     at 2 sectors and double with each request, up to 16 sectors.
+   - Seeking somewhere else starts the window over.
+   - Big reads go straight to the drive as a single request, by DMA if the
+     buffer is 32-byte aligned, and by PIO if it isn't.
+   - DMA is never used on a misaligned buffer, or without invalidating the
+     cache over the buffer first.
+
+   Usage: isosim [-v]
+     -v   print every request the drive gets
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <malloc.h>
+
+#include <dc/fs_iso9660.h>
+#include <dc/cdrom.h>
+#include <dc/vblank.h>
+#include <arch/cache.h>
+#include <kos/mutex.h>
+#include <kos/dbglog.h>
+#include <kos/fs.h>
+
+/* The image: 16 sectors of system area, the primary volume descriptor, the
+   descriptor set terminator, two blank sectors that get looked at for Joliet
+   descriptors, the root directory, and then the test file. */
+#define PVD_SECTOR      16
+#define ROOT_SECTOR     20
+#define FILE_SECTOR     21
+#define FILE_SECTORS    100
+#define FILE_SIZE       (FILE_SECTORS * 2048 + 1000)
+#define IMAGE_SECTORS   (FILE_SECTOR + FILE_SECTORS + 1)
+
+/* The Dreamcast's sector numbers start at 150. */
+#define LBA_OFFSET      150
+
+#define MAX_REQS        4096
+
+typedef struct {
+    void *buf;
+    int sector;
+    int cnt;
+    int mode;
+} cd_req_t;
+
+static uint8 *image;
+static cd_req_t reqs[MAX_REQS];
+static int req_count;
+static uint32 inval_start, inval_count;
+static int verbose;
+static int failed;
+
+static vfs_handler_t *vfs;
+
+static void fail(const char *fmt, ...) {
+    va_list ap;
+
+    printf("  FAIL: ");
+    va_start(ap, fmt);
+    vprintf(fmt, ap);
+    va_end(ap);
+    printf("\n");
+    ++failed;
+}
+
+/********************************************************************************/
+/* The fake drive */
+
+static int cd_read(void *buf, int sector, int cnt, int mode) {
+    cd_req_t *r;
+
+    if(verbose)
+        printf("    %s %2d sector(s) from %3d into %p\n",
+               mode == CDROM_READ_DMA ? "DMA" : "PIO", cnt,
+               sector - LBA_OFFSET, buf);
+
+    if(req_count < MAX_REQS) {
+        r = &reqs[req_count++];
+        r->buf = buf;
+        r->sector = sector - LBA_OFFSET;
+        r->cnt = cnt;
+        r->mode = mode;
+    }
+
+    if(sector < LBA_OFFSET || cnt <= 0 ||
+       sector - LBA_OFFSET + cnt > IMAGE_SECTORS) {
+        fail("read of %d sector(s) from %d is off the disc", cnt,
+             sector - LBA_OFFSET);
+        return ERR_SYS;
+    }
+
+    if(mode == CDROM_READ_DMA) {
+        if((uintptr_t)buf & 31)
+            fail("DMA into a misaligned buffer (%p)", buf);
+
+        if((uint32)(uintptr_t)buf - inval_start > inval_count ||
+           (uint32)(uintptr_t)buf + cnt * 2048 - inval_start > inval_count)
+            fail("DMA into %p without invalidating the cache first", buf);
+
+        inval_start = inval_count = 0;
+    }
+
+    memcpy(buf, image + (sector - LBA_OFFSET) * 2048, cnt * 2048);
+    return ERR_OK;
+}
+
+int cdrom_read_sectors_ex(void *buffer, int sector, int cnt, int mode) {
+    return cd_read(buffer, sector, cnt, mode);
+}
+
+int cdrom_read_sectors(void *buffer, int sector, int cnt) {
+    return cd_read(buffer, sector, cnt, CDROM_READ_PIO);
+}
+
+int cdrom_get_status(int *status, int *disc_type) {
+    *status = CD_STATUS_PAUSED;
+    *disc_type = 0;
+    return 0;
+}
+
+int cdrom_reinit(void) {
+    return 0;
+}
+
+int cdrom_read_toc(CDROM_TOC *toc_buffer, int session) {
+    memset(toc_buffer, 0, sizeof(CDROM_TOC));
+    return 0;
+}
+
+uint32 cdrom_locate_data_track(CDROM_TOC *toc) {
+    return LBA_OFFSET;
+}
+
+void dcache_inval_range(uint32 start, uint32 count) {
+    inval_start = start;
+    inval_count = count;
+}
+
+/********************************************************************************/
+/* Everything else the file system needs from the rest of KOS */
+
+void dbglog(int level, const char *fmt, ...) {
+    va_list ap;
+
+    if(!verbose && level > DBG_ERROR)
+        return;
+
+    va_start(ap, fmt);
+    vprintf(fmt, ap);
+    va_end(ap);
+}
+
+void dbglog_set_level(int level) {
+}
+
+/* There's only the one thread, so a mutex that's already locked would never
+   come unlocked. */
+int mutex_init(mutex_t *m, int mtype) {
+    m->type = mtype;
+    m->count = 0;
+    return 0;
+}
+
+int mutex_destroy(mutex_t *m) {
+    return 0;
+}
+
+int mutex_trylock(mutex_t *m) {
+    if(m->count && m->type != MUTEX_TYPE_RECURSIVE)
+        return -1;
+
+    ++m->count;
+    return 0;
+}
+
+int mutex_lock(mutex_t *m) {
+    if(mutex_trylock(m)) {
+        fprintf(stderr, "isosim: deadlock in mutex_lock\n");
+        abort();
+    }
+
+    return 0;
+}
+
+int mutex_unlock(mutex_t *m) {
+    if(!m->count) {
+        fprintf(stderr, "isosim: unlocking a mutex that isn't locked\n");
+        abort();
+    }
+
+    --m->count;
+    return 0;
+}
+
+int mutex_is_locked(mutex_t *m) {
+    return m->count != 0;
+}
+
+static asic_evt_handler vblank_hnd;
+
+int vblank_handler_add(asic_evt_handler hnd) {
+    vblank_hnd = hnd;
+    return 1;
+}
+
+int vblank_handler_remove(int handle) {
+    vblank_hnd = NULL;
+    return 0;
+}
+
+/* The file system registers a vfs_handler_t, which starts with its nmmgr
+   handler. */
+int nmmgr_handler_add(nmmgr_handler_t *hnd) {
+    vfs = (vfs_handler_t *)hnd;
+    return 0;
+}
+
+int nmmgr_handler_remove(nmmgr_handler_t *hnd) {
+    vfs = NULL;
+    return 0;
+}
+
+/********************************************************************************/
+/* Building the image */
+
+static void put_733(uint8 *p, uint32 v) {
+    p[0] = p[7] = v & 0xFF;
+    p[1] = p[6] = (v >> 8) & 0xFF;
+    p[2] = p[5] = (v >> 16) & 0xFF;
+    p[3] = p[4] = (v >> 24) & 0xFF;
+}
+
+/* Write a directory record, and return its length. */
+static int put_dirent(uint8 *p, uint32 extent, uint32 size, int dir,
+                      const char *name, int name_len) {
+    int len = 33 + name_len + !(name_len & 1);
+
+    memset(p, 0, len);
+    p[0] = len;
+    put_733(p + 2, extent);
+    put_733(p + 10, size);
+    p[25] = dir ? 2 : 0;
+    p[28] = 1;
+    p[31] = 1;
+    p[32] = name_len;
+    memcpy(p + 33, name, name_len);
+
+    return len;
+}
+
+/* What's at each byte of the test file. Every sector is different, so any
+   mix up in the sector numbers will show. */
+static uint8 file_byte(uint32 pos) {
+    return (pos * 7 + (pos >> 11) * 13 + (pos >> 8)) & 0xFF;
+}
+
+static void build_image(void) {
+    uint8 *s;
+    uint32 i;
+    int off;
+
+    image = (uint8 *)calloc(IMAGE_SECTORS, 2048);
+
+    if(!image) {
+        perror("calloc");
+        exit(EXIT_FAILURE);
+    }
+
+    s = image + PVD_SECTOR * 2048;
+    memcpy(s, "\01CD001\01", 7);
+    put_dirent(s + 156, ROOT_SECTOR, 2048, 1, "\0", 1);
+
+    s = image + (PVD_SECTOR + 1) * 2048;
+    memcpy(s, "\377CD001\01", 7);
+
+    s = image + ROOT_SECTOR * 2048;
+    off = put_dirent(s, ROOT_SECTOR, 2048, 1, "\0", 1);
+    off += put_dirent(s + off, ROOT_SECTOR, 2048, 1, "\1", 1);
+    put_dirent(s + off, FILE_SECTOR, FILE_SIZE, 0, "DATA.BIN;1", 10);
+
+    s = image + FILE_SECTOR * 2048;
+
+    for(i = 0; i < FILE_SIZE; ++i)
+        s[i] = file_byte(i);
+}
+
+/********************************************************************************/
+/* The tests */
+
+static void *open_file(void) {
+    void *h = vfs->open(vfs, "/data.bin", O_RDONLY);
+
+    if(!h) {
+        fail("couldn't open /data.bin");
+        exit(EXIT_FAILURE);
+    }
+
+    return h;
+}
+
+/* Read from the file, and check that what comes back is what's on the disc. */
+static int read_check(void *h, uint8 *buf, size_t bytes) {
+    off_t pos = vfs->tell(h);
+    ssize_t rv = vfs->read(h, buf, bytes);
+    ssize_t i;
+
+    if(rv < 0) {
+        fail("read of %d bytes at %d failed", (int)bytes, (int)pos);
+        return -1;
+    }
+
+    if((size_t)rv != bytes && pos + (off_t)bytes <= FILE_SIZE) {
+        fail("read of %d bytes at %d came up short (%d)", (int)bytes,
+             (int)pos, (int)rv);
+        return -1;
+    }
+
+    for(i = 0; i < rv; ++i) {
+        if(buf[i] != file_byte(pos + i)) {
+            fail("bad data at %d (read of %d bytes at %d)", (int)(pos + i),
+                 (int)bytes, (int)pos);
+            return -1;
+        }
+    }
+
+    return rv;
+}
+
+/* The handler's ioctl takes a va_list, like everything under fs_ioctl(). */
+static int ioctl(void *h, int cmd, ...) {
+    va_list ap;
+    int rv;
+
+    va_start(ap, cmd);
+    rv = vfs->ioctl(h, cmd, ap);
+    va_end(ap);
+
+    return rv;
+}
+
+static void seek(void *h, off_t pos) {
+    if(vfs->seek(h, pos, SEEK_SET) != pos)
+        fail("seek to %d failed", (int)pos);
+}
+
+/* Check that the requests since the given one are for the given counts of
+   sectors, one right after the other starting at the given sector of the
+   file. */
+static void expect_reqs(const char *what, int first, int sector,
+                        const int *cnts, int n) {
+    int i;
+
+    if(req_count - first != n) {
+        fail("%s: %d request(s) to the drive, expected %d", what,
+             req_count - first, n);
+        return;
+    }
+
+    for(i = 0; i < n; ++i) {
+        if(reqs[first + i].sector != FILE_SECTOR + sector ||
+           reqs[first + i].cnt != cnts[i]) {
+            fail("%s: request %d was %d sector(s) from %d, expected %d from %d",
+                 what, i, reqs[first + i].cnt,
+                 reqs[first + i].sector - FILE_SECTOR, cnts[i], sector);
+            return;
+        }
+
+        sector += cnts[i];
+    }
+}
+
+/* Reading through the whole file 512 bytes at a time should take the first
+   sector through the data cache, and then read ahead 2, 4, 8 and then 16
+   sectors at a time (as far as the end of the file). */
+static void test_sequential(void) {
+    static uint8 buf[512];
+    int cnts[FILE_SECTORS + 1];
+    int n = 0, left = FILE_SECTORS + 1, window = 1, first;
+    iso_cache_stats_t st;
+    void *h = open_file();
+    int i;
+
+    printf("Sequential reads, 512 bytes at a time:\n");
+
+    while(left > 0) {
+        cnts[n] = window < left ? window : left;
+        left -= cnts[n++];
+        window = window == 1 ? 2 : window * 2;
+
+        if(window > 16)
+            window = 16;
+    }
+
+    first = req_count;
+
+    while(read_check(h, buf, sizeof(buf)) > 0)
+        ;
+
+    expect_reqs("sequential", first, 0, cnts, n);
+
+    for(i = first + 1; i < req_count; ++i) {
+        if(reqs[i].mode != CDROM_READ_DMA)
+            fail("sequential: read-ahead %d wasn't done by DMA", i - first);
+    }
+
+    if(ioctl(h, ISO_IOCTL_GET_CACHE_STATS, &st))
+        fail("couldn't get the cache stats");
+    else
+        printf("  %d sectors in %d requests (%u read-ahead fills, %u "
+               "sectors from read-ahead)\n", FILE_SECTORS + 1,
+               req_count - first, (unsigned int)st.ra_fills,
+               (unsigned int)st.ra_hits);
+
+    vfs->close(h);
+}
+
+/* Seeking starts the window over, and reading on from there grows it again. */
+static void test_seek(void) {
+    static uint8 buf[2048];
+    static const int cnts1[] = { 1 };
+    static const int cnts2[] = { 2 };
+    void *h = open_file();
+    int first;
+
+    printf("Seeking:\n");
+
+    /* Get the window open all the way. */
+    seek(h, 0);
+
+    while(vfs->tell(h) < 40 * 2048)
+        read_check(h, buf, 1024);
+
+    seek(h, 70 * 2048 + 100);
+    first = req_count;
+    read_check(h, buf, 512);
+    expect_reqs("read after seeking", first, 70, cnts1, 1);
+
+    /* This finishes off that sector, and goes on to the next. */
+    first = req_count;
+    read_check(h, buf, 2048);
+    expect_reqs("read after that", first, 71, cnts2, 1);
+
+    vfs->close(h);
+}
+
+/* Big reads go straight into the caller's buffer, in one request, by DMA if
+   it can be done. Reading on from there counts as sequential. */
+static void test_direct(void) {
+    static const int cnts1[] = { 32 };
+    static const int cnts2[] = { 19, 2 };
+    uint8 *buf = (uint8 *)memalign(32, 65536 + 32);
+    void *h = open_file();
+    int first;
+
+    printf("Big reads:\n");
+
+    seek(h, 2048);
+    first = req_count;
+    read_check(h, buf, 65536);
+    expect_reqs("aligned", first, 1, cnts1, 1);
+
+    if(req_count - first == 1 && (reqs[first].mode != CDROM_READ_DMA ||
+                                  reqs[first].buf != buf))
+        fail("aligned: not read by DMA straight into the buffer");
+
+    seek(h, 2048);
+    first = req_count;
+    read_check(h, buf + 1, 65536);
+    expect_reqs("misaligned", first, 1, cnts1, 1);
+
+    if(req_count - first == 1 && (reqs[first].mode != CDROM_READ_PIO ||
+                                  reqs[first].buf != buf + 1))
+        fail("misaligned: not read by PIO straight into the buffer");
+
+    /* 19 whole sectors go straight in, and the rest is the start of a
+       sequential run. */
+    seek(h, 40 * 2048);
+    first = req_count;
+    read_check(h, buf, 40000);
+    expect_reqs("partial sectors", first, 40, cnts2, 2);
+
+    vfs->close(h);
+    free(buf);
+}
+
+/* Reads of all sizes, from all over the file, into buffers of all alignments.
+   The drive checks the DMA requests as they come in. */
+static void test_random(int rounds) {
+    uint8 *buf = (uint8 *)memalign(32, 16384 + 32);
+    void *h = open_file();
+    int i, len;
+
+    printf("Random reads, %d rounds:\n", rounds);
+
+    for(i = 0; i < rounds && failed < 10; ++i) {
+        if(rand() & 1)
+            seek(h, rand() % (FILE_SIZE + 1));
+        else if(rand() & 1)
+            seek(h, (rand() % (FILE_SECTORS + 1)) * 2048);
+
+        len = rand() & 1 ? rand() % 16384 : rand() % 3000;
+        read_check(h, buf + (rand() & 1 ? 0 : rand() & 31), len);
+    }
+
+    vfs->close(h);
+    free(buf);
+}
+
+int main(int argc, char *argv[]) {
+    int opt;
+
+    while((opt = getopt(argc, argv, "v")) != -1) {
+        switch(opt) {
+            case 'v':
+                verbose = 1;
+                break;
+
+            default:
+                fprintf(stderr, "Usage: %s [-v]\n", argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+
+    srand(1);
+    build_image();
+
+    if(fs_iso9660_init() < 0 || !vfs) {
+        fprintf(stderr, "isosim: couldn't initialize the file system\n");
+        return EXIT_FAILURE;
+    }
+
+    test_sequential();
+    test_seek();
+    test_direct();
+    test_random(20000);
+
+    fs_iso9660_shutdown();
+    free(image);
+
+    if(failed) {
+        printf("%d checks failed\n", failed);
+        return EXIT_FAILURE;
+    }
+
+    printf("All checks passed\n");
+    return EXIT_SUCCESS;
+}
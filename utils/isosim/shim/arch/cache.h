@@ -0,0 +1,18 @@
+/* KallistiOS ##version##
+
+   utils/isosim/shim/arch/cache.h
+   Copyright (C) 2026 The KOS Team and contributors
+
+   The host doesn't need its caches managed by hand, but the simulated drive
+   keeps track of what gets invalidated, so it can check that nothing is DMA'd
+   into memory that might still be dirty in the cache.
+*/
+
+#ifndef __ARCH_CACHE_H
+#define __ARCH_CACHE_H
+
+#include <arch/types.h>
+
+void dcache_inval_range(uint32 start, uint32 count);
+
+#endif  /* __ARCH_CACHE_H */
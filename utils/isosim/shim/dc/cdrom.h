@@ -0,0 +1,49 @@
+/* KallistiOS ##version##
+
+   utils/isosim/shim/dc/cdrom.h
+   Copyright (C) 2026 The KOS Team and contributors
+
+   The parts of the GD-ROM driver's interface that the ISO9660 file system
+   uses. The drive itself is faked by isosim.c, on top of a disc image in
+   memory.
+*/
+
+#ifndef __DC_CDROM_H
+#define __DC_CDROM_H
+
+#include <arch/types.h>
+
+#define ERR_OK          0
+#define ERR_NO_DISC     1
+#define ERR_DISC_CHG    2
+#define ERR_SYS         3
+#define ERR_ABORTED     4
+#define ERR_NO_ACTIVE   5
+
+#define CDROM_READ_PIO  0
+#define CDROM_READ_DMA  1
+
+#define CD_STATUS_BUSY      0
+#define CD_STATUS_PAUSED    1
+#define CD_STATUS_STANDBY   2
+#define CD_STATUS_PLAYING   3
+#define CD_STATUS_SEEKING   4
+#define CD_STATUS_SCANNING  5
+#define CD_STATUS_OPEN      6
+#define CD_STATUS_NO_DISC   7
+
+typedef struct {
+    uint32  entry[99];
+    uint32  first;
+    uint32  last;
+    uint32  leadout_sector;
+} CDROM_TOC;
+
+int cdrom_get_status(int *status, int *disc_type);
+int cdrom_reinit(void);
+int cdrom_read_toc(CDROM_TOC *toc_buffer, int session);
+int cdrom_read_sectors_ex(void *buffer, int sector, int cnt, int mode);
+int cdrom_read_sectors(void *buffer, int sector, int cnt);
+uint32 cdrom_locate_data_track(CDROM_TOC *toc);
+
+#endif  /* __DC_CDROM_H */
@@ -0,0 +1,9 @@
+/* KallistiOS ##version##
+
+   utils/isosim/shim/dc/fs_iso9660.h
+   Copyright (C) 2026 The KOS Team and contributors
+
+   This just pulls in the real KOS header.
+*/
+
+#include "../../../../kernel/arch/dreamcast/include/dc/fs_iso9660.h"
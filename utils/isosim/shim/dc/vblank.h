@@ -0,0 +1,20 @@
+/* KallistiOS ##version##
+
+   utils/isosim/shim/dc/vblank.h
+   Copyright (C) 2026 The KOS Team and contributors
+
+   There's no video hardware on the host, so the vblank handlers are just
+   remembered (and can be called by hand).
+*/
+
+#ifndef __DC_VBLANK_H
+#define __DC_VBLANK_H
+
+#include <arch/types.h>
+
+typedef void (*asic_evt_handler)(uint32 code);
+
+int vblank_handler_add(asic_evt_handler hnd);
+int vblank_handler_remove(int handle);
+
+#endif  /* __DC_VBLANK_H */
@@ -33,21 +33,40 @@
 
 #include "crc.h"
 
-int
-calc_crc(const unsigned char *buf, int size)
+/* This is the CRC16-CCITT, seeded with 0xFFFF, which is the same thing that
+ * net_crc16ccitt(buf, size, 0xffff) in KOS (kernel/net/net_crc.c) computes,
+ * and it's done the same way too: a byte at a time out of a table. */
+static unsigned short crc_table[256];
+
+static void
+make_crc_table(void)
 {
-  int i, c, n = 0xffff;
-  for (i = 0; i < size; i++) {
-    n ^= (buf[i]<<8);
+  int i, c, n;
+
+  for (i = 0; i < 256; i++) {
+    n = i << 8;
     for (c = 0; c < 8; c++) {
-      if (n & INITIAL_PROGRAM_SIZE)
-        n = (n << 1) ^ 4129;
+      if (n & 0x8000)
+        n = (n << 1) ^ 0x1021;
       else
         n = (n << 1);
     }
+    crc_table[i] = n & 0xffff;
   }
+}
+
+int
+calc_crc(const unsigned char *buf, int size)
+{
+  int i, n = 0xffff;
+
+  if (!crc_table[1])
+    make_crc_table();
+
+  for (i = 0; i < size; i++)
+    n = ((n << 8) ^ crc_table[((n >> 8) ^ buf[i]) & 0xff]) & 0xffff;
 
-  return n & 0xffff;
+  return n;
 }
 
 void
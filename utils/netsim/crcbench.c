@@ -0,0 +1,260 @@
+/* KallistiOS ##version##
+
+   utils/netsim/crcbench.c
+   Copyright (C) 2026 The KOS Team and contributors
+
+   This checks the CRCs and the Internet checksum in kernel/net/net_crc.c
+   against some well known values, and against simple bit-at-a-time versions
+   of them over lots of random data (of random lengths, at random alignments),
+   then measures how fast each one is next to the simple version.
+
+   Usage: crcbench [-n]
+     -n   do a lot fewer rounds of everything
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include <arpa/inet.h>
+
+#include "netsim.h"
+#include "../../kernel/net/net_ipv4.h"
+
+#define MAX_LEN     2048
+
+static int scale = 1;
+static int failed = 0;
+
+/* These are the way things were done before everything went to lookup tables,
+   which are about as obviously right as they can be. */
+static uint32 ref_crc32le(const uint8 *data, int size) {
+    uint32 rv = 0xFFFFFFFF;
+    int i, j;
+
+    for(i = 0; i < size; ++i) {
+        rv ^= data[i];
+
+        for(j = 0; j < 8; ++j)
+            rv = (0xEDB88320 & (-(rv & 1))) ^ (rv >> 1);
+    }
+
+    return ~rv;
+}
+
+static uint32 ref_crc32be(const uint8 *data, int size) {
+    uint32 rv = 0xFFFFFFFF, b, c;
+    int i, j;
+
+    for(i = 0; i < size; ++i) {
+        b = data[i];
+
+        for(j = 0; j < 8; ++j) {
+            c = ((rv & 0x80000000) ? 1 : 0) ^ (b & 1);
+            b >>= 1;
+
+            if(c)   rv = ((rv << 1) ^ 0x04C11DB6) | c;
+            else    rv <<= 1;
+        }
+    }
+
+    return rv;
+}
+
+static uint16 ref_crc16ccitt(const uint8 *data, int size, uint16 start) {
+    uint16 rv = start, tmp;
+
+    while(size--) {
+        tmp = (rv >> 8) ^ *data++;
+        tmp ^= tmp >> 4;
+
+        rv = (rv << 8) ^ (tmp << 12) ^ (tmp << 5) ^ tmp;
+    }
+
+    return rv;
+}
+
+static uint16 ref_checksum(const uint8 *data, size_t bytes, uint16 start) {
+    uint32 sum = start;
+    size_t i;
+
+    for(i = 0; i + 1 < bytes; i += 2) {
+        sum += data[i] | (data[i + 1] << 8);
+
+        while(sum >> 16)
+            sum = (sum >> 16) + (sum & 0xFFFF);
+    }
+
+    if(bytes & 1)
+        sum += data[bytes - 1];
+
+    while(sum >> 16)
+        sum = (sum >> 16) + (sum & 0xFFFF);
+
+    return sum ^ 0xFFFF;
+}
+
+static void check(const char *what, uint32 got, uint32 expected) {
+    if(got != expected) {
+        printf("  FAIL: %s: got %08x, expected %08x\n", what,
+               (unsigned int)got, (unsigned int)expected);
+        ++failed;
+    }
+}
+
+static void test_vectors(void) {
+    /* The usual "check" values from the CRC catalogues (other than for the
+       big-endian CRC-32, which isn't a standard one, so it's just what the
+       old code came up with), and the example from section 3 of RFC 1071. */
+    static const uint8 check_str[] = "123456789";
+    static const uint8 rfc1071[] = {
+        0x00, 0x01, 0xF2, 0x03, 0xF4, 0xF5, 0xF6, 0xF7
+    };
+
+    printf("Test vectors:\n");
+
+    check("CRC-32", net_crc32le(check_str, 9), 0xCBF43926);
+    check("CRC-32 (big-endian)", net_crc32be(check_str, 9), 0x9B63D02C);
+    check("CRC16-CCITT (seed 0xFFFF)", net_crc16ccitt(check_str, 9, 0xFFFF),
+          0x29B1);
+    check("CRC16-CCITT (seed 0)", net_crc16ccitt(check_str, 9, 0), 0x31C3);
+    check("CRC-32 (no data)", net_crc32le(check_str, 0), 0);
+    check("Internet checksum", ntohs(net_ipv4_checksum(rfc1071, 8, 0)),
+          0x220D);
+    check("Internet checksum (no data)", net_ipv4_checksum(rfc1071, 0, 0),
+          0xFFFF);
+}
+
+static void test_random(int rounds) {
+    static uint8 src[MAX_LEN + 8], dst[MAX_LEN + 8], ref[MAX_LEN + 8];
+    struct iovec iov[4];
+    int i, j, len, soff, doff, pos;
+    uint16 start, cs;
+
+    printf("Random data, %d rounds:\n", rounds);
+
+    for(i = 0; i < rounds && failed < 10; ++i) {
+        len = rand() % MAX_LEN;
+        soff = rand() & 7;
+        doff = rand() & 7;
+        start = rand() & 0xFFFF;
+
+        for(j = 0; j < len; ++j)
+            src[soff + j] = rand();
+
+        check("CRC-32", net_crc32le(src + soff, len),
+              ref_crc32le(src + soff, len));
+        check("CRC-32 (big-endian)", net_crc32be(src + soff, len),
+              ref_crc32be(src + soff, len));
+        check("CRC16-CCITT", net_crc16ccitt(src + soff, len, start),
+              ref_crc16ccitt(src + soff, len, start));
+        check("Internet checksum", net_ipv4_checksum(src + soff, len, start),
+              ref_checksum(src + soff, len, start));
+
+        /* The copy has to come out right, and not touch anything around it. */
+        memset(dst, 0xEE, sizeof(dst));
+        memset(ref, 0xEE, sizeof(ref));
+        memcpy(ref + doff, src + soff, len);
+
+        cs = net_ipv4_checksum_copy(dst + doff, src + soff, len, start);
+        check("Internet checksum (copied)", cs,
+              ref_checksum(src + soff, len, start));
+
+        if(memcmp(dst, ref, sizeof(dst))) {
+            printf("  FAIL: copy of %d bytes from +%d to +%d is wrong\n", len,
+                   soff, doff);
+            ++failed;
+        }
+
+        /* Cut the data up into pieces, some of which are at odd offsets. */
+        for(j = 0, pos = 0; j < 3; ++j) {
+            iov[j].iov_base = src + soff + pos;
+            iov[j].iov_len = len - pos ? rand() % (len - pos + 1) : 0;
+            pos += iov[j].iov_len;
+        }
+
+        iov[3].iov_base = src + soff + pos;
+        iov[3].iov_len = len - pos;
+
+        check("Internet checksum (in pieces)",
+              net_ipv4_checksum_iov(iov, 4, start),
+              ref_checksum(src + soff, len, start));
+    }
+}
+
+static uint64 now_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Keeps the compiler from throwing away any of the work. */
+static volatile uint32 sink;
+
+#define BENCH(name, expr) do { \
+        uint64 t = now_ns(); \
+        for(i = 0; i < rounds; ++i) \
+            sink += (expr); \
+        t = now_ns() - t; \
+        printf("  %-28s %8.1f MiB/s\n", name, \
+               (double)rounds * len / (1024.0 * 1024.0) / ((double)t / 1e9)); \
+    } while(0)
+
+static void bench(int len, int rounds) {
+    static uint8 src[MAX_LEN], dst[MAX_LEN];
+    int i;
+
+    for(i = 0; i < len; ++i)
+        src[i] = rand();
+
+    printf("%d byte blocks:\n", len);
+
+    BENCH("CRC-32 (bit at a time)", ref_crc32le(src, len));
+    BENCH("CRC-32", net_crc32le(src, len));
+    BENCH("CRC-32 BE (bit at a time)", ref_crc32be(src, len));
+    BENCH("CRC-32 BE", net_crc32be(src, len));
+    BENCH("CRC16-CCITT (nibbles)", ref_crc16ccitt(src, len, 0));
+    BENCH("CRC16-CCITT", net_crc16ccitt(src, len, 0));
+    BENCH("checksum (16 bits at a time)", ref_checksum(src, len, 0));
+    BENCH("checksum", net_ipv4_checksum(src, len, 0));
+    BENCH("memcpy, then checksum",
+          (memcpy(dst, src, len), net_ipv4_checksum(dst, len, 0)));
+    BENCH("checksum while copying",
+          net_ipv4_checksum_copy(dst, src, len, 0));
+}
+
+int main(int argc, char *argv[]) {
+    int opt;
+
+    while((opt = getopt(argc, argv, "n")) != -1) {
+        switch(opt) {
+            case 'n':
+                scale = 16;
+                break;
+
+            default:
+                fprintf(stderr, "Usage: %s [-n]\n", argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+
+    srand(1);
+
+    test_vectors();
+    test_random(200000 / scale);
+
+    if(failed) {
+        printf("%d checks failed\n", failed);
+        return EXIT_FAILURE;
+    }
+
+    printf("All checks passed\n");
+
+    bench(512, 200000 / scale);
+    bench(1500, 100000 / scale);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,384 @@
+/* KallistiOS ##version##
+
+   utils/netsim/netbench.c
+   Copyright (C) 2026 The KOS Team and contributors
+
+   This runs the whole network stack on the simulator's loopback device and
+   measures how much host CPU time it needs for the things that matter most:
+   pushing bulk data through a TCP connection, sending and receiving UDP
+   datagrams, and setting up and tearing down TCP connections. Each benchmark
+   also reports the time spent per frame that went through the device, which
+   covers both the send and receive paths (from the socket calls all the way
+   down to Ethernet and back up again).
+
+   The numbers are for the host, so they're only useful for comparing one
+   version of the stack to another (or one setting to another), not as a
+   prediction of what a Dreamcast would do.
+
+   Usage: netbench [-w file.pcap] [-c] [-s] [-n]
+     -w   write every frame to a pcap file (which gets big, and slows things
+          down, so it's best used along with -n)
+     -c   receive frames by copying them in, instead of in packet buffers
+     -s   send frames one at a time, like a driver without if_tx_batch
+     -n   do a lot fewer rounds of everything
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <netinet/tcp.h>
+
+#include "netsim.h"
+
+#define LOCAL_ADDR      0x0A000001      /* 10.0.0.1 */
+
+/* How long to let the simulated clock run when nothing is moving, so that
+   timers (delayed ACKs, retransmits) get a chance to fire. */
+#define IDLE_STEP       1000
+
+static int scale = 1;
+
+/* Each benchmark gets its own port, so that it doesn't run into connections
+   from the last one that are still closing. */
+static uint16 server_port = 5000;
+
+typedef struct {
+    uint64 ns;
+    uint32 frames;
+} mark_t;
+
+static void mark(mark_t *m) {
+    m->frames = netsim_nic_get_stats().rx_frames;
+    m->ns = netsim_host_ns();
+}
+
+/* Work out the time since a mark (less any that was spent on things that aren't
+   being measured), and how much of it went into each frame. */
+static uint64 since(const mark_t *m, uint64 paused, uint64 *ns_per_frame) {
+    uint64 ns = netsim_host_ns() - m->ns - paused;
+    uint32 frames = netsim_nic_get_stats().rx_frames - m->frames;
+
+    *ns_per_frame = frames ? ns / frames : 0;
+    return ns;
+}
+
+static void set_addr(struct sockaddr_in *addr, uint16 port) {
+    memset(addr, 0, sizeof(*addr));
+    addr->sin_family = AF_INET;
+    addr->sin_port = htons(port);
+    addr->sin_addr.s_addr = htonl(LOCAL_ADDR);
+}
+
+static net_socket_t *tcp_listener(int bufsz) {
+    struct sockaddr_in addr;
+    net_socket_t *lsock;
+
+    if(!(lsock = netsim_socket(AF_INET, SOCK_STREAM, IPPROTO_TCP)))
+        return NULL;
+
+    set_addr(&addr, ++server_port);
+
+    if((bufsz &&
+        (lsock->protocol->setsockopt(lsock, SOL_SOCKET, SO_RCVBUF, &bufsz,
+                                     sizeof(bufsz)) ||
+         lsock->protocol->setsockopt(lsock, SOL_SOCKET, SO_SNDBUF, &bufsz,
+                                     sizeof(bufsz)))) ||
+       lsock->protocol->bind(lsock, (struct sockaddr *)&addr, sizeof(addr)) ||
+       lsock->protocol->listen(lsock, 64)) {
+        fprintf(stderr, "Could not listen: %s\n", strerror(errno));
+        netsim_close(lsock);
+        return NULL;
+    }
+
+    return lsock;
+}
+
+/* Connect to the listening socket, and accept the connection. */
+static int tcp_connect(net_socket_t *lsock, int bufsz, net_socket_t **client,
+                       net_socket_t **server) {
+    struct sockaddr_in addr;
+    net_socket_t *c;
+    int fd;
+
+    if(!(c = netsim_socket(AF_INET, SOCK_STREAM, IPPROTO_TCP)))
+        return -1;
+
+    if(bufsz &&
+       (c->protocol->setsockopt(c, SOL_SOCKET, SO_RCVBUF, &bufsz,
+                                sizeof(bufsz)) ||
+        c->protocol->setsockopt(c, SOL_SOCKET, SO_SNDBUF, &bufsz,
+                                sizeof(bufsz))))
+        goto fail;
+
+    set_addr(&addr, server_port);
+
+    if(c->protocol->connect(c, (struct sockaddr *)&addr, sizeof(addr)) &&
+       errno != EINPROGRESS) {
+        fprintf(stderr, "connect failed: %s\n", strerror(errno));
+        goto fail;
+    }
+
+    netsim_poll();
+
+    if((fd = lsock->protocol->accept(lsock, NULL, NULL)) < 0) {
+        fprintf(stderr, "accept failed: %s\n", strerror(errno));
+        goto fail;
+    }
+
+    /* The stack doesn't send the <SYN,ACK> until the connection is accepted,
+       so let that (and the <ACK> to it) go around too. */
+    netsim_poll();
+
+    *client = c;
+    *server = netsim_get_socket(fd);
+    return 0;
+
+fail:
+    netsim_close(c);
+    return -1;
+}
+
+static int bench_tcp_bulk(int bufsz, size_t total) {
+    static uint8 chunk[16384];
+    net_socket_t *lsock, *c, *s;
+    size_t sent = 0, recvd = 0;
+    ssize_t rv;
+    uint64 ns, per_frame, sim_start;
+    mark_t m;
+    int progress;
+
+    memset(chunk, 0x5A, sizeof(chunk));
+
+    if(!(lsock = tcp_listener(bufsz)))
+        return -1;
+
+    if(tcp_connect(lsock, bufsz, &c, &s)) {
+        netsim_close(lsock);
+        return -1;
+    }
+
+    sim_start = netsim_now_us;
+    mark(&m);
+
+    while(recvd < total) {
+        progress = 0;
+
+        while(sent < total) {
+            rv = c->protocol->sendto(c, chunk, total - sent < sizeof(chunk) ?
+                                     total - sent : sizeof(chunk), 0, NULL, 0);
+
+            if(rv <= 0)
+                break;
+
+            sent += rv;
+            progress = 1;
+        }
+
+        progress |= netsim_poll();
+
+        while((rv = s->protocol->recvfrom(s, chunk, sizeof(chunk), 0, NULL,
+                                          NULL)) > 0) {
+            recvd += rv;
+            progress = 1;
+        }
+
+        /* Reading may have opened the window up, so let the update out. */
+        progress |= netsim_poll();
+
+        if(!progress)
+            netsim_advance(IDLE_STEP);
+    }
+
+    ns = since(&m, 0, &per_frame);
+
+    printf("  %4d KiB buffers: %8.1f MiB/s, %5" PRIu64 " ns/frame, "
+           "%6.1f ms simulated\n", bufsz / 1024,
+           (double)total / (1024.0 * 1024.0) / ((double)ns / 1e9),
+           per_frame, (netsim_now_us - sim_start) / 1000.0);
+
+    netsim_close(c);
+    netsim_close(s);
+    netsim_close(lsock);
+    netsim_poll();
+
+    return 0;
+}
+
+static int bench_udp(size_t payload, int rounds) {
+    static uint8 buf[2048];
+    struct sockaddr_in addr;
+    net_socket_t *tx, *rx;
+    uint64 ns, per_frame;
+    int i, j, got = 0;
+    mark_t m;
+
+#define UDP_BURST   32
+
+    if(!(tx = netsim_socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP)) ||
+       !(rx = netsim_socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP)))
+        return -1;
+
+    set_addr(&addr, ++server_port);
+
+    if(rx->protocol->bind(rx, (struct sockaddr *)&addr, sizeof(addr))) {
+        fprintf(stderr, "Could not bind: %s\n", strerror(errno));
+        return -1;
+    }
+
+    memset(buf, 0xA5, sizeof(buf));
+    mark(&m);
+
+    for(i = 0; i < rounds; ++i) {
+        for(j = 0; j < UDP_BURST; ++j) {
+            if(tx->protocol->sendto(tx, buf, payload, 0,
+                                    (struct sockaddr *)&addr,
+                                    sizeof(addr)) != (ssize_t)payload) {
+                fprintf(stderr, "sendto failed: %s\n", strerror(errno));
+                return -1;
+            }
+        }
+
+        netsim_poll();
+
+        while(rx->protocol->recvfrom(rx, buf, sizeof(buf), 0, NULL, NULL) ==
+              (ssize_t)payload)
+            ++got;
+    }
+
+    ns = since(&m, 0, &per_frame);
+
+    printf("  %4d bytes: %9.0f datagrams/s, %5" PRIu64 " ns/frame, "
+           "%d of %d received\n", (int)payload,
+           (double)got / ((double)ns / 1e9), per_frame, got,
+           rounds * UDP_BURST);
+
+    netsim_close(tx);
+    netsim_close(rx);
+
+    return 0;
+}
+
+static int bench_connect(int conns) {
+    net_socket_t *lsock, *c, *s;
+    uint64 ns, per_frame, paused = 0, t;
+    mark_t m;
+    int i;
+
+    if(!(lsock = tcp_listener(0)))
+        return -1;
+
+    mark(&m);
+
+    for(i = 0; i < conns; ++i) {
+        if(tcp_connect(lsock, 0, &c, &s)) {
+            netsim_close(lsock);
+            return -1;
+        }
+
+        /* The client closes first, so it's the one that ends up in TIME_WAIT,
+           just like with most protocols. */
+        netsim_close(c);
+        netsim_poll();
+        netsim_close(s);
+        netsim_poll();
+
+        /* Clear out the connections in TIME_WAIT every so often, so they don't
+           pile up. That's not part of what's being measured, though. */
+        if((i & 511) == 511) {
+            t = netsim_host_ns();
+            netsim_advance(31 * 1000 * 1000);
+            paused += netsim_host_ns() - t;
+        }
+    }
+
+    ns = since(&m, paused, &per_frame);
+
+    printf("  %d connections: %8.0f connections/s, %5" PRIu64 " ns/frame\n",
+           conns, (double)conns / ((double)ns / 1e9), per_frame);
+
+    netsim_close(lsock);
+    netsim_advance(31 * 1000 * 1000);
+
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    static const int bufs[] = { 8192, 65536, 262144 };
+    static const size_t payloads[] = { 64, 512, 1472 };
+    const char *pcap_fn = NULL;
+    netsim_nic_stats_t st;
+    unsigned int i;
+    int opt, copy = 0, single = 0;
+
+    while((opt = getopt(argc, argv, "w:csn")) != -1) {
+        switch(opt) {
+            case 'w':
+                pcap_fn = optarg;
+                break;
+
+            case 'c':
+                copy = 1;
+                break;
+
+            case 's':
+                single = 1;
+                break;
+
+            case 'n':
+                scale = 16;
+                break;
+
+            default:
+                fprintf(stderr, "Usage: %s [-w file.pcap] [-c] [-s] [-n]\n",
+                        argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+
+    netsim_rx_pbufs = !copy;
+    netsim_tx_batch = !single;
+
+    if(netsim_init()) {
+        fprintf(stderr, "Could not initialize the simulator\n");
+        return EXIT_FAILURE;
+    }
+
+    if(pcap_fn && netsim_pcap_open(pcap_fn)) {
+        fprintf(stderr, "Could not open %s\n", pcap_fn);
+        return EXIT_FAILURE;
+    }
+
+    printf("Full stack benchmarks (loopback, frames received %s, sent %s)\n",
+           netsim_rx_pbufs ? "in packet buffers" : "by copying",
+           netsim_tx_batch ? "in batches" : "one at a time");
+
+    printf("TCP bulk transfer, %d MiB:\n", 64 / scale);
+
+    for(i = 0; i < sizeof(bufs) / sizeof(bufs[0]); ++i) {
+        if(bench_tcp_bulk(bufs[i], (64 / scale) << 20))
+            return EXIT_FAILURE;
+    }
+
+    printf("UDP send and receive:\n");
+
+    for(i = 0; i < sizeof(payloads) / sizeof(payloads[0]); ++i) {
+        if(bench_udp(payloads[i], 20000 / scale))
+            return EXIT_FAILURE;
+    }
+
+    printf("TCP connection setup and teardown:\n");
+
+    if(bench_connect(20000 / scale))
+        return EXIT_FAILURE;
+
+    st = netsim_nic_get_stats();
+    printf("Device: %" PRIu32 " frames sent in %" PRIu32 " batches, %" PRIu32
+           " dropped (ring full)\n", st.tx_frames, st.tx_batches,
+           st.tx_dropped);
+
+    netsim_shutdown();
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,541 @@
+/* KallistiOS ##version##
+
+   utils/netsim/netsim.c
+   Copyright (C) 2026 The KOS Team and contributors
+
+   This file has the stand-ins for the parts of the kernel that the network
+   protocols need, along with the glue that lets a test program drive them.
+   See netsim.h for the details.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#include <arch/timer.h>
+#include <kos/mutex.h>
+#include <kos/cond.h>
+#include <kos/rwsem.h>
+#include <kos/genwait.h>
+#include <kos/dbglog.h>
+
+#include "netsim.h"
+#include "../../kernel/net/net_ipv4.h"
+#include "../../kernel/net/net_ipv6.h"
+#include "../../kernel/net/net_thd.h"
+
+int netsim_inside_int = 0;
+int netsim_rx_pbufs = 0;
+uint64 netsim_now_us = 0;
+
+static int dbg_level = DBG_WARNING;
+static int in_net_thd = 0;
+
+static void netsim_fatal(const char *what) {
+    fprintf(stderr, "netsim: %s would block forever\n", what);
+    abort();
+}
+
+/* Debug output */
+void dbglog(int level, const char *fmt, ...) {
+    va_list ap;
+
+    if(level > dbg_level)
+        return;
+
+    va_start(ap, fmt);
+    vfprintf(stderr, fmt, ap);
+    va_end(ap);
+}
+
+void dbglog_set_level(int level) {
+    dbg_level = level;
+}
+
+/* Locks. With only one thread, these just keep count. */
+int mutex_init(mutex_t *m, int mtype) {
+    m->type = mtype;
+    m->count = 0;
+    return 0;
+}
+
+int mutex_destroy(mutex_t *m) {
+    m->count = 0;
+    return 0;
+}
+
+int mutex_trylock(mutex_t *m) {
+    if(m->count && m->type != MUTEX_TYPE_RECURSIVE) {
+        errno = EAGAIN;
+        return -1;
+    }
+
+    ++m->count;
+    return 0;
+}
+
+int mutex_lock(mutex_t *m) {
+    if(mutex_trylock(m))
+        netsim_fatal("mutex_lock");
+
+    return 0;
+}
+
+int mutex_unlock(mutex_t *m) {
+    if(m->count)
+        --m->count;
+
+    return 0;
+}
+
+int mutex_is_locked(mutex_t *m) {
+    return !!m->count;
+}
+
+int cond_init(condvar_t *cv) {
+    cv->dynamic = 0;
+    return 0;
+}
+
+int cond_destroy(condvar_t *cv) {
+    (void)cv;
+    return 0;
+}
+
+int cond_wait(condvar_t *cv, mutex_t *m) {
+    (void)cv;
+    (void)m;
+    netsim_fatal("cond_wait");
+    return -1;
+}
+
+int cond_wait_timed(condvar_t *cv, mutex_t *m, int timeout) {
+    (void)cv;
+    (void)m;
+
+    if(!timeout)
+        netsim_fatal("cond_wait_timed");
+
+    /* Nobody can signal us, so this always times out. */
+    netsim_advance((uint64)timeout * 1000);
+    errno = ETIMEDOUT;
+    return -1;
+}
+
+int cond_signal(condvar_t *cv) {
+    (void)cv;
+    return 0;
+}
+
+int cond_broadcast(condvar_t *cv) {
+    (void)cv;
+    return 0;
+}
+
+int rwsem_init(rw_semaphore_t *s) {
+    s->read_count = s->write_lock = 0;
+    return 0;
+}
+
+int rwsem_destroy(rw_semaphore_t *s) {
+    (void)s;
+    return 0;
+}
+
+int rwsem_read_trylock(rw_semaphore_t *s) {
+    if(s->write_lock) {
+        errno = EWOULDBLOCK;
+        return -1;
+    }
+
+    ++s->read_count;
+    return 0;
+}
+
+int rwsem_read_lock(rw_semaphore_t *s) {
+    if(rwsem_read_trylock(s))
+        netsim_fatal("rwsem_read_lock");
+
+    return 0;
+}
+
+int rwsem_read_unlock(rw_semaphore_t *s) {
+    if(s->read_count)
+        --s->read_count;
+
+    return 0;
+}
+
+int rwsem_write_trylock(rw_semaphore_t *s) {
+    if(s->write_lock || s->read_count) {
+        errno = EWOULDBLOCK;
+        return -1;
+    }
+
+    s->write_lock = 1;
+    return 0;
+}
+
+int rwsem_write_lock(rw_semaphore_t *s) {
+    if(rwsem_write_trylock(s))
+        netsim_fatal("rwsem_write_lock");
+
+    return 0;
+}
+
+int rwsem_write_unlock(rw_semaphore_t *s) {
+    s->write_lock = 0;
+    return 0;
+}
+
+int genwait_wait(void *obj, const char *mesg, int timeout,
+                 void (*callback)(void *)) {
+    (void)obj;
+    (void)callback;
+
+    if(!timeout)
+        netsim_fatal(mesg);
+
+    netsim_advance((uint64)timeout * 1000);
+    errno = EAGAIN;
+    return -1;
+}
+
+/* Readiness events go nowhere, since there's nobody to poll. */
+void __poll_event_trigger(int fd, short event) {
+    (void)fd;
+    (void)event;
+}
+
+/* The network thread's callbacks run from netsim_advance(). */
+#define MAX_CALLBACKS   16
+
+static struct {
+    void (*cb)(void *);
+    void *data;
+    uint64 timeout;
+    uint64 nextrun;
+} callbacks[MAX_CALLBACKS];
+
+int net_thd_add_callback(void (*cb)(void *), void *data, uint64 timeout) {
+    int i;
+
+    for(i = 0; i < MAX_CALLBACKS; ++i) {
+        if(!callbacks[i].cb) {
+            callbacks[i].cb = cb;
+            callbacks[i].data = data;
+            callbacks[i].timeout = timeout;
+            callbacks[i].nextrun = timer_ms_gettime64() + timeout;
+            return i;
+        }
+    }
+
+    errno = ENOMEM;
+    return -1;
+}
+
+int net_thd_del_callback(int cbid) {
+    if(cbid < 0 || cbid >= MAX_CALLBACKS || !callbacks[cbid].cb)
+        return -1;
+
+    callbacks[cbid].cb = NULL;
+    return 0;
+}
+
+int net_thd_is_current(void) {
+    return in_net_thd;
+}
+
+void net_thd_kill(void) {
+}
+
+int net_thd_init(void) {
+    return 0;
+}
+
+void net_thd_shutdown(void) {
+    memset(callbacks, 0, sizeof(callbacks));
+}
+
+void netsim_advance(uint64 us) {
+    uint64 end = netsim_now_us + us, now;
+    int i;
+
+    /* Step a millisecond at a time, since that's the resolution callbacks are
+       scheduled with. */
+    while(netsim_now_us < end) {
+        netsim_now_us += 1000;
+
+        if(netsim_now_us > end)
+            netsim_now_us = end;
+
+        now = timer_ms_gettime64();
+
+        for(i = 0; i < MAX_CALLBACKS; ++i) {
+            if(callbacks[i].cb && now >= callbacks[i].nextrun) {
+                callbacks[i].nextrun = now + callbacks[i].timeout;
+                in_net_thd = 1;
+                callbacks[i].cb(callbacks[i].data);
+                in_net_thd = 0;
+            }
+        }
+    }
+}
+
+/* fs_socket */
+#define MAX_PROTOS      8
+
+static fs_socket_proto_t *protos[MAX_PROTOS];
+static LIST_HEAD(, net_socket) socks = LIST_HEAD_INITIALIZER(0);
+static file_t next_fd = 1000;
+
+int fs_socket_proto_add(fs_socket_proto_t *proto) {
+    int i;
+
+    for(i = 0; i < MAX_PROTOS; ++i) {
+        if(!protos[i]) {
+            protos[i] = proto;
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+int fs_socket_proto_remove(fs_socket_proto_t *proto) {
+    int i;
+
+    for(i = 0; i < MAX_PROTOS; ++i) {
+        if(protos[i] == proto) {
+            protos[i] = NULL;
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+static fs_socket_proto_t *find_proto(int type, int proto) {
+    int i;
+
+    for(i = 0; i < MAX_PROTOS; ++i) {
+        if(protos[i] && (type < 0 || protos[i]->type == type) &&
+           (!proto || protos[i]->protocol == proto))
+            return protos[i];
+    }
+
+    return NULL;
+}
+
+int fs_socket_init(void) {
+    return 0;
+}
+
+int fs_socket_shutdown(void) {
+    return 0;
+}
+
+int fs_socket_input(netif_t *src, int domain, int protocol, const void *hdr,
+                    const uint8 *data, size_t size) {
+    int i;
+
+    for(i = 0; i < MAX_PROTOS; ++i) {
+        if(protos[i] && protos[i]->protocol == protocol && protos[i]->input)
+            return protos[i]->input(src, domain, hdr, data, size);
+    }
+
+    return -2;
+}
+
+net_socket_t *fs_socket_open_sock(fs_socket_proto_t *proto) {
+    net_socket_t *sock;
+
+    if(!(sock = (net_socket_t *)calloc(1, sizeof(net_socket_t)))) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    sock->fd = next_fd++;
+    sock->protocol = proto;
+    LIST_INSERT_HEAD(&socks, sock, sock_list);
+    return sock;
+}
+
+static net_socket_t *find_sock(int fd) {
+    net_socket_t *sock;
+
+    LIST_FOREACH(sock, &socks, sock_list) {
+        if(sock->fd == fd)
+            return sock;
+    }
+
+    errno = EBADF;
+    return NULL;
+}
+
+int fs_close(file_t fd) {
+    net_socket_t *sock;
+
+    if(!(sock = find_sock(fd)))
+        return -1;
+
+    return netsim_close(sock);
+}
+
+int fs_fcntl(file_t fd, int cmd, ...) {
+    net_socket_t *sock;
+    va_list ap;
+    int rv;
+
+    if(!(sock = find_sock(fd)))
+        return -1;
+
+    va_start(ap, cmd);
+    rv = sock->protocol->fcntl(sock, cmd, ap);
+    va_end(ap);
+
+    return rv;
+}
+
+/* The socket calls that the stack itself makes (for DHCP). These take the
+   place of the host's versions, so close() hands anything that isn't one of
+   our sockets on to the host. */
+int socket(int domain, int type, int protocol) {
+    fs_socket_proto_t *p;
+    net_socket_t *sock;
+
+    if(!(p = find_proto(type, protocol))) {
+        errno = EPROTONOSUPPORT;
+        return -1;
+    }
+
+    if(!(sock = fs_socket_open_sock(p)))
+        return -1;
+
+    if(p->socket(sock, domain, type, protocol) < 0) {
+        LIST_REMOVE(sock, sock_list);
+        free(sock);
+        return -1;
+    }
+
+    return sock->fd;
+}
+
+int bind(int fd, const struct sockaddr *addr, socklen_t len) {
+    net_socket_t *sock;
+
+    if(!(sock = find_sock(fd)))
+        return -1;
+
+    return sock->protocol->bind(sock, addr, len);
+}
+
+ssize_t sendto(int fd, const void *buf, size_t len, int flags,
+               const struct sockaddr *addr, socklen_t alen) {
+    net_socket_t *sock;
+
+    if(!(sock = find_sock(fd)))
+        return -1;
+
+    return sock->protocol->sendto(sock, buf, len, flags, addr, alen);
+}
+
+ssize_t recvfrom(int fd, void *buf, size_t len, int flags,
+                 struct sockaddr *addr, socklen_t *alen) {
+    net_socket_t *sock;
+
+    if(!(sock = find_sock(fd)))
+        return -1;
+
+    return sock->protocol->recvfrom(sock, buf, len, flags, addr, alen);
+}
+
+int close(int fd) {
+    net_socket_t *sock;
+
+    LIST_FOREACH(sock, &socks, sock_list) {
+        if(sock->fd == fd)
+            return netsim_close(sock);
+    }
+
+    return syscall(SYS_close, fd);
+}
+
+static int call_fcntl(net_socket_t *sock, int cmd, ...) {
+    va_list ap;
+    int rv;
+
+    va_start(ap, cmd);
+    rv = sock->protocol->fcntl(sock, cmd, ap);
+    va_end(ap);
+
+    return rv;
+}
+
+net_socket_t *netsim_socket(int domain, int type, int proto) {
+    fs_socket_proto_t *p;
+    net_socket_t *sock;
+
+    if(!(p = find_proto(type, proto))) {
+        errno = EPROTONOSUPPORT;
+        return NULL;
+    }
+
+    if(!(sock = fs_socket_open_sock(p)))
+        return NULL;
+
+    if(p->socket(sock, domain, type, proto) < 0) {
+        LIST_REMOVE(sock, sock_list);
+        free(sock);
+        return NULL;
+    }
+
+    call_fcntl(sock, F_SETFL, O_NONBLOCK);
+    return sock;
+}
+
+net_socket_t *netsim_get_socket(int fd) {
+    net_socket_t *sock;
+
+    if((sock = find_sock(fd)))
+        call_fcntl(sock, F_SETFL, O_NONBLOCK);
+
+    return sock;
+}
+
+int netsim_close(net_socket_t *sock) {
+    LIST_REMOVE(sock, sock_list);
+    sock->protocol->close(sock);
+    free(sock);
+    return 0;
+}
+
+void netsim_close_all(void) {
+    while(!LIST_EMPTY(&socks))
+        netsim_close(LIST_FIRST(&socks));
+}
+
+void netsim_checksum(int proto, const struct in6_addr *src,
+                     const struct in6_addr *dst, uint8 *data, size_t size,
+                     size_t csum_off) {
+    uint16 cs;
+
+    data[csum_off] = data[csum_off + 1] = 0;
+    cs = net_ipv6_checksum_pseudo(src, dst, size, proto);
+    cs = net_ipv4_checksum(data, size, cs);
+    memcpy(data + csum_off, &cs, 2);
+}
+
+uint64 netsim_host_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
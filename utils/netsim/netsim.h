@@ -0,0 +1,124 @@
+/* KallistiOS ##version##
+
+   utils/netsim/netsim.h
+   Copyright (C) 2026 The KOS Team and contributors
+
+   This is the interface to the host-side network simulator. The simulator
+   builds the protocol code from kernel/net against a thin set of stand-ins
+   for the parts of the kernel it uses (locks, the clock, fs_socket and the
+   layers underneath it) so that it can be driven with synthetic packets and
+   timed on a PC.
+
+   There are two ways to put the simulator together. Programs linked with
+   netsim_ip.o only get the transport protocols, with the layers under them
+   replaced by the tx hook and netsim_input4()/netsim_input6(), so that they
+   can play the other end of a connection themselves. Programs linked with
+   netsim_nic.o get the whole stack (net_core and all the rest) running on top
+   of a simulated Ethernet device, which loops back everything that's sent to
+   it, so sockets on it can talk to each other as they would to another host.
+
+   Everything runs in one host thread. Anything in the stack that would block
+   aborts the simulation, so sockets should be non-blocking.
+*/
+
+#ifndef __NETSIM_H
+#define __NETSIM_H
+
+#include <stddef.h>
+#include <kos/net.h>
+#include <kos/fs_socket.h>
+
+/* The interface that everything is sent and received on. */
+extern netif_t netsim_if;
+
+/* Set this to make the stack think it is running in an interrupt. */
+extern int netsim_inside_int;
+
+/* Set this to have incoming packets put into packet buffers before they are
+   passed to the stack (as with drivers that use net_input_pbuf()), instead of
+   being passed in as is (as with drivers that use net_input()). */
+extern int netsim_rx_pbufs;
+
+/* The simulated clock, in microseconds. */
+extern uint64 netsim_now_us;
+
+/* Set up the simulator and the protocols in it. */
+int netsim_init(void);
+void netsim_shutdown(void);
+
+/* Move the clock forward, running any network thread callbacks that come due
+   along the way. */
+void netsim_advance(uint64 us);
+
+/* These are only in netsim_ip.o. */
+
+/* Everything that the stack sends goes to this hook (if one is set). For IPv4
+   packets, the addresses are v4-mapped. The data starts at the transport layer
+   header. */
+typedef void (*netsim_tx_hook_t)(int proto, const struct in6_addr *src,
+                                 const struct in6_addr *dst,
+                                 const uint8 *data, size_t size);
+void netsim_set_tx_hook(netsim_tx_hook_t hook);
+
+/* Hand a transport layer packet to the stack, as if it had come in over
+   IPv4 or IPv6. Any addresses are in network byte order. */
+int netsim_input4(int proto, uint32 src, uint32 dst, const uint8 *data,
+                  size_t size);
+int netsim_input6(int proto, const struct in6_addr *src,
+                  const struct in6_addr *dst, const uint8 *data, size_t size);
+
+/* These are only in netsim_nic.o. */
+
+/* Counters for the simulated device. */
+typedef struct netsim_nic_stats {
+    uint32 tx_frames;       /* Frames sent by the stack */
+    uint32 tx_dropped;      /* Frames dropped because the ring was full */
+    uint32 tx_errors;       /* Frames that were too big or too small */
+    uint32 rx_frames;       /* Frames looped back to the stack */
+    uint32 tx_batches;      /* Calls to the device's batch transmit */
+    uint64 tx_bytes;
+    uint64 rx_bytes;
+} netsim_nic_stats_t;
+
+netsim_nic_stats_t netsim_nic_get_stats(void);
+
+/* Should the device take frames from the stack in batches (if_tx_batch), or
+   only one at a time (if_tx)? This has to be set before netsim_init(). It
+   defaults to batches. */
+extern int netsim_tx_batch;
+
+/* Hand everything that's waiting to be looped back to the stack, including
+   anything sent in response to it, as a driver's receive interrupt would.
+   This also happens from the network thread every simulated millisecond.
+   Returns the number of frames passed up. If netsim_rx_pbufs is set, they're
+   received into packet buffers. */
+int netsim_poll(void);
+
+/* Write every frame the stack sends to a pcap file. */
+int netsim_pcap_open(const char *fn);
+void netsim_pcap_close(void);
+
+/* The rest of these are in both. */
+
+/* Create a socket through the registered protocol handlers, without going
+   through the file descriptor table. The socket is made non-blocking. */
+net_socket_t *netsim_socket(int domain, int type, int proto);
+int netsim_close(net_socket_t *sock);
+
+/* Close every socket that's still open. */
+void netsim_close_all(void);
+
+/* Look up a socket that the stack created (i.e, with accept()) by its file
+   descriptor. The socket is made non-blocking. */
+net_socket_t *netsim_get_socket(int fd);
+
+/* Compute the checksum of a TCP or UDP packet and fill it in, given the offset
+   of the checksum field in the header. */
+void netsim_checksum(int proto, const struct in6_addr *src,
+                     const struct in6_addr *dst, uint8 *data, size_t size,
+                     size_t csum_off);
+
+/* Time something with the host's clock, in nanoseconds. */
+uint64 netsim_host_ns(void);
+
+#endif /* !__NETSIM_H */
@@ -0,0 +1,197 @@
+/* KallistiOS ##version##
+
+   utils/netsim/netsim_ip.c
+   Copyright (C) 2026 The KOS Team and contributors
+
+   These are the stand-ins for the network and link layers, for programs that
+   only want to test the transport protocols. Packets going out go to the hook,
+   and packets coming in go straight to the right protocol. See netsim.h for
+   the details.
+*/
+
+#include <string.h>
+
+#include "netsim.h"
+#include "../../kernel/net/net_ipv4.h"
+#include "../../kernel/net/net_ipv6.h"
+
+netif_t netsim_if;
+netif_t *net_default_dev = &netsim_if;
+
+static netsim_tx_hook_t tx_hook = NULL;
+
+void netsim_set_tx_hook(netsim_tx_hook_t hook) {
+    tx_hook = hook;
+}
+
+uint16 net_ipv4_checksum_pseudo(in_addr_t src, in_addr_t dst, uint8 proto,
+                                uint16 len) {
+    ipv4_pseudo_hdr_t ps;
+
+    ps.src_addr = src;
+    ps.dst_addr = dst;
+    ps.zero = 0;
+    ps.proto = proto;
+    ps.length = htons(len);
+
+    return ~net_ipv4_checksum((uint8 *)&ps, sizeof(ipv4_pseudo_hdr_t), 0);
+}
+
+uint16 net_ipv6_checksum_pseudo(const struct in6_addr *src,
+                                const struct in6_addr *dst,
+                                uint32 upper_len, uint8 next_hdr) {
+    ipv6_pseudo_hdr_t ps;
+
+    if(IN6_IS_ADDR_V4MAPPED(src) && IN6_IS_ADDR_V4MAPPED(dst))
+        return net_ipv4_checksum_pseudo(src->__s6_addr.__s6_addr32[3],
+                                        dst->__s6_addr.__s6_addr32[3],
+                                        next_hdr, (uint16)upper_len);
+
+    memcpy(&ps.src_addr, src, sizeof(struct in6_addr));
+    memcpy(&ps.dst_addr, dst, sizeof(struct in6_addr));
+    ps.upper_layer_len = htonl(upper_len);
+    ps.next_header = next_hdr;
+    ps.zero[0] = ps.zero[1] = ps.zero[2] = 0;
+
+    return ~net_ipv4_checksum((uint8 *)&ps, sizeof(ipv6_pseudo_hdr_t), 0);
+}
+
+uint32 net_ipv4_address(const uint8 addr[4]) {
+    return (addr[0] << 24) | (addr[1] << 16) | (addr[2] << 8) | (addr[3]);
+}
+
+static void map_v4(struct in6_addr *out, uint32 addr) {
+    memset(out, 0, sizeof(struct in6_addr));
+    out->__s6_addr.__s6_addr16[5] = 0xFFFF;
+    out->__s6_addr.__s6_addr32[3] = addr;
+}
+
+int net_ipv4_send(netif_t *net, const uint8 *data, size_t size, int id, int ttl,
+                  int proto, uint32 src, uint32 dst) {
+    struct in6_addr s, d;
+
+    (void)net;
+    (void)id;
+    (void)ttl;
+
+    if(tx_hook) {
+        map_v4(&s, src);
+        map_v4(&d, dst);
+        tx_hook(proto, &s, &d, data, size);
+    }
+
+    return 0;
+}
+
+int net_ipv6_send(netif_t *net, const uint8 *data, size_t data_size,
+                  int hop_limit, int proto, const struct in6_addr *src,
+                  const struct in6_addr *dst) {
+    (void)net;
+    (void)hop_limit;
+
+    if(tx_hook)
+        tx_hook(proto, src, dst, data, data_size);
+
+    return 0;
+}
+
+/* Nothing is ever queued up here, since the packets are put together and sent
+   to the hook right away. */
+int net_ipv6_sendv(netif_t *net, net_txq_t *q, const uint8 *thdr,
+                   size_t thdr_size, const struct iovec *iov, int iovcnt,
+                   int hop_limit, int proto, const struct in6_addr *src,
+                   const struct in6_addr *dst) {
+    uint8 buf[65536];
+    size_t len = thdr_size;
+    int i;
+
+    (void)q;
+
+    memcpy(buf, thdr, thdr_size);
+
+    for(i = 0; i < iovcnt; ++i) {
+        memcpy(buf + len, iov[i].iov_base, iov[i].iov_len);
+        len += iov[i].iov_len;
+    }
+
+    return net_ipv6_send(net, buf, len, hop_limit, proto, src, dst);
+}
+
+/* Hand a packet to a protocol. If we're pretending to be a driver that
+   receives into packet buffers, put it in one first, like net_input_pbuf()
+   would. */
+static int input_packet(int proto, int domain, const void *hdr,
+                        const uint8 *data, size_t size) {
+    net_pbuf_t *pb;
+    int rv;
+
+    if(!netsim_rx_pbufs || !(pb = net_pbuf_alloc()))
+        return fs_socket_input(&netsim_if, domain, proto, hdr, data, size);
+
+    memcpy(pb->buf, data, size);
+    pb->len = size;
+
+    netsim_if.rx_pbuf = pb;
+    rv = fs_socket_input(&netsim_if, domain, proto, hdr, pb->buf, size);
+
+    if(netsim_if.rx_pbuf == pb) {
+        netsim_if.rx_pbuf = NULL;
+        net_pbuf_free(pb);
+    }
+
+    return rv;
+}
+
+int netsim_input4(int proto, uint32 src, uint32 dst, const uint8 *data,
+                  size_t size) {
+    ip_hdr_t ip;
+
+    memset(&ip, 0, sizeof(ip));
+    ip.version_ihl = 0x45;
+    ip.length = htons(sizeof(ip_hdr_t) + size);
+    ip.ttl = 64;
+    ip.protocol = proto;
+    ip.src = src;
+    ip.dest = dst;
+    ip.checksum = net_ipv4_checksum((uint8 *)&ip, sizeof(ip_hdr_t), 0);
+
+    return input_packet(proto, AF_INET, &ip, data, size);
+}
+
+int netsim_input6(int proto, const struct in6_addr *src,
+                  const struct in6_addr *dst, const uint8 *data, size_t size) {
+    ipv6_hdr_t ip;
+
+    memset(&ip, 0, sizeof(ip));
+    ip.version_lclass = 0x60;
+    ip.length = htons(size);
+    ip.next_header = proto;
+    ip.hop_limit = 64;
+    ip.src_addr = *src;
+    ip.dst_addr = *dst;
+
+    return input_packet(proto, AF_INET6, &ip, data, size);
+}
+
+/* Set up */
+int net_tcp_init(void);
+int net_udp_init(void);
+
+int netsim_init(void) {
+    memset(&netsim_if, 0, sizeof(netsim_if));
+    netsim_if.name = "sim0";
+    netsim_if.descr = "Network simulator";
+    netsim_if.flags = NETIF_RUNNING;
+    netsim_if.mtu = 1500;
+    netsim_if.ip_addr[0] = 10;
+    netsim_if.ip_addr[3] = 1;
+
+    if(net_pbuf_init() || net_tcp_init() || net_udp_init())
+        return -1;
+
+    return 0;
+}
+
+void netsim_shutdown(void) {
+    netsim_close_all();
+}
@@ -0,0 +1,310 @@
+/* KallistiOS ##version##
+
+   utils/netsim/netsim_nic.c
+   Copyright (C) 2026 The KOS Team and contributors
+
+   This is the bottom half of the simulator for programs that run the whole
+   stack (net_core and everything under it). The stack is given an in-memory
+   Ethernet device to talk to, which loops everything addressed to it (or to
+   everyone) back around, so that sockets can talk to each other through the
+   full input and output paths. Everything it sends can also be written to a
+   pcap file. See netsim.h for the details.
+*/
+
+#include <stdio.h>
+#include <string.h>
+
+#include <arch/timer.h>
+
+#include "netsim.h"
+#include "../../kernel/net/net_ipv4.h"
+#include "../../kernel/net/net_thd.h"
+
+/* How many frames can be waiting to be looped back. Anything sent while this
+   is full is dropped, like a real device with its transmit ring full. */
+#define NIC_RING_SIZE       1024
+
+/* Largest frame the device handles: a full-sized Ethernet frame, without the
+   FCS. */
+#define NIC_FRAME_MAX       1514
+
+netif_t netsim_if;
+
+static struct {
+    int len;
+    uint8 data[NIC_FRAME_MAX];
+} ring[NIC_RING_SIZE];
+
+static int ring_head = 0, ring_tail = 0;
+static int poll_cbid = -1;
+static FILE *pcap = NULL;
+static netsim_nic_stats_t nic_stats;
+
+int netsim_tx_batch = 1;
+
+static void pcap_write(const uint8 *data, int len) {
+    uint32 rec[4];
+
+    rec[0] = (uint32)(netsim_now_us / 1000000);
+    rec[1] = (uint32)(netsim_now_us % 1000000);
+    rec[2] = rec[3] = len;
+
+    fwrite(rec, sizeof(rec), 1, pcap);
+    fwrite(data, len, 1, pcap);
+}
+
+int netsim_pcap_open(const char *fn) {
+    /* Classic pcap: little endian, version 2.4, microsecond timestamps,
+       Ethernet frames. */
+    static const uint32 hdr[6] = {
+        0xA1B2C3D4, 0x00040002, 0, 0, 65535, 1
+    };
+
+    netsim_pcap_close();
+
+    if(!(pcap = fopen(fn, "wb")))
+        return -1;
+
+    fwrite(hdr, sizeof(hdr), 1, pcap);
+    return 0;
+}
+
+void netsim_pcap_close(void) {
+    if(pcap) {
+        fclose(pcap);
+        pcap = NULL;
+    }
+}
+
+/* Should a frame that we sent come back to us? */
+static int nic_loops(const uint8 *data) {
+    /* Broadcast and multicast frames are seen by everyone, including us. The
+       stack filters out the multicast groups it isn't in. */
+    if(data[0] & 0x01)
+        return 1;
+
+    return !memcmp(data, netsim_if.mac_addr, 6);
+}
+
+static int nic_detect(netif_t *self) {
+    self->flags |= NETIF_DETECTED;
+    return 0;
+}
+
+static int nic_init(netif_t *self) {
+    self->flags |= NETIF_INITIALIZED;
+    return 0;
+}
+
+static int nic_shutdown(netif_t *self) {
+    self->flags &= ~(NETIF_DETECTED | NETIF_INITIALIZED);
+    return 0;
+}
+
+static int nic_start(netif_t *self) {
+    self->flags |= NETIF_RUNNING;
+    return 0;
+}
+
+static int nic_stop(netif_t *self) {
+    self->flags &= ~NETIF_RUNNING;
+    return 0;
+}
+
+/* Put a frame, which is in pieces, onto the ring to be looped back (if it's
+   one that should be) and into the pcap file. */
+static int nic_put(const struct iovec *iov, int iovcnt, int len, int blocking) {
+    static uint8 scratch[NIC_FRAME_MAX];
+    int next = (ring_tail + 1) % NIC_RING_SIZE;
+    uint8 *frame;
+    int i, pos;
+
+    if(len < (int)sizeof(eth_hdr_t) || len > NIC_FRAME_MAX) {
+        ++nic_stats.tx_errors;
+        return NETIF_TX_ERROR;
+    }
+
+    /* Put it straight into the next slot on the ring, if there is one. */
+    frame = next == ring_head ? scratch : ring[ring_tail].data;
+
+    for(i = 0, pos = 0; i < iovcnt; ++i) {
+        memcpy(frame + pos, iov[i].iov_base, iov[i].iov_len);
+        pos += iov[i].iov_len;
+    }
+
+    if(pcap)
+        pcap_write(frame, len);
+
+    ++nic_stats.tx_frames;
+    nic_stats.tx_bytes += len;
+
+    if(!nic_loops(frame))
+        return NETIF_TX_OK;
+
+    if(frame == scratch) {
+        ++nic_stats.tx_dropped;
+        return blocking ? NETIF_TX_ERROR : NETIF_TX_AGAIN;
+    }
+
+    ring[ring_tail].len = len;
+    ring_tail = next;
+
+    return NETIF_TX_OK;
+}
+
+static int nic_tx(netif_t *self, const uint8 *data, int len, int blocking) {
+    struct iovec iov;
+
+    (void)self;
+
+    iov.iov_base = (void *)data;
+    iov.iov_len = len;
+
+    return nic_put(&iov, 1, len, blocking);
+}
+
+static int nic_tx_batch(netif_t *self, const netif_txpkt_t *pkts, int count,
+                        int blocking) {
+    int i, rv = NETIF_TX_OK;
+
+    (void)self;
+
+    ++nic_stats.tx_batches;
+
+    for(i = 0; i < count; ++i) {
+        if((rv = nic_put(pkts[i].iov, pkts[i].iovcnt, pkts[i].len,
+                         blocking)) != NETIF_TX_OK)
+            break;
+    }
+
+    return i ? i : rv;
+}
+
+static int nic_tx_commit(netif_t *self) {
+    (void)self;
+    return 0;
+}
+
+static int nic_rx_poll(netif_t *self) {
+    (void)self;
+    netsim_poll();
+    return 0;
+}
+
+static int nic_set_flags(netif_t *self, uint32 flags_and, uint32 flags_or) {
+    self->flags = (self->flags & flags_and) | flags_or;
+    return 0;
+}
+
+static int nic_set_mc(netif_t *self, const uint8 *list, int count) {
+    (void)self;
+    (void)list;
+    (void)count;
+    return 0;
+}
+
+int netsim_poll(void) {
+    static uint8 frame[NIC_FRAME_MAX];
+    net_pbuf_t *pb;
+    int n = 0, len;
+
+    while(ring_head != ring_tail) {
+        len = ring[ring_head].len;
+
+        /* Take the frame off of the ring before handing it to the stack, since
+           anything the stack sends in response goes onto the ring too. */
+        if(netsim_rx_pbufs && (pb = net_pbuf_alloc())) {
+            memcpy(pb->data, ring[ring_head].data, len);
+            pb->len = len;
+            ring_head = (ring_head + 1) % NIC_RING_SIZE;
+            net_input_pbuf(&netsim_if, pb);
+        }
+        else {
+            memcpy(frame, ring[ring_head].data, len);
+            ring_head = (ring_head + 1) % NIC_RING_SIZE;
+            net_input(&netsim_if, frame, len);
+        }
+
+        ++nic_stats.rx_frames;
+        nic_stats.rx_bytes += len;
+        ++n;
+    }
+
+    return n;
+}
+
+netsim_nic_stats_t netsim_nic_get_stats(void) {
+    return nic_stats;
+}
+
+/* The network thread picks up anything that was sent from a timer. */
+static void nic_poll_cb(void *data) {
+    (void)data;
+    netsim_poll();
+}
+
+int netsim_init(void) {
+    static const uint8 mac[6] = { 0x02, 0x00, 0x00, 0x00, 0x00, 0x01 };
+    static const uint8 ip[4] = { 10, 0, 0, 1 };
+    static const uint8 mask[4] = { 255, 255, 255, 0 };
+    static const uint8 bc[4] = { 10, 0, 0, 255 };
+
+    memset(&netsim_if, 0, sizeof(netsim_if));
+    memset(&nic_stats, 0, sizeof(nic_stats));
+    ring_head = ring_tail = 0;
+
+    netsim_if.name = "sim0";
+    netsim_if.descr = "Network simulator loopback";
+    netsim_if.mtu = 1500;
+    netsim_if.mtu6 = 1500;
+    netsim_if.hop_limit = 64;
+    memcpy(netsim_if.mac_addr, mac, 6);
+
+    /* Give the device an address up front, so that net_init() doesn't go off
+       looking for a DHCP server. */
+    memcpy(netsim_if.ip_addr, ip, 4);
+    memcpy(netsim_if.netmask, mask, 4);
+    memcpy(netsim_if.broadcast, bc, 4);
+
+    /* fe80::ff:fe00:1, as it would come from the MAC address */
+    netsim_if.ip6_lladdr.s6_addr[0] = 0xFE;
+    netsim_if.ip6_lladdr.s6_addr[1] = 0x80;
+    netsim_if.ip6_lladdr.s6_addr[8] = mac[0] ^ 0x02;
+    netsim_if.ip6_lladdr.s6_addr[11] = 0xFF;
+    netsim_if.ip6_lladdr.s6_addr[12] = 0xFE;
+    netsim_if.ip6_lladdr.s6_addr[15] = mac[5];
+
+    netsim_if.if_detect = nic_detect;
+    netsim_if.if_init = nic_init;
+    netsim_if.if_shutdown = nic_shutdown;
+    netsim_if.if_start = nic_start;
+    netsim_if.if_stop = nic_stop;
+    netsim_if.if_tx = nic_tx;
+    netsim_if.if_tx_commit = nic_tx_commit;
+    netsim_if.if_tx_batch = netsim_tx_batch ? nic_tx_batch : NULL;
+    netsim_if.if_rx_poll = nic_rx_poll;
+    netsim_if.if_set_flags = nic_set_flags;
+    netsim_if.if_set_mc = nic_set_mc;
+
+    if(net_reg_device(&netsim_if) || net_init(0))
+        return -1;
+
+    if((poll_cbid = net_thd_add_callback(&nic_poll_cb, NULL, 1)) < 0)
+        return -1;
+
+    /* Let anything the stack sent while starting up go around. */
+    netsim_advance(10 * 1000);
+
+    return 0;
+}
+
+void netsim_shutdown(void) {
+    netsim_close_all();
+    netsim_poll();
+
+    net_shutdown();
+    netsim_pcap_close();
+
+    poll_cbid = -1;
+    ring_head = ring_tail = 0;
+}
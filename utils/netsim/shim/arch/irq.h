@@ -0,0 +1,28 @@
+/* KallistiOS ##version##
+
+   utils/netsim/shim/arch/irq.h
+   Copyright (C) 2026 The KOS Team and contributors
+
+   There are no interrupts in the simulator. Everything runs in the one host
+   thread, but code can be made to think it is in an interrupt by setting
+   netsim_inside_int (to test the trylock paths).
+*/
+
+#ifndef __ARCH_IRQ_H
+#define __ARCH_IRQ_H
+
+extern int netsim_inside_int;
+
+static inline int irq_inside_int(void) {
+    return netsim_inside_int;
+}
+
+static inline int irq_disable(void) {
+    return 0;
+}
+
+static inline void irq_restore(int old) {
+    (void)old;
+}
+
+#endif  /* __ARCH_IRQ_H */
@@ -0,0 +1,25 @@
+/* KallistiOS ##version##
+
+   utils/netsim/shim/arch/timer.h
+   Copyright (C) 2026 The KOS Team and contributors
+
+   The clock in the simulator only moves when it is told to, so that runs are
+   repeatable. See netsim_advance().
+*/
+
+#ifndef __ARCH_TIMER_H
+#define __ARCH_TIMER_H
+
+#include <arch/types.h>
+
+extern uint64 netsim_now_us;
+
+static inline uint64 timer_us_gettime64(void) {
+    return netsim_now_us;
+}
+
+static inline uint64 timer_ms_gettime64(void) {
+    return netsim_now_us / 1000;
+}
+
+#endif  /* __ARCH_TIMER_H */
@@ -0,0 +1,39 @@
+/* KallistiOS ##version##
+
+   utils/netsim/shim/arch/types.h
+   Copyright (C) 2026 The KOS Team and contributors
+
+   The basic KOS integer types, with the right sizes on the host.
+*/
+
+#ifndef __ARCH_TYPES_H
+#define __ARCH_TYPES_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+typedef uint64_t uint64;
+typedef uint32_t uint32;
+typedef uint16_t uint16;
+typedef uint8_t uint8;
+typedef int64_t int64;
+typedef int32_t int32;
+typedef int16_t int16;
+typedef int8_t int8;
+
+typedef volatile uint64 vuint64;
+typedef volatile uint32 vuint32;
+typedef volatile uint16 vuint16;
+typedef volatile uint8 vuint8;
+
+typedef uintptr_t ptr_t;
+
+typedef int handle_t;
+typedef handle_t tid_t;
+typedef handle_t prio_t;
+
+/* Newlib has this one, glibc doesn't. */
+typedef int64_t _off64_t;
+
+#endif  /* __ARCH_TYPES_H */
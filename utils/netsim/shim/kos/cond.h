@@ -0,0 +1,29 @@
+/* KallistiOS ##version##
+
+   utils/netsim/shim/kos/cond.h
+   Copyright (C) 2026 The KOS Team and contributors
+
+   Condition variables for the simulator. Nothing else could ever signal one
+   while the only thread is waiting on it, so waiting aborts the simulation.
+   Use non-blocking sockets.
+*/
+
+#ifndef __KOS_COND_H
+#define __KOS_COND_H
+
+#include <kos/mutex.h>
+
+typedef struct condvar {
+    int dynamic;
+} condvar_t;
+
+#define COND_INITIALIZER    { 0 }
+
+int cond_init(condvar_t *cv);
+int cond_destroy(condvar_t *cv);
+int cond_wait(condvar_t *cv, mutex_t *m);
+int cond_wait_timed(condvar_t *cv, mutex_t *m, int timeout);
+int cond_signal(condvar_t *cv);
+int cond_broadcast(condvar_t *cv);
+
+#endif  /* __KOS_COND_H */
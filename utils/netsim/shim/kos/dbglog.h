@@ -0,0 +1,26 @@
+/* KallistiOS ##version##
+
+   utils/netsim/shim/kos/dbglog.h
+   Copyright (C) 2026 The KOS Team and contributors
+*/
+
+#ifndef __KOS_DBGLOG_H
+#define __KOS_DBGLOG_H
+
+#include <unistd.h>
+#include <stdarg.h>
+
+#define DBG_DEAD        0
+#define DBG_CRITICAL    1
+#define DBG_ERROR       2
+#define DBG_WARNING     3
+#define DBG_NOTICE      4
+#define DBG_INFO        5
+#define DBG_DEBUG       6
+#define DBG_KDEBUG      7
+
+void dbglog(int level, const char *fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+void dbglog_set_level(int level);
+
+#endif  /* __KOS_DBGLOG_H */
@@ -0,0 +1,23 @@
+/* KallistiOS ##version##
+
+   utils/netsim/shim/kos/fs.h
+   Copyright (C) 2026 The KOS Team and contributors
+
+   This pulls in the real KOS header, after getting rid of a couple of things
+   from the host's headers that it defines differently. That can only be done
+   the first time through, since the real header won't define them again.
+*/
+
+#ifndef __NETSIM_KOS_FS_H
+#define __NETSIM_KOS_FS_H
+
+#include <sys/types.h>
+#include <sys/fcntl.h>
+#include <sys/select.h>
+
+#undef FD_SETSIZE
+#undef O_ASYNC
+
+#include "../../../../include/kos/fs.h"
+
+#endif /* !__NETSIM_KOS_FS_H */
@@ -0,0 +1,26 @@
+/* KallistiOS ##version##
+
+   utils/netsim/shim/kos/genwait.h
+   Copyright (C) 2026 The KOS Team and contributors
+
+   Sleeping in the simulator would never end, so genwait_wait() aborts it.
+   Waking things up does nothing.
+*/
+
+#ifndef __KOS_GENWAIT_H
+#define __KOS_GENWAIT_H
+
+#include <kos/thread.h>
+
+int genwait_wait(void *obj, const char *mesg, int timeout,
+                 void (*callback)(void *));
+
+static inline void genwait_wake_one(void *obj) {
+    (void)obj;
+}
+
+static inline void genwait_wake_all(void *obj) {
+    (void)obj;
+}
+
+#endif  /* __KOS_GENWAIT_H */
@@ -0,0 +1,38 @@
+/* KallistiOS ##version##
+
+   utils/netsim/shim/kos/mutex.h
+   Copyright (C) 2026 The KOS Team and contributors
+
+   Mutexes for the simulator. Since there's only one thread, trying to lock a
+   mutex that is already locked (other than a recursive one) could never
+   succeed, so it aborts the simulation instead of hanging.
+*/
+
+#ifndef __KOS_MUTEX_H
+#define __KOS_MUTEX_H
+
+#include <kos/thread.h>
+
+typedef struct kos_mutex {
+    int type;
+    int count;
+} mutex_t;
+
+#define MUTEX_TYPE_NORMAL       0
+#define MUTEX_TYPE_OLDNORMAL    1
+#define MUTEX_TYPE_ERRORCHECK   2
+#define MUTEX_TYPE_RECURSIVE    3
+#define MUTEX_TYPE_DEFAULT      MUTEX_TYPE_NORMAL
+
+#define MUTEX_INITIALIZER               { MUTEX_TYPE_NORMAL, 0 }
+#define ERRORCHECK_MUTEX_INITIALIZER    { MUTEX_TYPE_ERRORCHECK, 0 }
+#define RECURSIVE_MUTEX_INITIALIZER     { MUTEX_TYPE_RECURSIVE, 0 }
+
+int mutex_init(mutex_t *m, int mtype);
+int mutex_destroy(mutex_t *m);
+int mutex_lock(mutex_t *m);
+int mutex_trylock(mutex_t *m);
+int mutex_unlock(mutex_t *m);
+int mutex_is_locked(mutex_t *m);
+
+#endif  /* __KOS_MUTEX_H */
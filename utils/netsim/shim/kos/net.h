@@ -0,0 +1,9 @@
+/* KallistiOS ##version##
+
+   utils/netsim/shim/kos/net.h
+   Copyright (C) 2026 The KOS Team and contributors
+
+   This just pulls in the real KOS header.
+*/
+
+#include "../../../../include/kos/net.h"
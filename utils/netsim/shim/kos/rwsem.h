@@ -0,0 +1,31 @@
+/* KallistiOS ##version##
+
+   utils/netsim/shim/kos/rwsem.h
+   Copyright (C) 2026 The KOS Team and contributors
+
+   Reader/writer semaphores for the simulator. As with mutexes, anything that
+   would have to wait aborts the simulation.
+*/
+
+#ifndef __KOS_RWSEM_H
+#define __KOS_RWSEM_H
+
+#include <kos/thread.h>
+
+typedef struct rw_semaphore {
+    int read_count;
+    int write_lock;
+} rw_semaphore_t;
+
+#define RWSEM_INITIALIZER   { 0, 0 }
+
+int rwsem_init(rw_semaphore_t *s);
+int rwsem_destroy(rw_semaphore_t *s);
+int rwsem_read_lock(rw_semaphore_t *s);
+int rwsem_read_trylock(rw_semaphore_t *s);
+int rwsem_read_unlock(rw_semaphore_t *s);
+int rwsem_write_lock(rw_semaphore_t *s);
+int rwsem_write_trylock(rw_semaphore_t *s);
+int rwsem_write_unlock(rw_semaphore_t *s);
+
+#endif  /* __KOS_RWSEM_H */
@@ -0,0 +1,21 @@
+/* KallistiOS ##version##
+
+   utils/netsim/shim/kos/thread.h
+   Copyright (C) 2026 The KOS Team and contributors
+
+   The simulator only has one thread, so there isn't much to this.
+*/
+
+#ifndef __KOS_THREAD_H
+#define __KOS_THREAD_H
+
+#include <kos/cdefs.h>
+#include <arch/types.h>
+#include <arch/irq.h>
+
+typedef struct kthread kthread_t;
+
+static inline void thd_pass(void) {
+}
+
+#endif  /* __KOS_THREAD_H */
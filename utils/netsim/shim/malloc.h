@@ -0,0 +1,15 @@
+/* KallistiOS ##version##
+
+   utils/netsim/shim/malloc.h
+   Copyright (C) 2026 The KOS Team and contributors
+
+   KOS's malloc.h has malloc_irq_safe() in it too. Everything here runs in one
+   thread, so the heap can never be in the middle of something when the stack
+   thinks it's in an interrupt.
+*/
+
+#include_next <malloc.h>
+
+static inline int malloc_irq_safe(void) {
+    return 1;
+}
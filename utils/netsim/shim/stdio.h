@@ -0,0 +1,11 @@
+/* KallistiOS ##version##
+
+   utils/netsim/shim/stdio.h
+   Copyright (C) 2026 The KOS Team and contributors
+
+   KOS's stdio.h brings in dbglog() along with everything else, and some of
+   the network code counts on that.
+*/
+
+#include_next <stdio.h>
+#include <kos/dbglog.h>
@@ -0,0 +1,206 @@
+/* KallistiOS ##version##
+
+   utils/netsim/tcpdemux.c
+   Copyright (C) 2026 The KOS Team and contributors
+
+   This benchmarks how long it takes net_tcp_input() to match incoming segments
+   to sockets, as the number of open connections grows. It opens a listening
+   socket, then has a bunch of simulated peers connect to it (each one from its
+   own address), and times the processing of pure ACKs sent to random
+   connections, as well as of segments that don't match any connection (which
+   get answered with a RST).
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <errno.h>
+
+#include "netsim.h"
+
+#define LOCAL_ADDR      0x0A000001      /* 10.0.0.1 */
+#define LOCAL_PORT      80
+#define PEER_PORT       40000
+#define MAX_CONNS       8192
+#define ROUNDS          200000
+
+#define TCP_SYN         0x02
+#define TCP_ACK         0x10
+
+typedef struct {
+    uint16_t src_port;
+    uint16_t dst_port;
+    uint32_t seq;
+    uint32_t ack;
+    uint16_t off_flags;
+    uint16_t wnd;
+    uint16_t checksum;
+    uint16_t urg;
+} __attribute__((packed)) seg_t;
+
+static struct {
+    uint32_t addr;
+    uint32_t snd_nxt;
+    uint32_t rcv_nxt;
+} peers[MAX_CONNS];
+
+static seg_t last_tx;
+static int tx_count;
+
+static void tx_hook(int proto, const struct in6_addr *src,
+                    const struct in6_addr *dst, const uint8 *data,
+                    size_t size) {
+    (void)src;
+    (void)dst;
+
+    if(proto == IPPROTO_TCP && size >= sizeof(seg_t)) {
+        memcpy(&last_tx, data, sizeof(seg_t));
+        ++tx_count;
+    }
+}
+
+static uint32_t rand_state = 1;
+
+static uint32_t next_rand(void) {
+    rand_state = rand_state * 1103515245 + 12345;
+    return rand_state >> 8;
+}
+
+static uint32_t peer_addr(int i) {
+    /* 10.1.x.y */
+    return htonl(0x0A010000 | (i + 1));
+}
+
+static int send_seg(uint32_t src, uint16_t sport, uint32_t seq, uint32_t ack,
+                    int flags) {
+    seg_t seg;
+    struct in6_addr s, d;
+
+    memset(&seg, 0, sizeof(seg));
+    seg.src_port = htons(sport);
+    seg.dst_port = htons(LOCAL_PORT);
+    seg.seq = htonl(seq);
+    seg.ack = htonl(ack);
+    seg.off_flags = htons((5 << 12) | flags);
+    seg.wnd = htons(65535);
+
+    memset(&s, 0, sizeof(s));
+    memset(&d, 0, sizeof(d));
+    s.__s6_addr.__s6_addr16[5] = d.__s6_addr.__s6_addr16[5] = 0xFFFF;
+    s.__s6_addr.__s6_addr32[3] = src;
+    d.__s6_addr.__s6_addr32[3] = htonl(LOCAL_ADDR);
+    netsim_checksum(IPPROTO_TCP, &s, &d, (uint8 *)&seg, sizeof(seg), 16);
+
+    return netsim_input4(IPPROTO_TCP, src, htonl(LOCAL_ADDR),
+                         (const uint8 *)&seg, sizeof(seg));
+}
+
+/* Run a peer through the three-way handshake with the listening socket. */
+static int connect_peer(net_socket_t *lsock, int i) {
+    uint32_t isn = next_rand();
+    int fd;
+
+    peers[i].addr = peer_addr(i);
+    send_seg(peers[i].addr, PEER_PORT, isn, 0, TCP_SYN);
+
+    tx_count = 0;
+
+    if((fd = lsock->protocol->accept(lsock, NULL, NULL)) < 0) {
+        fprintf(stderr, "accept failed for peer %d: %s\n", i, strerror(errno));
+        return -1;
+    }
+
+    if(!tx_count || (ntohs(last_tx.off_flags) & (TCP_SYN | TCP_ACK)) !=
+       (TCP_SYN | TCP_ACK)) {
+        fprintf(stderr, "No SYN/ACK for peer %d\n", i);
+        return -1;
+    }
+
+    peers[i].snd_nxt = isn + 1;
+    peers[i].rcv_nxt = ntohl(last_tx.seq) + 1;
+    send_seg(peers[i].addr, PEER_PORT, peers[i].snd_nxt, peers[i].rcv_nxt,
+             TCP_ACK);
+
+    return 0;
+}
+
+static void run_round(int conns) {
+    uint64 start, hit, miss;
+    int i, p;
+
+    start = netsim_host_ns();
+
+    for(i = 0; i < ROUNDS; ++i) {
+        p = next_rand() % conns;
+        send_seg(peers[p].addr, PEER_PORT, peers[p].snd_nxt, peers[p].rcv_nxt,
+                 TCP_ACK);
+    }
+
+    hit = netsim_host_ns() - start;
+
+    /* These come from the right addresses, but the wrong port. */
+    start = netsim_host_ns();
+
+    for(i = 0; i < ROUNDS / 10; ++i) {
+        p = next_rand() % conns;
+        send_seg(peers[p].addr, PEER_PORT + 1, peers[p].snd_nxt,
+                 peers[p].rcv_nxt, TCP_ACK);
+    }
+
+    miss = netsim_host_ns() - start;
+
+    printf("%6d connections: %6" PRIu64 " ns/segment, %6" PRIu64
+           " ns/unmatched segment\n", conns, hit / ROUNDS,
+           miss / (ROUNDS / 10));
+}
+
+int main(int argc, char *argv[]) {
+    static const int sizes[] = { 1, 16, 256, 1024, 4096, MAX_CONNS };
+    struct sockaddr_in addr;
+    net_socket_t *lsock;
+    unsigned int i;
+    int conns = 0;
+
+    (void)argc;
+    (void)argv;
+
+    if(netsim_init()) {
+        fprintf(stderr, "Could not initialize the simulator\n");
+        return EXIT_FAILURE;
+    }
+
+    netsim_set_tx_hook(&tx_hook);
+
+    if(!(lsock = netsim_socket(AF_INET, SOCK_STREAM, IPPROTO_TCP))) {
+        fprintf(stderr, "Could not create the listening socket\n");
+        return EXIT_FAILURE;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(LOCAL_PORT);
+    addr.sin_addr.s_addr = htonl(LOCAL_ADDR);
+
+    if(lsock->protocol->bind(lsock, (struct sockaddr *)&addr, sizeof(addr)) ||
+       lsock->protocol->listen(lsock, 16)) {
+        fprintf(stderr, "Could not listen: %s\n", strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    printf("TCP input demultiplexing benchmark\n");
+
+    for(i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i) {
+        while(conns < sizes[i]) {
+            if(connect_peer(lsock, conns))
+                return EXIT_FAILURE;
+
+            ++conns;
+        }
+
+        run_round(conns);
+    }
+
+    netsim_shutdown();
+    return EXIT_SUCCESS;
+}
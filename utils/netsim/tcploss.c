@@ -0,0 +1,623 @@
+/* KallistiOS ##version##
+
+   utils/netsim/tcploss.c
+   Copyright (C) 2026 The KOS Team and contributors
+
+   This measures TCP goodput over a lossy link. The stack talks to a simulated
+   peer over a link with a fixed one-way delay that drops packets (in both
+   directions) at a given rate. Everything is driven by the simulated clock and
+   a fixed random seed, so every run gives the same results.
+
+   In the "send" direction, the stack sends a block of data to the peer, which
+   acts like a plain receiver: it holds onto out-of-order data and ACKs every
+   segment it gets. In the "recv" direction, the peer sends the data with a
+   simple fixed-window sender (which resends the oldest segment after three
+   duplicate ACKs or a timeout, and probes the stack's window when it's closed)
+   and the stack receives it. Either way, the data is checked when it
+   arrives.
+
+   The peer offers window scaling and timestamps when it connects, like most
+   other stacks would. After the lossy runs, there's a set of runs without any
+   loss at a few different socket buffer sizes, which shows how much the
+   buffers (and so the windows) limit throughput once the link has a bit of
+   delay on it. Those also count how many ACKs the stack sends when it is
+   receiving.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "netsim.h"
+
+#define LOCAL_ADDR      0x0A000001      /* 10.0.0.1 */
+#define PEER_ADDR       0x0A000002      /* 10.0.0.2 */
+#define LOCAL_PORT      80
+#define PEER_PORT       5000
+
+#define TOTAL           (512 * 1024)
+#define PEER_MSS        1024
+#define PEER_WINDOW     (8 * PEER_MSS)  /* For the lossy runs */
+#define PEER_RCVWND     (1024 * 1024)
+#define PEER_WSCALE     5
+#define TIME_LIMIT      (300 * 1000)    /* Simulated milliseconds */
+
+#define TCP_SYN         0x02
+#define TCP_ACK         0x10
+
+typedef struct {
+    uint16_t src_port;
+    uint16_t dst_port;
+    uint32_t seq;
+    uint32_t ack;
+    uint16_t off_flags;
+    uint16_t wnd;
+    uint16_t checksum;
+    uint16_t urg;
+} __attribute__((packed)) seg_t;
+
+/* A packet on the link */
+typedef struct pkt {
+    struct pkt *next;
+    uint64 due;
+    size_t len;
+    uint8 data[1600];
+} pkt_t;
+
+typedef struct {
+    pkt_t *head;
+    pkt_t *tail;
+} link_t;
+
+static link_t to_peer, to_stack;
+static uint32_t loss_ppm;
+static uint64 delay_us;
+static uint32_t rand_state;
+static int dropped;
+static int acks;
+
+/* The peer's side of the connection */
+static struct {
+    uint16_t port;
+    uint32_t iss;
+    uint32_t irs;
+    uint32_t snd_una;
+    uint32_t snd_nxt;
+    uint32_t rcv_nxt;
+    uint32_t wnd;
+    uint32_t window;
+    int wscale;
+    int ts;
+    uint32_t ts_recent;
+    int dupacks;
+    uint64 rto_at;
+    uint8 *buf;
+    uint8 *have;
+} peer;
+
+static uint8 pattern(uint32_t off) {
+    return (uint8)((off * 7) ^ (off >> 9));
+}
+
+static uint32_t next_rand(void) {
+    rand_state = rand_state * 1103515245 + 12345;
+    return rand_state >> 1;
+}
+
+static int drop(void) {
+    if(loss_ppm && next_rand() % 1000000 < loss_ppm) {
+        ++dropped;
+        return 1;
+    }
+
+    return 0;
+}
+
+static void link_put(link_t *l, const uint8 *data, size_t len) {
+    pkt_t *p;
+
+    if(drop())
+        return;
+
+    if(!(p = (pkt_t *)malloc(sizeof(pkt_t)))) {
+        fprintf(stderr, "Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+
+    p->next = NULL;
+    p->due = netsim_now_us + delay_us;
+    p->len = len;
+    memcpy(p->data, data, len);
+
+    if(l->tail)
+        l->tail->next = p;
+    else
+        l->head = p;
+
+    l->tail = p;
+}
+
+static pkt_t *link_get(link_t *l) {
+    pkt_t *p = l->head;
+
+    if(!p || p->due > netsim_now_us)
+        return NULL;
+
+    if(!(l->head = p->next))
+        l->tail = NULL;
+
+    return p;
+}
+
+static void link_flush(link_t *l) {
+    pkt_t *p;
+
+    while((p = l->head)) {
+        l->head = p->next;
+        free(p);
+    }
+
+    l->tail = NULL;
+}
+
+static void tx_hook(int proto, const struct in6_addr *src,
+                    const struct in6_addr *dst, const uint8 *data,
+                    size_t size) {
+    (void)src;
+    (void)dst;
+
+    if(proto == IPPROTO_TCP && size <= sizeof(((pkt_t *)0)->data))
+        link_put(&to_peer, data, size);
+}
+
+static void put32(uint8 *p, uint32_t v) {
+    p[0] = (uint8)(v >> 24);
+    p[1] = (uint8)(v >> 16);
+    p[2] = (uint8)(v >> 8);
+    p[3] = (uint8)v;
+}
+
+static uint32_t get32(const uint8 *p) {
+    return ((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+static void peer_send(uint32_t seq, int flags, const uint8 *data, size_t len) {
+    uint8 raw[sizeof(seg_t) + 20 + PEER_MSS];
+    seg_t *seg = (seg_t *)raw;
+    struct in6_addr s, d;
+    size_t hlen = sizeof(seg_t);
+    uint32_t wnd;
+
+    memset(raw, 0, sizeof(seg_t));
+    seg->src_port = htons(peer.port);
+    seg->dst_port = htons(LOCAL_PORT);
+    seg->seq = htonl(seq);
+    seg->ack = htonl(peer.rcv_nxt);
+
+    if(flags & TCP_SYN) {
+        /* Send an MSS option with the SYN, and offer window scaling and
+           timestamps. The window in a SYN is never scaled. */
+        seg->wnd = htons(65535);
+        raw[hlen++] = 2;
+        raw[hlen++] = 4;
+        raw[hlen++] = 1460 >> 8;
+        raw[hlen++] = 1460 & 0xFF;
+        raw[hlen++] = 1;
+        raw[hlen++] = 3;
+        raw[hlen++] = 3;
+        raw[hlen++] = PEER_WSCALE;
+    }
+    else {
+        /* Our window only gets scaled if the stack agreed to it. */
+        wnd = PEER_RCVWND >> (peer.wscale >= 0 ? PEER_WSCALE : 0);
+        seg->wnd = htons(wnd > 65535 ? 65535 : wnd);
+    }
+
+    if((flags & TCP_SYN) || peer.ts) {
+        raw[hlen++] = 1;
+        raw[hlen++] = 1;
+        raw[hlen++] = 8;
+        raw[hlen++] = 10;
+        put32(raw + hlen, (uint32_t)(netsim_now_us / 1000));
+        put32(raw + hlen + 4, peer.ts_recent);
+        hlen += 8;
+    }
+
+    seg->off_flags = htons(((hlen / 4) << 12) | flags);
+    memcpy(raw + hlen, data, len);
+
+    memset(&s, 0, sizeof(s));
+    memset(&d, 0, sizeof(d));
+    s.__s6_addr.__s6_addr16[5] = d.__s6_addr.__s6_addr16[5] = 0xFFFF;
+    s.__s6_addr.__s6_addr32[3] = htonl(PEER_ADDR);
+    d.__s6_addr.__s6_addr32[3] = htonl(LOCAL_ADDR);
+    netsim_checksum(IPPROTO_TCP, &s, &d, raw, hlen + len, 16);
+
+    link_put(&to_stack, raw, hlen + len);
+}
+
+/* Send one segment of the peer's data, starting at the given offset. */
+static void peer_send_data(uint32_t off) {
+    uint8 data[PEER_MSS];
+    uint32_t i, len = TOTAL - off;
+
+    if(len > PEER_MSS)
+        len = PEER_MSS;
+
+    for(i = 0; i < len; ++i)
+        data[i] = pattern(off + i);
+
+    peer_send(peer.iss + 1 + off, TCP_ACK, data, len);
+}
+
+/* Handle a segment from the stack. */
+static void peer_input(const pkt_t *p, int sending) {
+    const seg_t *seg = (const seg_t *)p->data;
+    uint16_t flags = ntohs(seg->off_flags);
+    size_t hlen = (flags >> 12) * 4;
+    uint32_t seq = ntohl(seg->seq), ack = ntohl(seg->ack), off, i;
+    size_t len = p->len - hlen;
+
+    /* Ignore anything left over from an earlier connection */
+    if(seg->dst_port != htons(peer.port))
+        return;
+
+    /* Pick out the options we care about */
+    for(i = sizeof(seg_t); i < hlen && p->data[i];) {
+        if(p->data[i] == 1) {
+            ++i;
+            continue;
+        }
+
+        if(i + 1 >= hlen || p->data[i + 1] < 2)
+            break;
+
+        if((flags & TCP_SYN) && p->data[i] == 3)
+            peer.wscale = p->data[i + 2];
+        else if(p->data[i] == 8) {
+            if(flags & TCP_SYN)
+                peer.ts = 1;
+
+            peer.ts_recent = get32(p->data + i + 2);
+        }
+
+        i += p->data[i + 1];
+    }
+
+    if(flags & TCP_SYN) {
+        peer.irs = seq;
+        peer.rcv_nxt = seq + 1;
+        peer.snd_una = ack;
+        peer.wnd = ntohs(seg->wnd);
+        peer_send(peer.snd_nxt, TCP_ACK, NULL, 0);
+        return;
+    }
+
+    peer.wnd = (uint32_t)ntohs(seg->wnd) << (peer.wscale >= 0 ? peer.wscale :
+                                             0);
+
+    /* Count the stack's ACKs while it's receiving */
+    if(!len && sending)
+        ++acks;
+
+    if(sending) {
+        /* Acknowledgements for our data */
+        if((int32_t)(ack - peer.snd_una) > 0) {
+            peer.snd_una = ack;
+            peer.dupacks = 0;
+            peer.rto_at = netsim_now_us + 4 * delay_us + 200000;
+        }
+        else if(ack == peer.snd_una && peer.snd_nxt != peer.snd_una &&
+                ++peer.dupacks == 3) {
+            peer_send_data(peer.snd_una - peer.iss - 1);
+        }
+
+        return;
+    }
+
+    /* Data for us. Keep it even if it is out of order. */
+    off = seq - peer.irs - 1;
+
+    for(i = 0; i < len; ++i) {
+        if(off + i < TOTAL) {
+            peer.buf[off + i] = p->data[hlen + i];
+            peer.have[off + i] = 1;
+        }
+    }
+
+    off = peer.rcv_nxt - peer.irs - 1;
+
+    while(off < TOTAL && peer.have[off]) {
+        ++peer.rcv_nxt;
+        ++off;
+    }
+
+    if(len)
+        peer_send(peer.snd_nxt, TCP_ACK, NULL, 0);
+}
+
+/* Keep the peer's fixed-size window full, and resend on a timeout. If the
+   stack's window is closed, poke it every so often to make sure we find out
+   when it opens back up. */
+static void peer_output(void) {
+    uint32_t wnd = peer.wnd < peer.window ? peer.wnd : peer.window;
+    uint32_t off;
+
+    if(netsim_now_us >= peer.rto_at) {
+        if(peer.snd_nxt != peer.snd_una)
+            peer_send_data(peer.snd_una - peer.iss - 1);
+        else if(!peer.wnd)
+            peer_send(peer.snd_nxt - 1, TCP_ACK, NULL, 0);
+
+        peer.rto_at = netsim_now_us + 4 * delay_us + 200000;
+    }
+
+    while((off = peer.snd_nxt - peer.iss - 1) < TOTAL &&
+          peer.snd_nxt - peer.snd_una + PEER_MSS <= wnd) {
+        if(peer.snd_nxt == peer.snd_una)
+            peer.rto_at = netsim_now_us + 4 * delay_us + 200000;
+
+        peer_send_data(off);
+        peer.snd_nxt += (TOTAL - off > PEER_MSS) ? PEER_MSS : TOTAL - off;
+    }
+}
+
+/* Deliver everything on the links that's due, then move the clock forward by
+   a millisecond. */
+static void step(int sending) {
+    pkt_t *p;
+    int delivered;
+
+    do {
+        delivered = 0;
+
+        while((p = link_get(&to_stack))) {
+            netsim_input4(IPPROTO_TCP, htonl(PEER_ADDR), htonl(LOCAL_ADDR),
+                          p->data, p->len);
+            free(p);
+            delivered = 1;
+        }
+
+        while((p = link_get(&to_peer))) {
+            peer_input(p, sending);
+            free(p);
+            delivered = 1;
+        }
+    } while(delivered);
+
+    netsim_advance(1000);
+}
+
+/* Run one transfer, with the given loss rate (in parts per million) and the
+   given limit on how much the peer sends at once. Returns the time it took in
+   milliseconds, or 0 if it didn't finish in time. */
+static uint64 run(net_socket_t *lsock, int sending, uint32_t loss,
+                  uint32_t window) {
+    static uint8 chunk[4096];
+    net_socket_t *sock;
+    uint64 start, elapsed;
+    uint32_t done = 0, i;
+    ssize_t rv;
+    int fd;
+    uint16_t port;
+
+    /* Each transfer comes from a new port, so that the last connection can
+       still be closing down when the next one starts. */
+    port = peer.port ? peer.port + 1 : PEER_PORT;
+    memset(&peer, 0, sizeof(peer));
+    peer.port = port;
+    peer.window = window;
+    peer.wscale = -1;
+    peer.buf = (uint8 *)calloc(1, TOTAL);
+    peer.have = (uint8 *)calloc(1, TOTAL);
+    peer.iss = next_rand();
+    peer.snd_una = peer.snd_nxt = peer.iss + 1;
+    dropped = acks = 0;
+
+    /* Connect, without losing anything along the way. */
+    loss_ppm = 0;
+    peer_send(peer.iss, TCP_SYN, NULL, 0);
+
+    while((fd = lsock->protocol->accept(lsock, NULL, NULL)) < 0) {
+        if(errno != EWOULDBLOCK) {
+            fprintf(stderr, "accept failed: %s\n", strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+
+        step(!sending);
+    }
+
+    if(!(sock = netsim_get_socket(fd))) {
+        fprintf(stderr, "Can't find the new socket\n");
+        exit(EXIT_FAILURE);
+    }
+
+    /* Wait for the SYN/ACK to get there and the ACK for it to come back. */
+    while(!peer.rcv_nxt)
+        step(!sending);
+
+    for(i = 0; i <= delay_us / 1000; ++i)
+        step(!sending);
+
+    loss_ppm = loss;
+    start = netsim_now_us;
+
+    while(netsim_now_us - start < TIME_LIMIT * 1000ULL) {
+        if(sending) {
+            if(peer.rcv_nxt - peer.irs - 1 == TOTAL)
+                break;
+
+            /* Queue up as much as the stack will take */
+            while(done < TOTAL) {
+                rv = TOTAL - done > sizeof(chunk) ? sizeof(chunk) :
+                     TOTAL - done;
+
+                for(i = 0; i < rv; ++i)
+                    chunk[i] = pattern(done + i);
+
+                if((rv = sock->protocol->sendto(sock, chunk, rv, 0, NULL,
+                                                0)) <= 0)
+                    break;
+
+                done += rv;
+            }
+        }
+        else {
+            if(done == TOTAL)
+                break;
+
+            peer_output();
+
+            /* Read whatever has come in */
+            while((rv = sock->protocol->recvfrom(sock, chunk, sizeof(chunk),
+                                                 0, NULL, NULL)) > 0) {
+                for(i = 0; i < rv; ++i) {
+                    if(chunk[i] != pattern(done + i)) {
+                        fprintf(stderr, "Data mismatch at %u\n",
+                                (unsigned)(done + i));
+                        exit(EXIT_FAILURE);
+                    }
+                }
+
+                done += rv;
+            }
+        }
+
+        step(!sending);
+    }
+
+    elapsed = (netsim_now_us - start) / 1000;
+
+    if(sending) {
+        if(peer.rcv_nxt - peer.irs - 1 != TOTAL)
+            elapsed = 0;
+
+        for(i = 0; elapsed && i < TOTAL; ++i) {
+            if(peer.buf[i] != pattern(i)) {
+                fprintf(stderr, "Data mismatch at %u\n", (unsigned)i);
+                exit(EXIT_FAILURE);
+            }
+        }
+    }
+    else if(done != TOTAL) {
+        elapsed = 0;
+    }
+
+    loss_ppm = 0;
+    netsim_close(sock);
+    link_flush(&to_peer);
+    link_flush(&to_stack);
+
+    /* Let the socket finish closing. */
+    netsim_advance(2 * 15000 * 1000ULL + 1000000);
+    link_flush(&to_peer);
+    link_flush(&to_stack);
+
+    free(peer.buf);
+    free(peer.have);
+
+    return elapsed;
+}
+
+/* Set the size of the buffers the listening socket gives the connections it
+   accepts. */
+static void set_buffers(net_socket_t *lsock, int size) {
+    if(lsock->protocol->setsockopt(lsock, SOL_SOCKET, SO_RCVBUF, &size,
+                                   sizeof(size)) ||
+       lsock->protocol->setsockopt(lsock, SOL_SOCKET, SO_SNDBUF, &size,
+                                   sizeof(size))) {
+        fprintf(stderr, "Could not set the buffer size: %s\n",
+                strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    static const uint32_t losses[] = { 0, 5000, 10000, 20000, 50000 };
+    static const uint64 delays[] = { 1000, 20000 };
+    static const int bufs[] = { 8192, 65536, 262144 };
+    struct sockaddr_in addr;
+    net_socket_t *lsock;
+    unsigned int i, j;
+    uint64 ms;
+    int sending;
+
+    (void)argc;
+    (void)argv;
+
+    if(netsim_init()) {
+        fprintf(stderr, "Could not initialize the simulator\n");
+        return EXIT_FAILURE;
+    }
+
+    netsim_set_tx_hook(&tx_hook);
+
+    if(!(lsock = netsim_socket(AF_INET, SOCK_STREAM, IPPROTO_TCP))) {
+        fprintf(stderr, "Could not create the listening socket\n");
+        return EXIT_FAILURE;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(LOCAL_PORT);
+    addr.sin_addr.s_addr = htonl(LOCAL_ADDR);
+
+    if(lsock->protocol->bind(lsock, (struct sockaddr *)&addr, sizeof(addr)) ||
+       lsock->protocol->listen(lsock, 4)) {
+        fprintf(stderr, "Could not listen: %s\n", strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    printf("TCP goodput over a lossy link (%d KiB per transfer)\n",
+           TOTAL / 1024);
+
+    for(sending = 1; sending >= 0; --sending) {
+        for(j = 0; j < sizeof(delays) / sizeof(delays[0]); ++j) {
+            for(i = 0; i < sizeof(losses) / sizeof(losses[0]); ++i) {
+                rand_state = 1;
+                delay_us = delays[j];
+                ms = run(lsock, sending, losses[i], PEER_WINDOW);
+
+                printf("%s, %2d ms delay, %4.1f%% loss: ",
+                       sending ? "send" : "recv", (int)(delays[j] / 1000),
+                       losses[i] / 10000.0);
+
+                if(ms)
+                    printf("%8.1f KiB/s (%d dropped)\n",
+                           TOTAL / 1024.0 / (ms / 1000.0), dropped);
+                else
+                    printf("did not finish in %d s (%d dropped)\n",
+                           TIME_LIMIT / 1000, dropped);
+            }
+        }
+    }
+
+    printf("\nTCP goodput without loss, by socket buffer size\n");
+
+    for(sending = 1; sending >= 0; --sending) {
+        for(j = 0; j < sizeof(delays) / sizeof(delays[0]); ++j) {
+            for(i = 0; i < sizeof(bufs) / sizeof(bufs[0]); ++i) {
+                rand_state = 1;
+                delay_us = delays[j];
+                set_buffers(lsock, bufs[i]);
+                ms = run(lsock, sending, 0, PEER_RCVWND);
+
+                printf("%s, %2d ms delay, %3d KiB buffers: ",
+                       sending ? "send" : "recv", (int)(delays[j] / 1000),
+                       bufs[i] / 1024);
+
+                if(!ms)
+                    printf("did not finish in %d s\n", TIME_LIMIT / 1000);
+                else if(sending)
+                    printf("%8.1f KiB/s\n", TOTAL / 1024.0 / (ms / 1000.0));
+                else
+                    printf("%8.1f KiB/s (%d ACKs)\n",
+                           TOTAL / 1024.0 / (ms / 1000.0), acks);
+            }
+        }
+    }
+
+    netsim_shutdown();
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,260 @@
+/* KallistiOS ##version##
+
+   utils/netsim/udpfrag.c
+   Copyright (C) 2026 The KOS Team and contributors
+
+   This sends UDP datagrams that are too big for one frame through the whole
+   stack on the simulator's loopback device, so that they get fragmented on the
+   way out and put back together on the way in, and checks that every one of
+   them makes it to the socket intact. Those don't fit in a packet buffer, so
+   the socket has to queue them in buffers from the heap. It then does the same
+   thing again with the packet buffer pool drained by other sockets, which
+   have to fall back on the heap for datagrams of any size. Last, it checks
+   that a socket can have a lot more datagrams queued up on it than it is
+   allowed to keep in buffers from the pool.
+
+   Usage: udpfrag [-c]
+     -c   receive frames by copying them in, instead of in packet buffers
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "netsim.h"
+
+#define LOCAL_ADDR      0x0A000001      /* 10.0.0.1 */
+#define BASE_PORT       6000
+
+/* How many datagrams a socket can keep in buffers from the pool
+   (UDP_MAX_POOLED in net_udp.c). */
+#define POOLED_MAX      (NET_PBUF_COUNT / 2)
+
+/* How many datagrams to send in a burst, without reading any of them. */
+#define BURST           (NET_PBUF_COUNT * 4)
+
+/* The biggest UDP payload that fits in an IPv4 datagram. */
+#define UDP_MAX_PAYLOAD 65507
+
+static const size_t sizes[] = {
+    1, 1472, 1473, 2000, 2952, 2953, 8192, 32768, UDP_MAX_PAYLOAD
+};
+
+static uint8 txbuf[UDP_MAX_PAYLOAD], rxbuf[UDP_MAX_PAYLOAD + 1];
+static int failed = 0;
+
+static void set_addr(struct sockaddr_in *addr, uint16 port) {
+    memset(addr, 0, sizeof(*addr));
+    addr->sin_family = AF_INET;
+    addr->sin_port = htons(port);
+    addr->sin_addr.s_addr = htonl(LOCAL_ADDR);
+}
+
+static net_socket_t *udp_bound(uint16 port) {
+    struct sockaddr_in addr;
+    net_socket_t *sock;
+
+    if(!(sock = netsim_socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP)))
+        return NULL;
+
+    set_addr(&addr, port);
+
+    if(sock->protocol->bind(sock, (struct sockaddr *)&addr, sizeof(addr))) {
+        fprintf(stderr, "Could not bind: %s\n", strerror(errno));
+        netsim_close(sock);
+        return NULL;
+    }
+
+    return sock;
+}
+
+/* Every datagram gets its own pattern, so that one can't pass for another. */
+static void fill(uint8 *buf, size_t len, int seq) {
+    size_t i;
+
+    for(i = 0; i < len; ++i)
+        buf[i] = (uint8)(i * 7 + (i >> 8) + seq * 13);
+}
+
+static int send_one(net_socket_t *tx, uint16 port, size_t len, int seq) {
+    struct sockaddr_in addr;
+
+    set_addr(&addr, port);
+    fill(txbuf, len, seq);
+
+    if(tx->protocol->sendto(tx, txbuf, len, 0, (struct sockaddr *)&addr,
+                            sizeof(addr)) != (ssize_t)len) {
+        fprintf(stderr, "sendto of %d bytes failed: %s\n", (int)len,
+                strerror(errno));
+        return -1;
+    }
+
+    return 0;
+}
+
+static void check_one(net_socket_t *rx, size_t len, int seq) {
+    ssize_t got;
+
+    got = rx->protocol->recvfrom(rx, rxbuf, sizeof(rxbuf), 0, NULL, NULL);
+    fill(txbuf, len, seq);
+
+    if(got < 0) {
+        printf("  FAIL: %d byte datagram never arrived\n", (int)len);
+        ++failed;
+    }
+    else if((size_t)got != len || memcmp(rxbuf, txbuf, len)) {
+        printf("  FAIL: %d byte datagram came back as %d bytes, or mangled\n",
+               (int)len, (int)got);
+        ++failed;
+    }
+}
+
+/* Send one of each size, then make sure they all come out, in order. */
+static void test_sizes(net_socket_t *tx, net_socket_t *rx, uint16 port) {
+    unsigned int i;
+
+    for(i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i) {
+        if(send_one(tx, port, sizes[i], i)) {
+            ++failed;
+            return;
+        }
+
+        netsim_poll();
+    }
+
+    for(i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i)
+        check_one(rx, sizes[i], i);
+}
+
+static int run(void) {
+    net_socket_t *tx, *rx, *hogs[2] = { NULL, NULL };
+    net_udp_stats_t st;
+    net_pbuf_t *pbs[NET_PBUF_COUNT + 1];
+    int i, j, rv = -1;
+
+    if(!(tx = netsim_socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP)) ||
+       !(rx = udp_bound(BASE_PORT)))
+        return -1;
+
+    printf("Fragmented datagrams:\n");
+    test_sizes(tx, rx, BASE_PORT);
+
+    /* Queue datagrams up on a couple of sockets that nobody reads from, until
+       they've taken every buffer in the pool. */
+    printf("Fragmented datagrams, with the packet buffer pool empty:\n");
+
+    for(i = 0; i < 2; ++i) {
+        if(!(hogs[i] = udp_bound(BASE_PORT + 1 + i)))
+            goto out;
+
+        for(j = 0; j < POOLED_MAX; ++j) {
+            if(send_one(tx, BASE_PORT + 1 + i, 64, j))
+                goto out;
+        }
+
+        netsim_poll();
+    }
+
+    if((pbs[0] = net_pbuf_alloc())) {
+        printf("  FAIL: the pool didn't run dry\n");
+        net_pbuf_free(pbs[0]);
+        ++failed;
+    }
+
+    test_sizes(tx, rx, BASE_PORT);
+
+    /* Once everything is let go of, the pool should be back to full, and have
+       nothing in it that came from the heap. */
+    netsim_close(hogs[0]);
+    netsim_close(hogs[1]);
+    hogs[0] = hogs[1] = NULL;
+
+    for(i = 0; i <= NET_PBUF_COUNT; ++i) {
+        if(!(pbs[i] = net_pbuf_alloc()))
+            break;
+    }
+
+    if(i != NET_PBUF_COUNT) {
+        printf("  FAIL: %d buffers in the pool afterwards, expected %d\n", i,
+               NET_PBUF_COUNT);
+        ++failed;
+    }
+
+    while(i--)
+        net_pbuf_free(pbs[i]);
+
+    /* None of a burst should be dropped, however many there are. */
+    printf("A burst of %d datagrams:\n", BURST);
+
+    for(i = 0; i < BURST; ++i) {
+        if(send_one(tx, BASE_PORT, 512, i))
+            goto out;
+
+        if(!(i & 7))
+            netsim_poll();
+    }
+
+    netsim_poll();
+
+    for(i = 0; i < BURST; ++i)
+        check_one(rx, 512, i);
+
+    st = net_udp_get_stats();
+
+    if(st.pkt_recv_no_buf) {
+        printf("  FAIL: %u datagrams dropped for want of a buffer\n",
+               (unsigned int)st.pkt_recv_no_buf);
+        ++failed;
+    }
+
+    rv = 0;
+
+out:
+    for(i = 0; i < 2; ++i) {
+        if(hogs[i])
+            netsim_close(hogs[i]);
+    }
+
+    netsim_close(tx);
+    netsim_close(rx);
+
+    return rv;
+}
+
+int main(int argc, char *argv[]) {
+    int opt, copy = 0;
+
+    while((opt = getopt(argc, argv, "c")) != -1) {
+        switch(opt) {
+            case 'c':
+                copy = 1;
+                break;
+
+            default:
+                fprintf(stderr, "Usage: %s [-c]\n", argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+
+    netsim_rx_pbufs = !copy;
+
+    if(netsim_init()) {
+        fprintf(stderr, "Could not initialize the simulator\n");
+        return EXIT_FAILURE;
+    }
+
+    if(run())
+        return EXIT_FAILURE;
+
+    netsim_shutdown();
+
+    if(failed) {
+        printf("%d checks failed\n", failed);
+        return EXIT_FAILURE;
+    }
+
+    printf("All checks passed\n");
+    return EXIT_SUCCESS;
+}
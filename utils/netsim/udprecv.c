@@ -0,0 +1,193 @@
+/* KallistiOS ##version##
+
+   utils/netsim/udprecv.c
+   Copyright (C) 2026 The KOS Team and contributors
+
+   This benchmarks the UDP receive path: datagrams are fed into the stack in
+   bursts and then read back out of the socket, either one at a time with
+   recvfrom() or in one go with recvmmsg(). Each combination is run with the
+   packets being passed in as is (like a driver that calls net_input()) and
+   with them being received into packet buffers (like a driver that calls
+   net_input_pbuf()), in which case the socket can just hang onto the buffer.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <errno.h>
+
+#include "netsim.h"
+
+#define LOCAL_ADDR      0x0A000001      /* 10.0.0.1 */
+#define PEER_ADDR       0x0A000002      /* 10.0.0.2 */
+#define LOCAL_PORT      9000
+#define PEER_PORT       9001
+#define BURST           16
+#define ROUNDS          50000
+
+typedef struct {
+    uint16_t src_port;
+    uint16_t dst_port;
+    uint16_t length;
+    uint16_t checksum;
+} __attribute__((packed)) udp_hdr_t;
+
+static uint8 pkt[sizeof(udp_hdr_t) + 1024];
+static uint8 bufs[BURST][1024];
+
+/* Build the datagram that gets sent over and over again. */
+static void build_pkt(size_t payload) {
+    udp_hdr_t *hdr = (udp_hdr_t *)pkt;
+    struct in6_addr s, d;
+    size_t i;
+
+    for(i = 0; i < payload; ++i)
+        pkt[sizeof(udp_hdr_t) + i] = (uint8)i;
+
+    hdr->src_port = htons(PEER_PORT);
+    hdr->dst_port = htons(LOCAL_PORT);
+    hdr->length = htons(sizeof(udp_hdr_t) + payload);
+
+    memset(&s, 0, sizeof(s));
+    memset(&d, 0, sizeof(d));
+    s.__s6_addr.__s6_addr16[5] = d.__s6_addr.__s6_addr16[5] = 0xFFFF;
+    s.__s6_addr.__s6_addr32[3] = htonl(PEER_ADDR);
+    d.__s6_addr.__s6_addr32[3] = htonl(LOCAL_ADDR);
+    netsim_checksum(IPPROTO_UDP, &s, &d, pkt, sizeof(udp_hdr_t) + payload, 6);
+}
+
+static int feed(size_t payload) {
+    int i;
+
+    for(i = 0; i < BURST; ++i) {
+        if(netsim_input4(IPPROTO_UDP, htonl(PEER_ADDR), htonl(LOCAL_ADDR), pkt,
+                         sizeof(udp_hdr_t) + payload)) {
+            fprintf(stderr, "Datagram dropped\n");
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+static int drain_recvfrom(net_socket_t *sock, size_t payload) {
+    struct sockaddr_in from;
+    socklen_t fromlen;
+    int i;
+
+    for(i = 0; i < BURST; ++i) {
+        fromlen = sizeof(from);
+
+        if(sock->protocol->recvfrom(sock, bufs[i], sizeof(bufs[i]), 0,
+                                    (struct sockaddr *)&from, &fromlen) !=
+           (ssize_t)payload) {
+            fprintf(stderr, "recvfrom failed: %s\n", strerror(errno));
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+static int drain_recvmmsg(net_socket_t *sock, size_t payload) {
+    struct mmsghdr msgs[BURST];
+    struct iovec iov[BURST];
+    struct sockaddr_in from[BURST];
+    int i;
+
+    for(i = 0; i < BURST; ++i) {
+        iov[i].iov_base = bufs[i];
+        iov[i].iov_len = sizeof(bufs[i]);
+        memset(&msgs[i], 0, sizeof(msgs[i]));
+        msgs[i].msg_hdr.msg_name = &from[i];
+        msgs[i].msg_hdr.msg_namelen = sizeof(from[i]);
+        msgs[i].msg_hdr.msg_iov = &iov[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    if(sock->protocol->recvmmsg(sock, msgs, BURST, 0, NULL) != BURST) {
+        fprintf(stderr, "recvmmsg failed: %s\n", strerror(errno));
+        return -1;
+    }
+
+    for(i = 0; i < BURST; ++i) {
+        if(msgs[i].msg_len != payload) {
+            fprintf(stderr, "recvmmsg returned a short datagram\n");
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+static int run(net_socket_t *sock, size_t payload, int pbufs, int batch) {
+    uint64 start, end;
+    int i;
+
+    netsim_rx_pbufs = pbufs;
+    build_pkt(payload);
+    start = netsim_host_ns();
+
+    for(i = 0; i < ROUNDS; ++i) {
+        if(feed(payload))
+            return -1;
+
+        if(batch ? drain_recvmmsg(sock, payload) :
+           drain_recvfrom(sock, payload))
+            return -1;
+    }
+
+    end = netsim_host_ns();
+
+    printf("%4d bytes, %-15s %-8s: %5" PRIu64 " ns/datagram\n", (int)payload,
+           pbufs ? "packet buffer," : "copied in,", batch ? "recvmmsg" :
+           "recvfrom", (end - start) / (ROUNDS * BURST));
+
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    static const size_t sizes[] = { 64, 512, 1024 };
+    struct sockaddr_in addr;
+    net_socket_t *sock;
+    unsigned int i;
+    int pbufs, batch;
+
+    (void)argc;
+    (void)argv;
+
+    if(netsim_init()) {
+        fprintf(stderr, "Could not initialize the simulator\n");
+        return EXIT_FAILURE;
+    }
+
+    if(!(sock = netsim_socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP))) {
+        fprintf(stderr, "Could not create the socket\n");
+        return EXIT_FAILURE;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(LOCAL_PORT);
+    addr.sin_addr.s_addr = htonl(LOCAL_ADDR);
+
+    if(sock->protocol->bind(sock, (struct sockaddr *)&addr, sizeof(addr))) {
+        fprintf(stderr, "Could not bind: %s\n", strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    printf("UDP receive benchmark (%d datagram bursts)\n", BURST);
+
+    for(i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i) {
+        for(pbufs = 0; pbufs < 2; ++pbufs) {
+            for(batch = 0; batch < 2; ++batch) {
+                if(run(sock, sizes[i], pbufs, batch))
+                    return EXIT_FAILURE;
+            }
+        }
+    }
+
+    netsim_shutdown();
+    return EXIT_SUCCESS;
+}